@@ -0,0 +1,218 @@
+/*
+ * BMScriptProbes.d as SystemTap/USDT probes, for builds on Linux with BMSCRIPT_ENABLE_DTRACE set to 1.
+ *
+ * Every probe of the BMScript provider gets the same BMSCRIPT_<NAME>() and BMSCRIPT_<NAME>_ENABLED() macros the
+ * header generated by dtrace(1M) has, so the BM_PROBE call sites stay as they are. The probes are emitted with
+ * <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel) into the .note.stapsdt section, where bpftrace, perf and
+ * SystemTap find them as usdt:<binary>:BMScript:<probe>.
+ *
+ * Each probe has a semaphore, which the tracer raises while it is attached, so the arguments (mostly strings built
+ * for the probe) are only computed while someone is listening. The semaphores are defined here, so this header must
+ * only be imported by one translation unit (BMScript.m).
+ *
+ * Keep in sync with BMScriptProbes.d.
+ */
+
+#ifndef	_BMSCRIPTPROBESSDT_H
+#define	_BMSCRIPTPROBESSDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define BMSCRIPT_SDT_SEMAPHORE(name) \
+	__extension__ unsigned short BMScript_ ## name ## _semaphore \
+	__attribute__((used)) __attribute__((section(".probes"))) __attribute__((visibility("hidden")))
+
+#define BMSCRIPT_SDT_ENABLED(name) \
+	__builtin_expect(BMScript_ ## name ## _semaphore, 0)
+
+BMSCRIPT_SDT_SEMAPHORE(acquire_lock_end);
+#define	BMSCRIPT_ACQUIRE_LOCK_END(arg0) \
+	DTRACE_PROBE1(BMScript, acquire_lock_end, arg0)
+#define	BMSCRIPT_ACQUIRE_LOCK_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(acquire_lock_end)
+BMSCRIPT_SDT_SEMAPHORE(acquire_lock_start);
+#define	BMSCRIPT_ACQUIRE_LOCK_START(arg0) \
+	DTRACE_PROBE1(BMScript, acquire_lock_start, arg0)
+#define	BMSCRIPT_ACQUIRE_LOCK_START_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(acquire_lock_start)
+BMSCRIPT_SDT_SEMAPHORE(append_data_begin);
+#define	BMSCRIPT_APPEND_DATA_BEGIN(arg0) \
+	DTRACE_PROBE1(BMScript, append_data_begin, arg0)
+#define	BMSCRIPT_APPEND_DATA_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(append_data_begin)
+BMSCRIPT_SDT_SEMAPHORE(append_data_end);
+#define	BMSCRIPT_APPEND_DATA_END(arg0) \
+	DTRACE_PROBE1(BMScript, append_data_end, arg0)
+#define	BMSCRIPT_APPEND_DATA_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(append_data_end)
+BMSCRIPT_SDT_SEMAPHORE(bg_execute_begin);
+#define	BMSCRIPT_BG_EXECUTE_BEGIN(arg0, arg1, arg2) \
+	DTRACE_PROBE3(BMScript, bg_execute_begin, arg0, arg1, arg2)
+#define	BMSCRIPT_BG_EXECUTE_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(bg_execute_begin)
+BMSCRIPT_SDT_SEMAPHORE(bg_execute_end);
+#define	BMSCRIPT_BG_EXECUTE_END(arg0) \
+	DTRACE_PROBE1(BMScript, bg_execute_end, arg0)
+#define	BMSCRIPT_BG_EXECUTE_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(bg_execute_end)
+BMSCRIPT_SDT_SEMAPHORE(cleanup_bg_task_begin);
+#define	BMSCRIPT_CLEANUP_BG_TASK_BEGIN() \
+	DTRACE_PROBE(BMScript, cleanup_bg_task_begin)
+#define	BMSCRIPT_CLEANUP_BG_TASK_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(cleanup_bg_task_begin)
+BMSCRIPT_SDT_SEMAPHORE(cleanup_bg_task_end);
+#define	BMSCRIPT_CLEANUP_BG_TASK_END() \
+	DTRACE_PROBE(BMScript, cleanup_bg_task_end)
+#define	BMSCRIPT_CLEANUP_BG_TASK_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(cleanup_bg_task_end)
+BMSCRIPT_SDT_SEMAPHORE(cleanup_task_begin);
+#define	BMSCRIPT_CLEANUP_TASK_BEGIN() \
+	DTRACE_PROBE(BMScript, cleanup_task_begin)
+#define	BMSCRIPT_CLEANUP_TASK_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(cleanup_task_begin)
+BMSCRIPT_SDT_SEMAPHORE(cleanup_task_end);
+#define	BMSCRIPT_CLEANUP_TASK_END() \
+	DTRACE_PROBE(BMScript, cleanup_task_end)
+#define	BMSCRIPT_CLEANUP_TASK_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(cleanup_task_end)
+BMSCRIPT_SDT_SEMAPHORE(execute_begin);
+#define	BMSCRIPT_EXECUTE_BEGIN(arg0, arg1, arg2) \
+	DTRACE_PROBE3(BMScript, execute_begin, arg0, arg1, arg2)
+#define	BMSCRIPT_EXECUTE_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(execute_begin)
+BMSCRIPT_SDT_SEMAPHORE(execute_end);
+#define	BMSCRIPT_EXECUTE_END(arg0) \
+	DTRACE_PROBE1(BMScript, execute_end, arg0)
+#define	BMSCRIPT_EXECUTE_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(execute_end)
+BMSCRIPT_SDT_SEMAPHORE(init_begin);
+#define	BMSCRIPT_INIT_BEGIN(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, init_begin, arg0, arg1)
+#define	BMSCRIPT_INIT_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(init_begin)
+BMSCRIPT_SDT_SEMAPHORE(init_end);
+#define	BMSCRIPT_INIT_END(arg0) \
+	DTRACE_PROBE1(BMScript, init_end, arg0)
+#define	BMSCRIPT_INIT_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(init_end)
+BMSCRIPT_SDT_SEMAPHORE(last_result_begin);
+#define	BMSCRIPT_LAST_RESULT_BEGIN(arg0) \
+	DTRACE_PROBE1(BMScript, last_result_begin, arg0)
+#define	BMSCRIPT_LAST_RESULT_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(last_result_begin)
+BMSCRIPT_SDT_SEMAPHORE(last_result_end);
+#define	BMSCRIPT_LAST_RESULT_END(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, last_result_end, arg0, arg1)
+#define	BMSCRIPT_LAST_RESULT_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(last_result_end)
+BMSCRIPT_SDT_SEMAPHORE(last_script_begin);
+#define	BMSCRIPT_LAST_SCRIPT_BEGIN(arg0) \
+	DTRACE_PROBE1(BMScript, last_script_begin, arg0)
+#define	BMSCRIPT_LAST_SCRIPT_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(last_script_begin)
+BMSCRIPT_SDT_SEMAPHORE(last_script_end);
+#define	BMSCRIPT_LAST_SCRIPT_END(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, last_script_end, arg0, arg1)
+#define	BMSCRIPT_LAST_SCRIPT_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(last_script_end)
+BMSCRIPT_SDT_SEMAPHORE(net_execution_begin);
+#define	BMSCRIPT_NET_EXECUTION_BEGIN(arg0) \
+	DTRACE_PROBE1(BMScript, net_execution_begin, arg0)
+#define	BMSCRIPT_NET_EXECUTION_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(net_execution_begin)
+BMSCRIPT_SDT_SEMAPHORE(net_execution_end);
+#define	BMSCRIPT_NET_EXECUTION_END(arg0) \
+	DTRACE_PROBE1(BMScript, net_execution_end, arg0)
+#define	BMSCRIPT_NET_EXECUTION_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(net_execution_end)
+BMSCRIPT_SDT_SEMAPHORE(result_at_index_begin);
+#define	BMSCRIPT_RESULT_AT_INDEX_BEGIN(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, result_at_index_begin, arg0, arg1)
+#define	BMSCRIPT_RESULT_AT_INDEX_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(result_at_index_begin)
+BMSCRIPT_SDT_SEMAPHORE(result_at_index_end);
+#define	BMSCRIPT_RESULT_AT_INDEX_END(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, result_at_index_end, arg0, arg1)
+#define	BMSCRIPT_RESULT_AT_INDEX_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(result_at_index_end)
+BMSCRIPT_SDT_SEMAPHORE(saturate_with_argument_begin);
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENT_BEGIN(arg0) \
+	DTRACE_PROBE1(BMScript, saturate_with_argument_begin, arg0)
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENT_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(saturate_with_argument_begin)
+BMSCRIPT_SDT_SEMAPHORE(saturate_with_argument_end);
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENT_END(arg0) \
+	DTRACE_PROBE1(BMScript, saturate_with_argument_end, arg0)
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENT_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(saturate_with_argument_end)
+BMSCRIPT_SDT_SEMAPHORE(saturate_with_arguments_begin);
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENTS_BEGIN() \
+	DTRACE_PROBE(BMScript, saturate_with_arguments_begin)
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENTS_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(saturate_with_arguments_begin)
+BMSCRIPT_SDT_SEMAPHORE(saturate_with_arguments_end);
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENTS_END(arg0) \
+	DTRACE_PROBE1(BMScript, saturate_with_arguments_end, arg0)
+#define	BMSCRIPT_SATURATE_WITH_ARGUMENTS_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(saturate_with_arguments_end)
+BMSCRIPT_SDT_SEMAPHORE(saturate_with_dictionary_begin);
+#define	BMSCRIPT_SATURATE_WITH_DICTIONARY_BEGIN(arg0) \
+	DTRACE_PROBE1(BMScript, saturate_with_dictionary_begin, arg0)
+#define	BMSCRIPT_SATURATE_WITH_DICTIONARY_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(saturate_with_dictionary_begin)
+BMSCRIPT_SDT_SEMAPHORE(saturate_with_dictionary_end);
+#define	BMSCRIPT_SATURATE_WITH_DICTIONARY_END(arg0) \
+	DTRACE_PROBE1(BMScript, saturate_with_dictionary_end, arg0)
+#define	BMSCRIPT_SATURATE_WITH_DICTIONARY_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(saturate_with_dictionary_end)
+BMSCRIPT_SDT_SEMAPHORE(script_at_index_begin);
+#define	BMSCRIPT_SCRIPT_AT_INDEX_BEGIN(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, script_at_index_begin, arg0, arg1)
+#define	BMSCRIPT_SCRIPT_AT_INDEX_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(script_at_index_begin)
+BMSCRIPT_SDT_SEMAPHORE(script_at_index_end);
+#define	BMSCRIPT_SCRIPT_AT_INDEX_END(arg0, arg1) \
+	DTRACE_PROBE2(BMScript, script_at_index_end, arg0, arg1)
+#define	BMSCRIPT_SCRIPT_AT_INDEX_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(script_at_index_end)
+BMSCRIPT_SDT_SEMAPHORE(setup_bg_task_begin);
+#define	BMSCRIPT_SETUP_BG_TASK_BEGIN() \
+	DTRACE_PROBE(BMScript, setup_bg_task_begin)
+#define	BMSCRIPT_SETUP_BG_TASK_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(setup_bg_task_begin)
+BMSCRIPT_SDT_SEMAPHORE(setup_bg_task_end);
+#define	BMSCRIPT_SETUP_BG_TASK_END() \
+	DTRACE_PROBE(BMScript, setup_bg_task_end)
+#define	BMSCRIPT_SETUP_BG_TASK_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(setup_bg_task_end)
+BMSCRIPT_SDT_SEMAPHORE(setup_task_begin);
+#define	BMSCRIPT_SETUP_TASK_BEGIN() \
+	DTRACE_PROBE(BMScript, setup_task_begin)
+#define	BMSCRIPT_SETUP_TASK_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(setup_task_begin)
+BMSCRIPT_SDT_SEMAPHORE(setup_task_end);
+#define	BMSCRIPT_SETUP_TASK_END() \
+	DTRACE_PROBE(BMScript, setup_task_end)
+#define	BMSCRIPT_SETUP_TASK_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(setup_task_end)
+BMSCRIPT_SDT_SEMAPHORE(stop_bg_task_begin);
+#define	BMSCRIPT_STOP_BG_TASK_BEGIN() \
+	DTRACE_PROBE(BMScript, stop_bg_task_begin)
+#define	BMSCRIPT_STOP_BG_TASK_BEGIN_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(stop_bg_task_begin)
+BMSCRIPT_SDT_SEMAPHORE(stop_bg_task_end);
+#define	BMSCRIPT_STOP_BG_TASK_END() \
+	DTRACE_PROBE(BMScript, stop_bg_task_end)
+#define	BMSCRIPT_STOP_BG_TASK_END_ENABLED() \
+	BMSCRIPT_SDT_ENABLED(stop_bg_task_end)
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _BMSCRIPTPROBESSDT_H */
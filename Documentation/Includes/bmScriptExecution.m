@@ -1,4 +1,9 @@
 - (ExecutionStatus) execute;  // call -lastResult after completion to obtain the result.
 - (ExecutionStatus) executeAndReturnResult:(NSString **)result;
 - (ExecutionStatus) executeAndReturnResult:(NSString **)result error:(NSError **)error;
-- (void) executeInBackgroundAndNotify; AVAILABLE_MAC_OS_X_VERSION_10_4_AND_LATER
\ No newline at end of file
+- (ExecutionStatus) executeAndReturnResult:(NSString **)result error:(NSError **)error timeLimit:(NSTimeInterval)limit;
+- (void) executeInBackgroundAndNotify; AVAILABLE_MAC_OS_X_VERSION_10_4_AND_LATER
+- (void) executeInBackgroundAndNotifyWithTimeLimit:(NSTimeInterval)limit;
+- (void) executeInBackgroundAndNotifyOnThread:(NSThread *)thread timeLimit:(NSTimeInterval)limit;  // nil posts on the engine's I/O thread
+- (void) executeInBackgroundAndNotifyOnQueue:(NSOperationQueue *)queue timeLimit:(NSTimeInterval)limit;
+- (void) cancel;  // thread-safe, terminates in-flight executions
\ No newline at end of file
@@ -1,4 +1,6 @@
 - (NSString *) scriptSourceFromHistoryAtIndex:(NSUInteger)index;
 - (NSData *) resultFromHistoryAtIndex:(NSUInteger)index;
+- (NSData *) errorResultFromHistoryAtIndex:(NSUInteger)index;
 - (NSString *) lastScriptSourceFromHistory;
-- (NSData *) lastResultFromHistory;
\ No newline at end of file
+- (NSData *) lastResultFromHistory;
+- (NSData *) lastErrorResultFromHistory;
\ No newline at end of file
@@ -33,12 +33,36 @@
  *
  * @par Usage
  *
- * First off, to use BMScript in your own project, all you need to do is add the three
+ * First off, to use BMScript in your own project, all you need to do is add the
  * files that comprise BMScript:
  *
  * -# BMDefines.h
  * -# BMScript.h
  * -# BMScript.m
+ * -# BMScriptTask.h
+ * -# BMScriptTask.m
+ * -# BMScriptEngine.h
+ * -# BMScriptEngine.m
+ * -# BMScriptOutputBuffer.h
+ * -# BMScriptOutputBuffer.m
+ * -# BMScriptTemplate.h
+ * -# BMScriptTemplate.m
+ * -# BMScriptLibrary.h
+ * -# BMScriptLibrary.m
+ * -# BMScriptResultCache.h
+ * -# BMScriptResultCache.m
+ * -# BMScriptResultStore.h
+ * -# BMScriptResultStore.m
+ * -# BMScriptHistory.h
+ * -# BMScriptHistory.m
+ * -# BMScriptHistoryLog.h
+ * -# BMScriptHistoryLog.m
+ * -# BMScriptLock.h
+ * -# BMScriptLock.m
+ * -# BMScriptWorkerPool.h
+ * -# BMScriptWorkerPool.m
+ * -# BMScriptQueue.h
+ * -# BMScriptQueue.m
  *
  * Then BMScript can be used in in your own code one of two ways:
  *
@@ -202,7 +226,7 @@
  * the object paramater (see inline example below).
  *
  * Then you tell the BMScript instance to BMScript.executeInBackgroundAndNotify. When execution finishes and your
- * selector is called it will be passed an NSNotification object which encapsulates an NSDictionary with three keys:
+ * selector is called it will be passed an NSNotification object which encapsulates an NSDictionary with four keys:
  *
  * <div class="box hasRows noshadow">
  *      <div class="row odd firstRow">
@@ -217,6 +241,10 @@
  *          <span class="cell left firstCell">#BMScriptNotificationExecutionStatus</span>
  *          <span class="cell rightCell lastCell">contains the script's execution status</span>
  *      </div>
+ *      <div class="row even">
+ *          <span class="cell left firstCell">#BMScriptNotificationTaskErrorResults</span>
+ *          <span class="cell rightCell lastCell">contains what the script wrote to stderr, if captured separately</span>
+ *      </div>
  * </div>
  *
  * To make that clearer here's an example with the relevant parts thrown together:
@@ -360,6 +388,16 @@
 #import <Cocoa/Cocoa.h>
 #include <AvailabilityMacros.h>
 
+@class BMScript;
+@class BMScriptTask;
+@class BMScriptOutputBuffer;
+@class BMScriptTemplate;
+@class BMScriptWorkerPool;
+@class BMScriptResultCache;
+@class BMScriptResultStore;
+@class BMScriptHistory;
+@class BMScriptHistoryLog;
+
 /*!
  * @addtogroup defines Defines
  * @{
@@ -407,6 +445,9 @@
  *
  *
  * Set this to 1 to use the pthread library directly instead of Cocoa's <span class="sourcecode">\@synchronized</span> directive which is reported to live a bit on the slow side.
+ * Either way each BMScript instance locks only itself, so instances running on different threads don't wait for each other.
+ * With the pthread locks an instance locks its stripe of a table of mutexes (see BMScriptLock.h), which also counts
+ * acquisitions, contention and wait time (see BMScriptGetLockStatistics()).
  * @see <a href="http://googlemac.blogspot.com/2006/10/synchronized-swimming.html" class="external">Synchronized Swimming (Google Mac Blog)</a>
  * 
  * You may have to evaluate yourself if the article still holds true. I'm mearly pointing you to it. <br>
@@ -426,7 +467,11 @@
     #define BMSCRIPT_FAST_LOCK 0
 #endif
 
-/*! Toggle for DTrace probes. */
+/*! 
+ * Toggle for DTrace probes. 
+ * On Linux the same probes are emitted as SystemTap/USDT probes through <span class="sourcecode">&lt;sys/sdt.h&gt;</span> 
+ * (see DTrace/Probes/BMScriptProbesSDT.h), for bpftrace, perf or SystemTap to attach to.
+ */
 #ifndef BMSCRIPT_ENABLE_DTRACE
     #define BMSCRIPT_ENABLE_DTRACE 0
 #endif
@@ -468,6 +513,65 @@
  */
 #define BMSCRIPT_TEMPLATE_TOKEN_END     @"#>"
 
+/*!
+ * Default for BMScript#timeLimit, in seconds. 
+ * Blocking executions running longer than this are terminated (see BMScript#cancel for how). 
+ * Define it yourself before importing BMScript.h to change the default for all instances.
+ */
+#ifndef BMSCRIPT_DEFAULT_TIME_LIMIT
+    #define BMSCRIPT_DEFAULT_TIME_LIMIT 10.0
+#endif
+
+/*!
+ * Seconds to wait between the steps of the SIGINT → SIGTERM → SIGKILL sequence used
+ * when a script is cancelled or exceeds its time limit.
+ */
+#ifndef BMSCRIPT_TERMINATION_GRACE_PERIOD
+    #define BMSCRIPT_TERMINATION_GRACE_PERIOD 2.0
+#endif
+
+/*!
+ * Default for BMScript#outputHighWaterMark, in bytes. 
+ * How much streamed output of a background execution may wait for the BMScript#outputHandler before the task is throttled.
+ */
+#ifndef BMSCRIPT_OUTPUT_HIGH_WATER_MARK
+    #define BMSCRIPT_OUTPUT_HIGH_WATER_MARK (1024 * 1024)
+#endif
+
+/*!
+ * Sources longer than this many bytes (in UTF-8) are not passed as an argument even if the options ask for 
+ * #BMScriptSourceDeliveryArgument, but through standard input, provided the options have arguments for that
+ * mode (see #BMScriptOptionsSourceDeliveryArgumentsKey). Linux refuses single arguments larger than 128 KiB.
+ */
+#ifndef BMSCRIPT_SOURCE_ARGUMENT_LIMIT
+    #define BMSCRIPT_SOURCE_ARGUMENT_LIMIT (128 * 1024)
+#endif
+
+/*!
+ * How the factory methods of BMScript(CommonScriptLanguagesFactories) pass the source of a Ruby script to 
+ * the interpreter. One of #BMScriptSourceDeliveryArgument, #BMScriptSourceDeliveryStandardInput or #BMScriptSourceDeliveryFileDescriptor.
+ * The same goes for #BMSCRIPT_PYTHON_SOURCE_DELIVERY, #BMSCRIPT_PERL_SOURCE_DELIVERY and #BMSCRIPT_SHELL_SOURCE_DELIVERY.
+ */
+#ifndef BMSCRIPT_RUBY_SOURCE_DELIVERY
+    #define BMSCRIPT_RUBY_SOURCE_DELIVERY BMScriptSourceDeliveryArgument
+#endif
+/*! How the factory methods pass the source of a Python script. @sa #BMSCRIPT_RUBY_SOURCE_DELIVERY */
+#ifndef BMSCRIPT_PYTHON_SOURCE_DELIVERY
+    #define BMSCRIPT_PYTHON_SOURCE_DELIVERY BMScriptSourceDeliveryArgument
+#endif
+/*! How the factory methods pass the source of a Perl script. @sa #BMSCRIPT_RUBY_SOURCE_DELIVERY */
+#ifndef BMSCRIPT_PERL_SOURCE_DELIVERY
+    #define BMSCRIPT_PERL_SOURCE_DELIVERY BMScriptSourceDeliveryArgument
+#endif
+/*! 
+ * How the factory methods pass the source of a shell script. @sa #BMSCRIPT_RUBY_SOURCE_DELIVERY 
+ * Note that <span class="sourcecode">sh -s</span> reads its commands from standard input as it goes, 
+ * so commands of the script reading standard input would consume the script itself. Prefer #BMScriptSourceDeliveryFileDescriptor.
+ */
+#ifndef BMSCRIPT_SHELL_SOURCE_DELIVERY
+    #define BMSCRIPT_SHELL_SOURCE_DELIVERY BMScriptSourceDeliveryArgument
+#endif
+
 /*!
  * Used to synthesize a valid options dictionary. 
  * You can use this convenience macro to generate the boilerplate code for the options dictionary 
@@ -513,9 +617,28 @@ typedef enum {
     /*! script finished successfully */
     BMScriptFinishedSuccessfully = (NSInteger)0,
     /*! script task failed with an exception */
-    BMScriptFailedWithException = (NSInteger)(NSIntegerMax-10)
+    BMScriptFailedWithException = (NSInteger)(NSIntegerMax-10),
+    /*! script was cancelled with BMScript#cancel and terminated */
+    BMScriptCancelled = (NSInteger)(NSIntegerMax-11),
+    /*! script exceeded its time limit and was terminated */
+    BMScriptTimedOut = (NSInteger)(NSIntegerMax-12)
 } ExecutionStatus;
 
+/*!
+ * Retention policies for the output of a script, see BMScript#outputRetentionPolicy.
+ * The output is always read completely, a policy only decides which part of it is kept.
+ */
+typedef enum {
+    /*! keep all of the output */
+    BMScriptRetainAllOutput = 0,
+    /*! keep the first BMScript#outputRetentionLimit bytes */
+    BMScriptRetainOutputHead = 1,
+    /*! keep the last BMScript#outputRetentionLimit bytes */
+    BMScriptRetainOutputTail = 2,
+    /*! keep the first and the last half of BMScript#outputRetentionLimit bytes */
+    BMScriptRetainOutputHeadAndTail = 3
+} BMScriptOutputRetention;
+
 /*!
  * @addtogroup functions Functions and Global Variables
  * @{
@@ -543,11 +666,49 @@ NS_INLINE NSString * BMNSStringFromExecutionStatus(ExecutionStatus status) {
         case BMScriptFailedWithException:
             return @"script task failed with an exception. check if launch path and/or arguments are appropriate";
             break;
+        case BMScriptCancelled:
+            return @"script cancelled";
+            break;
+        case BMScriptTimedOut:
+            return @"script exceeded its time limit";
+            break;
         default:
             return [NSString stringWithFormat:@"script terminated", status];
             break;
     }
 }
+/*!
+ * Returns the mapping behind #BMNSStringC99EscapeCharacterMapping. 
+ * It is built once and shared, and the escaping methods recognize it and use tables precompiled from it.
+ */
+OBJC_EXPORT NSArray * BMNSStringC99EscapeMapping(void);
+/*!
+ * Returns the mapping behind #BMNSStringCommonEscapeCharacterMapping. 
+ * It is built once and shared, and the escaping methods recognize it and use tables precompiled from it.
+ */
+OBJC_EXPORT NSArray * BMNSStringCommonEscapeMapping(void);
+/*!
+ * Finds the first occurrence of a run of UTF-16 units in another, comparing units literally (like NSLiteralSearch).
+ * Scans for the first unit of the pattern a vector at a time where the target allows it and compares the rest
+ * of the pattern only at those positions. Doesn't allocate. 
+ * @param characters the units to search
+ * @param length the number of units to search
+ * @param pattern the units to look for
+ * @param patternLength the number of units in pattern
+ * @returns the index of the first occurrence, or NSNotFound if there is none or patternLength is 0
+ */
+OBJC_EXPORT NSUInteger BMNSStringFindCharacters(const unichar * characters, NSUInteger length, const unichar * pattern, NSUInteger patternLength);
+/*!
+ * Writes bytes as a dump of numbers separated by single spaces: <span class="sourcecode">0x41 0xc3 0xa4</span> in hex
+ * (always two digits), <span class="sourcecode">65 195 164</span> in decimal. No terminating NUL is written.
+ * The hex dump is formatted 16 bytes at a time with SSE2 where available.
+ * @param bytes the bytes to dump
+ * @param length the number of bytes
+ * @param asHex YES for hexadecimal, NO for decimal notation
+ * @param buffer where to write the dump, or NULL to only compute its length
+ * @returns the number of characters written, or that would be written if buffer is NULL
+ */
+OBJC_EXPORT NSUInteger BMNSDataWriteByteDump(const void * bytes, NSUInteger length, BOOL asHex, char * buffer);
 
 /*! 
  * @} 
@@ -571,11 +732,43 @@ OBJC_EXPORT NSString * const BMScriptNotificationTaskResults;
 OBJC_EXPORT NSString * const BMScriptNotificationExecutionStatus;
 /*! Key incorporated by the notification's userInfo dictionary. Contains the termination status of the finished task */
 OBJC_EXPORT NSString * const BMScriptNotificationTaskReturnValue;
+/*! 
+ * Key incorporated by the notification's userInfo dictionary. Contains what the finished task wrote to stderr.
+ * Empty unless BMScript#capturesStandardErrorSeparately is set. 
+ */
+OBJC_EXPORT NSString * const BMScriptNotificationTaskErrorResults;
 
 /*! Key incorporated by the options dictionary. Contains the launch path string for the task */
 OBJC_EXPORT NSString * const BMScriptOptionsTaskLaunchPathKey;
 /*! Key incorporated by the options dictionary. Contains the arguments array for the task */
 OBJC_EXPORT NSString * const BMScriptOptionsTaskArgumentsKey;
+/*! 
+ * Optional key of the options dictionary. Names the worker shim (e.g. #BMScriptWorkerShimPython) used 
+ * when BMScript#usesWorkerPool is YES. Options without it are always executed with a new process. 
+ */
+OBJC_EXPORT NSString * const BMScriptOptionsWorkerShimKey;
+/*! 
+ * Optional key of the options dictionary. Contains how the source is handed to the tool: #BMScriptSourceDeliveryArgument 
+ * (the default), #BMScriptSourceDeliveryStandardInput or #BMScriptSourceDeliveryFileDescriptor.
+ */
+OBJC_EXPORT NSString * const BMScriptOptionsSourceDeliveryKey;
+/*! 
+ * Optional key of the options dictionary. Contains a dictionary mapping #BMScriptSourceDeliveryStandardInput and 
+ * #BMScriptSourceDeliveryFileDescriptor to the arguments array used instead of the one for #BMScriptOptionsTaskArgumentsKey 
+ * in that mode, e.g. <span class="sourcecode">-</span> for Python instead of <span class="sourcecode">-c</span>.
+ * Without an entry the task arguments are used as they are.
+ */
+OBJC_EXPORT NSString * const BMScriptOptionsSourceDeliveryArgumentsKey;
+/*! Source delivery mode. The source is appended to the task arguments, which is visible in <span class="sourcecode">ps(1)</span>. */
+OBJC_EXPORT NSString * const BMScriptSourceDeliveryArgument;
+/*! Source delivery mode. The source is written to the standard input of the tool, e.g. <span class="sourcecode">python -</span>. */
+OBJC_EXPORT NSString * const BMScriptSourceDeliveryStandardInput;
+/*! 
+ * Source delivery mode. The source is written to a pipe the tool inherits as descriptor 3 and 
+ * <span class="sourcecode">/dev/fd/3</span> is appended to the task arguments, e.g. <span class="sourcecode">sh /dev/fd/3</span>.
+ * Keeps standard input free for the script.
+ */
+OBJC_EXPORT NSString * const BMScriptSourceDeliveryFileDescriptor;
 /*! 
  * Used by the template saturation dictionary to define the start (first part) of a custom magic (replacement) token. 
  * The default token is '<##>' where '<#' would be the start and '#>' the end. 
@@ -642,14 +835,14 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * If implemented, called whenever a history item is about to be added to the history. 
  * Delegation methods beginning with <i>should</i> give the delegate the power to abort the operation by returning NO. 
  *
- * @param historyItem a history item is an NSArray with two entries: the script and the result when that script was executed.
+ * @param historyItem a history item is an NSArray with three entries: the script, the result and the stderr result (see BMScript#lastErrorResult) when that script was executed.
  */
 - (BOOL) shouldAddItemToHistory:(NSArray *)historyItem;
 /*!
  * If implemented, called whenever a history item is about to be returned from the history.
  * Delegation methods beginning with <i>should</i> give the delegate the power to abort the operation by returning NO. 
  *
- * @param historyItem a history item is an NSArray with two entries: the script and the result when that script was executed.
+ * @param historyItem a history item is an NSArray with three entries: the script, the result and the stderr result (see BMScript#lastErrorResult) when that script was executed.
  */
 - (BOOL) shouldReturnItemFromHistory:(NSArray *)historyItem;
 /*!
@@ -661,6 +854,7 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
 - (BOOL) shouldSetResult:(NSData *)data;
 /*!
  * If implemented, called during execution in background (non-blocking) whenever new data is available.
+ * Called on the I/O thread of BMScriptEngine.
  * Delegation methods beginning with <i>should</i> give the delegate the power to abort the operation by returning NO. 
  * @param data the data that will be used as new value if this method returns YES.
  */
@@ -719,6 +913,22 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
 
 @end
 
+/*!
+ * @protocol BMScriptOutputHandler
+ * Objects conforming to this protocol receive the output of a script chunk by chunk while it is running.
+ * @sa BMScript#outputHandler
+ */
+@protocol BMScriptOutputHandler <NSObject>
+/*!
+ * Called for each chunk of output, in the order the script wrote them. 
+ * Blocking executions call it on the executing thread, background executions on the thread or queue 
+ * the completion notification is posted on. Until it returns no more output is read for this script.
+ * @param script the script producing the output
+ * @param chunk the chunk that was read
+ */
+- (void) script:(BMScript *)script didReceiveOutput:(NSData *)chunk;
+@end
+
 /*! @} */
 
 /*!
@@ -732,14 +942,36 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
     id<BMScriptDelegateProtocol> delegate;
  @private
     NSData * result;
-    NSMutableData * partialResult;
+    NSData * errorResult;
+    BMScriptOutputBuffer * partialResult;
+    BMScriptOutputBuffer * partialErrorResult;
     BOOL isTemplate;
-    NSMutableArray * _history;
-    NSTask * task;
+    BMScriptTemplate * scriptTemplate;
+    BMScriptHistory * _history;
+    BMScriptTask * task;
     NSPipe * pipe;
-    NSTask * bgTask;
+    NSPipe * errorPipe;
+    BMScriptTask * bgTask;
     NSPipe * bgPipe;
+    NSPipe * bgErrorPipe;
     NSInteger returnValue;
+    NSTimeInterval timeLimit;
+    int wakeupPipe[2];
+    BOOL cancelRequested;
+    BOOL usesWorkerPool;
+    id<BMScriptOutputHandler> outputHandler;
+    BOOL retainsOutput;
+    NSUInteger outputHighWaterMark;
+    NSUInteger outputSpillThreshold;
+    BMScriptOutputRetention outputRetentionPolicy;
+    unsigned long long outputRetentionLimit;
+    unsigned long long discardedOutputLength;
+    BOOL capturesStandardErrorSeparately;
+    BMScriptResultCache * resultCache;
+    BMScriptResultStore * resultStore;
+    NSArray * inputPaths;
+    NSData * rawResult;
+    BOOL revalidatesResultCache;
 }
 
 // Doxygen seems to "swallow" the first property item and not generate any documentation for it
@@ -787,6 +1019,149 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  */
 @property (BM_ATOMIC copy, readonly, getter=lastResult) NSData * result;
 
+/** 
+ * Gets what the last execution wrote to stderr (getter=<b>lastErrorResult</b>). 
+ * Empty unless BMScript#capturesStandardErrorSeparately is set, nil if the script hasn't been executed yet.
+ */
+@property (BM_ATOMIC copy, readonly, getter=lastErrorResult) NSData * errorResult;
+
+/*!
+ * Gets or sets if stderr is captured on its own instead of being merged into the result. Defaults to NO.
+ *
+ * Both pipes are drained at the same time, by the blocking execution loop or by the BMScriptEngine, so a script
+ * filling up one of them while we wait on the other can't deadlock. What arrived on stderr is available through
+ * BMScript#lastErrorResult, as the third entry of the history item and under #BMScriptNotificationTaskErrorResults.
+ * The BMScript#outputSpillThreshold and the BMScript#outputRetentionPolicy apply to it as well; the 
+ * BMScript#outputHandler and the partial result delegate methods only see stdout.
+ *
+ * A worker of a BMScriptWorkerPool collects everything into one file and can't tell both apart, so while this is
+ * set, blocking executions use a new process even if BMScript#usesWorkerPool is set.
+ */
+@property (BM_ATOMIC assign) BOOL capturesStandardErrorSeparately;
+
+/*!
+ * Gets the compiled template the script source is saturated from, or nil if the script isn't based on a template. 
+ * Compiled from the template source the first time it is needed, unless the script was created with one
+ * (see #initWithTemplate:options:). It outlives the saturation, so a template script can be saturated again 
+ * with other values without re-reading or re-parsing it; each saturation starts over from the template.
+ */
+@property (BM_ATOMIC retain, readonly) BMScriptTemplate * scriptTemplate;
+
+/*!
+ * Gets or sets the time limit in seconds for blocking executions. Defaults to #BMSCRIPT_DEFAULT_TIME_LIMIT. 
+ * Set to 0 to let blocking executions run for as long as they take.
+ *
+ * When the limit is reached the task is terminated as described for BMScript#cancel 
+ * and the execution status is #BMScriptTimedOut.
+ * @sa #executeAndReturnResult:error:timeLimit:, #executeInBackgroundAndNotifyWithTimeLimit:
+ */
+@property (BM_ATOMIC assign) NSTimeInterval timeLimit;
+
+/*!
+ * Gets or sets if blocking executions run on a long-lived interpreter from a BMScriptWorkerPool instead of a new 
+ * process. Defaults to NO. Only has an effect if the options contain a #BMScriptOptionsWorkerShimKey, which is 
+ * the case for the factory methods of BMScript(CommonScriptLanguagesFactories).
+ *
+ * Result, return value and history are set just as for a regular execution. There are a few differences though:
+ * - the script does not run in a fresh interpreter. Each job gets a new top level scope, but modules it imported 
+ *   and changes it made to the interpreter itself are still there for the next script running on the same worker.
+ * - a timed out or cancelled script is killed right away (without the SIGINT and SIGTERM steps), along with its 
+ *   worker, and its output is lost.
+ * - background executions always use a new process, and so do blocking executions that capture stderr 
+ *   separately (see BMScript#capturesStandardErrorSeparately) or stream their output (see BMScript#outputHandler).
+ * @sa BMScriptWorkerPool
+ */
+@property (BM_ATOMIC assign) BOOL usesWorkerPool;
+
+/*!
+ * Gets or sets an object that receives the output as it arrives. Not retained. Defaults to nil.
+ *
+ * Background executions stream the output to it on the thread or queue they post their notification on.
+ * If it falls behind by more than BMScript#outputHighWaterMark bytes the engine stops reading the task's 
+ * pipe until it has caught up, so the script is throttled rather than its output piling up in memory.
+ * A worker of a BMScriptWorkerPool only hands back the output once the script has finished, so while this is set,
+ * blocking executions use a new process even if BMScript#usesWorkerPool is set.
+ * @sa BMScriptEngine
+ */
+@property (BM_ATOMIC assign) id<BMScriptOutputHandler> outputHandler;
+
+/*!
+ * Gets or sets if the output is kept as BMScript.partialResult and result. Defaults to YES.
+ * Set to NO together with an BMScript#outputHandler to process large outputs in constant memory. 
+ * The result (and the history item) is empty then.
+ */
+@property (BM_ATOMIC assign) BOOL retainsOutput;
+
+/*! Gets or sets how many bytes of streamed output may wait for the BMScript#outputHandler. Defaults to #BMSCRIPT_OUTPUT_HIGH_WATER_MARK. */
+@property (BM_ATOMIC assign) NSUInteger outputHighWaterMark;
+
+/*!
+ * Gets or sets the output size in bytes beyond which the output is moved out of memory into an anonymous file.
+ * The result is then a read-only mapping of that file. 0 keeps everything in memory. Defaults to #BMSCRIPT_OUTPUT_SPILL_THRESHOLD.
+ * @sa BMScriptOutputBuffer
+ */
+@property (BM_ATOMIC assign) NSUInteger outputSpillThreshold;
+
+/*!
+ * Gets or sets which part of the output is kept once it exceeds BMScript#outputRetentionLimit. Defaults to #BMScriptRetainAllOutput.
+ *
+ * The output is still read completely, so a chatty script runs to its end in bounded memory. With #BMScriptRetainOutputTail
+ * the last bytes are kept in a ring buffer. With #BMScriptRetainOutputHeadAndTail the result is the first half of the limit
+ * directly followed by the last half; how much was cut out in between is told by BMScript#discardedOutputLength.
+ * Applies to the result and to BMScript.partialResult, not to what is passed to the BMScript#outputHandler.
+ */
+@property (BM_ATOMIC assign) BMScriptOutputRetention outputRetentionPolicy;
+
+/*! Gets or sets how many bytes of output the BMScript#outputRetentionPolicy keeps. 0 means no limit. Defaults to 0. */
+@property (BM_ATOMIC assign) unsigned long long outputRetentionLimit;
+
+/*! Gets the number of output bytes the last execution discarded because of the BMScript#outputRetentionPolicy. */
+@property (BM_ATOMIC assign, readonly) unsigned long long discardedOutputLength;
+
+/*!
+ * Gets or sets the cache blocking executions look up the script's BMScript#fingerprint in before starting anything. 
+ * Defaults to nil, i.e. every execution runs the script. Only set it for scripts whose output depends on nothing 
+ * but their source and options; BMScriptResultCache#sharedCache is there for that.
+ *
+ * A hit sets the result, the error result and the return value, asks the delegate about them and adds a history 
+ * item just like an execution would, without starting a process. Background executions don't use the cache.
+ * @sa BMScriptResultCache
+ */
+@property (BM_ATOMIC retain) BMScriptResultCache * resultCache;
+
+/*!
+ * Gets or sets the on-disk store blocking executions look up the script's BMScript#fingerprint in after the 
+ * BMScript#resultCache, before starting anything. Defaults to nil. Results found there survive restarts and are 
+ * shared with other processes using the same store; a hit is handed out like a hit in the result cache and added to it.
+ * @sa BMScriptResultStore
+ */
+@property (BM_ATOMIC retain) BMScriptResultStore * resultStore;
+
+/*!
+ * Gets or sets the paths of the files the script reads, its declared inputs. Defaults to nil. 
+ * Their contents are part of the BMScript#fingerprint, so a cached or stored result is only used as long as 
+ * the inputs are unchanged.
+ */
+@property (BM_ATOMIC copy) NSArray * inputPaths;
+
+/*!
+ * Gets or sets how many items the history keeps. 0 means no limit. Defaults to #BMSCRIPT_HISTORY_LIMIT.
+ * Once exceeded, the oldest items are dropped. @sa BMScriptHistory
+ */
+@property (BM_ATOMIC assign) NSUInteger historyLimit;
+/*!
+ * Gets or sets how many bytes the distinct sources and results in the history may take up. 0 means no limit. 
+ * Defaults to #BMSCRIPT_HISTORY_BYTE_LIMIT. Equal sources and results are stored and counted once. @sa BMScriptHistory
+ */
+@property (BM_ATOMIC assign) unsigned long long historyByteLimit;
+/*!
+ * Gets or sets a persistent log to keep the history in instead of memory. Defaults to nil.
+ * Setting it appends the items kept so far to the log. With a log the history survives the process, 
+ * the history limits don't apply, and looking up an item by index is O(1) however long the log gets.
+ * Give each script a log of its own. @sa BMScriptHistoryLog
+ */
+@property (BM_ATOMIC retain) BMScriptHistoryLog * historyLog;
+
 // MARK: Initializer Methods
 
 
@@ -812,6 +1187,14 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * @see saturateTemplateWithArgument: and variants.
  */
 - (id) initWithTemplateSource:(NSString *)templateSource options:(NSDictionary *)scriptOptions;
+/*!
+ * Initialize a new BMScript instance with a compiled template. 
+ * Share one BMScriptTemplate among many scripts to parse the template only once.
+ * @param aTemplate a compiled template
+ * @param scriptOptions a dictionary containing the task options
+ * @see BMScript#scriptTemplate
+ */
+- (id) initWithTemplate:(BMScriptTemplate *)aTemplate options:(NSDictionary *)scriptOptions;
 /*!
  * Initialize a new BMScript instance. 
  * <div class="box important">
@@ -861,6 +1244,11 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * @see #initWithScriptSource:options: et al.
  */
 + (id) scriptWithContentsOfTemplateFile:(NSString *)path options:(NSDictionary *)scriptOptions;
+/*!
+ * Returns an autoreleased instance of BMScript based on a compiled template.
+ * @see #initWithTemplate:options:
+ */
++ (id) scriptWithTemplate:(BMScriptTemplate *)aTemplate options:(NSDictionary *)scriptOptions;
 
 
 // MARK: Execution
@@ -868,8 +1256,8 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
 
 /*!
  * Executes the script with a synchroneous (blocking) task. To get the result call BMScript.lastResult.
- * @note the blocking task is allowed a maximum of 10 seconds to execute and finish before being interrupted.
- * If you need longer time periods use the non-blocking execution model (e.g. #executeInBackgroundAndNotify).
+ * @note the blocking task is allowed BMScript#timeLimit seconds to execute and finish before being terminated.
+ * If you need longer time periods raise the limit or use the non-blocking execution model (e.g. #executeInBackgroundAndNotify).
  * @throws BMScriptTemplateArgumentMissingException thrown when the BMScript instance was initialized with a template which hasn't been saturated prior to execution
  * @returns the script's execution status
  * @see ExecutionStatus
@@ -879,8 +1267,8 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * Executes the script with a synchroneous (blocking) task and stores the result in &results.
  * If the BMScript instance was initialized with a template, the template must first be saturated
  * before the BMScript instance can be executed.
- * @note the blocking task is allowed a maximum of 10 seconds to execute and finish before being interrupted.
- * If you need longer time periods use the non-blocking execution model (e.g. #executeInBackgroundAndNotify).
+ * @note the blocking task is allowed BMScript#timeLimit seconds to execute and finish before being terminated.
+ * If you need longer time periods raise the limit or use the non-blocking execution model (e.g. #executeInBackgroundAndNotify).
  * @param results a pointer to an NSData where the result should be written to
  * @throws BMScriptTemplateArgumentMissingException thrown when the BMScript instance was initialized with a template which hasn't been saturated prior to execution
  * @returns the script's execution status 
@@ -889,8 +1277,8 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
 - (ExecutionStatus) executeAndReturnResult:(NSData **)results;
 /*!
  * Executes the script with a synchroneous (blocking) task and stores the result in the string pointed to by results.
- * @note the blocking task is allowed a maximum of 10 seconds to execute and finish before being interrupted.
- * If you need longer time periods use the non-blocking execution model (e.g. #executeInBackgroundAndNotify).
+ * @note the blocking task is allowed BMScript#timeLimit seconds to execute and finish before being terminated.
+ * If you need longer time periods raise the limit or use the non-blocking execution model (e.g. #executeInBackgroundAndNotify).
  * @param results a pointer to an NSData where the result should be written to
  * @param error a pointer to an NSError where errors should be written to
  * @throws BMScriptTemplateArgumentMissingException thrown when the BMScript instance was initialized with a template which hasn't been saturated prior to execution
@@ -898,20 +1286,75 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * @see ExecutionStatus
  */
 - (ExecutionStatus) executeAndReturnResult:(NSData **)results error:(NSError **)error;
+/*!
+ * Executes the script with a synchroneous (blocking) task, overriding BMScript#timeLimit for this one call.
+ * If the limit is exceeded the task is terminated, the execution status is #BMScriptTimedOut and 
+ * whatever output the task produced until then is available as result.
+ * @param results a pointer to an NSData where the result should be written to
+ * @param error a pointer to an NSError where errors should be written to
+ * @param limit time limit in seconds. 0 means no limit.
+ * @throws BMScriptTemplateArgumentMissingException thrown when the BMScript instance was initialized with a template which hasn't been saturated prior to execution
+ * @returns the script's execution status
+ * @see ExecutionStatus
+ */
+- (ExecutionStatus) executeAndReturnResult:(NSData **)results error:(NSError **)error timeLimit:(NSTimeInterval)limit;
 /*!
  * Executes the script with a asynchroneous (non-blocking) task. 
  * The script's execution status, results and the task's return value will be posted with a notifcation.
+ * The task runs and its output is collected on the I/O thread of the shared BMScriptEngine, the notification 
+ * is posted on the calling thread, which has to run its run loop to receive it.
  * @throws BMScriptTemplateArgumentMissingException thrown when the BMScript instance was initialized with a template which hasn't been saturated prior to execution
  * @see @link NonBlockingExecutionExample.m @endlink
  * @sa BMScriptNotificationExecutionStatus, BMScriptNotificationTaskReturnValue, BMScriptNotificationTaskResults
  */
 - (void) executeInBackgroundAndNotify; 
+/*!
+ * Same as #executeInBackgroundAndNotify but terminates the task if it is still running after limit seconds. 
+ * The execution status posted with the notification is #BMScriptTimedOut in that case.
+ * @param limit time limit in seconds. 0 means no limit.
+ */
+- (void) executeInBackgroundAndNotifyWithTimeLimit:(NSTimeInterval)limit;
+/*!
+ * Same as #executeInBackgroundAndNotifyWithTimeLimit: but posts the notification (and calls the delegate's 
+ * result and history methods) on the given thread, which has to run its run loop. 
+ * Pass nil to have it posted right on the engine's I/O thread, for callers without any run loop. 
+ * Observers must not block then, since that thread serves all background executions.
+ * @note the partial result delegate methods are always called on the I/O thread.
+ * @param thread the thread to post the notification on, or nil
+ * @param limit time limit in seconds. 0 means no limit.
+ * @sa BMScriptEngine
+ */
+- (void) executeInBackgroundAndNotifyOnThread:(NSThread *)thread timeLimit:(NSTimeInterval)limit;
+/*!
+ * Same as #executeInBackgroundAndNotifyOnThread:timeLimit: but posts the notification from an operation added to queue.
+ * @param queue the operation queue to post the notification from
+ * @param limit time limit in seconds. 0 means no limit.
+ */
+- (void) executeInBackgroundAndNotifyOnQueue:(NSOperationQueue *)queue timeLimit:(NSTimeInterval)limit;
+/*!
+ * Cancels in-flight blocking and background executions of the receiver. Safe to call from any thread.
+ *
+ * The task is started as the leader of its own process group so that everything the script spawned 
+ * can be reached. Cancelling sends SIGINT to that process group, then SIGTERM and finally SIGKILL, 
+ * waiting #BMSCRIPT_TERMINATION_GRACE_PERIOD seconds between the steps for the script to exit. 
+ * Whatever is left of the group once the script itself has exited is killed.
+ *
+ * The blocking execute methods return #BMScriptCancelled, background executions post it with 
+ * their notification. A cancel that arrives while an execution is still being set up, or before it
+ * started at all, is kept and cancels that execution as soon as its task is launched; it is cleared
+ * once the execution is over.
+ */
+- (void) cancel;
 
 // MARK: Virtual (Readonly) Getters
 
 /*!
- * Returns an immutable copy of the receiver's instance local execution cache (aka its history).
- * @returns an NSArray copied from the local execution history.
+ * Returns an immutable snapshot of the receiver's instance local execution cache (aka its history).
+ * 
+ * The snapshot shares its storage with the history instead of copying it, and as long as the history 
+ * doesn't change, every call returns the same object. Use BMScriptHistorySnapshot#subarrayWithRange: 
+ * and fast enumeration to read a range of items.
+ * @returns a BMScriptHistorySnapshot of the local execution history.
  */
 - (NSArray *) history;
 
@@ -924,13 +1367,22 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * @returns return code from the underlying NSTask as NSInteger or #BMScriptNotExecuted if the script wasn't executed yet. 
  */
 - (NSInteger) lastReturnValue;
+/*!
+ * Returns the content fingerprint of the script: a SHA-256 digest of its source, its options, the contents of its
+ * #inputPaths and the settings that change what its result looks like (see #capturesStandardErrorSeparately). 
+ * Two scripts with the same fingerprint are expected to produce the same result.
+ * @sa BMScriptFingerprint, BMScript#resultCache, BMScript#resultStore
+ */
+- (NSString *) fingerprint;
 
 
 // MARK: Templates
 
+// All saturation methods render the source from BMScript#scriptTemplate in a single pass and leave the template intact,
+// so they can be called again to saturate the same template with other values.
 
 /*!
- * Replaces a single <##> construct in the template.
+ * Replaces every <##> construct in the template with the same value.
  * @param tArg the value that should be inserted
  * @returns YES if the replacement was successful, NO on error
  */
@@ -940,8 +1392,16 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * @param firstArg the first value which should be inserted
  * @param ... the remaining values to be inserted in order of occurrence
  * @returns YES if the replacements were successful, NO on error
+ * @throws BMScriptTemplateArgumentMissingException if one of the values needed for the tokens of the template is nil
  */
 - (BOOL) saturateTemplateWithArguments:(NSString *)firstArg, ...;
+/*!
+ * Same as #saturateTemplateWithArguments: with the values taken from an array.
+ * @param args the values to be inserted in order of occurrence
+ * @returns YES if the replacements were successful, NO if the script has no template or the template has no <##> constructs
+ * @throws BMScriptTemplateArgumentMissingException if the array has fewer values than the template has tokens
+ */
+- (BOOL) saturateTemplateWithArgumentsInArray:(NSArray *)args;
 /*!
  * Replaces multiple <span class="sourcecode">&lt;\#KEY\#&gt;</span> constructs in the template. 
  * The <span class="sourcecode">KEY</span> phrase is a variant and describes the name of a key in the dictionary passed to this method.<br/>
@@ -973,6 +1433,17 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * May return nil if the history does not contain any objects.
  */
 - (NSData *) lastResultFromHistory;
+/*!
+ * Returns a cached stderr result from the history. 
+ * @param index index of the item to return. May return nil if the history does not contain any objects.
+ * @sa BMScript#capturesStandardErrorSeparately
+ */
+- (NSData *) errorResultFromHistoryAtIndex:(NSUInteger)index;
+/*!
+ * Returns the last cached stderr result from the history. 
+ * May return nil if the history does not contain any objects.
+ */
+- (NSData *) lastErrorResultFromHistory;
 
 // MARK: Equality
 
@@ -993,6 +1464,11 @@ OBJC_EXPORT NSString * const BMScriptLanguageProtocolMethodMissingException;
  * @category BMScript(CommonScriptLanguagesFactories)
  * A category on BMScript adding default factory methods for Ruby, Python and Perl.
  * The task options use default paths (for 10.5 and 10.6) for the task launch path.
+ * 
+ * Each language profile knows the arguments for all source delivery modes (<span class="sourcecode">ruby -</span>, 
+ * <span class="sourcecode">python -</span>, <span class="sourcecode">perl -</span>, <span class="sourcecode">sh -s</span> and 
+ * their <span class="sourcecode">/dev/fd/3</span> counterparts). Which one is used is set by #BMSCRIPT_RUBY_SOURCE_DELIVERY 
+ * and its siblings, or per script by replacing #BMScriptOptionsSourceDeliveryKey in its options.
  */
 @interface BMScript(CommonScriptLanguagesFactories)
 /*!
@@ -1103,32 +1579,19 @@ typedef NSArray BMNSStringEscapeCharacterMapping;
             </div>
         </div>
  * </div>
+ * The entries, in order: backslash, \\n, \\r, \\t, \\f, \\a, \\v, \\b and double quote, each mapped to its backslash escape, 
+ * e.g. <span class="sourcecode">[NSArray arrayWithObjects:@"\\n", @"\\\\n", nil]</span>.
  * @sa BMNSStringCommonEscapeCharacterMapping
  */
-#define BMNSStringC99EscapeCharacterMapping  [NSArray arrayWithObjects:                         \
-                                                [NSArray arrayWithObjects:@"\\", @"\\\\", nil], \
-                                                [NSArray arrayWithObjects:@"\n", @"\\n", nil],  \
-                                                [NSArray arrayWithObjects:@"\r", @"\\r", nil],  \
-                                                [NSArray arrayWithObjects:@"\t", @"\\t", nil],  \
-                                                [NSArray arrayWithObjects:@"\f", @"\\f", nil],  \
-                                                [NSArray arrayWithObjects:@"\a", @"\\a", nil],  \
-                                                [NSArray arrayWithObjects:@"\v", @"\\v", nil],  \
-                                                [NSArray arrayWithObjects:@"\b", @"\\b", nil],  \
-                                                [NSArray arrayWithObjects:@"\"", @"\\\"", nil], \
-                                             nil]
+#define BMNSStringC99EscapeCharacterMapping BMNSStringC99EscapeMapping()
 /*! 
  * ￼Defines an escape character mapping that includes the most common escapable characters for an NSString. This mapping is used internally by <span class="sourcecode">quotedString</span> and <span class="sourcecode">unquotedString</span>.
  * It was put in the public header file to make it easier to infer the format needed for constructing new <span class="sourcecode">BMNSStringEscapeCharacterMapping</span> instances which can be passed to <span class="sourcecode">stringByEscapingStringUsingMapping:order:</span>.
  * Contrary to #BMNSStringC99EscapeCharacterMapping the order here is not as important since <span class="sourcecode">quotedString</span> traverses the mapping in first order.
+ * The entries, in order: backslash, \\n, \\r, \\t and double quote, each mapped to its backslash escape.
  * @sa BMNSStringC99EscapeCharacterMapping
  */
-#define BMNSStringCommonEscapeCharacterMapping [NSArray arrayWithObjects:                         \
-                                                  [NSArray arrayWithObjects:@"\\", @"\\\\", nil], \
-                                                  [NSArray arrayWithObjects:@"\n", @"\\n", nil],  \
-                                                  [NSArray arrayWithObjects:@"\r", @"\\r", nil],  \
-                                                  [NSArray arrayWithObjects:@"\t", @"\\t", nil],  \
-                                                  [NSArray arrayWithObjects:@"\"", @"\\\"", nil], \
-                                               nil]
+#define BMNSStringCommonEscapeCharacterMapping BMNSStringCommonEscapeMapping()
 
 /*! String truncation modes￼￼ */
 typedef enum {
@@ -1251,9 +1714,10 @@ typedef enum {
  */ 
 - (NSString *) stringByTruncatingToLength:(NSUInteger)length mode:(BMNSStringTruncateMode)mode indicator:(NSString *)indicatorString;
 /*!
- * Counts the number of occurrences of a string in another string 
+ * Counts the number of non-overlapping occurrences of a string in another string, comparing literally. 
+ * Works on the receiver's characters directly (see #BMNSStringFindCharacters) and doesn't create any objects.
  * @param aString the string to count occurrences of
- * @returns NSInteger with the amount of occurrences
+ * @returns NSInteger with the amount of occurrences, or NSNotFound if there are none
  */
 - (NSInteger) countOccurrencesOfString:(NSString *)aString;
 /*!
@@ -1264,12 +1728,28 @@ typedef enum {
  * Returns a string wrapped in double quotes. 
  */
 - (NSString *) stringByWrappingDoubleQuotes;
-/*! 
- * Returns an array of strings representing the reciever's bytes in hexadecimal or decimal notation. 
+/*!
+ * Returns the reciever's bytes in an encoding.
  * Uses getBytes:maxLength:usedLength:encoding:options:range:remainingRange: with option NSStringEncodingConversionExternalRepresentation to get the BOM included (if needed).
  * See NSString.h for more details.
  * @param enc Usually you want NSUTF8StringEncoding but if you're interested in the BOM pass NSUnicodeStringEncoding or NSUTF16StringEncoding (which is an alias for the former)
- * @param asHex specify YES if for example you want "0x42" for 'A' ("65" if NO)
+ * @returns the encoded bytes, or nil if the reciever can't be converted to enc losslessly
+ * @throws NSInvalidArgumentException if enc is 0
+ */
+- (NSData *) bytesForEncoding:(NSStringEncoding)enc;
+/*!
+ * Returns the reciever's bytes in an encoding as a single string of numbers separated by spaces. 
+ * Suitable for inspecting large strings: the dump is written into one buffer (see #BMNSDataWriteByteDump).
+ * @param enc the encoding, as for #bytesForEncoding:
+ * @param asHex specify YES if for example you want "0x41" for 'A' ("65" if NO)
+ * @returns the dump, or nil if the reciever can't be converted to enc losslessly
+ */
+- (NSString *) byteDumpForEncoding:(NSStringEncoding)enc asHex:(BOOL)asHex;
+/*! 
+ * Returns an array of strings representing the reciever's bytes in hexadecimal or decimal notation. 
+ * Splits #byteDumpForEncoding:asHex: so it creates one string per byte; prefer the dump or #bytesForEncoding: for anything but short strings.
+ * @param enc the encoding, as for #bytesForEncoding:
+ * @param asHex specify YES if for example you want "0x41" for 'A' ("65" if NO)
  */
 - (NSArray *) bytesForEncoding:(NSStringEncoding)enc asHex:(BOOL)asHex;
 /*!
@@ -1342,6 +1822,11 @@ typedef enum {
  * Otherwise returns string from <span class="sourcecode">[self description]</span>.
  */
 - (NSString *) contentsAsString;
+/*!
+ * Returns the bytes of the data as numbers separated by spaces, in hexadecimal (<span class="sourcecode">0x0a</span>) or decimal notation.
+ * @see #BMNSDataWriteByteDump
+ */
+- (NSString *) byteDumpAsHex:(BOOL)asHex;
 @end
 
 
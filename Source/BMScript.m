@@ -20,73 +20,88 @@
 /// @cond HIDDEN
 
 #import "BMScript.h"
+#import "BMScriptTask.h"
+#import "BMScriptWorkerPool.h"
+#import "BMScriptEngine.h"
+#import "BMScriptOutputBuffer.h"
+#import "BMScriptTemplate.h"
+#import "BMScriptResultCache.h"
+#import "BMScriptResultStore.h"
+#import "BMScriptHistory.h"
+#import "BMScriptHistoryLog.h"
+#import "BMScriptLock.h"
 
 #if BMSCRIPT_ENABLE_DTRACE
-#import "BMScriptProbes.h"      /* dtrace probes auto-generated from .d file(s) */
+    #if defined(__linux__)
+    #import "BMScriptProbesSDT.h"   /* the same probes as SystemTap/USDT probes, see DTrace/Probes/BMScriptProbesSDT.h */
+    #else
+    #import "BMScriptProbes.h"      /* dtrace probes auto-generated from .d file(s) */
+    #endif
 #endif
 
-#include <unistd.h>             /* for usleep       */
+#include <unistd.h>             /* for read         */
 #include <pthread.h>            /* for pthread_*    */
+#include <poll.h>               /* for poll         */
+#include <errno.h>              /* for errno        */
+#include <math.h>               /* for ceil         */
+#include <fcntl.h>              /* for fcntl        */
+#include <signal.h>             /* for SIGINT etc.  */
+
+#if defined(__AVX2__)
+#include <immintrin.h>          /* for _mm256_*     */
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>          /* for _mm_*        */
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>           /* for v*q_u16      */
+#endif
 
 #define BMNSSTRING_TRUNCATE_LENGTH      20              /* used by -truncatedString, defined in NSString (BMScriptUtilities) */
 #define BMNSSTRING_TRUNCATE_TOKEN       @"\u2026"       /* Unicode: Horizontal Ellipsis (…). Also used by -truncatedString   */
 
-#define BMSCRIPT_TEMPLATE_TOKEN_EMPTY   @""BMSCRIPT_TEMPLATE_TOKEN_START""BMSCRIPT_TEMPLATE_TOKEN_END""                                 /* complete (but empty) magic token used in templates */
-#define BMSCRIPT_TEMPLATE_TOKEN_INSERT  @""BMSCRIPT_TEMPLATE_TOKEN_START""BMSCRIPT_INSERTION_TOKEN""BMSCRIPT_TEMPLATE_TOKEN_END""       /* complete magic token incl. insertion token used in templates */
 #define BMSCRIPT_DEFAULT_OPTIONS        @"BMSynthesizeOptions(@\"/bin/echo\", @\"\")"   /* default script option for display in warnings etc. */
 #define BMSCRIPT_DEFAULT_SCRIPT_SOURCE  @"'<script source placeholder>'"                /* default script source for display in warnings etc. */
 
-#define BMSCRIPT_TASK_TIME_LIMIT        10  /* time limit in seconds for how long the blocking task is allowed to execute before being interrupted */
+#define BMSCRIPT_READ_BUFFER_SIZE       65536   /* size of the stack buffer used when reading task output in the blocking execution model */
 
 #ifndef BMSCRIPT_DEBUG_HISTORY
     #define BMSCRIPT_DEBUG_HISTORY  0
 #endif
 
+/* 
+ * BM_LOCK(object) and BM_UNLOCK(object) bracket a critical section for one object, so different instances don't wait 
+ * for each other. With BMSCRIPT_FAST_LOCK the object's stripe of the BMScriptLock table is locked (and counted, 
+ * see BMScriptGetLockStatistics()), otherwise the section is @synchronized on the object.
+ * Unrelated instances may share a stripe, so no lock may be held across a delegate call, a notification or anything
+ * else that can run code of the caller's; two threads could otherwise end up waiting for each other's stripes.
+ */
 #if (BMSCRIPT_THREAD_AWARE && BMSCRIPT_ENABLE_DTRACE)
     #if BMSCRIPT_FAST_LOCK
-        #define BM_LOCK(name) \
-        BM_PROBE(ACQUIRE_LOCK_START, (char *) [BMStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]); \
-        static pthread_mutex_t mtx_##name = PTHREAD_MUTEX_INITIALIZER; \
-        if (pthread_mutex_lock(&mtx_##name)) {\
-            printf("*** Warning: Lock failed! Application behaviour may be undefined. Exiting...");\
-            exit(EXIT_FAILURE);\
-        }
-        #define BM_UNLOCK(name) \
-        if ((pthread_mutex_unlock(&mtx_##name) != 0)) {\
-            printf("*** Warning: Unlock failed! Application behaviour may be undefined. Exiting...");\
-            exit(EXIT_FAILURE);\
-        }\
-        BM_PROBE(ACQUIRE_LOCK_END, (char *) [BMStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]);
+        #define BM_LOCK(object) \
+        BM_PROBE(ACQUIRE_LOCK_START, (char *) [BMNSStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]); \
+        BMScriptLockObject(object);
+        #define BM_UNLOCK(object) \
+        BMScriptUnlockObject(object); \
+        BM_PROBE(ACQUIRE_LOCK_END, (char *) [BMNSStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]);
     #else
-        #define BM_LOCK(name) \
-        BM_PROBE(ACQUIRE_LOCK_START, (char *) [BMStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]);\
-        static id const sync_##name##_ref = @""#name;\
-        @synchronized(sync_##name##_ref) {
-        #define BM_UNLOCK(name) }\
-        BM_PROBE(ACQUIRE_LOCK_END, (char *) [BMStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]);
+        #define BM_LOCK(object) \
+        BM_PROBE(ACQUIRE_LOCK_START, (char *) [BMNSStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]);\
+        @synchronized(object) {
+        #define BM_UNLOCK(object) }\
+        BM_PROBE(ACQUIRE_LOCK_END, (char *) [BMNSStringFromBOOL(BMSCRIPT_FAST_LOCK) UTF8String]);
     #endif
 #elif (BMSCRIPT_THREAD_AWARE && !BMSCRIPT_ENABLE_DTRACE)
     #if BMSCRIPT_FAST_LOCK
-        #define BM_LOCK(name) \
-        static pthread_mutex_t mtx_##name = PTHREAD_MUTEX_INITIALIZER; \
-        if (pthread_mutex_lock(&mtx_##name)) {\
-            printf("*** Warning: Lock failed! Application behaviour may be undefined. Exiting...");\
-            exit(EXIT_FAILURE);\
-        }
-        #define BM_UNLOCK(name) \
-        if ((pthread_mutex_unlock(&mtx_##name) != 0)) {\
-            printf("*** Warning: Unlock failed! Application behaviour may be undefined. Exiting...");\
-            exit(EXIT_FAILURE);\
-        };
+        #define BM_LOCK(object) BMScriptLockObject(object);
+        #define BM_UNLOCK(object) BMScriptUnlockObject(object);
     #else
-        #define BM_LOCK(name) \
-        static id const sync_##name##_ref = @""#name;\
-        @synchronized(sync_##name##_ref) {
-        #define BM_UNLOCK(name) };
+        #define BM_LOCK(object) \
+        @synchronized(object) {
+        #define BM_UNLOCK(object) };
     #endif
 #else 
-    #define BM_LOCK(name)
-    #define BM_UNLOCK(name)
+    #define BM_LOCK(object)
+    #define BM_UNLOCK(object)
 #endif
 
 
@@ -94,9 +109,17 @@ NSString * const BMScriptTaskDidEndNotification                  = @"BMScriptTas
 NSString * const BMScriptNotificationTaskResults                 = @"BMScriptNotificationTaskResults";
 NSString * const BMScriptNotificationTaskReturnValue             = @"BMScriptNotificationTaskReturnValue";
 NSString * const BMScriptNotificationExecutionStatus             = @"BMScriptNotificationExecutionStatus";
+NSString * const BMScriptNotificationTaskErrorResults            = @"BMScriptNotificationTaskErrorResults";
 
 NSString * const BMScriptOptionsTaskLaunchPathKey                = @"BMScriptOptionsTaskLaunchPathKey";
 NSString * const BMScriptOptionsTaskArgumentsKey                 = @"BMScriptOptionsTaskArgumentsKey";
+NSString * const BMScriptOptionsWorkerShimKey                    = @"BMScriptOptionsWorkerShimKey";
+NSString * const BMScriptOptionsSourceDeliveryKey                = @"BMScriptOptionsSourceDeliveryKey";
+NSString * const BMScriptOptionsSourceDeliveryArgumentsKey       = @"BMScriptOptionsSourceDeliveryArgumentsKey";
+
+NSString * const BMScriptSourceDeliveryArgument                  = @"BMScriptSourceDeliveryArgument";
+NSString * const BMScriptSourceDeliveryStandardInput             = @"BMScriptSourceDeliveryStandardInput";
+NSString * const BMScriptSourceDeliveryFileDescriptor            = @"BMScriptSourceDeliveryFileDescriptor";
 
 NSString * const BMScriptTemplateTokenStartKey                   = @"BMScriptTemplateTokenStartKey";
 NSString * const BMScriptTemplateTokenEndKey                     = @"BMScriptTemplateTokenEndKey";
@@ -106,28 +129,62 @@ NSString * const BMScriptTemplateArgumentMissingException        = @"BMScriptTem
 NSString * const BMScriptLanguageProtocolDoesNotConformException = @"BMScriptLanguageProtocolDoesNotConformException";
 NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLanguageProtocolMethodMissingException";
 
+/* folded into the options by -fingerprint, the result of such a script looks different */
+static NSString * const BMScriptFingerprintSeparateStandardErrorKey = @"BMScriptCapturesStandardErrorSeparately";
+
+
+/* Creates a non-blocking, close-on-exec pipe. On failure both descriptors are set to -1. */
+static void BMScriptOpenWakeupPipe(int fds[2]) {
+    if (pipe(fds) == 0) {
+        for (NSUInteger i = 0; i < 2; i++) {
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[i], F_SETFL, O_NONBLOCK);
+        }
+    } else {
+        fds[0] = fds[1] = -1;
+    }
+}
 
 /* Empty braces means this is an "Extension" as opposed to a Category */
-@interface BMScript (/* Private */)
+@interface BMScript (/* Private */) <BMScriptEngineClient>
 
 @property (BM_ATOMIC copy, readwrite) NSData * result;
+@property (BM_ATOMIC copy, readwrite) NSData * errorResult;
 @property (BM_ATOMIC assign) NSInteger returnValue;
-@property (BM_ATOMIC copy) NSMutableData * partialResult;
+@property (BM_ATOMIC retain) BMScriptOutputBuffer * partialResult;
+@property (BM_ATOMIC retain) BMScriptOutputBuffer * partialErrorResult;
 @property (BM_ATOMIC assign) BOOL isTemplate;
-@property (BM_ATOMIC retain) NSTask * task;
+@property (BM_ATOMIC retain, readwrite) BMScriptTemplate * scriptTemplate;
+@property (BM_ATOMIC retain) BMScriptTask * task;
 @property (BM_ATOMIC retain) NSPipe * pipe;
-@property (BM_ATOMIC retain) NSTask * bgTask;
+@property (BM_ATOMIC retain) NSPipe * errorPipe;
+@property (BM_ATOMIC retain) BMScriptTask * bgTask;
 @property (BM_ATOMIC retain) NSPipe * bgPipe;
-@property (BM_ATOMIC copy, readwrite) NSMutableArray * _history;
+@property (BM_ATOMIC retain) NSPipe * bgErrorPipe;
+@property (BM_ATOMIC retain, readwrite) BMScriptHistory * _history;
+@property (BM_ATOMIC assign, readwrite) unsigned long long discardedOutputLength;
+@property (BM_ATOMIC copy) NSData * rawResult;
+@property (BM_ATOMIC assign) BOOL revalidatesResultCache;
 
-- (void) stopTask;
 - (BOOL) setupTask;
-- (void) cleanupTask:(NSTask *)whichTask;
-- (ExecutionStatus) launchTask;
-- (void) setupAndLaunchBackgroundTask;
-- (void) taskTerminated:(NSNotification *)aNotification;
+- (BMScriptTemplate *) templateWithTokenStart:(NSString *)start tokenEnd:(NSString *)end;
+- (void) configureSourceDeliveryOfTask:(BMScriptTask *)aTask;
+- (void) cleanupTask:(BMScriptTask *)whichTask;
+- (ExecutionStatus) launchTaskWithTimeLimit:(NSTimeInterval)limit;
+- (ExecutionStatus) launchPooledTaskWithPool:(BMScriptWorkerPool *)workerPool timeLimit:(NSTimeInterval)limit;
+- (BOOL) resetWakeupPipe;
+- (void) storeResult:(NSData *)data;
+- (NSDictionary *) cachedExecutionWithFingerprint:(NSString *)fingerprint;
+- (ExecutionStatus) storeCachedExecution:(NSDictionary *)info;
+- (void) cacheExecutionWithStatus:(ExecutionStatus)status fingerprint:(NSString *)fingerprint;
+- (void) revalidateResultCache;
+- (void) setupAndLaunchBackgroundTaskWithTimeLimit:(NSTimeInterval)limit deliveryThread:(NSThread *)thread deliveryQueue:(NSOperationQueue *)queue;
+- (void) closeWakeupPipe;
 - (void) appendPartialData:(NSData *)d;
-- (void) dataReceived:(NSNotification *)aNotification;
+- (void) appendPartialErrorData:(NSData *)d;
+- (NSArray *) historyItem;
+- (BMScriptOutputBuffer *) outputBuffer;
+- (NSData *) applyOutputRetentionTo:(NSData *)data;
 - (const char *) gdbDataFormatter;
 
 @end
@@ -138,13 +195,32 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
 @synthesize source;
 @synthesize options;
 @synthesize partialResult;
+@synthesize partialErrorResult;
 @synthesize result;
+@synthesize errorResult;
 @synthesize isTemplate;
 @synthesize task;
 @synthesize pipe;
+@synthesize errorPipe;
 @synthesize bgTask;
 @synthesize bgPipe;
+@synthesize bgErrorPipe;
 @synthesize returnValue;
+@synthesize timeLimit;
+@synthesize usesWorkerPool;
+@synthesize outputHandler;
+@synthesize retainsOutput;
+@synthesize outputHighWaterMark;
+@synthesize outputSpillThreshold;
+@synthesize outputRetentionPolicy;
+@synthesize outputRetentionLimit;
+@synthesize discardedOutputLength;
+@synthesize capturesStandardErrorSeparately;
+@synthesize resultCache;
+@synthesize resultStore;
+@synthesize inputPaths;
+@synthesize rawResult;
+@synthesize revalidatesResultCache;
 @synthesize _history;
 
 
@@ -209,15 +285,26 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
     if (BM_EXPECTED([task isRunning], 0)) [task terminate];
     if (BM_EXPECTED([bgTask isRunning], 0)) [bgTask terminate];
     
+    [self closeWakeupPipe];
+    
     [source release], source = nil;
     [_history release], _history = nil;
     [options release], options = nil;
     [result release], result = nil;
+    [errorResult release], errorResult = nil;
     [partialResult release], partialResult = nil;
+    [partialErrorResult release], partialErrorResult = nil;
+    [scriptTemplate release], scriptTemplate = nil;
     [task release], task = nil;
     [pipe release], pipe = nil;
+    [errorPipe release], errorPipe = nil;
     [bgTask release], bgTask = nil;
     [bgPipe release], bgPipe = nil;
+    [bgErrorPipe release], bgErrorPipe = nil;
+    [resultCache release], resultCache = nil;
+    [resultStore release], resultStore = nil;
+    [inputPaths release], inputPaths = nil;
+    [rawResult release], rawResult = nil;
     
     [super dealloc];
 }
@@ -225,6 +312,7 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
 - (void) finalize {
     if (BM_EXPECTED([task isRunning], 0)) [task terminate];
     if (BM_EXPECTED([bgTask isRunning], 0)) [bgTask terminate];
+    [self closeWakeupPipe];
     [super finalize];
 }
 
@@ -296,13 +384,19 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
             }
         }
         
-        _history = [[NSMutableArray alloc] init];
-        partialResult = [[NSString alloc] init];
+        _history = [[BMScriptHistory alloc] init];
+        partialResult = [[BMScriptOutputBuffer alloc] init];
+        partialErrorResult = [[BMScriptOutputBuffer alloc] init];
         
         returnValue = BMScriptNotExecuted;
+        timeLimit = BMSCRIPT_DEFAULT_TIME_LIMIT;
+        retainsOutput = YES;
+        outputHighWaterMark = BMSCRIPT_OUTPUT_HIGH_WATER_MARK;
+        outputSpillThreshold = BMSCRIPT_OUTPUT_SPILL_THRESHOLD;
+        wakeupPipe[0] = wakeupPipe[1] = -1;
         
         // tasks/pipes will be allocated, initialized (and destroyed) lazily
-        // on an as-needed basis because NSTasks are one-shot (not for re-use)
+        // on an as-needed basis because BMScriptTasks are one-shot (not for re-use)
     }
     #if (BMSCRIPT_ENABLE_DTRACE)    
         BM_PROBE(INIT_END, (char *) [[[self debugDescription] quotedString] UTF8String]);
@@ -319,6 +413,17 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
     return nil;
 }
 
+- (id) initWithTemplate:(BMScriptTemplate *)aTemplate options:(NSDictionary *)scriptOptions {
+    
+    if (aTemplate) {
+        if ((self = [self initWithTemplateSource:[aTemplate string] options:scriptOptions])) {
+            self.scriptTemplate = aTemplate;
+        }
+        return self;
+    }
+    return nil;
+}
+
 - (id) initWithContentsOfFile:(NSString *)path options:(NSDictionary *)scriptOptions {
     
     NSError * err = nil;
@@ -359,8 +464,63 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
     return [[[self alloc] initWithContentsOfTemplateFile:path options:scriptOptions] autorelease];
 }
 
++ (id) scriptWithTemplate:(BMScriptTemplate *)aTemplate options:(NSDictionary *)scriptOptions {
+    return [[[self alloc] initWithTemplate:aTemplate options:scriptOptions] autorelease];
+}
+
 // MARK: Private Methods
 
+/* returns the compiled template, recompiled for other delimiters if need be. nil if the script isn't a template. */
+- (BMScriptTemplate *) templateWithTokenStart:(NSString *)start tokenEnd:(NSString *)end {
+    
+    BMScriptTemplate * tmpl = self.scriptTemplate;
+    if (!tmpl || ([[tmpl tokenStart] isEqualToString:start] && [[tmpl tokenEnd] isEqualToString:end])) {
+        return tmpl;
+    }
+    tmpl = [BMScriptTemplate templateWithString:[tmpl string] tokenStart:start tokenEnd:end];
+    self.scriptTemplate = tmpl;
+    return tmpl;
+}
+
+/* sets the arguments of a task and, unless the source goes in as an argument, the input it reads the source from */
+- (void) configureSourceDeliveryOfTask:(BMScriptTask *)aTask {
+    
+    NSString * mode = [self.options objectForKey:BMScriptOptionsSourceDeliveryKey];
+    NSDictionary * modeArgs = [self.options objectForKey:BMScriptOptionsSourceDeliveryArgumentsKey];
+    NSString * src = self.source;
+    
+    if (!mode) mode = BMScriptSourceDeliveryArgument;
+    
+    // a source too large to be an argument would make the launch fail with E2BIG
+    if ([mode isEqualToString:BMScriptSourceDeliveryArgument] 
+        && [modeArgs objectForKey:BMScriptSourceDeliveryStandardInput]
+        && [src lengthOfBytesUsingEncoding:NSUTF8StringEncoding] > BMSCRIPT_SOURCE_ARGUMENT_LIMIT) {
+        mode = BMScriptSourceDeliveryStandardInput;
+    }
+    
+    NSArray * args = [modeArgs objectForKey:mode];
+    if (!args) args = [self.options objectForKey:BMScriptOptionsTaskArgumentsKey];
+    
+    // If BMSynthesizeOptions is called with "nil" as second argument 
+    // that effectively sets up BMScriptOptionsTaskArgumentsKey as 
+    // [NSArray arrayWithObjects:nil] which in turn becomes a "__NSArray0"
+    if (!args || [args isEmptyStringArray] || [args isZeroArray]) {
+        args = [NSArray array];
+    }
+    
+    if ([mode isEqualToString:BMScriptSourceDeliveryStandardInput]) {
+        [aTask setInputData:[src dataUsingEncoding:NSUTF8StringEncoding]];
+        [aTask setInputDescriptor:0];
+    } else if ([mode isEqualToString:BMScriptSourceDeliveryFileDescriptor]) {
+        [aTask setInputData:[src dataUsingEncoding:NSUTF8StringEncoding]];
+        [aTask setInputDescriptor:3];
+        args = [args arrayByAddingObject:@"/dev/fd/3"];
+    } else {
+        args = [args arrayByAddingObject:src];
+    }
+    [aTask setArguments:args];
+}
+
 - (BOOL) setupTask {
     
     BOOL success = NO;
@@ -374,33 +534,31 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
             BM_PROBE(SETUP_TASK_BEGIN);
         #endif
 
-        self.task = [[NSTask alloc] init];
-        self.pipe = [[NSPipe alloc] init];
+        self.task = [[[BMScriptTask alloc] init] autorelease];
+        self.pipe = [[[NSPipe alloc] init] autorelease];
+        self.errorPipe = (self.capturesStandardErrorSeparately ? [[[NSPipe alloc] init] autorelease] : nil);
         
-        if (self.task && self.pipe) {
-            
-            NSString * path = [self.options objectForKey:BMScriptOptionsTaskLaunchPathKey];
-            NSArray * args = [self.options objectForKey:BMScriptOptionsTaskArgumentsKey];
-            
-            // If BMSynthesizeOptions is called with "nil" as second argument 
-            // that effectively sets up BMScriptOptionsTaskArgumentsKey as 
-            // [NSArray arrayWithObjects:nil] which in turn becomes a "__NSArray0"
-            if (!args || [args isEmptyStringArray] || [args isZeroArray]) {
-                args = [NSArray arrayWithObject:(self.source)];
-            } else {
-                args = [args arrayByAddingObject:(self.source)];
-            }  
+        if (self.task && self.pipe && [self resetWakeupPipe]) {
             
-            [self.task setLaunchPath:path];
-            [self.task setArguments:args];
+            [self.task setLaunchPath:[self.options objectForKey:BMScriptOptionsTaskLaunchPathKey]];
+            [self configureSourceDeliveryOfTask:(self.task)];
             [self.task setStandardOutput:(self.pipe)];
             
+            // run the script in its own process group so a timeout or -cancel reaches its children too.
+            // a background process group must not read from the terminal, so give it /dev/null as stdin.
+            // the calling thread blocks until the task is done, so it is safe to tie the task's lifetime to it.
+            [self.task setCreatesProcessGroup:YES];
+            [self.task setTerminatesWithParent:YES];
+            [self.task setStandardInput:[NSFileHandle fileHandleForReadingAtPath:@"/dev/null"]];
+            
             // Unfortunately we need the following define if we want to use SenTestingKit for unit testing. Since we are telling 
             // BMScript here to write to stdout and stderr SenTestingKit will actually output certain messages to stderr, messages
             // which can include the PID of the current task used for the testing. This invalidates testing task ouput from
             // two tasks even if their output is identical because their PID is not. To work around this, we can use a define which
             // will be set to 1 in the build settings for our unit tests via OTHER_CFLAGS and -DBMSCRIPT_UNIT_TESTS=1.
-            if (!BMSCRIPT_UNIT_TEST) {
+            if (self.errorPipe) {
+                [self.task setStandardError:(self.errorPipe)];
+            } else if (!BMSCRIPT_UNIT_TEST) {
                 //NSLog(@"BMScript: Info: setting [task standardError:pipe]");
                 [self.task setStandardError:[self.task standardOutput]];
             }
@@ -414,7 +572,7 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
 }
 
 /* fires a one-off (blocking or synchroneous) task and stores the result */
-- (ExecutionStatus) launchTask {
+- (ExecutionStatus) launchTaskWithTimeLimit:(NSTimeInterval)limit {
     
     NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
     
@@ -440,52 +598,313 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
         BM_PROBE(NET_EXECUTION_END, (char *) [[BMNSStringFromExecutionStatus(status) stringByWrappingSingleQuotes] UTF8String]);
     #endif
     
-    NSMutableData * someData = [NSMutableData data];
-    NSDate * limitDate = [NSDate dateWithTimeIntervalSinceNow:BMSCRIPT_TASK_TIME_LIMIT];
-    
-    // It appears that very large output data from the underlying task 
-    // fills up the pipe instance used by the reading filehandle and then
-    // the task will block forever because it wants to deliver new data
-    // but has to wait until the pipe is approachable again.
-    // There's two ways around this: fire off the task in a thread. Not really
-    // sure why this works. Maybe because the thread comes with another runloop
-    // and the task can check if it needs to interrupt the process. 
-    // Alternatively, do not call waitUntilExit and empty the filehandle data 
-    // yourself by reading to the end. I could do this asynchroneously but since 
-    // what I offer with the blocking execution model, the caller may depend on it
-    // blocking. So I do what normally is considered bad practice: I poll for
-    // the end of the task while emptying the filehandle each 0.1 seconds.
-    // To be safer I say it has to end after BMSCRIPT_TASK_TIME_LIMIT seconds.
-    // Of course I may need to expose the time limit to the caller since (s)he 
-    // may be setting up for a somewhat lenghty execution. (hint: for this really, 
-    // the non-blocking model is much better). 
-    // I think it is somewhat reasonable to assume that a considerate programmer 
-    // would use the non-blocking execution model if the script could potentially
-    // take forever, so for the moment I am settings this to 10s. My own tests
-    // have shown that for that even for input data up to 1 MiB using this "hack"
-    // below the task will complete as fast as if it would have never blocked due
-    // to the pipe being full. However further tests are still in order if this
-    // approach is practical. For example instead of using usleep I could use sth
-    // like [NSThread sleepForTimeInterval:...], etc. 
-    // 
-    while ([self.task isRunning]) {
-        [someData appendData:[[self.pipe fileHandleForReading] readDataToEndOfFile]];
-        usleep(100000);
-        if ([limitDate compare:[NSDate date]] < 0) {
-            [self.task interrupt];
+    // large outputs go to a file instead of the heap and the retention policy is enforced as we read, see BMScriptOutputBuffer
+    BMScriptOutputBuffer * someData = [self outputBuffer];
+    BMScriptOutputBuffer * errorData = [self outputBuffer];
+    id<BMScriptOutputHandler> handler = self.outputHandler;
+    BOOL retains = self.retainsOutput;
+    
+    int outfd = [[self.pipe fileHandleForReading] fileDescriptor];
+    int errfd = (self.errorPipe ? [[self.errorPipe fileHandleForReading] fileDescriptor] : -1);
+    int wakefd = wakeupPipe[0];
+    int exitfd = [self.task exitFileDescriptor];
+    BOOL eof = NO;
+    BOOL errEof = (errfd < 0);
+    BOOL exited = NO;
+    char buffer[BMSCRIPT_READ_BUFFER_SIZE];
+    
+    NSTimeInterval deadline = (limit > 0 ? [NSDate timeIntervalSinceReferenceDate] + limit : 0);
+    NSTimeInterval nextEscalation = 0;
+    NSUInteger terminationStep = 0;
+    ExecutionStatus terminationReason = BMScriptNotExecuted;
+    
+    // Wait on the output pipe and the exit of the child at the same time (exitfd is a pidfd on Linux 
+    // and a kqueue on Mac OS X) so we return as soon as the child is gone instead of polling for it.
+    // Once it has exited we only drain what is still buffered in the pipe: a grandchild that inherited 
+    // the write end (think "sleep 100 &" in a /bin/sh script) must not keep us blocked until it exits too.
+    // Where no exit descriptor is available we simply read until EOF and reap the child afterwards.
+    // The poll timeout doubles as the timer for the time limit and the termination sequence.
+    // A separate stderr pipe is watched alongside stdout, so the child can't block on one while we wait on the other.
+    for (;;) {
+        struct pollfd fds[4] = { { (eof ? -1 : outfd), POLLIN, 0 }, { wakefd, POLLIN, 0 }, 
+                                 { (errEof ? -1 : errfd), POLLIN, 0 }, { exitfd, POLLIN, 0 } };
+        nfds_t nfds = ((exitfd >= 0 && !exited) ? 4 : 3);
+        int timeout = -1;
+        
+        if (eof && errEof && nfds < 4) break;
+        
+        if (exited) {
+            timeout = 0;
+        } else {
+            NSTimeInterval due = (terminationReason == BMScriptNotExecuted ? deadline : nextEscalation);
+            if (due > 0) {
+                // checked on every round, not only when poll times out: a script that keeps writing never lets it
+                NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+                if (now >= due) {
+                    // either the time limit was reached or the current termination step is overdue
+                    if (terminationReason == BMScriptNotExecuted) {
+                        terminationReason = BMScriptTimedOut;
+                    }
+                    nextEscalation = ([self.task escalateTermination:&terminationStep] ? 
+                                      now + BMSCRIPT_TERMINATION_GRACE_PERIOD : 0);
+                    continue;
+                }
+                timeout = (int) ceil((due - now) * 1000.0);
+            }
+        }
+        
+        int n = poll(fds, nfds, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (n == 0) {
+            if (exited) break;
+            // the time limit or termination step that is due now is taken care of on the next round
+            continue;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesRead = read(outfd, buffer, sizeof(buffer));
+            if (bytesRead > 0) {
+                if (handler) {
+                    [handler script:self didReceiveOutput:[NSData dataWithBytes:buffer length:(NSUInteger)bytesRead]];
+                }
+                if (retains) {
+                    [someData appendBytes:buffer length:(NSUInteger)bytesRead];
+                }
+            } else if (bytesRead == 0 || errno != EINTR) {
+                eof = YES;
+            }
+        }
+        if (fds[2].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesRead = read(errfd, buffer, sizeof(buffer));
+            if (bytesRead > 0) {
+                [errorData appendBytes:buffer length:(NSUInteger)bytesRead];
+            } else if (bytesRead == 0 || errno != EINTR) {
+                errEof = YES;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            while (read(wakefd, buffer, sizeof(buffer)) > 0);
+            BOOL cancelled = NO;
+            @synchronized(self) {
+                cancelled = cancelRequested;
+            }
+            if (cancelled && terminationReason == BMScriptNotExecuted) {
+                terminationReason = BMScriptCancelled;
+                nextEscalation = ([self.task escalateTermination:&terminationStep] ? 
+                                  [NSDate timeIntervalSinceReferenceDate] + BMSCRIPT_TERMINATION_GRACE_PERIOD : 0);
+            }
+        }
+        if (nfds == 4 && fds[3].revents) {
+            exited = YES;
         }
     }
     
-    data = [[someData copy] autorelease];
+    // the child is still a zombie until waitUntilExit reaped it, so its process group id is still ours
+    if (terminationReason != BMScriptNotExecuted) {
+        [self.task signalProcessGroup:SIGKILL];
+    }
     
-    [self.task terminate];
+    [self.task waitUntilExit];
+    
+    data = [someData data];
+    self.discardedOutputLength = [someData discardedLength];
+    self.errorResult = [errorData data];
     
     self.returnValue = status = [self.task terminationStatus];
     
-    [self.task release], self.task = nil;
+    if (terminationReason != BMScriptNotExecuted) {
+        status = terminationReason;
+    }
+    
+    [self storeResult:data];
+    
+    goto endnow1;
+    
+endnow1:
+    [pool drain], pool = nil;
+    [self cleanupTask:(self.task)];
+    return status;
+}
+
+/* fires a one-off (non-blocking or asynchroneous) task and hands it over to the shared BMScriptEngine,
+   whose I/O thread reels in the results and calls back once the task has exited */
+- (void) setupAndLaunchBackgroundTaskWithTimeLimit:(NSTimeInterval)limit deliveryThread:(NSThread *)thread deliveryQueue:(NSOperationQueue *)queue {
+    
+    if (self.isTemplate) {
+            @throw [NSException exceptionWithName:BMScriptTemplateArgumentMissingException 
+                                           reason:@"please define all replacement values for the current template "
+                                                  @"by calling one of the -[saturateTemplate...] methods prior to execution" 
+                                         userInfo:nil];            
+    }
+    
+    #if (BMSCRIPT_ENABLE_DTRACE)    
+        BM_PROBE(BG_EXECUTE_BEGIN, 
+                 (char *) [[[self.options objectForKey:BMScriptOptionsTaskLaunchPathKey] stringByWrappingSingleQuotes] UTF8String],
+                 (char *) [[self.source quotedString] UTF8String], 
+                 (char *) [BMNSStringFromBOOL(self.isTemplate) UTF8String]);
+    #endif
+    
+    BMScriptTask * runningTask = nil;
+    @synchronized(self) {
+        runningTask = [[bgTask retain] autorelease];
+    }
+    if (BM_EXPECTED(runningTask != nil, 0)) {
+        // a BMScript runs one background execution at a time. the one in flight finishes as cancelled.
+        [[BMScriptEngine sharedEngine] cancelTask:runningTask];
+        return;
+    }
+    
+    #if (BMSCRIPT_ENABLE_DTRACE)            
+        BM_PROBE(SETUP_BG_TASK_BEGIN);
+    #endif
+    
+    BMScriptEngine * engine = [BMScriptEngine sharedEngine];
+    
+    // Create a task and pipe
+    BMScriptTask * aTask = [[[BMScriptTask alloc] init] autorelease];
+    NSPipe * aPipe = [[[NSPipe alloc] init] autorelease];
+    NSPipe * anErrorPipe = (self.capturesStandardErrorSeparately ? [[[NSPipe alloc] init] autorelease] : nil);
+    
+    // set options for background task
+    [aTask setLaunchPath:[self.options objectForKey:BMScriptOptionsTaskLaunchPathKey]];
+    [self configureSourceDeliveryOfTask:aTask];
+    [aTask setStandardOutput:aPipe];
+    [aTask setStandardError:(anErrorPipe ? anErrorPipe : aPipe)];
+    
+    // see setupTask. Linux kills a PR_SET_PDEATHSIG child when the launching *thread* exits, 
+    // which is only safe to rely on for the main thread here.
+    [aTask setCreatesProcessGroup:YES];
+    [aTask setTerminatesWithParent:[NSThread isMainThread]];
+    [aTask setStandardInput:[NSFileHandle fileHandleForReadingAtPath:@"/dev/null"]];
+    
+    // self.partialResult is accumulated over the time the task is running, chunk by chunk as the
+    // engine reads them (see -engine:didReadData:fromTask:). Once the task has exited it is mirrored
+    // over to lastResult. This gives the user the advantage for long running scripts to check 
+    // partialResult periodically and see if the task needs to be aborted.
+    @synchronized(self) {
+        self.partialResult = [self outputBuffer];
+        self.partialErrorResult = [self outputBuffer];
+    }
+    
+    #if (BMSCRIPT_ENABLE_DTRACE)            
+        BM_PROBE(SETUP_BG_TASK_END);
+    #endif
+    
+    if (!engine || ![aTask launchAndReturnError:NULL]) {
+        self.returnValue = BMScriptFailedWithException;
+        return;
+    }
+    
+    // registering under the same lock -cancel takes makes sure a cancel can't fall between launch and hand-over
+    @synchronized(self) {
+        self.bgTask = aTask;
+        self.bgPipe = aPipe;
+        self.bgErrorPipe = anErrorPipe;
+        [engine addTask:aTask 
+           outputHandle:[aPipe fileHandleForReading] 
+            errorHandle:[anErrorPipe fileHandleForReading] 
+              timeLimit:limit 
+                 client:self 
+         deliveryThread:thread 
+          deliveryQueue:queue 
+          highWaterMark:(self.outputHandler ? MAX(self.outputHighWaterMark, (NSUInteger)1) : 0)];
+        if (cancelRequested) {
+            // cancelled before it got going
+            [engine cancelTask:aTask];
+        }
+    }
+}
+
+/* runs a blocking execution on a worker of the pool, see BMScriptWorkerPool */
+- (ExecutionStatus) launchPooledTaskWithPool:(BMScriptWorkerPool *)workerPool timeLimit:(NSTimeInterval)limit {
+    
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    
+    NSData * data = nil;
+    NSInteger retval = BMScriptNotExecuted;
+    
+    #if (BMSCRIPT_ENABLE_DTRACE)
+        BM_PROBE(NET_EXECUTION_BEGIN, (char *) [[BMNSStringFromExecutionStatus(BMScriptNotExecuted) stringByWrappingSingleQuotes] UTF8String]);
+    #endif
+    
+    ExecutionStatus status = [workerPool executeSource:self.source 
+                                             timeLimit:limit 
+                                      cancelDescriptor:wakeupPipe[0] 
+                                               results:&data 
+                                           returnValue:&retval 
+                                                 error:NULL];
+    
+    #if (BMSCRIPT_ENABLE_DTRACE)
+        BM_PROBE(NET_EXECUTION_END, (char *) [[BMNSStringFromExecutionStatus(status) stringByWrappingSingleQuotes] UTF8String]);
+    #endif
+    
+    self.returnValue = retval;
+    
+    // the worker collects stdout and stderr into one file
+    self.errorResult = [NSData data];
+    
+    // the worker hands back the whole output, cut it down here
+    data = [self applyOutputRetentionTo:data];
+    
+    if (status != BMScriptFailedWithException) {
+        [self storeResult:data];
+    }
+    
+    @synchronized(self) {
+        [self closeWakeupPipe];
+    }
+    
+    [pool drain], pool = nil;
+    return status;
+}
+
+/* returns a new buffer for the output of an execution, set up according to the spill threshold and retention policy */
+- (BMScriptOutputBuffer *) outputBuffer {
+    return [[[BMScriptOutputBuffer alloc] initWithSpillThreshold:self.outputSpillThreshold 
+                                                 retentionPolicy:self.outputRetentionPolicy 
+                                                           limit:self.outputRetentionLimit] autorelease];
+}
+
+/* returns what the retention policy keeps of an output that was collected in one piece, 
+   by a worker or the result cache, and sets discardedOutputLength accordingly */
+- (NSData *) applyOutputRetentionTo:(NSData *)data {
+    if (!self.retainsOutput) {
+        return [NSData data];
+    }
+    if (self.outputRetentionLimit > 0 && self.outputRetentionPolicy != BMScriptRetainAllOutput) {
+        BMScriptOutputBuffer * buffer = [self outputBuffer];
+        [buffer appendData:data];
+        self.discardedOutputLength = [buffer discardedLength];
+        return [buffer data];
+    }
+    self.discardedOutputLength = 0;
+    return data;
+}
+
+/* closes the wakeup pipe of the previous execution and opens a new one. 
+   the blocking execution loop watches it so -cancel can wake it up from another thread.
+   a cancel that came in before the pipe was there is passed on to it, it is only cleared once the execution is over */
+- (BOOL) resetWakeupPipe {
+    @synchronized(self) {
+        [self closeWakeupPipe];
+        BMScriptOpenWakeupPipe(wakeupPipe);
+        if (cancelRequested && wakeupPipe[1] >= 0) {
+            (void) write(wakeupPipe[1], "c", 1);
+        }
+    }
+    return (wakeupPipe[0] >= 0);
+}
+
+/* sets self.result, giving the delegate a chance to intervene */
+- (void) storeResult:(NSData *)data {
     
     NSData * aResult = data;
     
+    // the result cache keeps what the delegate got to see, so a hit can go through the delegate again
+    self.rawResult = ((self.resultCache || self.resultStore) ? data : nil);
+    
     BOOL shouldSetResult = YES;
     if ([self.delegate respondsToSelector:@selector(shouldSetResult:)]) {
         shouldSetResult = [self.delegate shouldSetResult:data];
@@ -496,101 +915,108 @@ NSString * const BMScriptLanguageProtocolMethodMissingException  = @"BMScriptLan
         }
         self.result = aResult;
     }
+}
+
+/* looks in the result cache, then in the result store. a stale hit in the cache is refreshed by a copy of the script. */
+- (NSDictionary *) cachedExecutionWithFingerprint:(NSString *)fingerprint {
     
-    goto endnow1;
+    BMScriptResultCache * cache = self.resultCache;
+    BMScriptResultStore * store = self.resultStore;
+    NSDictionary * cached = nil;
     
-endnow1:
-    [pool drain], pool = nil;
-    [self cleanupTask:(self.task)];
-    return status;
+    if (cache) {
+        BOOL revalidate = NO;
+        cached = [cache resultForFingerprint:fingerprint needsRevalidation:&revalidate];
+        if (revalidate) {
+            // hand out the stale result now and let a copy of the script refresh it
+            BMScript * copy = [self copy];
+            [NSThread detachNewThreadSelector:@selector(revalidateResultCache) toTarget:copy withObject:nil];
+            [copy release];
+        }
+    }
+    if (!cached && store) {
+        cached = [store resultForFingerprint:fingerprint];
+        if (cached && cache) {
+            [cache setResult:[cached objectForKey:BMScriptNotificationTaskResults] 
+                 errorResult:[cached objectForKey:BMScriptNotificationTaskErrorResults] 
+                 returnValue:[[cached objectForKey:BMScriptNotificationTaskReturnValue] integerValue] 
+             executionStatus:(ExecutionStatus)[[cached objectForKey:BMScriptNotificationExecutionStatus] integerValue] 
+              forFingerprint:fingerprint];
+        }
+    }
+    return cached;
 }
 
-/* fires a one-off (non-blocking or asynchroneous) task and reels in the results 
-   one after another through notifications */
-- (void) setupAndLaunchBackgroundTask {
+/* hands out a result found in the result cache the way -launchPooledTaskWithPool:timeLimit: does for a pooled one */
+- (ExecutionStatus) storeCachedExecution:(NSDictionary *)info {
     
-    if (BM_EXPECTED([self.bgTask isRunning], 0)) {
-        [self.bgTask terminate];
-        [self cleanupTask:(self.bgTask)];
-    } else {
-        if (!self.bgTask) {
-            #if (BMSCRIPT_ENABLE_DTRACE)            
-                BM_PROBE(SETUP_BG_TASK_BEGIN);
-            #endif
-
-            // Create a task and pipe
-            self.bgTask = [[[NSTask alloc] init] autorelease];
-            self.bgPipe = [[[NSPipe alloc] init] autorelease];    
-            
-            NSString * path = [self.options objectForKey:BMScriptOptionsTaskLaunchPathKey];
-            NSArray * args = [self.options objectForKey:BMScriptOptionsTaskArgumentsKey];
-            
-            // If BMSynthesizeOptions is called with "nil" as second argument 
-            // that effectively sets up BMScriptOptionsTaskArgumentsKey as 
-            // [NSArray arrayWithObjects:nil] which in turn becomes an opaque 
-            // object named "__NSArray0"
-            if (!args || [args isEmptyStringArray] || [args isZeroArray]) {
-                //NSLog(@"args = %@, args class = %@", args, NSStringFromClass([args class]));
-                args = [NSArray arrayWithObject:(self.source)];
-            } else {
-                args = [args arrayByAddingObject:(self.source)];
-            }  
-            
-            // set options for background task
-            [self.bgTask setLaunchPath:path];
-            [self.bgTask setArguments:args];
-            [self.bgTask setStandardOutput:(self.bgPipe)];
-            [self.bgTask setStandardError:(self.bgPipe)];
-            
-            // register for notifications
-            
-            // currently the execution model for background tasks is an incremental one:
-            // self.partialResult is accumulated over the time the task is running and
-            // posting NSFileHandleReadCompletionNotification notifications. This happens
-            // through #dataReceived: which calls #appendData: until the NSTaskDidTerminateNotification 
-            // is posted. Then, the partialResult is simply mirrored over to lastResult.
-            // This gives the user the advantage for long running scripts to check partialResult
-            // periodically and see if the task needs to be aborted.
-                        
-            [[NSNotificationCenter defaultCenter] addObserver:self 
-                                                     selector:@selector(dataReceived:) 
-                                                         name:NSFileHandleReadCompletionNotification 
-                                                       object:[self.bgPipe fileHandleForReading]];
-            
-            [[NSNotificationCenter defaultCenter] addObserver:self 
-                                                     selector:@selector(taskTerminated:) 
-                                                         name:NSTaskDidTerminateNotification 
-                                                       object:self.bgTask];
-            #if (BMSCRIPT_ENABLE_DTRACE)            
-                BM_PROBE(SETUP_BG_TASK_END);
-            #endif
-
-            @try {
-                [self.bgTask launch];
-            }
-            @catch (NSException * e) {
-                self.returnValue = BMScriptFailedWithException;
-                [self cleanupTask:(self.bgTask)];
-            }
-
-            // kick off pipe reading in background
-            [[self.bgPipe fileHandleForReading] readInBackgroundAndNotify];
-        }
+    NSData * data = [info objectForKey:BMScriptNotificationTaskResults];
+    
+    self.returnValue = [[info objectForKey:BMScriptNotificationTaskReturnValue] integerValue];
+    
+    if ([data length] > 0 && self.outputHandler) {
+        [self.outputHandler script:self didReceiveOutput:data];
+    }
+    self.errorResult = [info objectForKey:BMScriptNotificationTaskErrorResults];
+    
+    [self storeResult:[self applyOutputRetentionTo:data]];
+    self.rawResult = nil;
+    
+    return (ExecutionStatus)[[info objectForKey:BMScriptNotificationExecutionStatus] integerValue];
+}
+
+/* only complete results of executions that ran to their end are worth keeping */
+- (void) cacheExecutionWithStatus:(ExecutionStatus)status fingerprint:(NSString *)fingerprint {
+    
+    if (status != BMScriptNotExecuted && 
+        status != BMScriptFailedWithException && 
+        status != BMScriptTimedOut && 
+        status != BMScriptCancelled && 
+        self.retainsOutput && 
+        self.discardedOutputLength == 0 && 
+        self.rawResult) {
+        [self.resultCache setResult:self.rawResult 
+                        errorResult:self.errorResult 
+                        returnValue:self.returnValue 
+                    executionStatus:status 
+                     forFingerprint:fingerprint];
+        [self.resultStore setResult:self.rawResult 
+                        errorResult:self.errorResult 
+                        returnValue:self.returnValue 
+                    executionStatus:status 
+                     forFingerprint:fingerprint];
     }
+    self.rawResult = nil;
 }
 
-- (void) dataReceived:(NSNotification *)aNotification {
+/* runs on a thread of its own, on a copy of the script whose cached result has gone stale */
+- (void) revalidateResultCache {
     
-	NSData * data = [[aNotification userInfo] valueForKey:NSFileHandleNotificationDataItem];
-    if ([data length] > 0) {
-        [self appendPartialData:data];
-    } else {
-        [self stopTask];
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    
+    self.delegate = nil;
+    self.outputHandler = nil;
+    self.historyLog = nil;      // a refresh is no execution of the original's, keep it out of the shared log
+    self.revalidatesResultCache = YES;
+    
+    NSString * fingerprint = [self fingerprint];
+    @try {
+        [self executeAndReturnResult:NULL error:NULL];
+    }
+    @catch (NSException * e) {
+        NSLog(@"%@ Error: Refreshing the cached result of '%@' raised %@", [self className], [[self.source quotedString] truncatedString], e);
     }
-    // fire again in background after each notification
-    [[self.bgPipe fileHandleForReading] readInBackgroundAndNotify];
+    // a no-op if the execution stored a new result
+    [self.resultCache endRevalidatingFingerprint:fingerprint];
+    
+    [pool drain], pool = nil;
 }
 
+- (void) closeWakeupPipe {
+    if (wakeupPipe[0] >= 0) close(wakeupPipe[0]);
+    if (wakeupPipe[1] >= 0) close(wakeupPipe[1]);
+    wakeupPipe[0] = wakeupPipe[1] = -1;
+}
 
 - (void) appendPartialData:(NSData *)data {
     
@@ -610,20 +1036,34 @@ endnow1:
             if ([self.delegate respondsToSelector:@selector(willAppendPartialResult:)]) {
                 aPartial = [self.delegate willAppendPartialResult:aPartial];
             }
-            [self.partialResult appendData:aPartial];
+            @synchronized(self) {
+                [self.partialResult appendData:aPartial];
+            }
         }
     } else {
         NSLog(@"BMScript: Warning: Attempted %s but could not append to self.partialResult. Data maybe lost!", __PRETTY_FUNCTION__);
     }
     
     #if (BMSCRIPT_ENABLE_DTRACE)
-        BM_PROBE(APPEND_DATA_END, (char *) [[self.partialResult contentsAsString] UTF8String]);
+        BM_PROBE(APPEND_DATA_END, (char *) [[[self.partialResult data] contentsAsString] UTF8String]);
     #endif
     
     aPartial = nil;
 }
 
-- (void) cleanupTask:(NSTask *)whichTask {
+- (void) appendPartialErrorData:(NSData *)data {
+    @synchronized(self) {
+        [self.partialErrorResult appendData:data];
+    }
+}
+
+/* source, result and stderr result of the last execution, as stored in the history */
+- (NSArray *) historyItem {
+    NSData * errors = self.errorResult;
+    return [NSArray arrayWithObjects:self.source, self.result, (errors ? errors : [NSData data]), nil];
+}
+
+- (void) cleanupTask:(BMScriptTask *)whichTask {
     
     if (self.task && self.task == whichTask) {
                 
@@ -631,11 +1071,19 @@ endnow1:
             BM_PROBE(CLEANUP_TASK_BEGIN);
         #endif
         
-        [self.task release], self.task = nil;
+        self.task = nil;
         
         if (self.pipe) {
             [[self.pipe fileHandleForReading] closeFile];
-            [self.pipe release], self.pipe = nil;
+            self.pipe = nil;
+        }
+        if (self.errorPipe) {
+            [[self.errorPipe fileHandleForReading] closeFile];
+            self.errorPipe = nil;
+        }
+        
+        @synchronized(self) {
+            [self closeWakeupPipe];
         }
         #if (BMSCRIPT_ENABLE_DTRACE)
             BM_PROBE(CLEANUP_TASK_END);
@@ -647,18 +1095,17 @@ endnow1:
             BM_PROBE(CLEANUP_BG_TASK_BEGIN);
         #endif
         
-        [[NSNotificationCenter defaultCenter] removeObserver:self
-                                                        name:NSFileHandleReadCompletionNotification 
-                                                      object:[self.bgPipe fileHandleForReading]];
-        
-        [[NSNotificationCenter defaultCenter] removeObserver:self 
-                                                        name:NSTaskDidTerminateNotification 
-                                                      object:(self.bgTask)];
-        [self.bgTask release], self.bgTask = nil;
-        
-        if (self.bgPipe) {
-            [[self.bgPipe fileHandleForReading] closeFile];
-            [self.bgPipe release], self.bgPipe = nil;
+        @synchronized(self) {
+            if (self.bgPipe) {
+                [[self.bgPipe fileHandleForReading] closeFile];
+                self.bgPipe = nil;
+            }
+            if (self.bgErrorPipe) {
+                [[self.bgErrorPipe fileHandleForReading] closeFile];
+                self.bgErrorPipe = nil;
+            }
+            self.bgTask = nil;
+            cancelRequested = NO;
         }
         
         #if (BMSCRIPT_ENABLE_DTRACE)
@@ -668,49 +1115,62 @@ endnow1:
 }
 
 
-- (void) stopTask {
+// MARK: BMScriptEngineClient
+
+/* called on the engine's I/O thread, or on the delivery target when streaming to the output handler */
+- (void) engine:(BMScriptEngine *)engine didReadData:(NSData *)data fromTask:(BMScriptTask *)aTask {
+    #pragma unused(engine, aTask)
+    id<BMScriptOutputHandler> handler = self.outputHandler;
+    if (handler) {
+        [handler script:self didReceiveOutput:data];
+    }
+    if (self.retainsOutput) {
+        [self appendPartialData:data];
+    }
+}
+
+/* always called on the engine's I/O thread */
+- (void) engine:(BMScriptEngine *)engine didReadErrorData:(NSData *)data fromTask:(BMScriptTask *)aTask {
+    #pragma unused(engine, aTask)
+    [self appendPartialErrorData:data];
+}
+
+/* called on the thread or queue the background execution was started for */
+- (void) engine:(BMScriptEngine *)engine taskDidFinish:(BMScriptTask *)aTask terminationReason:(ExecutionStatus)reason {
+    #pragma unused(engine)
+    
+    @synchronized(self) {
+        if (aTask != bgTask) return;
+    }
+    
     #if (BMSCRIPT_ENABLE_DTRACE)    
         BM_PROBE(STOP_BG_TASK_BEGIN);
     #endif
     
-    // read out remaining data, as the pipes have a limited buffer size 
-    // and may stall on subsequent calls if full
-    NSData * dataInPipe = [[(self.bgPipe) fileHandleForReading] readDataToEndOfFile];
-    if (dataInPipe && [dataInPipe length]) {
-        [self appendPartialData:dataInPipe];
-    }
-
-    if (BM_EXPECTED([self.bgTask isRunning], 0)) [self.bgTask terminate];
+    // the engine has read all output and reaped the task by now
+    ExecutionStatus status = [aTask terminationStatus];
+    self.returnValue = status;
     
-    ExecutionStatus status = self.returnValue;
-    if (status == 0) {
-        status = BMScriptFinishedSuccessfully;
+    if (reason != BMScriptNotExecuted) {
+        status = reason;
     }
-
-    self.returnValue = [self.bgTask terminationStatus];
     
     // task is finished, copy over the accumulated partialResults into lastResult
-    NSData * data = self.partialResult;
-    NSData * aResult = data;
-    
-    BOOL shouldSetResult = YES;
-    if ([self.delegate respondsToSelector:@selector(shouldSetResult:)]) {
-        shouldSetResult = [self.delegate shouldSetResult:aResult];
-    }
-    if (shouldSetResult) {
-        if ([self.delegate respondsToSelector:@selector(willSetResult:)]) {
-            aResult = [self.delegate willSetResult:data];
-        }
-        self.result = aResult;
+    NSData * data = nil;
+    @synchronized(self) {
+        data = [self.partialResult data];
+        self.discardedOutputLength = [self.partialResult discardedLength];
+        self.errorResult = [self.partialErrorResult data];
     }
+    [self storeResult:data];
     
-    [self cleanupTask:(self.bgTask)];
+    [self cleanupTask:aTask];
 
     #if (BMSCRIPT_ENABLE_DTRACE)
         BM_PROBE(BG_EXECUTE_END, (char *) [[[self.result contentsAsString] quotedString] UTF8String]);
     #endif
     
-    NSArray * historyItem = [NSArray arrayWithObjects:self.source, self.result, nil];
+    NSArray * historyItem = [self historyItem];
     
     BOOL shouldAddItemToHistory = YES;
     if ([self.delegate respondsToSelector:@selector(shouldAddItemToHistory:)]) {
@@ -720,7 +1180,7 @@ endnow1:
         if ([self.delegate respondsToSelector:@selector(willAddItemToHistory:)]) {
             historyItem = [self.delegate willAddItemToHistory:historyItem];
         }
-        [self._history addObject:historyItem];
+        [self._history addItem:historyItem];
     }
     
     if (BMSCRIPT_DEBUG_HISTORY) {
@@ -731,39 +1191,52 @@ endnow1:
     NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:
                            [NSNumber numberWithInteger:self.returnValue], BMScriptNotificationTaskReturnValue,
                                      [NSNumber numberWithInteger:status], BMScriptNotificationExecutionStatus, 
+                                                        self.errorResult, BMScriptNotificationTaskErrorResults,
                                                              self.result, BMScriptNotificationTaskResults, nil];
-    BM_LOCK(self)
+    // posted without a lock held: observers may run scripts of their own, whose locks can share a stripe with ours
     [[NSNotificationCenter defaultCenter] postNotificationName:BMScriptTaskDidEndNotification object:self userInfo:info];
-    BM_UNLOCK(self)
     
     #if (BMSCRIPT_ENABLE_DTRACE)
         BM_PROBE(STOP_BG_TASK_END);
     #endif
 }
 
-- (void) taskTerminated:(NSNotification *) aNotification { 
-    #pragma unused(aNotification)
-    [self stopTask]; 
+// MARK: Templates
+
+/* compiles the template source the first time it is asked for */
+- (BMScriptTemplate *) scriptTemplate {
+    @synchronized(self) {
+        if (!scriptTemplate && self.isTemplate && self.source) {
+            scriptTemplate = [[BMScriptTemplate alloc] initWithString:self.source];
+        }
+        return [[scriptTemplate retain] autorelease];
+    }
 }
 
-// MARK: Templates
+- (void) setScriptTemplate:(BMScriptTemplate *)newTemplate {
+    @synchronized(self) {
+        if (newTemplate != scriptTemplate) {
+            [scriptTemplate release];
+            scriptTemplate = [newTemplate retain];
+        }
+    }
+}
 
 - (BOOL) saturateTemplateWithArgument:(NSString *)tArg {
     #if (BMSCRIPT_ENABLE_DTRACE)    
         BM_PROBE(SATURATE_WITH_ARGUMENT_BEGIN, (char *) [tArg UTF8String]);
     #endif
-    if (self.isTemplate) {
-        NSString * src = self.source;
-        src = [src stringByReplacingOccurrencesOfString:BMSCRIPT_TEMPLATE_TOKEN_EMPTY 
-                                             withString:tArg];
-        self.source = src;
+    BOOL success = NO;
+    BMScriptTemplate * tmpl = [self templateWithTokenStart:BMSCRIPT_TEMPLATE_TOKEN_START tokenEnd:BMSCRIPT_TEMPLATE_TOKEN_END];
+    if (tmpl) {
+        self.source = [tmpl stringByRenderingWithArgument:tArg];
         self.isTemplate = NO;
-        return YES;
+        success = YES;
     }
-    return NO;
     #if (BMSCRIPT_ENABLE_DTRACE)
         BM_PROBE(SATURATE_WITH_ARGUMENT_END, (char *) [[self.source quotedString] UTF8String]);
     #endif
+    return success;
 }
 
 - (BOOL) saturateTemplateWithArguments:(NSString *)firstArg, ... {
@@ -771,60 +1244,51 @@ endnow1:
         BM_PROBE(SATURATE_WITH_ARGUMENTS_BEGIN);
     #endif
     BOOL success = NO;
-    if (self.isTemplate) {
-        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
-        
-        NSString * src = self.source;
-        src = [src stringByReplacingOccurrencesOfString:BMSCRIPT_TEMPLATE_TOKEN_EMPTY withString:BMSCRIPT_TEMPLATE_TOKEN_INSERT];
-        
-        // determine how many replacements we need to make
-        NSInteger numTokens = [src countOccurrencesOfString:BMSCRIPT_INSERTION_TOKEN];
-        if (numTokens == NSNotFound) {
-            goto endnow2;
-        }
-        
-        NSString * accumulator = src;
-        NSString * arg;
-        
-        NSUInteger tlen = [@""BMSCRIPT_TEMPLATE_TOKEN_INSERT"" length];
-        
-        NSAssert(tlen > 0, @"");
+    BMScriptTemplate * tmpl = [self templateWithTokenStart:BMSCRIPT_TEMPLATE_TOKEN_START tokenEnd:BMSCRIPT_TEMPLATE_TOKEN_END];
+    
+    // there is no terminating nil, so take exactly as many arguments as the template has tokens
+    NSUInteger numTokens = [tmpl positionalTokenCount];
+    if (numTokens > 0) {
+        NSMutableArray * args = [NSMutableArray arrayWithCapacity:numTokens];
+        NSString * arg = firstArg;
         
         va_list arglist;
         va_start(arglist, firstArg);
-        
-        NSRange searchRange = NSMakeRange(0, [accumulator rangeOfString:BMSCRIPT_TEMPLATE_TOKEN_START].location + tlen);
-        
-        // make sure we don't break composed grapheme clusters
-        searchRange = [accumulator adjustRangeToIncludeComposedCharacterSequencesForRange:searchRange];
-        
-        accumulator = [accumulator stringByReplacingOccurrencesOfString:BMSCRIPT_TEMPLATE_TOKEN_INSERT
-                                                             withString:firstArg 
-                                                                options:0 
-                                                                  range:searchRange];
-        
-        while (--numTokens > 0) {
+        for (;;) {
+            if (!arg) {
+                va_end(arglist);
+                @throw [NSException exceptionWithName:BMScriptTemplateArgumentMissingException 
+                                               reason:[NSString stringWithFormat:@"%@ Error: argument %lu for the template is nil", 
+                                                       [self className], (unsigned long)[args count] + 1]
+                                             userInfo:nil];
+            }
+            [args addObject:arg];
+            if ([args count] == numTokens) break;
             arg = va_arg(arglist, NSString *);
-            searchRange = NSMakeRange(0, [accumulator rangeOfString:BMSCRIPT_INSERTION_TOKEN].location + tlen);
-            searchRange = [accumulator adjustRangeToIncludeComposedCharacterSequencesForRange:searchRange];
-            accumulator = [accumulator stringByReplacingOccurrencesOfString:BMSCRIPT_TEMPLATE_TOKEN_INSERT
-                                                                 withString:arg 
-                                                                    options:0 
-                                                                      range:searchRange];
-            if (numTokens <= 1) break;
         }
-        
         va_end(arglist);
         
-        //self.source = [accumulator stringByUnescapingPercentSigns];
-        self.source = accumulator;
+        self.source = [tmpl stringByRenderingWithArguments:args];
         self.isTemplate = NO;
+        success = YES;
+    }
+    #if (BMSCRIPT_ENABLE_DTRACE)
+        BM_PROBE(SATURATE_WITH_ARGUMENTS_END, (char *) [[self.source quotedString] UTF8String]);
+    #endif
+    return success;
+}
 
-        [pool drain];
+- (BOOL) saturateTemplateWithArgumentsInArray:(NSArray *)args {
+    #if (BMSCRIPT_ENABLE_DTRACE)    
+        BM_PROBE(SATURATE_WITH_ARGUMENTS_BEGIN);
+    #endif
+    BOOL success = NO;
+    BMScriptTemplate * tmpl = [self templateWithTokenStart:BMSCRIPT_TEMPLATE_TOKEN_START tokenEnd:BMSCRIPT_TEMPLATE_TOKEN_END];
+    if ([tmpl positionalTokenCount] > 0) {
+        self.source = [tmpl stringByRenderingWithArguments:args];
+        self.isTemplate = NO;
         success = YES;
-        goto endnow2;
     }
-endnow2:
     #if (BMSCRIPT_ENABLE_DTRACE)
         BM_PROBE(SATURATE_WITH_ARGUMENTS_END, (char *) [[self.source quotedString] UTF8String]);
     #endif
@@ -839,36 +1303,21 @@ endnow2:
         BM_PROBE(SATURATE_WITH_DICTIONARY_BEGIN, (char *) [[[dictionary descriptionInStringsFileFormat] quotedString] UTF8String]);
     #endif
     
-    if (self.isTemplate) {
-        
-        NSString * accumulator = self.source;
-        
-        NSArray * keys = [dictionary allKeys];
-        NSArray * values = [dictionary allValues];
-        NSString * tokenStart;
-        NSString * tokenEnd;
-        
-        if ((tokenStart = [dictionary objectForKey:BMScriptTemplateTokenStartKey]) && 
-            (tokenEnd = [dictionary objectForKey:BMScriptTemplateTokenEndKey])) {
-            ;
-        } else {
-            tokenStart = BMSCRIPT_TEMPLATE_TOKEN_START;
-            tokenEnd = BMSCRIPT_TEMPLATE_TOKEN_END;
-        }
-        
-        NSInteger i = 0;
-        NSString * tokenString = nil;
-        
-        for (NSString * key in keys) {
-            tokenString = [NSString stringWithFormat:@"%@"BMSCRIPT_INSERTION_TOKEN"%@", tokenStart, key, tokenEnd];
-            accumulator = [accumulator stringByReplacingOccurrencesOfString:tokenString
-                                                                 withString:[values objectAtIndex:i]];
-            i++;
-        }
-        
-        self.source = [accumulator stringByUnescapingPercentSigns];
+    NSString * tokenStart;
+    NSString * tokenEnd;
+    
+    if ((tokenStart = [dictionary objectForKey:BMScriptTemplateTokenStartKey]) && 
+        (tokenEnd = [dictionary objectForKey:BMScriptTemplateTokenEndKey])) {
+        ;
+    } else {
+        tokenStart = BMSCRIPT_TEMPLATE_TOKEN_START;
+        tokenEnd = BMSCRIPT_TEMPLATE_TOKEN_END;
+    }
+    
+    BMScriptTemplate * tmpl = [self templateWithTokenStart:tokenStart tokenEnd:tokenEnd];
+    if (tmpl) {
+        self.source = [tmpl stringByRenderingWithDictionary:dictionary unescapingPercentSigns:YES];
         self.isTemplate = NO;
-        
         success = YES;
     }
     #if (BMSCRIPT_ENABLE_DTRACE)
@@ -909,6 +1358,10 @@ endnow2:
 }
 
 - (ExecutionStatus) executeAndReturnResult:(NSData **)results error:(NSError **)error {
+    return [self executeAndReturnResult:results error:error timeLimit:self.timeLimit];
+}
+
+- (ExecutionStatus) executeAndReturnResult:(NSData **)results error:(NSError **)error timeLimit:(NSTimeInterval)limit {
     #if (BMSCRIPT_ENABLE_DTRACE)
         BM_PROBE(EXECUTE_BEGIN, 
                  (char *) [[[self.task launchPath] stringByWrappingSingleQuotes] UTF8String],
@@ -936,30 +1389,76 @@ endnow2:
         }            
     } else {// isTemplate is NO
         
-        BM_LOCK(task)
-        success = [self setupTask];
-        BM_UNLOCK(task)
+        NSString * fingerprint = ((self.resultCache || self.resultStore) ? [self fingerprint] : nil);
+        NSDictionary * cached = nil;
+        BMScriptWorkerPool * workerPool = nil;
+        
+        if (fingerprint && !self.revalidatesResultCache) {
+            cached = [self cachedExecutionWithFingerprint:fingerprint];
+        }
+        
+        if (cached) {
+            success = YES;
+        } else {
+            // a worker collects stdout and stderr into one file and hands it back once the job is done. a script 
+            // that wants them apart, or its output as it arrives, gets a process of its own.
+            workerPool = ((self.usesWorkerPool && !self.capturesStandardErrorSeparately && !self.outputHandler) 
+                          ? [BMScriptWorkerPool poolForOptions:self.options] : nil);
+            if (workerPool) {
+                success = [self resetWakeupPipe];
+            } else {
+                BM_LOCK(self)
+                success = [self setupTask];
+                BM_UNLOCK(self)
+            }
+        }
         
         if (BM_EXPECTED(success, 1)) {
             
-            status = [self launchTask];
+            if (cached) {
+                status = [self storeCachedExecution:cached];
+            } else if (workerPool) {
+                status = [self launchPooledTaskWithPool:workerPool timeLimit:limit];
+            } else {
+                status = [self launchTaskWithTimeLimit:limit];
+            }
+            
+            if (fingerprint && !cached) {
+                [self cacheExecutionWithStatus:status fingerprint:fingerprint];
+            }
             
             if (status == BMScriptFailedWithException) {
                 if (error) {
                     NSString * reason = [NSString stringWithFormat:@"%@ Error: Executing the task raised an exception.", [self className]];
                     NSString * suggestion = [NSString stringWithFormat:@"Check launch path (path to the executable) and task arguments. "
-                                                                       @"Often an exception by NSTask is raised because either or both are inappropriate."];               
+                                                                       @"Often an exception is raised because either or both are inappropriate."];               
+                    NSDictionary * errorDict = [NSDictionary dictionaryWithObjectsAndKeys:
+                                                        reason, NSLocalizedFailureReasonErrorKey, 
+                                                    suggestion, NSLocalizedRecoverySuggestionErrorKey, nil];
+                    
+                    *error = [NSError errorWithDomain:NSCocoaErrorDomain code:0 userInfo:errorDict];
+                }
+            } else if (status == BMScriptNotExecuted) {
+                if (error) {
+                    NSString * reason = [NSString stringWithFormat:@"%@ Error: Unable to execute task.", [self className]];
+                    NSString * suggestion = [NSString stringWithFormat:@"Check launch path (path to the executable) and task arguments. "
+                                                                       @"Often a task refuses to execute because either or both are inappropriate."];
                     NSDictionary * errorDict = [NSDictionary dictionaryWithObjectsAndKeys:
                                                         reason, NSLocalizedFailureReasonErrorKey, 
                                                     suggestion, NSLocalizedRecoverySuggestionErrorKey, nil];
                     
                     *error = [NSError errorWithDomain:NSCocoaErrorDomain code:0 userInfo:errorDict];
                 }
-            } else if (status == BMScriptNotExecuted) {
+            } else if (status == BMScriptTimedOut || status == BMScriptCancelled) {
+                if (results) {
+                    *results = self.result;
+                }
                 if (error) {
-                    NSString * reason = [NSString stringWithFormat:@"%@ Error: Unable to execute task.", [self className]];
-                    NSString * suggestion = [NSString stringWithFormat:@"Check launch path (path to the executable) and task arguments. "
-                                                                       @"Often an NSTask refuses to execute because either or both are inappropriate."];
+                    NSString * reason = (status == BMScriptTimedOut 
+                                         ? [NSString stringWithFormat:@"%@ Error: Task exceeded the time limit of %.1f seconds and was terminated.", [self className], limit]
+                                         : [NSString stringWithFormat:@"%@ Error: Task was cancelled.", [self className]]);
+                    NSString * suggestion = [NSString stringWithFormat:@"The result contains the output produced until the task was terminated. "
+                                                                       @"Raise the time limit or use the non-blocking execution model for long running scripts."];
                     NSDictionary * errorDict = [NSDictionary dictionaryWithObjectsAndKeys:
                                                         reason, NSLocalizedFailureReasonErrorKey, 
                                                     suggestion, NSLocalizedRecoverySuggestionErrorKey, nil];
@@ -971,7 +1470,7 @@ endnow2:
                     *results = self.result;
                 }
                 
-                NSArray * historyItem = [NSArray arrayWithObjects:self.source, self.result, nil];
+                NSArray * historyItem = [self historyItem];
                 
                 BOOL shouldAddItemToHistory = YES;
                 if ([self.delegate respondsToSelector:@selector(shouldAddItemToHistory:)]) {
@@ -981,7 +1480,7 @@ endnow2:
                     if ([self.delegate respondsToSelector:@selector(willAddItemToHistory:)]) {
                         historyItem = [self.delegate willAddItemToHistory:historyItem];
                     }
-                    [self._history addObject:historyItem];
+                    [self._history addItem:historyItem];
                 }
                 
                 if (BMSCRIPT_DEBUG_HISTORY) {
@@ -998,6 +1497,10 @@ endnow2:
             }
         }
     }
+    
+    @synchronized(self) {
+        cancelRequested = NO;
+    }
 
     #if (BMSCRIPT_ENABLE_DTRACE)
         BM_PROBE(EXECUTE_END, (char *) [[[self.result contentsAsString] quotedString] UTF8String]);
@@ -1008,28 +1511,71 @@ endnow2:
 
 
 - (void) executeInBackgroundAndNotify {
-    if (self.isTemplate) {
-            @throw [NSException exceptionWithName:BMScriptTemplateArgumentMissingException 
-                                           reason:@"please define all replacement values for the current template "
-                                                  @"by calling one of the -[saturateTemplate...] methods prior to execution" 
-                                         userInfo:nil];            
+    [self setupAndLaunchBackgroundTaskWithTimeLimit:0 deliveryThread:[NSThread currentThread] deliveryQueue:nil];
+}
+
+- (void) executeInBackgroundAndNotifyWithTimeLimit:(NSTimeInterval)limit {
+    [self setupAndLaunchBackgroundTaskWithTimeLimit:limit deliveryThread:[NSThread currentThread] deliveryQueue:nil];
+}
+
+- (void) executeInBackgroundAndNotifyOnThread:(NSThread *)thread timeLimit:(NSTimeInterval)limit {
+    [self setupAndLaunchBackgroundTaskWithTimeLimit:limit deliveryThread:thread deliveryQueue:nil];
+}
+
+- (void) executeInBackgroundAndNotifyOnQueue:(NSOperationQueue *)queue timeLimit:(NSTimeInterval)limit {
+    [self setupAndLaunchBackgroundTaskWithTimeLimit:limit deliveryThread:nil deliveryQueue:queue];
+}
+
+- (void) cancel {
+    @synchronized(self) {
+        cancelRequested = YES;
+        if (wakeupPipe[1] >= 0) {
+            (void) write(wakeupPipe[1], "c", 1);
+        }
+        if (bgTask) {
+            [[BMScriptEngine sharedEngine] cancelTask:bgTask];
+        }
     }
-    
-    #if (BMSCRIPT_ENABLE_DTRACE)    
-        BM_PROBE(BG_EXECUTE_BEGIN, 
-                 (char *) [[[self.options objectForKey:BMScriptOptionsTaskLaunchPathKey] stringByWrappingSingleQuotes] UTF8String],
-                 (char *) [[self.source quotedString] UTF8String], 
-                 (char *) [BMNSStringFromBOOL(self.isTemplate) UTF8String]);
-    #endif
-    
-    [self setupAndLaunchBackgroundTask];
-    
 }
 
 // MARK: Virtual (Readonly) Getters
 
 - (NSArray *) history {
-    return [[self._history copy] autorelease];
+    return [self._history snapshot];
+}
+
+- (NSUInteger) historyLimit {
+    return [self._history limit];
+}
+
+- (void) setHistoryLimit:(NSUInteger)maxItems {
+    [self._history setLimit:maxItems];
+}
+
+- (BMScriptHistoryLog *) historyLog {
+    return [self._history log];
+}
+
+- (void) setHistoryLog:(BMScriptHistoryLog *)aLog {
+    [self._history setLog:aLog];
+}
+
+- (unsigned long long) historyByteLimit {
+    return [self._history byteLimit];
+}
+
+- (void) setHistoryByteLimit:(unsigned long long)maxBytes {
+    [self._history setByteLimit:maxBytes];
+}
+
+- (NSString *) fingerprint {
+    NSDictionary * opts = self.options;
+    if (self.capturesStandardErrorSeparately) {
+        NSMutableDictionary * salted = [NSMutableDictionary dictionaryWithDictionary:opts];
+        [salted setObject:[NSNumber numberWithBool:YES] forKey:BMScriptFingerprintSeparateStandardErrorKey];
+        opts = salted;
+    }
+    return BMScriptFingerprint(self.source, opts, self.inputPaths);
 }
 
 - (NSInteger) lastReturnValue {
@@ -1049,7 +1595,7 @@ endnow2:
     #endif
     NSString * aScript = nil;
     NSUInteger hc = [self._history count];
-    if (hc > 0 && index <= hc) {
+    if (index < hc) {
         NSArray * item = [self._history objectAtIndex:index];
         if ([self.delegate respondsToSelector:@selector(shouldReturnItemFromHistory:)]) {
             if ([self.delegate shouldReturnItemFromHistory:item]) {
@@ -1075,7 +1621,7 @@ endnow2:
     #endif
     NSData * aResult = nil;
     NSUInteger hc = [self._history count];
-    if (hc > 0 && index <= hc) {
+    if (index < hc) {
         NSArray * item = [self._history objectAtIndex:index];
         if ([self.delegate respondsToSelector:@selector(shouldReturnItemFromHistory:)]) {
             if ([self.delegate shouldReturnItemFromHistory:item]) {
@@ -1137,6 +1683,33 @@ endnow2:
     return aResult;
 }
 
+- (NSData *) errorResultFromHistoryAtIndex:(NSUInteger)index {
+    NSData * aResult = nil;
+    NSUInteger hc = [self._history count];
+    if (index < hc) {
+        NSArray * item = [self._history objectAtIndex:index];
+        if ([item count] > 2) {
+            if ([self.delegate respondsToSelector:@selector(shouldReturnItemFromHistory:)]) {
+                if ([self.delegate shouldReturnItemFromHistory:item]) {
+                    aResult = [[[item objectAtIndex:2] retain] autorelease];
+                }
+            } else {
+                aResult = [[[item objectAtIndex:2] retain] autorelease];
+            }
+        }
+    } else {
+        @throw [NSException exceptionWithName:NSInvalidArgumentException 
+                                       reason:[NSString stringWithFormat:@"Index (%d) out of bounds (%d)", index, hc]
+                                     userInfo:nil];                    
+    }    
+    return aResult;
+}
+
+- (NSData *) lastErrorResultFromHistory {
+    NSUInteger hc = [self._history count];
+    return (hc > 0 ? [self errorResultFromHistoryAtIndex:(hc - 1)] : nil);
+}
+
 // MARK: Equality
 
 - (BOOL) isEqualToScript:(BMScript *)other {
@@ -1158,7 +1731,22 @@ endnow2:
     BMScript * copy = [[[self class] allocWithZone:zone] initWithScriptSource:self.source 
                                                                       options:self.options ];
     copy.result      = self.result;
+    copy.errorResult = self.errorResult;
     copy.returnValue = self.returnValue;
+    copy.timeLimit   = self.timeLimit;
+    copy.usesWorkerPool = self.usesWorkerPool;
+    copy.outputHandler = self.outputHandler;
+    copy.retainsOutput = self.retainsOutput;
+    copy.outputHighWaterMark = self.outputHighWaterMark;
+    copy.outputSpillThreshold = self.outputSpillThreshold;
+    copy.outputRetentionPolicy = self.outputRetentionPolicy;
+    copy.outputRetentionLimit = self.outputRetentionLimit;
+    copy.capturesStandardErrorSeparately = self.capturesStandardErrorSeparately;
+    copy.resultCache = self.resultCache;
+    copy.resultStore = self.resultStore;
+    copy.inputPaths = self.inputPaths;
+    copy.isTemplate  = self.isTemplate;
+    copy.scriptTemplate = self.scriptTemplate;
     copy._history    = [[self._history copy] autorelease];
     
     [copy setDelegate:self.delegate];
@@ -1172,11 +1760,10 @@ endnow2:
     [coder encodeObject:source];
     [coder encodeObject:result];
     [coder encodeObject:options];
-    [coder encodeObject:_history];
-    [coder encodeObject:task];
-    [coder encodeObject:pipe];
-    [coder encodeObject:bgTask];
-    [coder encodeObject:bgPipe];
+    // a history kept in a log is archived as the directory of the log, not item by item
+    BMScriptHistoryLog * historyLog = [_history log];
+    [coder encodeObject:(historyLog ? nil : [_history allItems])];
+    [coder encodeObject:[historyLog directory]];
     [coder encodeObject:delegate];
     [coder encodeValueOfObjCType:@encode(BOOL) at:&isTemplate];
     [coder encodeValueOfObjCType:@encode(NSInteger) at:&returnValue];
@@ -1188,14 +1775,22 @@ endnow2:
         source      = [[coder decodeObject] retain];
         result      = [[coder decodeObject] retain];
         options     = [[coder decodeObject] retain];
-        _history    = [[coder decodeObject] retain];
-        task        = [[coder decodeObject] retain];
-        pipe        = [[coder decodeObject] retain];
-        bgTask      = [[coder decodeObject] retain];
-        bgPipe      = [[coder decodeObject] retain];
+        _history    = [[BMScriptHistory alloc] init];
+        for (NSArray * item in [coder decodeObject]) {
+            [_history addItem:item];
+        }
+        NSString * historyLogPath = [coder decodeObject];
+        if (historyLogPath) {
+            [_history setLog:[BMScriptHistoryLog logWithDirectory:historyLogPath]];
+        }
         delegate    = [[coder decodeObject] retain];
         [coder decodeValueOfObjCType:@encode(BOOL) at:&isTemplate];
         [coder decodeValueOfObjCType:@encode(NSInteger) at:&returnValue];
+        timeLimit = BMSCRIPT_DEFAULT_TIME_LIMIT;
+        retainsOutput = YES;
+        outputHighWaterMark = BMSCRIPT_OUTPUT_HIGH_WATER_MARK;
+        outputSpillThreshold = BMSCRIPT_OUTPUT_SPILL_THRESHOLD;
+        wakeupPipe[0] = wakeupPipe[1] = -1;
     }
     return self;
 }
@@ -1211,109 +1806,640 @@ endnow2:
 
 @end
 
+// Options shared by the factory methods. Besides launch path and arguments they 
+// name the shim a script runs on if it opts into the worker pool (see usesWorkerPool)
+// and how the source is handed over if it doesn't (see BMScriptOptionsSourceDeliveryKey).
+
+static NSDictionary * BMScriptLanguageOptions(NSDictionary * synthesized, NSString * shim, NSString * delivery, 
+                                              NSArray * stdinArgs, NSArray * fdArgs) {
+    NSMutableDictionary * opts = [[synthesized mutableCopy] autorelease];
+    [opts setObject:shim forKey:BMScriptOptionsWorkerShimKey];
+    [opts setObject:delivery forKey:BMScriptOptionsSourceDeliveryKey];
+    [opts setObject:[NSDictionary dictionaryWithObjectsAndKeys:stdinArgs, BMScriptSourceDeliveryStandardInput, 
+                                                                  fdArgs, BMScriptSourceDeliveryFileDescriptor, nil] 
+             forKey:BMScriptOptionsSourceDeliveryArgumentsKey];
+    return opts;
+}
+
+static NSDictionary * BMScriptRubyOptions(void) {
+    return BMScriptLanguageOptions(BMSynthesizeOptions(@"/usr/bin/ruby", @"-Ku", @"-e"), BMScriptWorkerShimRuby, BMSCRIPT_RUBY_SOURCE_DELIVERY,
+                                   [NSArray arrayWithObjects:@"-Ku", @"-", nil], [NSArray arrayWithObject:@"-Ku"]);
+}
+
+static NSDictionary * BMScriptPythonOptions(void) {
+    return BMScriptLanguageOptions(BMSynthesizeOptions(@"/usr/bin/python", @"-c"), BMScriptWorkerShimPython, BMSCRIPT_PYTHON_SOURCE_DELIVERY,
+                                   [NSArray arrayWithObject:@"-"], [NSArray array]);
+}
+
+static NSDictionary * BMScriptPerlOptions(void) {
+    return BMScriptLanguageOptions(BMSynthesizeOptions(@"/usr/bin/perl", @"-Mutf8", @"-e"), BMScriptWorkerShimPerl, BMSCRIPT_PERL_SOURCE_DELIVERY,
+                                   [NSArray arrayWithObjects:@"-Mutf8", @"-", nil], [NSArray arrayWithObject:@"-Mutf8"]);
+}
+
+static NSDictionary * BMScriptShellOptions(void) {
+    return BMScriptLanguageOptions(BMSynthesizeOptions(@"/bin/sh", @"-c"), BMScriptWorkerShimShell, BMSCRIPT_SHELL_SOURCE_DELIVERY,
+                                   [NSArray arrayWithObject:@"-s"], [NSArray array]);
+}
+
 @implementation BMScript (CommonScriptLanguagesFactories)
 
 // Ruby
 
 + (id) rubyScriptWithSource:(NSString *)scriptSource {
-    NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/ruby", @"-Ku", @"-e");
+    NSDictionary * opts = BMScriptRubyOptions();
     return [[[self alloc] initWithScriptSource:scriptSource options:opts] autorelease];
 }
 
 + (id) rubyScriptWithContentsOfFile:(NSString *)path {
-    NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/ruby", @"-Ku", @"-e");
+    NSDictionary * opts = BMScriptRubyOptions();
     return [[[self alloc] initWithContentsOfFile:path options:opts] autorelease];
 }
 
 + (id) rubyScriptWithContentsOfTemplateFile:(NSString *)path {
-	NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/ruby", @"-Ku", @"-e");
+	NSDictionary * opts = BMScriptRubyOptions();
     return [[[self alloc] initWithContentsOfTemplateFile:path options:opts] autorelease];
 }
 
 // Python 
 
 + (id) pythonScriptWithSource:(NSString *)scriptSource {
-    NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/python", @"-c");
+    NSDictionary * opts = BMScriptPythonOptions();
     return [[[self alloc] initWithScriptSource:scriptSource options:opts] autorelease];
 }
 
 + (id) pythonScriptWithContentsOfFile:(NSString *)path {
-    NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/python", @"-c");
+    NSDictionary * opts = BMScriptPythonOptions();
     return [[[self alloc] initWithContentsOfFile:path options:opts] autorelease];
 }
 
 + (id) pythonScriptWithContentsOfTemplateFile:(NSString *)path {
-    NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/python", @"-c");
+    NSDictionary * opts = BMScriptPythonOptions();
     return [[[self alloc] initWithContentsOfTemplateFile:path options:opts] autorelease];
 }
 
 // Perl
 
 + (id) perlScriptWithSource:(NSString *)scriptSource {
-	NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/perl", @"-Mutf8", @"-e");
+	NSDictionary * opts = BMScriptPerlOptions();
     return [[[self alloc] initWithScriptSource:scriptSource options:opts] autorelease];
 }
 
 + (id) perlScriptWithContentsOfFile:(NSString *)path {
-	NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/perl", @"-Mutf8", @"-e");
+	NSDictionary * opts = BMScriptPerlOptions();
     return [[[self alloc] initWithContentsOfFile:path options:opts] autorelease];
 }
 
 + (id) perlScriptWithContentsOfTemplateFile:(NSString *)path {
-	NSDictionary * opts = BMSynthesizeOptions(@"/usr/bin/perl", @"-Mutf8", @"-e");
+	NSDictionary * opts = BMScriptPerlOptions();
     return [[[self alloc] initWithContentsOfTemplateFile:path options:opts] autorelease];
 }
 
 // Shell 
 
 + (id) shellScriptWithSource:(NSString *)scriptSource {
-	NSDictionary * opts = BMSynthesizeOptions(@"/bin/sh", @"-c");
+	NSDictionary * opts = BMScriptShellOptions();
     return [[[self alloc] initWithScriptSource:scriptSource options:opts] autorelease];
 }
 
 + (id) shellScriptWithContentsOfFile:(NSString *)path {
-	NSDictionary * opts = BMSynthesizeOptions(@"/bin/sh", @"-c");
+	NSDictionary * opts = BMScriptShellOptions();
     return [[[self alloc] initWithContentsOfFile:path options:opts] autorelease];
 }
 
 + (id) shellScriptWithContentsOfTemplateFile:(NSString *)path {
-	NSDictionary * opts = BMSynthesizeOptions(@"/bin/sh", @"-c");
+	NSDictionary * opts = BMScriptShellOptions();
     return [[[self alloc] initWithContentsOfTemplateFile:path options:opts] autorelease];
 }
 
 @end
 
 
-@implementation NSString (BMScriptStringUtilities)
+// MARK: Escape Tables
+
+/* One replacement of a mapping, in the direction and position it is applied in. */
+typedef struct BMNSStringEscapeRule {
+    UniChar * target;
+    NSUInteger targetLength;
+    UniChar * replacement;
+    NSUInteger replacementLength;
+} BMNSStringEscapeRule;
+
+/* 
+ * A mapping compiled for one direction and traversing order. 
+ * 
+ * Replacing the targets one full pass after the other is the contract. If every target is a single UTF-16 unit,
+ * each character of the input is affected independently of its neighbours, so the passes collapse into one
+ * lookup per character: what the passes make of that character alone (its expansion) is worked out up front.
+ * Longer targets (the unescaping direction) can be formed across replacements of earlier passes, so there the
+ * passes are kept, but run over a UTF-16 buffer and only allocate when a target actually occurs.
+ */
+typedef struct BMNSStringEscapeTable {
+    BMNSStringEscapeRule * rules;
+    NSUInteger ruleCount;
+    BOOL singleUnit;
+    unsigned char firstUnits[128 / 8];      /* ASCII units that start a target */
+    BOOL nonASCIITargets;                   /* a target starts beyond ASCII */
+    UniChar ** expansions;                  /* singleUnit: per rule, NULL if the unit stays or an earlier rule has it */
+    NSUInteger * expansionLengths;
+    int asciiRule[128];                     /* singleUnit: rule for an ASCII unit that changes, or -1 */
+} BMNSStringEscapeTable;
+
+static void BMNSStringFreeEscapeTable(BMNSStringEscapeTable * table) {
+    if (!table) return;
+    NSUInteger i;
+    for (i = 0; i < table->ruleCount; i++) {
+        free(table->rules[i].target);
+        free(table->rules[i].replacement);
+        if (table->expansions) free(table->expansions[i]);
+    }
+    free(table->rules);
+    free(table->expansions);
+    free(table->expansionLengths);
+    free(table);
+}
 
-- (NSString *) quotedString {
+static UniChar * BMNSStringCopyUnits(NSString * string, NSUInteger * length) {
+    *length = [string length];
+    UniChar * units = malloc(sizeof(UniChar) * (*length ? *length : 1));
+    if (units) [string getCharacters:units range:NSMakeRange(0, *length)];
+    return units;
+}
+
+/* Compiles a mapping. reverse swaps target and replacement (unescaping). Raises like the mapping's accessors would. */
+static BMNSStringEscapeTable * BMNSStringCompileEscapeTable(NSArray * mapping, BOOL reverse, BMNSStringEscapeTraversingOrder order) {
+
+    NSUInteger count = [mapping count];
+    BMNSStringEscapeTable * table = calloc(1, sizeof(BMNSStringEscapeTable));
+    if (!table) return NULL;
+    table->rules = calloc((count ? count : 1), sizeof(BMNSStringEscapeRule));
+    if (!table->rules) {
+        free(table);
+        return NULL;
+    }
+
+    NSUInteger i;
+    table->singleUnit = YES;
+    for (i = 0; i < count; i++) {
+        NSArray * pair = [mapping objectAtIndex:(order == BMNSStringEscapeTraversingOrderLast ? count - 1 - i : i)];
+        NSString * target = [pair objectAtIndex:(reverse ? 1 : 0)];
+        NSString * replacement = [pair objectAtIndex:(reverse ? 0 : 1)];
+        if ([target length] == 0) continue;     // replacing nothing changes nothing
+        BMNSStringEscapeRule * rule = &table->rules[table->ruleCount++];
+        rule->target = BMNSStringCopyUnits(target, &rule->targetLength);
+        rule->replacement = BMNSStringCopyUnits(replacement, &rule->replacementLength);
+        if (!rule->target || !rule->replacement) {
+            BMNSStringFreeEscapeTable(table);
+            return NULL;
+        }
+        if (rule->targetLength != 1) table->singleUnit = NO;
+        if (rule->target[0] < 128) table->firstUnits[rule->target[0] >> 3] |= (unsigned char)(1 << (rule->target[0] & 7));
+        else table->nonASCIITargets = YES;
+    }
+
+    if (table->singleUnit) {
+        table->expansions = calloc((table->ruleCount ? table->ruleCount : 1), sizeof(UniChar *));
+        table->expansionLengths = calloc((table->ruleCount ? table->ruleCount : 1), sizeof(NSUInteger));
+        if (!table->expansions || !table->expansionLengths) {
+            BMNSStringFreeEscapeTable(table);
+            return NULL;
+        }
+        for (i = 0; i < 128; i++) table->asciiRule[i] = -1;
+        for (i = 0; i < table->ruleCount; i++) {
+            UniChar unit = table->rules[i].target[0];
+            NSUInteger j;
+            for (j = 0; j < i && table->rules[j].target[0] != unit; j++);
+            if (j < i) continue;    // an earlier rule takes the unit through the passes already
+            // run the passes over the unit on its own, once
+            NSString * expansion = [NSString stringWithCharacters:&unit length:1];
+            for (j = 0; j < table->ruleCount; j++) {
+                expansion = [expansion stringByReplacingOccurrencesOfString:[NSString stringWithCharacters:table->rules[j].target length:1]
+                                                                 withString:[NSString stringWithCharacters:table->rules[j].replacement length:table->rules[j].replacementLength]
+                                                                    options:NSLiteralSearch
+                                                                      range:NSMakeRange(0, [expansion length])];
+            }
+            if ([expansion length] == 1 && [expansion characterAtIndex:0] == unit) continue;
+            table->expansions[i] = BMNSStringCopyUnits(expansion, &table->expansionLengths[i]);
+            if (!table->expansions[i]) {
+                BMNSStringFreeEscapeTable(table);
+                return NULL;
+            }
+            if (unit < 128) table->asciiRule[unit] = (int)i;
+        }
+    }
+    return table;
+}
+
+/* the rule whose expansion applies to a unit, or -1 if the unit stays as it is */
+NS_INLINE NSInteger BMNSStringEscapeRuleForUnit(const BMNSStringEscapeTable * table, UniChar unit) {
+    if (unit < 128) return table->asciiRule[unit];
+    if (!table->nonASCIITargets) return -1;
+    NSUInteger i;
+    for (i = 0; i < table->ruleCount; i++) {
+        if (table->rules[i].target[0] == unit) return (table->expansions[i] ? (NSInteger)i : -1);
+    }
+    return -1;
+}
+
+NS_INLINE BOOL BMNSStringEscapeTableMayMatch(const BMNSStringEscapeTable * table, UniChar unit) {
+    return (unit < 128 ? (table->firstUnits[unit >> 3] & (1 << (unit & 7))) != 0 : table->nonASCIITargets);
+}
+
+/* Applies a compiled mapping. Returns the string itself if nothing needs replacing. */
+static NSString * BMNSStringApplyEscapeTable(NSString * string, const BMNSStringEscapeTable * table) {
+
+    NSUInteger length = [string length];
+    if (length == 0 || table->ruleCount == 0) return string;
+
+    UniChar stackBuffer[512];
+    UniChar * units = (length <= 512 ? stackBuffer : malloc(sizeof(UniChar) * length));
+    if (!units) {
+        @throw [NSException exceptionWithName:NSMallocException reason:@"BMNSStringApplyEscapeTable: out of memory" userInfo:nil];
+    }
+    [string getCharacters:units range:NSMakeRange(0, length)];
+
+    NSUInteger i = 0;
+    while (i < length && !BMNSStringEscapeTableMayMatch(table, units[i])) i++;
+    if (i == length) {
+        if (units != stackBuffer) free(units);
+        return string;
+    }
+
+    NSString * result = string;
+
+    if (table->singleUnit) {
+        // size the output first, then copy unchanged runs in bulk
+        NSUInteger outLength = length;
+        NSUInteger k;
+        for (k = i; k < length; k++) {
+            NSInteger r = BMNSStringEscapeRuleForUnit(table, units[k]);
+            if (r >= 0) outLength += table->expansionLengths[r] - 1;
+        }
+        UniChar * out = malloc(sizeof(UniChar) * (outLength ? outLength : 1));
+        if (!out) {
+            if (units != stackBuffer) free(units);
+            @throw [NSException exceptionWithName:NSMallocException reason:@"BMNSStringApplyEscapeTable: out of memory" userInfo:nil];
+        }
+        NSUInteger o = 0, runStart = 0;
+        for (k = i; k < length; k++) {
+            NSInteger r = BMNSStringEscapeRuleForUnit(table, units[k]);
+            if (r < 0) continue;
+            memcpy(out + o, units + runStart, (k - runStart) * sizeof(UniChar));
+            o += k - runStart;
+            memcpy(out + o, table->expansions[r], table->expansionLengths[r] * sizeof(UniChar));
+            o += table->expansionLengths[r];
+            runStart = k + 1;
+        }
+        memcpy(out + o, units + runStart, (length - runStart) * sizeof(UniChar));
+        o += length - runStart;
+        result = [[[NSString alloc] initWithCharactersNoCopy:out length:o freeWhenDone:YES] autorelease];
+    } else {
+        // one pass per rule, each leftmost and non-overlapping like stringByReplacingOccurrencesOfString:
+        UniChar * current = units;
+        NSUInteger currentLength = length;
+        BOOL changed = NO;
+        NSUInteger r;
+        for (r = 0; r < table->ruleCount; r++) {
+            const BMNSStringEscapeRule * rule = &table->rules[r];
+            UniChar first = rule->target[0];
+            NSUInteger matches = 0, k = 0;
+            while (k + rule->targetLength <= currentLength) {
+                if (current[k] == first && memcmp(current + k, rule->target, rule->targetLength * sizeof(UniChar)) == 0) {
+                    matches++;
+                    k += rule->targetLength;
+                } else {
+                    k++;
+                }
+            }
+            if (matches == 0) continue;
+
+            NSUInteger nextLength = currentLength - matches * rule->targetLength + matches * rule->replacementLength;
+            UniChar * next = malloc(sizeof(UniChar) * (nextLength ? nextLength : 1));
+            if (!next) {
+                if (current != units) free(current);
+                if (units != stackBuffer) free(units);
+                @throw [NSException exceptionWithName:NSMallocException reason:@"BMNSStringApplyEscapeTable: out of memory" userInfo:nil];
+            }
+            NSUInteger o = 0;
+            k = 0;
+            while (k < currentLength) {
+                if (k + rule->targetLength <= currentLength && current[k] == first
+                    && memcmp(current + k, rule->target, rule->targetLength * sizeof(UniChar)) == 0) {
+                    memcpy(next + o, rule->replacement, rule->replacementLength * sizeof(UniChar));
+                    o += rule->replacementLength;
+                    k += rule->targetLength;
+                } else {
+                    next[o++] = current[k++];
+                }
+            }
+            if (current != units) free(current);
+            current = next;
+            currentLength = nextLength;
+            changed = YES;
+        }
+        if (changed) {
+            result = [[[NSString alloc] initWithCharactersNoCopy:current length:currentLength freeWhenDone:YES] autorelease];
+        }
+    }
+
+    if (units != stackBuffer) free(units);
+    return result;
+}
+
+/* the built-in mappings and their tables, made once */
+static NSArray * BMNSStringC99Mapping = nil;
+static NSArray * BMNSStringCommonMapping = nil;
+static BMNSStringEscapeTable * BMNSStringBuiltinTables[2][2][2];     /* [c99?][reverse?][order] */
+static pthread_once_t BMNSStringEscapeTablesOnce = PTHREAD_ONCE_INIT;
+
+static void BMNSStringMakeEscapeTables(void) {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    BMNSStringC99Mapping = [[NSArray alloc] initWithObjects:
+                            [NSArray arrayWithObjects:@"\\", @"\\\\", nil],
+                            [NSArray arrayWithObjects:@"\n", @"\\n", nil],
+                            [NSArray arrayWithObjects:@"\r", @"\\r", nil],
+                            [NSArray arrayWithObjects:@"\t", @"\\t", nil],
+                            [NSArray arrayWithObjects:@"\f", @"\\f", nil],
+                            [NSArray arrayWithObjects:@"\a", @"\\a", nil],
+                            [NSArray arrayWithObjects:@"\v", @"\\v", nil],
+                            [NSArray arrayWithObjects:@"\b", @"\\b", nil],
+                            [NSArray arrayWithObjects:@"\"", @"\\\"", nil],
+                            nil];
+    BMNSStringCommonMapping = [[NSArray alloc] initWithObjects:
+                               [NSArray arrayWithObjects:@"\\", @"\\\\", nil],
+                               [NSArray arrayWithObjects:@"\n", @"\\n", nil],
+                               [NSArray arrayWithObjects:@"\r", @"\\r", nil],
+                               [NSArray arrayWithObjects:@"\t", @"\\t", nil],
+                               [NSArray arrayWithObjects:@"\"", @"\\\"", nil],
+                               nil];
+    int c99, reverse, order;
+    for (c99 = 0; c99 < 2; c99++) {
+        for (reverse = 0; reverse < 2; reverse++) {
+            for (order = 0; order < 2; order++) {
+                BMNSStringBuiltinTables[c99][reverse][order] = BMNSStringCompileEscapeTable((c99 ? BMNSStringC99Mapping : BMNSStringCommonMapping), 
+                                                                                            (BOOL)reverse, (BMNSStringEscapeTraversingOrder)order);
+            }
+        }
+    }
+    [pool drain];
+}
+
+NSArray * BMNSStringC99EscapeMapping(void) {
+    pthread_once(&BMNSStringEscapeTablesOnce, BMNSStringMakeEscapeTables);
+    return BMNSStringC99Mapping;
+}
+
+NSArray * BMNSStringCommonEscapeMapping(void) {
+    pthread_once(&BMNSStringEscapeTablesOnce, BMNSStringMakeEscapeTables);
+    return BMNSStringCommonMapping;
+}
+
+/* Escapes or unescapes with a mapping, using a precompiled table for the built-in ones. */
+static NSString * BMNSStringEscape(NSString * string, NSArray * mapping, BOOL reverse, BMNSStringEscapeTraversingOrder order) {
+    if (order != BMNSStringEscapeTraversingOrderFirst && order != BMNSStringEscapeTraversingOrderLast) {
+        return string;
+    }
+    pthread_once(&BMNSStringEscapeTablesOnce, BMNSStringMakeEscapeTables);
+    if (mapping == BMNSStringC99Mapping || mapping == BMNSStringCommonMapping) {
+        const BMNSStringEscapeTable * table = BMNSStringBuiltinTables[(mapping == BMNSStringC99Mapping)][reverse ? 1 : 0][order];
+        if (table) return BMNSStringApplyEscapeTable(string, table);
+    }
+    BMNSStringEscapeTable * table = BMNSStringCompileEscapeTable(mapping, reverse, order);
+    if (!table) {
+        @throw [NSException exceptionWithName:NSMallocException reason:@"BMNSStringEscape: out of memory" userInfo:nil];
+    }
+    NSString * result = nil;
+    @try {
+        result = BMNSStringApplyEscapeTable(string, table);
+    }
+    @finally {
+        BMNSStringFreeEscapeTable(table);
+    }
+    return result;
+}
+
+
+// MARK: Unicode Escaping
+
+/* 
+ * -stringByEscapingUnicodeCharacters leaves units up to 0x7e alone and turns everything else into \uxxxx.
+ * Script sources are mostly ASCII, so the work is finding the end of each run of plain units and copying the
+ * run over. Both are done a vector at a time where the compiler lets us: AVX2 (16 units), SSE2 (8 units) or
+ * AArch64 NEON (8 units), with a scalar loop for the tail and everything else.
+ */
+
+#define BMNSSTRING_UNICODE_ESCAPE_LENGTH    6       /* \uxxxx */
+#define BMNSSTRING_ASCII_LIMIT              0x7e    /* last unit that is copied as is */
+
+/* Returns the number of units at the start of units that are copied as is. */
+static NSUInteger BMNSStringPlainRunLength(const UniChar * units, NSUInteger length) {
+    NSUInteger i = 0;
+#if defined(__AVX2__)
+    const __m256i limit256 = _mm256_set1_epi16(BMNSSTRING_ASCII_LIMIT);
+    const __m256i zero256 = _mm256_setzero_si256();
+    for (; i + 16 <= length; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(units + i));
+        // units above the limit don't saturate to zero
+        unsigned int plain = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_subs_epu16(v, limit256), zero256));
+        if (plain != 0xffffffffU) return i + (NSUInteger)__builtin_ctz(~plain) / 2;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i limit = _mm_set1_epi16(BMNSSTRING_ASCII_LIMIT);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= length; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(units + i));
+        unsigned int plain = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(v, limit), zero));
+        if (plain != 0xffffU) return i + (NSUInteger)__builtin_ctz(~plain) / 2;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint16x8_t limit = vdupq_n_u16(BMNSSTRING_ASCII_LIMIT);
+    for (; i + 8 <= length; i += 8) {
+        // lanes are all ones where the unit is plain, so the minimum is all ones only for a plain vector
+        if (vminvq_u16(vcleq_u16(vld1q_u16(units + i), limit)) != 0xffff) break;
+    }
+#endif
+    while (i < length && units[i] <= BMNSSTRING_ASCII_LIMIT) i++;
+    return i;
+}
+
+/* Copies length plain units to bytes. */
+static void BMNSStringNarrowPlainRun(char * bytes, const UniChar * units, NSUInteger length) {
+    NSUInteger i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(units + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(units + i + 8));
+        _mm_storeu_si128((__m128i *)(bytes + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= length; i += 8) {
+        vst1_u8((uint8_t *)(bytes + i), vmovn_u16(vld1q_u16(units + i)));
+    }
+#endif
+    for (; i < length; i++) bytes[i] = (char)units[i];
+}
+
+/* Escapes units into bytes, which must hold length units plus (BMNSSTRING_UNICODE_ESCAPE_LENGTH - 1) per escaped unit. */
+static NSUInteger BMNSStringWriteUnicodeEscapes(char * bytes, const UniChar * units, NSUInteger length) {
+    static const char hexDigits[] = "0123456789abcdef";
+    NSUInteger i = 0, n = 0;
+    while (i < length) {
+        NSUInteger run = BMNSStringPlainRunLength(units + i, length - i);
+        BMNSStringNarrowPlainRun(bytes + n, units + i, run);
+        i += run, n += run;
+        if (i == length) break;
+        UniChar unit = units[i++];
+        bytes[n++] = '\\';
+        bytes[n++] = 'u';
+        bytes[n++] = hexDigits[(unit >> 12) & 0xf];
+        bytes[n++] = hexDigits[(unit >> 8) & 0xf];
+        bytes[n++] = hexDigits[(unit >> 4) & 0xf];
+        bytes[n++] = hexDigits[unit & 0xf];
+    }
+    return n;
+}
+
+
+// MARK: Substring Search
+
+#define BMNSSTRING_SEARCH_BUFFER_LENGTH     1024    /* units of the receiver -countOccurrencesOfString: copies at a time */
+
+NSUInteger BMNSStringFindCharacters(const unichar * characters, NSUInteger length, const unichar * pattern, NSUInteger patternLength) {
     
-    NSString * quotedResult = self;
-    NSArray * charSets = BMNSStringCommonEscapeCharacterMapping;
-    NSUInteger cslen = [charSets count];
+    if (patternLength == 0 || patternLength > length) return NSNotFound;
     
-    for (NSUInteger i = 0; i < cslen; ++i) {
-        NSArray * curSet = [charSets objectAtIndex:i];
-        quotedResult = [quotedResult stringByReplacingOccurrencesOfString:[curSet objectAtIndex:0] 
-                                                               withString:[curSet objectAtIndex:1]];
-    }
+    // candidates are the positions holding the first unit of the pattern, the rest is compared for those only
+    NSUInteger limit = length - patternLength + 1;
+    NSUInteger tailLength = (patternLength - 1) * sizeof(unichar);
+    const unichar * tail = pattern + 1;
+    unichar first = pattern[0];
+    NSUInteger i = 0;
     
-    return quotedResult;
+#if defined(__AVX2__)
+    const __m256i first256 = _mm256_set1_epi16((short)first);
+    for (; i + 16 <= limit; i += 16) {
+        unsigned int hits = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(characters + i)), first256));
+        while (hits) {
+            unsigned int bit = (unsigned int)__builtin_ctz(hits);
+            if (memcmp(characters + i + bit / 2 + 1, tail, tailLength) == 0) return i + bit / 2;
+            hits &= ~(3U << bit);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i first128 = _mm_set1_epi16((short)first);
+    for (; i + 8 <= limit; i += 8) {
+        unsigned int hits = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(characters + i)), first128));
+        while (hits) {
+            unsigned int bit = (unsigned int)__builtin_ctz(hits);
+            if (memcmp(characters + i + bit / 2 + 1, tail, tailLength) == 0) return i + bit / 2;
+            hits &= ~(3U << bit);
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint16x8_t first128 = vdupq_n_u16(first);
+    for (; i + 8 <= limit; i += 8) {
+        if (vmaxvq_u16(vceqq_u16(vld1q_u16(characters + i), first128)) == 0) continue;
+        NSUInteger j;
+        for (j = i; j < i + 8; j++) {
+            if (characters[j] == first && memcmp(characters + j + 1, tail, tailLength) == 0) return j;
+        }
+    }
+#endif
+    for (; i < limit; i++) {
+        if (characters[i] == first && memcmp(characters + i + 1, tail, tailLength) == 0) return i;
+    }
+    return NSNotFound;
 }
 
-- (NSString *) unquotedString {
+/* Counts the non-overlapping occurrences of pattern in characters. */
+static NSUInteger BMNSStringCountCharacters(const unichar * characters, NSUInteger length, const unichar * pattern, NSUInteger patternLength) {
+    NSUInteger count = 0, i = 0, found;
+    while ((found = BMNSStringFindCharacters(characters + i, length - i, pattern, patternLength)) != NSNotFound) {
+        count++;
+        i += found + patternLength;
+    }
+    return count;
+}
+
+
+// MARK: Byte Dumps
+
+#define BMNSDATA_HEX_DUMP_STRIDE            5       /* "0xhh " */
+#define BMNSSTRING_MAX_BOM_LENGTH           4       /* a UTF-32 byte order mark */
+
+static const char BMNSDataHexDigits[] = "0123456789abcdef";
+
+NSUInteger BMNSDataWriteByteDump(const void * bytes, NSUInteger length, BOOL asHex, char * buffer) {
     
-    NSString * unquotedResult = self;
-    NSArray * charSets = BMNSStringCommonEscapeCharacterMapping;
-    NSUInteger cslen = [charSets count];
+    if (length == 0) return 0;
+    const unsigned char * in = (const unsigned char *)bytes;
+    NSUInteger i = 0;
     
-    for (NSUInteger i = 0; i < cslen; ++i) {
-        NSArray * curSet = [charSets objectAtIndex:i];
-        unquotedResult = [unquotedResult stringByReplacingOccurrencesOfString:[curSet objectAtIndex:1] 
-                                                                   withString:[curSet objectAtIndex:0]];
+    if (asHex) {
+        if (!buffer) return length * BMNSDATA_HEX_DUMP_STRIDE - 1;
+        char * out = buffer;
+#if defined(__SSE2__)
+        // turn 16 bytes into 32 hex digits at once, then put them into their slots. 
+        // the last byte is left to the scalar loop so no slot is written past the end.
+        const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i zeroDigit = _mm_set1_epi8('0');
+        const __m128i letterOffset = _mm_set1_epi8('a' - '0' - 10);
+        char digits[32];
+        for (; i + 16 < length; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibbleMask);
+            __m128i lo = _mm_and_si128(v, nibbleMask);
+            hi = _mm_add_epi8(_mm_add_epi8(hi, zeroDigit), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letterOffset));
+            lo = _mm_add_epi8(_mm_add_epi8(lo, zeroDigit), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letterOffset));
+            _mm_storeu_si128((__m128i *)digits, _mm_unpacklo_epi8(hi, lo));
+            _mm_storeu_si128((__m128i *)(digits + 16), _mm_unpackhi_epi8(hi, lo));
+            NSUInteger k;
+            for (k = 0; k < 16; k++, out += BMNSDATA_HEX_DUMP_STRIDE) {
+                out[0] = '0';
+                out[1] = 'x';
+                out[2] = digits[2 * k];
+                out[3] = digits[2 * k + 1];
+                out[4] = ' ';
+            }
+        }
+#endif
+        for (; i < length; i++) {
+            *out++ = '0';
+            *out++ = 'x';
+            *out++ = BMNSDataHexDigits[in[i] >> 4];
+            *out++ = BMNSDataHexDigits[in[i] & 0xf];
+            if (i + 1 < length) *out++ = ' ';
+        }
+        return (NSUInteger)(out - buffer);
     }
     
-    return unquotedResult;
+    if (!buffer) {
+        NSUInteger total = length - 1;
+        for (; i < length; i++) total += (in[i] >= 100 ? 3 : (in[i] >= 10 ? 2 : 1));
+        return total;
+    }
+    char * out = buffer;
+    for (; i < length; i++) {
+        unsigned char b = in[i];
+        if (b >= 100) *out++ = (char)('0' + b / 100);
+        if (b >= 10) *out++ = (char)('0' + (b / 10) % 10);
+        *out++ = (char)('0' + b % 10);
+        if (i + 1 < length) *out++ = ' ';
+    }
+    return (NSUInteger)(out - buffer);
+}
+
+
+@implementation NSString (BMScriptStringUtilities)
+
+- (NSString *) quotedString {
+    return BMNSStringEscape(self, BMNSStringCommonEscapeMapping(), NO, BMNSStringEscapeTraversingOrderFirst);
+}
+
+- (NSString *) unquotedString {
+    return BMNSStringEscape(self, BMNSStringCommonEscapeMapping(), YES, BMNSStringEscapeTraversingOrderFirst);
 }
 
 - (NSString *) escapedString {
@@ -1325,37 +2451,7 @@ endnow2:
 }
 
 - (NSString *) unescapedStringUsingOrder:(BMNSStringEscapeTraversingOrder)order {
-    
-    NSString * unescapedResult = self;
-    NSArray * charSets = BMNSStringC99EscapeCharacterMapping;
-    NSUInteger cslen = [charSets count];
-    NSUInteger i;
-    NSInteger j;
-    
-    //NSLog(@"[%@%s]: self = %@", NSStringFromClass([self class]), __PRETTY_FUNCTION__, self);
-    
-    switch (order) {
-        case BMNSStringEscapeTraversingOrderFirst:
-            for (i = 0; i < cslen; ++i) {
-                NSArray * curSet = [charSets objectAtIndex:i];
-                unescapedResult = [unescapedResult stringByReplacingOccurrencesOfString:[curSet objectAtIndex:1] 
-                                                                             withString:[curSet objectAtIndex:0]];
-                //NSLog(@"escapedResult after replacing %@: %@", [curSet objectAtIndex:1], escapedResult);
-            }
-            break;
-        case BMNSStringEscapeTraversingOrderLast:
-            for (j = --cslen; j >= 0; ) {
-                NSArray * curSet = [charSets objectAtIndex:j--];
-                unescapedResult = [unescapedResult stringByReplacingOccurrencesOfString:[curSet objectAtIndex:1] 
-                                                                             withString:[curSet objectAtIndex:0]];
-                //NSLog(@"escapedResult after replacing %@: %@", [curSet objectAtIndex:1], escapedResult);
-            }            
-            break;
-        default:
-            break;
-    }
-    
-    return unescapedResult;
+    return BMNSStringEscape(self, BMNSStringC99EscapeMapping(), YES, order);
 }
 
 - (NSString *) stringByEscapingStringUsingOrder:(BMNSStringEscapeTraversingOrder)order {
@@ -1364,8 +2460,7 @@ endnow2:
 
 - (NSString *) stringByEscapingStringUsingMapping:(BMNSStringEscapeCharacterMapping *)mapping order:(BMNSStringEscapeTraversingOrder)order {
     
-    NSString * escapedResult = self;
-    BMNSStringEscapeCharacterMapping * charSets = BMNSStringC99EscapeCharacterMapping;
+    BMNSStringEscapeCharacterMapping * charSets = BMNSStringC99EscapeMapping();
     
     if (mapping) {
         charSets = mapping;
@@ -1377,59 +2472,47 @@ endnow2:
                                      userInfo:nil];
     }
     
-    NSUInteger cslen = [charSets count];
-    NSUInteger i;
-    NSInteger j;
-    
-    //NSLog(@"[%@%s]: self = %@", NSStringFromClass([self class]), __PRETTY_FUNCTION__, self);
-    
-    switch (order) {
-        case BMNSStringEscapeTraversingOrderFirst:
-            for (i = 0; i < cslen; i++) {
-                NSArray * curSet = [charSets objectAtIndex:i];
-                escapedResult = [escapedResult stringByReplacingOccurrencesOfString:[curSet objectAtIndex:0] 
-                                                                         withString:[curSet objectAtIndex:1]];
-                //NSLog(@"escapedResult after replacing %@: %@", [curSet objectAtIndex:1], escapedResult);
-            }
-            break;
-        case BMNSStringEscapeTraversingOrderLast:
-            for (j = --cslen; j >= 0; ) {
-                NSArray * curSet = [charSets objectAtIndex:j--];
-                escapedResult = [escapedResult stringByReplacingOccurrencesOfString:[curSet objectAtIndex:0] 
-                                                                         withString:[curSet objectAtIndex:1]];
-                //NSLog(@"escapedResult after replacing %@: %@", [curSet objectAtIndex:1], escapedResult);
-            }
-            break;
-        default:
-            break;
-    }
-    
-    return escapedResult;
+    return BMNSStringEscape(self, charSets, NO, order);
 }
 
 - (NSString *) stringByEscapingUnicodeCharacters {
     
-    NSMutableString * uniString = [[NSMutableString alloc] init];
+    NSUInteger length = [self length];
+    UniChar * uniBuffer = NULL;
+    const UniChar * units = CFStringGetCharactersPtr((CFStringRef)self);
     
-    UniChar * uniBuffer = (UniChar *)malloc(sizeof(UniChar) * [self length]);
-    CFRange stringRange = CFRangeMake(0, [self length]);
+    if (!units) {
+        uniBuffer = (UniChar *)malloc(sizeof(UniChar) * (length ? length : 1));
+        if (!uniBuffer) {
+            @throw [NSException exceptionWithName:NSMallocException reason:@"-stringByEscapingUnicodeCharacters: out of memory" userInfo:nil];
+        }
+        CFStringGetCharacters((CFStringRef)self, CFRangeMake(0, length), uniBuffer);
+        units = uniBuffer;
+    }
     
-    CFStringGetCharacters((CFStringRef)self, stringRange, uniBuffer);
+    // count first so the output is allocated once, at its final size
+    NSUInteger escapes = 0;
+    NSUInteger i = BMNSStringPlainRunLength(units, length);
+    while (i < length) {
+        escapes++, i++;
+        i += BMNSStringPlainRunLength(units + i, length - i);
+    }
     
-    for (unsigned long i = 0; i < [self length]; i++ ) {
-        if (uniBuffer[i] > 0x7e) {
-            [uniString appendFormat:@"\\u%04x", uniBuffer[i]];
-        } else {
-            [uniString appendFormat:@"%c", uniBuffer[i]];
-        }
+    if (escapes == 0) {
+        free(uniBuffer);
+        return [NSString stringWithString:self];
     }
     
+    NSUInteger outLength = length + escapes * (BMNSSTRING_UNICODE_ESCAPE_LENGTH - 1);
+    char * bytes = (char *)malloc(outLength);
+    if (!bytes) {
+        free(uniBuffer);
+        @throw [NSException exceptionWithName:NSMallocException reason:@"-stringByEscapingUnicodeCharacters: out of memory" userInfo:nil];
+    }
+    BMNSStringWriteUnicodeEscapes(bytes, units, length);
     free(uniBuffer);
     
-    NSString * retString = [NSString stringWithString:uniString];
-    [uniString release], uniString = nil;
-    
-    return retString;
+    return [[[NSString alloc] initWithBytesNoCopy:bytes length:outLength encoding:NSASCIIStringEncoding freeWhenDone:YES] autorelease];
 }
 
 - (NSString *) stringByEscapingPercentSigns {
@@ -1549,53 +2632,105 @@ endnow2:
 
 - (NSInteger) countOccurrencesOfString:(NSString *)aString {
     NSParameterAssert(aString);
-    NSInteger num = ((NSInteger)[[NSArray arrayWithArray:[self componentsSeparatedByString:aString]] count] - 1);
+    
+    NSUInteger length = [self length];
+    NSUInteger patternLength = [aString length];
+    if (patternLength == 0 || patternLength > length) return NSNotFound;
+    
+    unichar patternBuffer[BMNSSTRING_SEARCH_BUFFER_LENGTH / 2];
+    unichar * allocatedPattern = NULL;
+    const unichar * pattern = CFStringGetCharactersPtr((CFStringRef)aString);
+    if (!pattern) {
+        if (patternLength > BMNSSTRING_SEARCH_BUFFER_LENGTH / 2) {
+            allocatedPattern = malloc(patternLength * sizeof(unichar));
+            if (!allocatedPattern) {
+                @throw [NSException exceptionWithName:NSMallocException reason:@"-countOccurrencesOfString: out of memory" userInfo:nil];
+            }
+        }
+        [aString getCharacters:(allocatedPattern ? allocatedPattern : patternBuffer) range:NSMakeRange(0, patternLength)];
+        pattern = (allocatedPattern ? allocatedPattern : patternBuffer);
+    }
+    
+    NSUInteger num = 0;
+    const unichar * characters = CFStringGetCharactersPtr((CFStringRef)self);
+    
+    if (characters) {
+        num = BMNSStringCountCharacters(characters, length, pattern, patternLength);
+    } else if (patternLength <= BMNSSTRING_SEARCH_BUFFER_LENGTH / 2) {
+        // copy a window at a time. a window ends patternLength - 1 units past the last position it searches,
+        // and the next window starts at the first position not searched yet, or past the last match.
+        unichar buffer[BMNSSTRING_SEARCH_BUFFER_LENGTH];
+        NSUInteger base = 0;
+        while (base + patternLength <= length) {
+            NSUInteger n = MIN(length - base, (NSUInteger)BMNSSTRING_SEARCH_BUFFER_LENGTH);
+            [self getCharacters:buffer range:NSMakeRange(base, n)];
+            NSUInteger i = 0, found;
+            while ((found = BMNSStringFindCharacters(buffer + i, n - i, pattern, patternLength)) != NSNotFound) {
+                num++;
+                i += found + patternLength;
+            }
+            base += MAX(i, n - patternLength + 1);
+        }
+    } else {
+        unichar * copied = malloc(length * sizeof(unichar));
+        if (!copied) {
+            free(allocatedPattern);
+            @throw [NSException exceptionWithName:NSMallocException reason:@"-countOccurrencesOfString: out of memory" userInfo:nil];
+        }
+        [self getCharacters:copied range:NSMakeRange(0, length)];
+        num = BMNSStringCountCharacters(copied, length, pattern, patternLength);
+        free(copied);
+    }
+    free(allocatedPattern);
+    
     if (num > 0) {
-        return num;
+        return (NSInteger)num;
     }
     return NSNotFound;
 }
 
-- (NSArray *) bytesForEncoding:(NSStringEncoding)enc asHex:(BOOL)asHex {
+- (NSData *) bytesForEncoding:(NSStringEncoding)enc {
     
-    if (!self) return nil;
-    if ([self length] == 0) return [NSArray array];
     if (!enc) {
         @throw [NSException exceptionWithName:NSInvalidArgumentException 
                                        reason:@"enc must be a valid NSStringEncoding" 
                                      userInfo:nil];
     }
     NSUInteger len = [self length];
-    NSUInteger ulen;
-    NSRangePointer rp = NULL;
-    char bytes[len];
-    BOOL success = [self getBytes:bytes 
-                        maxLength:len 
+    if (len == 0) return [NSData data];
+    
+    NSUInteger maxLength = [self maximumLengthOfBytesUsingEncoding:enc];
+    if (maxLength == 0) return nil;
+    maxLength += BMNSSTRING_MAX_BOM_LENGTH;
+    
+    NSMutableData * data = [NSMutableData dataWithLength:maxLength];
+    NSUInteger ulen = 0;
+    NSRange remaining = NSMakeRange(0, 0);
+    BOOL success = [self getBytes:[data mutableBytes] 
+                        maxLength:maxLength 
                        usedLength:&ulen 
                          encoding:enc 
                           options:NSStringEncodingConversionExternalRepresentation 
                             range:NSMakeRange(0, len) 
-                   remainingRange:rp];
-    if (!success) {
+                   remainingRange:&remaining];
+    if (!success || remaining.length > 0) {
         return nil;
     }
-    
-    NSString * fmt = nil;
-    if (asHex) {
-        fmt = @"%#x";
-    } else {
-        fmt = @"%u";
-    }
-    size_t blen = strlen(bytes);
-    NSMutableArray * bytesArray = [NSMutableArray arrayWithCapacity:blen];
-    NSUInteger i;
-    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
-    for (i = 0; i<ulen; i++) {
-        char ch = bytes[i];
-        [bytesArray insertObject:[NSString stringWithFormat:fmt, ch] atIndex:i];
-    }
-    [pool drain];
-    return [NSArray arrayWithArray:bytesArray];
+    [data setLength:ulen];
+    return data;
+}
+
+- (NSString *) byteDumpForEncoding:(NSStringEncoding)enc asHex:(BOOL)asHex {
+    NSData * data = [self bytesForEncoding:enc];
+    if (!data) return nil;
+    return [data byteDumpAsHex:asHex];
+}
+
+- (NSArray *) bytesForEncoding:(NSStringEncoding)enc asHex:(BOOL)asHex {
+    NSString * dump = [self byteDumpForEncoding:enc asHex:asHex];
+    if (!dump) return nil;
+    if ([dump length] == 0) return [NSArray array];
+    return [dump componentsSeparatedByString:@" "];
 }
 
 - (NSRange) adjustRangeToIncludeComposedCharacterSequencesForRange:(NSRange)aRange {
@@ -1677,6 +2812,17 @@ endnow2:
     return [string autorelease];
 }
 
+- (NSString *) byteDumpAsHex:(BOOL)asHex {
+    NSUInteger length = BMNSDataWriteByteDump([self bytes], [self length], asHex, NULL);
+    if (length == 0) return @"";
+    char * buffer = (char *)malloc(length);
+    if (!buffer) {
+        @throw [NSException exceptionWithName:NSMallocException reason:@"-byteDumpAsHex: out of memory" userInfo:nil];
+    }
+    BMNSDataWriteByteDump([self bytes], [self length], asHex, buffer);
+    return [[[NSString alloc] initWithBytesNoCopy:buffer length:length encoding:NSASCIIStringEncoding freeWhenDone:YES] autorelease];
+}
+
 @end
 
 
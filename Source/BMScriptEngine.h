@@ -0,0 +1,183 @@
+//
+//  BMScriptEngine.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptEngine.h
+ * Class interface of BMScriptEngine.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+@class BMScriptEngine;
+@class BMScriptTask;
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*!
+ * Interval in seconds at which BMScriptEngine checks whether a task has exited on platforms
+ * where BMScriptTask#exitFileDescriptor is not available.
+ */
+#ifndef BMSCRIPT_ENGINE_REAP_INTERVAL
+    #define BMSCRIPT_ENGINE_REAP_INTERVAL 0.05
+#endif
+
+/*! @} */
+
+/*!
+ * @addtogroup protocols Protocols
+ * @{
+ */
+
+/*!
+ * @protocol BMScriptEngineClient
+ * Objects handing tasks to a BMScriptEngine must conform to this protocol.
+ */
+@protocol BMScriptEngineClient <NSObject>
+/*!
+ * Called on the engine's I/O thread whenever output of a task has been read, or on the delivery target if
+ * the task was added with a high water mark. Must not block on the I/O thread, as the engine serves all of
+ * its tasks from that one thread.
+ * @param engine the engine
+ * @param data the chunk that was read
+ * @param aTask the task that wrote it
+ */
+- (void) engine:(BMScriptEngine *)engine didReadData:(NSData *)data fromTask:(BMScriptTask *)aTask;
+/*!
+ * Called on the engine's I/O thread whenever output has been read from the error handle of a task.
+ * Error output is never streamed, so this must not block either.
+ * @param engine the engine
+ * @param data the chunk that was read
+ * @param aTask the task that wrote it
+ */
+- (void) engine:(BMScriptEngine *)engine didReadErrorData:(NSData *)data fromTask:(BMScriptTask *)aTask;
+/*!
+ * Called once the task has exited and its output has been read, on the thread or queue passed to
+ * BMScriptEngine#addTask:outputHandle:timeLimit:client:deliveryThread:deliveryQueue:.
+ * The task has been reaped, so its termination status is available.
+ * @param engine the engine
+ * @param aTask the task that finished
+ * @param reason #BMScriptTimedOut or #BMScriptCancelled if the engine terminated the task, #BMScriptNotExecuted otherwise
+ */
+- (void) engine:(BMScriptEngine *)engine taskDidFinish:(BMScriptTask *)aTask terminationReason:(ExecutionStatus)reason;
+@end
+
+/*! @} */
+
+/*!
+ * @class BMScriptEngine
+ * Runs the non-blocking executions of all BMScript instances on one dedicated I/O thread.
+ *
+ * Previously a background execution relied on <span class="sourcecode">-readInBackgroundAndNotify</span> and
+ * timers on the run loop of the thread that started it, so it only made progress while that thread spun its
+ * run loop. The engine instead owns the output pipe and the exit of every background task: its thread waits
+ * on all of them at once (<span class="sourcecode">epoll(7)</span> on Linux, <span class="sourcecode">poll(2)</span>
+ * elsewhere), reads output as soon as it arrives, enforces time limits and termination sequences and reaps the
+ * children. Exits are detected through BMScriptTask#exitFileDescriptor; where the platform has none the engine
+ * checks every #BMSCRIPT_ENGINE_REAP_INTERVAL seconds.
+ *
+ * Output is handed to the client on the I/O thread. Only the completion is delivered where the caller asked for
+ * it: on a thread (via <span class="sourcecode">-performSelector:onThread:withObject:waitUntilDone:</span>, so that
+ * thread needs a run loop), on an NSOperationQueue, or right on the I/O thread.
+ *
+ * Alternatively output can be streamed to the delivery target as well, in order and followed by the completion.
+ * The engine then keeps track of how much of it has not been consumed yet and stops reading from the task's pipe
+ * once that exceeds a high water mark. The task blocks on its next write until the client has worked off half
+ * of the backlog, so a slow consumer can't make the engine buffer unbounded output.
+ *
+ * Normally there is no need to talk to the engine directly, see BMScript#executeInBackgroundAndNotifyOnThread:timeLimit:.
+ * All methods are thread-safe.
+ */
+@interface BMScriptEngine : NSObject {
+ @private
+    NSLock * lock;
+    NSMutableArray * incomingJobs;
+    NSMutableArray * cancelledTasks;
+    NSMutableArray * jobs;
+    NSThread * ioThread;
+    NSUInteger taskCount;
+    int wakeupPipe[2];
+    int eventDescriptor;
+}
+
+/*! Returns the shared engine, starting its I/O thread the first time it is called. */
++ (BMScriptEngine *) sharedEngine;
+
+/*! Returns the engine's I/O thread. It has no run loop, so don't perform selectors on it. */
+- (NSThread *) ioThread;
+/*! Returns the number of tasks the engine is currently looking after. */
+- (NSUInteger) taskCount;
+
+/*!
+ * Hands a launched task over to the engine. From now on the engine reads its output and reaps it, so the caller
+ * must neither read from the handle nor wait for the task.
+ * @param aTask a launched task. Should have been created with BMScriptTask#createsProcessGroup set so termination reaches its children.
+ * @param handle the read end of the pipe the task writes its output to. It is switched to non-blocking mode.
+ * @param limit time limit in seconds after which the task is terminated, 0 means no limit
+ * @param client the object receiving output and completion. Retained until the completion has been delivered.
+ * @param thread the thread the completion is delivered on, or nil
+ * @param queue the operation queue the completion is delivered on if thread is nil. If both are nil the completion is delivered on the I/O thread.
+ */
+- (void) addTask:(BMScriptTask *)aTask
+    outputHandle:(NSFileHandle *)handle
+       timeLimit:(NSTimeInterval)limit
+          client:(id<BMScriptEngineClient>)client
+  deliveryThread:(NSThread *)thread
+   deliveryQueue:(NSOperationQueue *)queue;
+
+/*!
+ * Same as #addTask:outputHandle:timeLimit:client:deliveryThread:deliveryQueue: but streams the output to the
+ * delivery target instead of handing it to the client on the I/O thread.
+ * @param mark the number of undelivered bytes at which the engine stops reading the pipe. 0 means no streaming.
+ */
+- (void) addTask:(BMScriptTask *)aTask
+    outputHandle:(NSFileHandle *)handle
+       timeLimit:(NSTimeInterval)limit
+          client:(id<BMScriptEngineClient>)client
+  deliveryThread:(NSThread *)thread
+   deliveryQueue:(NSOperationQueue *)queue
+   highWaterMark:(NSUInteger)mark;
+
+/*!
+ * Same as #addTask:outputHandle:timeLimit:client:deliveryThread:deliveryQueue:highWaterMark: for a task whose stderr
+ * goes to a pipe of its own. Both pipes are read as data arrives, so the task can't block writing to either of them.
+ * Backpressure only holds back the output handle.
+ * @param errorHandle the read end of the pipe the task writes its error output to, or nil. It is switched to non-blocking mode.
+ */
+- (void) addTask:(BMScriptTask *)aTask
+    outputHandle:(NSFileHandle *)handle
+     errorHandle:(NSFileHandle *)errorHandle
+       timeLimit:(NSTimeInterval)limit
+          client:(id<BMScriptEngineClient>)client
+  deliveryThread:(NSThread *)thread
+   deliveryQueue:(NSOperationQueue *)queue
+   highWaterMark:(NSUInteger)mark;
+
+/*!
+ * Starts the termination sequence for a task (see BMScript#cancel). The completion reports #BMScriptCancelled.
+ * Does nothing if the task is unknown or already being terminated.
+ * @param aTask a task previously passed to #addTask:outputHandle:timeLimit:client:deliveryThread:deliveryQueue:
+ */
+- (void) cancelTask:(BMScriptTask *)aTask;
+
+@end
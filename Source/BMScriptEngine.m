@@ -0,0 +1,693 @@
+//
+//  BMScriptEngine.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptEngine.h"
+#import "BMScriptTask.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+    #include <sys/epoll.h>
+#endif
+
+#define BMSCRIPT_ENGINE_READ_BUFFER_SIZE    65536   /* size of the buffer used when reading task output */
+#define BMSCRIPT_ENGINE_READS_PER_WAKEUP    16      /* chunks read from one task before the others get their turn */
+#define BMSCRIPT_ENGINE_MAX_EVENTS          64      /* events fetched per epoll_wait */
+
+static BMScriptEngine * BMScriptSharedEngine = nil;
+
+
+/* One background task and everything the I/O thread needs to know about it. Only touched on the I/O thread. */
+@interface BMScriptEngineJob : NSObject {
+ @public
+    BMScriptTask * task;
+    NSFileHandle * handle;
+    NSFileHandle * errorHandle;
+    id<BMScriptEngineClient> client;
+    NSThread * deliveryThread;
+    NSOperationQueue * deliveryQueue;
+    int outfd;
+    int errfd;                  /* -1 unless stderr has a pipe of its own */
+    int exitfd;
+    BOOL eof;
+    BOOL errEof;
+    BOOL exited;
+    BOOL outputSuspended;       /* the output descriptor is not being watched because of backpressure */
+    NSUInteger highWaterMark;   /* 0 unless output is streamed to the delivery target */
+    NSMutableArray * outbox;    /* streamed chunks and the completion marker, guarded by the engine's lock */
+    NSUInteger outboxBytes;
+    BOOL deliveryScheduled;
+    BOOL readingPaused;         /* set when outboxBytes reaches highWaterMark, cleared once it is down to half of it */
+    NSTimeInterval deadline;
+    NSTimeInterval nextEscalation;
+    NSTimeInterval nextReap;
+    NSUInteger terminationStep;
+    ExecutionStatus terminationReason;
+}
+@end
+
+@implementation BMScriptEngineJob
+
+- (void) dealloc {
+    [task release], task = nil;
+    [handle release], handle = nil;
+    [errorHandle release], errorHandle = nil;
+    [client release], client = nil;
+    [deliveryThread release], deliveryThread = nil;
+    [deliveryQueue release], deliveryQueue = nil;
+    [outbox release], outbox = nil;
+    [super dealloc];
+}
+
+@end
+
+
+@interface BMScriptEngine (/* Private */)
+- (void) run;
+- (void) takeCommands;
+- (void) waitForEventsWithTimeout:(int)timeout;
+- (int) timeoutUntilNextTimer;
+- (void) fireTimers;
+- (void) finishJobs;
+- (void) watchJob:(BMScriptEngineJob *)job;
+- (void) unwatchDescriptor:(int)fd;
+- (void) setWatchesOutput:(BOOL)flag ofJob:(BMScriptEngineJob *)job;
+- (void) updateSuspendedJobs;
+- (void) serviceJob:(BMScriptEngineJob *)job;
+- (BOOL) readJob:(BMScriptEngineJob *)job;
+- (BOOL) readErrorOfJob:(BMScriptEngineJob *)job;
+- (void) escalateJob:(BMScriptEngineJob *)job;
+- (void) deliverCompletionOfJob:(BMScriptEngineJob *)job;
+- (BOOL) postItem:(id)item length:(NSUInteger)length toJob:(BMScriptEngineJob *)job;
+- (void) deliverOutboxOfJob:(BMScriptEngineJob *)job;
+@end
+
+@implementation BMScriptEngine
+
++ (BMScriptEngine *) sharedEngine {
+    @synchronized(self) {
+        if (!BMScriptSharedEngine) {
+            BMScriptSharedEngine = [[BMScriptEngine alloc] init];
+        }
+    }
+    return BMScriptSharedEngine;
+}
+
+- (id) init {
+    if ((self = [super init])) {
+        eventDescriptor = -1;
+        if (pipe(wakeupPipe) != 0) {
+            NSLog(@"%@ Error: Could not create wakeup pipe: %s", [self className], strerror(errno));
+            wakeupPipe[0] = wakeupPipe[1] = -1;
+            [self release];
+            return nil;
+        }
+        for (NSUInteger i = 0; i < 2; i++) {
+            fcntl(wakeupPipe[i], F_SETFD, FD_CLOEXEC);
+            fcntl(wakeupPipe[i], F_SETFL, O_NONBLOCK);
+        }
+        #if defined(__linux__)
+            eventDescriptor = epoll_create1(EPOLL_CLOEXEC);
+            if (eventDescriptor >= 0) {
+                struct epoll_event ev;
+                ev.events = EPOLLIN;
+                ev.data.ptr = NULL;
+                if (epoll_ctl(eventDescriptor, EPOLL_CTL_ADD, wakeupPipe[0], &ev) != 0) {
+                    close(eventDescriptor), eventDescriptor = -1;
+                }
+            }
+        #endif
+        lock = [[NSLock alloc] init];
+        incomingJobs = [[NSMutableArray alloc] init];
+        cancelledTasks = [[NSMutableArray alloc] init];
+        jobs = [[NSMutableArray alloc] init];
+        ioThread = [[NSThread alloc] initWithTarget:self selector:@selector(run) object:nil];
+        [ioThread setName:@"BMScriptEngine I/O"];
+        [ioThread start];
+    }
+    return self;
+}
+
+// the shared engine lives as long as the process, so there is no -dealloc tearing down the I/O thread
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%lu tasks)", [super description], (unsigned long)[self taskCount]];
+}
+
+- (NSThread *) ioThread {
+    return ioThread;
+}
+
+- (NSUInteger) taskCount {
+    [lock lock];
+    NSUInteger count = taskCount;
+    [lock unlock];
+    return count;
+}
+
+// MARK: Commands
+
+- (void) addTask:(BMScriptTask *)aTask
+    outputHandle:(NSFileHandle *)handle
+       timeLimit:(NSTimeInterval)limit
+          client:(id<BMScriptEngineClient>)client
+  deliveryThread:(NSThread *)thread
+   deliveryQueue:(NSOperationQueue *)queue {
+    [self addTask:aTask outputHandle:handle timeLimit:limit client:client deliveryThread:thread deliveryQueue:queue highWaterMark:0];
+}
+
+- (void) addTask:(BMScriptTask *)aTask
+    outputHandle:(NSFileHandle *)handle
+       timeLimit:(NSTimeInterval)limit
+          client:(id<BMScriptEngineClient>)client
+  deliveryThread:(NSThread *)thread
+   deliveryQueue:(NSOperationQueue *)queue
+   highWaterMark:(NSUInteger)mark {
+    [self addTask:aTask outputHandle:handle errorHandle:nil timeLimit:limit client:client deliveryThread:thread deliveryQueue:queue highWaterMark:mark];
+}
+
+- (void) addTask:(BMScriptTask *)aTask
+    outputHandle:(NSFileHandle *)handle
+     errorHandle:(NSFileHandle *)errorHandle
+       timeLimit:(NSTimeInterval)limit
+          client:(id<BMScriptEngineClient>)client
+  deliveryThread:(NSThread *)thread
+   deliveryQueue:(NSOperationQueue *)queue
+   highWaterMark:(NSUInteger)mark {
+
+    BMScriptEngineJob * job = [[[BMScriptEngineJob alloc] init] autorelease];
+    job->task = [aTask retain];
+    job->handle = [handle retain];
+    job->errorHandle = [errorHandle retain];
+    job->client = [client retain];
+    job->deliveryThread = [thread retain];
+    job->deliveryQueue = [queue retain];
+    job->outfd = [handle fileDescriptor];
+    job->errfd = (errorHandle ? [errorHandle fileDescriptor] : -1);
+    job->errEof = (job->errfd < 0);
+    job->exitfd = [aTask exitFileDescriptor];
+    job->nextReap = [NSDate timeIntervalSinceReferenceDate];
+    job->deadline = (limit > 0 ? job->nextReap + limit : 0);
+    job->terminationReason = BMScriptNotExecuted;
+    if (mark > 0) {
+        job->highWaterMark = mark;
+        job->outbox = [[NSMutableArray alloc] init];
+    }
+
+    fcntl(job->outfd, F_SETFL, fcntl(job->outfd, F_GETFL) | O_NONBLOCK);
+    if (job->errfd >= 0) {
+        fcntl(job->errfd, F_SETFL, fcntl(job->errfd, F_GETFL) | O_NONBLOCK);
+    }
+
+    [lock lock];
+    [incomingJobs addObject:job];
+    taskCount++;
+    [lock unlock];
+
+    (void) write(wakeupPipe[1], "a", 1);
+}
+
+- (void) cancelTask:(BMScriptTask *)aTask {
+    if (!aTask) return;
+    [lock lock];
+    [cancelledTasks addObject:aTask];
+    [lock unlock];
+    (void) write(wakeupPipe[1], "c", 1);
+}
+
+// MARK: I/O Thread
+
+- (void) run {
+    for (;;) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        [self takeCommands];
+        [self waitForEventsWithTimeout:[self timeoutUntilNextTimer]];
+        [self fireTimers];
+        [self finishJobs];
+        [pool drain];
+    }
+}
+
+- (void) takeCommands {
+
+    [lock lock];
+    NSArray * added = [[incomingJobs copy] autorelease];
+    NSArray * cancelled = [[cancelledTasks copy] autorelease];
+    [incomingJobs removeAllObjects];
+    [cancelledTasks removeAllObjects];
+    [lock unlock];
+
+    for (BMScriptEngineJob * job in added) {
+        [jobs addObject:job];
+        [self watchJob:job];
+    }
+    [self updateSuspendedJobs];
+    for (BMScriptTask * aTask in cancelled) {
+        for (BMScriptEngineJob * job in jobs) {
+            if (job->task == aTask && !job->exited && job->terminationReason == BMScriptNotExecuted) {
+                job->terminationReason = BMScriptCancelled;
+                [self escalateJob:job];
+            }
+        }
+    }
+}
+
+- (void) watchJob:(BMScriptEngineJob *)job {
+    #if defined(__linux__)
+        if (eventDescriptor >= 0) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = job;
+            if (epoll_ctl(eventDescriptor, EPOLL_CTL_ADD, job->outfd, &ev) != 0) {
+                job->eof = YES;
+            }
+            if (!job->errEof && epoll_ctl(eventDescriptor, EPOLL_CTL_ADD, job->errfd, &ev) != 0) {
+                job->errEof = YES;
+            }
+            if (job->exitfd >= 0 && epoll_ctl(eventDescriptor, EPOLL_CTL_ADD, job->exitfd, &ev) != 0) {
+                job->exitfd = -1;
+            }
+        }
+    #endif
+    // the child may have exited before we got here, have a look right away
+    [self serviceJob:job];
+}
+
+- (void) unwatchDescriptor:(int)fd {
+    #if defined(__linux__)
+        if (eventDescriptor >= 0 && fd >= 0) {
+            struct epoll_event ev;
+            epoll_ctl(eventDescriptor, EPOLL_CTL_DEL, fd, &ev);
+        }
+    #else
+        #pragma unused(fd)
+    #endif
+}
+
+/* the poll backend skips suspended descriptors when it builds its set, epoll needs to be told */
+- (void) setWatchesOutput:(BOOL)flag ofJob:(BMScriptEngineJob *)job {
+    job->outputSuspended = !flag;
+    #if defined(__linux__)
+        if (eventDescriptor >= 0) {
+            struct epoll_event ev;
+            ev.events = (flag ? EPOLLIN : 0);
+            ev.data.ptr = job;
+            epoll_ctl(eventDescriptor, EPOLL_CTL_MOD, job->outfd, &ev);
+        }
+    #endif
+}
+
+/* resumes reading from streaming jobs whose consumer has caught up */
+- (void) updateSuspendedJobs {
+    for (BMScriptEngineJob * job in jobs) {
+        if (!job->outputSuspended || job->eof) continue;
+        [lock lock];
+        BOOL paused = job->readingPaused;
+        [lock unlock];
+        if (!paused) {
+            [self setWatchesOutput:YES ofJob:job];
+        }
+    }
+}
+
+/* epoll where we have it, otherwise a poll set rebuilt on every round */
+- (void) waitForEventsWithTimeout:(int)timeout {
+
+    char buffer[64];
+
+    #if defined(__linux__)
+    if (eventDescriptor >= 0) {
+        struct epoll_event events[BMSCRIPT_ENGINE_MAX_EVENTS];
+        int n = epoll_wait(eventDescriptor, events, BMSCRIPT_ENGINE_MAX_EVENTS, timeout);
+        for (int i = 0; i < n; i++) {
+            BMScriptEngineJob * job = events[i].data.ptr;
+            if (job) {
+                [self serviceJob:job];
+            } else {
+                while (read(wakeupPipe[0], buffer, sizeof(buffer)) > 0);
+            }
+        }
+        return;
+    }
+    #endif
+
+    // output, error output and exit descriptor of each job, behind the wakeup pipe
+    NSUInteger count = [jobs count];
+    struct pollfd * fds = malloc((1 + 3 * count) * sizeof(struct pollfd));
+    if (!fds) return;
+
+    fds[0].fd = wakeupPipe[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        BMScriptEngineJob * job = [jobs objectAtIndex:i];
+        struct pollfd * jobfds = fds + 1 + 3 * i;
+        jobfds[0].fd = ((job->eof || job->outputSuspended) ? -1 : job->outfd);
+        jobfds[1].fd = (job->errEof ? -1 : job->errfd);
+        jobfds[2].fd = (job->exited ? -1 : job->exitfd);
+        for (NSUInteger j = 0; j < 3; j++) {
+            jobfds[j].events = POLLIN;
+            jobfds[j].revents = 0;
+        }
+    }
+
+    if (poll(fds, (nfds_t)(1 + 3 * count), timeout) > 0) {
+        if (fds[0].revents) {
+            while (read(wakeupPipe[0], buffer, sizeof(buffer)) > 0);
+        }
+        for (NSUInteger i = 0; i < count; i++) {
+            struct pollfd * jobfds = fds + 1 + 3 * i;
+            if (jobfds[0].revents || jobfds[1].revents || jobfds[2].revents) {
+                [self serviceJob:[jobs objectAtIndex:i]];
+            }
+        }
+    }
+    free(fds);
+}
+
+/* milliseconds until the earliest time limit, termination step or reap check is due, -1 if there is none */
+- (int) timeoutUntilNextTimer {
+
+    NSTimeInterval due = 0;
+
+    for (BMScriptEngineJob * job in jobs) {
+        if (job->exited) {
+            // a job waiting for its consumer to catch up is woken through the wakeup pipe
+            if (job->outputSuspended && !job->eof) continue;
+            return 0;
+        }
+        NSTimeInterval jobDue = (job->terminationReason == BMScriptNotExecuted ? job->deadline : job->nextEscalation);
+        if (job->exitfd < 0 && (jobDue == 0 || job->nextReap < jobDue)) {
+            jobDue = job->nextReap;
+        }
+        if (jobDue > 0 && (due == 0 || jobDue < due)) {
+            due = jobDue;
+        }
+    }
+    if (due == 0) return -1;
+
+    int timeout = (int) ceil((due - [NSDate timeIntervalSinceReferenceDate]) * 1000.0);
+    return (timeout < 0 ? 0 : timeout);
+}
+
+- (void) fireTimers {
+
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    for (BMScriptEngineJob * job in jobs) {
+        if (job->exited) continue;
+        if (job->terminationReason == BMScriptNotExecuted) {
+            if (job->deadline > 0 && now >= job->deadline) {
+                job->terminationReason = BMScriptTimedOut;
+                [self escalateJob:job];
+            }
+        } else if (job->nextEscalation > 0 && now >= job->nextEscalation) {
+            [self escalateJob:job];
+        }
+        if (job->exitfd < 0 && now >= job->nextReap) {
+            if ([job->task isRunning]) {
+                job->nextReap = now + BMSCRIPT_ENGINE_REAP_INTERVAL;
+            } else {
+                job->exited = YES;
+                if (!job->eof && !job->outputSuspended) [self readJob:job];
+                if (!job->errEof) [self readErrorOfJob:job];
+            }
+        }
+    }
+}
+
+- (void) finishJobs {
+
+    NSUInteger i = 0;
+    while (i < [jobs count]) {
+        BMScriptEngineJob * job = [jobs objectAtIndex:i];
+        if (!job->exited) {
+            i++;
+            continue;
+        }
+        // the child is gone but may have left more in the pipes than one round reads. 
+        // drain them, unless the consumer falls behind again and reading pauses.
+        while (!job->eof && !job->outputSuspended && [self readJob:job]);
+        while (!job->errEof && [self readErrorOfJob:job]);
+        if (job->outputSuspended && !job->eof) {
+            i++;
+            continue;
+        }
+        if (!job->eof) [self unwatchDescriptor:job->outfd];
+        if (!job->errEof) [self unwatchDescriptor:job->errfd];
+
+        // whatever the script left behind in its process group goes too. the child is still a
+        // zombie until waitUntilExit reaped it, so the process group id can't have been recycled.
+        if (job->terminationReason != BMScriptNotExecuted) {
+            [job->task signalProcessGroup:SIGKILL];
+        }
+        [job->task waitUntilExit];
+
+        [lock lock];
+        taskCount--;
+        [lock unlock];
+
+        if (job->highWaterMark > 0) {
+            // queued up behind the chunks that still wait for delivery
+            [self postItem:[NSNull null] length:0 toJob:job];
+        } else {
+            [self deliverCompletionOfJob:job];
+        }
+        [jobs removeObjectAtIndex:i];
+    }
+}
+
+/* reads what is available and checks whether the child exited. exit is checked first,
+   so the read that follows picks up everything the child wrote before it went away.
+   jobs that already exited are still read, their output may have been paused for the consumer */
+- (void) serviceJob:(BMScriptEngineJob *)job {
+
+    if (!job->exited && job->exitfd >= 0) {
+        struct pollfd pfd = { job->exitfd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) > 0) {
+            job->exited = YES;
+            [self unwatchDescriptor:job->exitfd];
+        }
+    }
+    if (!job->eof && !job->outputSuspended) {
+        [self readJob:job];
+    }
+    if (!job->errEof) {
+        [self readErrorOfJob:job];
+    }
+    if (job->eof && job->errEof && job->exitfd < 0 && !job->exited) {
+        // no exit descriptor: EOF usually means the child is about to go, make the reap check due now
+        job->nextReap = [NSDate timeIntervalSinceReferenceDate];
+    }
+}
+
+/* returns YES if it stopped after BMSCRIPT_ENGINE_READS_PER_WAKEUP reads with more possibly waiting */
+- (BOOL) readJob:(BMScriptEngineJob *)job {
+
+    char buffer[BMSCRIPT_ENGINE_READ_BUFFER_SIZE];
+
+    for (NSUInteger reads = 0; reads < BMSCRIPT_ENGINE_READS_PER_WAKEUP; reads++) {
+        ssize_t n = read(job->outfd, buffer, sizeof(buffer));
+        if (n > 0) {
+            NSData * data = [[NSData alloc] initWithBytes:buffer length:(NSUInteger)n];
+            if (job->highWaterMark > 0) {
+                BOOL full = [self postItem:data length:(NSUInteger)n toJob:job];
+                [data release];
+                if (full) {
+                    // backpressure: leave the rest in the pipe until the consumer has caught up
+                    [self setWatchesOutput:NO ofJob:job];
+                    return NO;
+                }
+                continue;
+            }
+            @try {
+                [job->client engine:self didReadData:data fromTask:job->task];
+            }
+            @catch (NSException * e) {
+                NSLog(@"%@ Warning: Client %@ raised %@: %@", [self className], job->client, [e name], [e reason]);
+            }
+            [data release];
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            job->eof = YES;
+            [self unwatchDescriptor:job->outfd];
+        }
+        return NO;
+    }
+    return YES;
+}
+
+/* error output is small as a rule and never streamed, so it goes straight to the client */
+- (BOOL) readErrorOfJob:(BMScriptEngineJob *)job {
+
+    char buffer[BMSCRIPT_ENGINE_READ_BUFFER_SIZE];
+
+    for (NSUInteger reads = 0; reads < BMSCRIPT_ENGINE_READS_PER_WAKEUP; reads++) {
+        ssize_t n = read(job->errfd, buffer, sizeof(buffer));
+        if (n > 0) {
+            NSData * data = [[NSData alloc] initWithBytes:buffer length:(NSUInteger)n];
+            @try {
+                [job->client engine:self didReadErrorData:data fromTask:job->task];
+            }
+            @catch (NSException * e) {
+                NSLog(@"%@ Warning: Client %@ raised %@: %@", [self className], job->client, [e name], [e reason]);
+            }
+            [data release];
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            job->errEof = YES;
+            [self unwatchDescriptor:job->errfd];
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (void) escalateJob:(BMScriptEngineJob *)job {
+    job->nextEscalation = ([job->task escalateTermination:&job->terminationStep] ?
+                           [NSDate timeIntervalSinceReferenceDate] + BMSCRIPT_TERMINATION_GRACE_PERIOD : 0);
+}
+
+- (void) deliverCompletionOfJob:(BMScriptEngineJob *)job {
+
+    SEL selector = @selector(engine:taskDidFinish:terminationReason:);
+    BMScriptEngine * engine = self;
+    ExecutionStatus reason = job->terminationReason;
+
+    NSInvocation * invocation = [NSInvocation invocationWithMethodSignature:[job->client methodSignatureForSelector:selector]];
+    [invocation setTarget:job->client];
+    [invocation setSelector:selector];
+    [invocation setArgument:&engine atIndex:2];
+    [invocation setArgument:&job->task atIndex:3];
+    [invocation setArgument:&reason atIndex:4];
+    [invocation retainArguments];
+
+    if (job->deliveryThread) {
+        [invocation performSelector:@selector(invoke) onThread:job->deliveryThread withObject:nil waitUntilDone:NO];
+    } else if (job->deliveryQueue) {
+        [job->deliveryQueue addOperation:[[[NSInvocationOperation alloc] initWithInvocation:invocation] autorelease]];
+    } else {
+        @try {
+            [invocation invoke];
+        }
+        @catch (NSException * e) {
+            NSLog(@"%@ Warning: Client %@ raised %@: %@", [self className], job->client, [e name], [e reason]);
+        }
+    }
+}
+
+// MARK: Streaming
+
+/* appends a chunk (or the completion marker, NSNull) to the outbox and makes sure a delivery is on its way.
+   returns YES if reading should pause because the consumer is more than highWaterMark bytes behind */
+- (BOOL) postItem:(id)item length:(NSUInteger)length toJob:(BMScriptEngineJob *)job {
+
+    [lock lock];
+    [job->outbox addObject:item];
+    job->outboxBytes += length;
+    if (job->outboxBytes >= job->highWaterMark) {
+        job->readingPaused = YES;
+    }
+    BOOL schedule = !job->deliveryScheduled;
+    job->deliveryScheduled = YES;
+    [lock unlock];
+
+    if (schedule) {
+        if (job->deliveryThread) {
+            [self performSelector:@selector(deliverOutboxOfJob:) onThread:job->deliveryThread withObject:job waitUntilDone:NO];
+        } else if (job->deliveryQueue) {
+            [job->deliveryQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self 
+                                                                                  selector:@selector(deliverOutboxOfJob:) 
+                                                                                    object:job] autorelease]];
+        } else {
+            [self deliverOutboxOfJob:job];
+        }
+    }
+
+    [lock lock];
+    BOOL paused = job->readingPaused;
+    [lock unlock];
+    return paused;
+}
+
+/* runs on the delivery target. only one delivery per job is scheduled at a time, which keeps the chunks in order
+   even on an operation queue that runs several operations at once */
+- (void) deliverOutboxOfJob:(BMScriptEngineJob *)job {
+
+    for (;;) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+
+        [lock lock];
+        if ([job->outbox count] == 0) {
+            job->deliveryScheduled = NO;
+            [lock unlock];
+            [pool drain];
+            break;
+        }
+        id item = [[[job->outbox objectAtIndex:0] retain] autorelease];
+        [job->outbox removeObjectAtIndex:0];
+        [lock unlock];
+
+        BOOL isCompletion = (item == [NSNull null]);
+        @try {
+            if (isCompletion) {
+                [job->client engine:self taskDidFinish:job->task terminationReason:job->terminationReason];
+            } else {
+                [job->client engine:self didReadData:item fromTask:job->task];
+            }
+        }
+        @catch (NSException * e) {
+            NSLog(@"%@ Warning: Client %@ raised %@: %@", [self className], job->client, [e name], [e reason]);
+        }
+
+        [lock lock];
+        job->outboxBytes -= (isCompletion ? 0 : [item length]);
+        BOOL resume = (job->readingPaused && job->outboxBytes <= job->highWaterMark / 2);
+        if (resume) {
+            job->readingPaused = NO;
+        }
+        [lock unlock];
+
+        if (resume) {
+            (void) write(wakeupPipe[1], "r", 1);
+        }
+        [pool drain];
+    }
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,177 @@
+//
+//  BMScriptHistory.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptHistory.h
+ * Class interface of BMScriptHistory.
+ */
+
+#import "BMDefines.h"
+#import <Foundation/Foundation.h>
+
+@class BMScriptHistoryLog;
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*! Default for BMScriptHistory#limit, the number of items kept. 0 means no limit. */
+#ifndef BMSCRIPT_HISTORY_LIMIT
+    #define BMSCRIPT_HISTORY_LIMIT 1000
+#endif
+
+/*! Default for BMScriptHistory#byteLimit, the number of bytes of sources and results kept. 0 means no limit. */
+#ifndef BMSCRIPT_HISTORY_BYTE_LIMIT
+    #define BMSCRIPT_HISTORY_BYTE_LIMIT (16ULL * 1024 * 1024)
+#endif
+
+/*! Number of items per chunk of a BMScriptHistory. Snapshots share the chunks of the history they were taken from. */
+#ifndef BMSCRIPT_HISTORY_CHUNK_ITEMS
+    #define BMSCRIPT_HISTORY_CHUNK_ITEMS 64
+#endif
+
+/*! @} */
+
+@class BMScriptHistorySnapshot;
+
+/*!
+ * @class BMScriptHistory
+ * The execution history of a BMScript: a bounded list of items, each the script source, the result and the
+ * stderr result of one execution.
+ *
+ * Items are appended to chunks of #BMSCRIPT_HISTORY_CHUNK_ITEMS, and a filled slot never changes again. An item
+ * is kept as three pointers rather than as an NSArray of its own. Sources and results are interned: equal
+ * sources (or results) of any number of items are stored once and counted once towards BMScriptHistory#byteLimit,
+ * so a script that runs the same source over and over costs a few bytes per execution.
+ *
+ * Once there are more than BMScriptHistory#limit items, or their distinct sources and results take up more than
+ * BMScriptHistory#byteLimit bytes, the oldest items are dropped. The newest item is always kept, however large.
+ * Indexes are relative to the oldest item still kept. Dropped items are released right away, or when the last
+ * snapshot that still shows them goes away.
+ *
+ * #snapshot hands out the items as an immutable BMScriptHistorySnapshot that shares the chunks instead of copying
+ * the items. Every change bumps BMScriptHistory#generation; as long as it stays the same, #snapshot returns the
+ * same object, so polling an unchanged history costs nothing.
+ *
+ * With a BMScriptHistory#log the items are appended to the log instead and looked up there; the limits and the
+ * byte count then only concern the (empty) chunks.
+ *
+ * Items are handed out as NSArrays of three entries, as BMScript always has. All methods are thread-safe.
+ */
+@interface BMScriptHistory : NSObject <NSCopying> {
+ @private
+    NSLock * lock;
+    NSMutableArray * chunks;
+    NSUInteger head;
+    NSUInteger count;
+    NSCountedSet * atoms;
+    unsigned long long byteCount;
+    NSUInteger limit;
+    unsigned long long byteLimit;
+    NSUInteger evictionCount;
+    BMScriptHistoryLog * log;
+    unsigned long long generation;
+    BMScriptHistorySnapshot * snapshot;
+}
+
+/*! Gets or sets the number of items kept. 0 means no limit. Defaults to #BMSCRIPT_HISTORY_LIMIT. */
+@property (BM_ATOMIC assign) NSUInteger limit;
+/*! Gets or sets the number of bytes the distinct sources and results of the items may take up. 0 means no limit. Defaults to #BMSCRIPT_HISTORY_BYTE_LIMIT. */
+@property (BM_ATOMIC assign) unsigned long long byteLimit;
+/*!
+ * Gets or sets the persistent log the items are kept in, or nil to keep them in memory. Setting a log appends the
+ * items kept in memory to it. Copies of the history share the log. Defaults to nil.
+ */
+@property (BM_ATOMIC retain) BMScriptHistoryLog * log;
+
+/*! Initializes an empty history with the default limits. */
+- (id) init;
+/*!
+ * Initializes an empty history. This is the designated initializer.
+ * @param maxItems the number of items kept, 0 for no limit
+ * @param maxBytes the number of bytes of sources and results kept, 0 for no limit
+ */
+- (id) initWithLimit:(NSUInteger)maxItems byteLimit:(unsigned long long)maxBytes;
+
+/*!
+ * Adds an item, dropping the oldest items if a limit is exceeded.
+ * @param item an NSArray with the source, the result and optionally the stderr result. Missing or NSNull entries are stored as nil.
+ */
+- (void) addItem:(NSArray *)item;
+/*! Removes all items. */
+- (void) removeAllItems;
+
+/*! Returns the number of items kept. */
+- (NSUInteger) count;
+/*!
+ * Returns the item at an index as an NSArray of source, result and stderr result.
+ * @throws NSRangeException if index is beyond the end of the history
+ */
+- (NSArray *) objectAtIndex:(NSUInteger)index;
+/*! Returns the newest item or nil if the history is empty. */
+- (NSArray *) lastObject;
+/*! Returns all items kept, oldest first. The same as #snapshot. */
+- (NSArray *) allItems;
+/*!
+ * Returns the items kept as an immutable array that shares the storage of the history. Taking a snapshot copies
+ * one pointer per chunk, and nothing at all if the history hasn't changed since the last one.
+ */
+- (BMScriptHistorySnapshot *) snapshot;
+/*! Returns a number that changes whenever an item is added or dropped. */
+- (unsigned long long) generation;
+
+/*! Returns the number of bytes taken up by the distinct sources and results of the items. */
+- (unsigned long long) byteCount;
+/*! Returns the number of items dropped so far because a limit was exceeded. */
+- (NSUInteger) evictionCount;
+
+@end
+
+
+/*!
+ * @class BMScriptHistorySnapshot
+ * An immutable view of the items of a BMScriptHistory at one point in time, returned by BMScriptHistory#snapshot
+ * and BMScript#history.
+ *
+ * A snapshot shares the chunks of the history: later changes to the history don't show, and nothing is copied.
+ * Items are NSArrays of source, result and stderr result, made when asked for; #sourceAtIndex:,
+ * #resultAtIndex: and #errorResultAtIndex: return the stored objects without making one.
+ * #subarrayWithRange: returns a snapshot of a range of items in O(1) and fast enumeration (for ... in) walks the
+ * items without an intermediate array.
+ *
+ * A snapshot of a history kept in a BMScriptHistoryLog looks its items up in the log. It stays valid as long as
+ * the items are not removed from the log.
+ */
+@interface BMScriptHistorySnapshot : NSArray {
+ @private
+    NSArray * chunks;
+    BMScriptHistoryLog * log;
+    NSUInteger start;
+    NSUInteger count;
+}
+
+/*! Returns the script source of the item at an index. @throws NSRangeException if index is beyond the end */
+- (id) sourceAtIndex:(NSUInteger)index;
+/*! Returns the result of the item at an index. @throws NSRangeException if index is beyond the end */
+- (id) resultAtIndex:(NSUInteger)index;
+/*! Returns the stderr result of the item at an index, or nil. @throws NSRangeException if index is beyond the end */
+- (id) errorResultAtIndex:(NSUInteger)index;
+
+@end
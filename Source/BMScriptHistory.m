@@ -0,0 +1,500 @@
+//
+//  BMScriptHistory.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptHistory.h"
+#import "BMScriptHistoryLog.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* One execution. Slots are filled once and emptied once evicted and out of sight of all snapshots. */
+typedef struct BMScriptHistoryEntry {
+    id source;
+    id result;
+    id errorResult;
+} BMScriptHistoryEntry;
+
+/* what an object is charged against the byte limit when it is first interned */
+static unsigned long long BMScriptHistoryCost(id object) {
+    if ([object isKindOfClass:[NSData class]]) return [object length];
+    if ([object isKindOfClass:[NSString class]]) return [object length] * sizeof(unichar);
+    return 0;
+}
+
+static NSArray * BMScriptHistoryItem(const BMScriptHistoryEntry * entry) {
+    // same shape as -[BMScript historyItem], which stops at the first nil
+    return [NSArray arrayWithObjects:entry->source, entry->result, entry->errorResult, nil];
+}
+
+static NSException * BMScriptHistoryRangeException(NSString * className, NSUInteger index, NSUInteger count) {
+    return [NSException exceptionWithName:NSRangeException
+                                   reason:[NSString stringWithFormat:@"%@: index (%lu) beyond bounds (%lu)", className, (unsigned long)index, (unsigned long)count]
+                                 userInfo:nil];
+}
+
+
+/* guards evicted, released and pins of all chunks. taken once per eviction and once per snapshot made or gone. */
+static pthread_mutex_t BMScriptHistoryPinLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A fixed number of slots, shared by the history and all snapshots that cover them.
+   Slots before evicted are no longer part of the history; those before released are empty.
+   pins counts the snapshots sharing the chunk, evicted slots are emptied once there are none. */
+@interface BMScriptHistoryChunk : NSObject {
+ @public
+    NSUInteger used;
+    NSUInteger evicted;
+    NSUInteger released;
+    NSUInteger pins;
+    BMScriptHistoryEntry entries[BMSCRIPT_HISTORY_CHUNK_ITEMS];
+}
+- (void) releaseEntriesBelow:(NSUInteger)end;
+@end
+
+@implementation BMScriptHistoryChunk
+
+- (void) dealloc {
+    [self releaseEntriesBelow:used];
+    [super dealloc];
+}
+
+- (void) releaseEntriesBelow:(NSUInteger)end {
+    for (; released < end; released++) {
+        BMScriptHistoryEntry * entry = &entries[released];
+        [entry->source release], entry->source = nil;
+        [entry->result release], entry->result = nil;
+        [entry->errorResult release], entry->errorResult = nil;
+    }
+}
+
+@end
+
+static void BMScriptHistoryPinChunks(NSArray * chunks) {
+    pthread_mutex_lock(&BMScriptHistoryPinLock);
+    for (BMScriptHistoryChunk * chunk in chunks) {
+        chunk->pins++;
+    }
+    pthread_mutex_unlock(&BMScriptHistoryPinLock);
+}
+
+/* the last snapshot to let go of a chunk empties the slots evicted meanwhile */
+static void BMScriptHistoryUnpinChunks(NSArray * chunks) {
+    pthread_mutex_lock(&BMScriptHistoryPinLock);
+    for (BMScriptHistoryChunk * chunk in chunks) {
+        if (--chunk->pins == 0) {
+            [chunk releaseEntriesBelow:chunk->evicted];
+        }
+    }
+    pthread_mutex_unlock(&BMScriptHistoryPinLock);
+}
+
+/* absolute is the slot counted from the start of the first chunk */
+static const BMScriptHistoryEntry * BMScriptHistoryEntryAt(NSArray * chunks, NSUInteger absolute) {
+    BMScriptHistoryChunk * chunk = [chunks objectAtIndex:absolute / BMSCRIPT_HISTORY_CHUNK_ITEMS];
+    return &chunk->entries[absolute % BMSCRIPT_HISTORY_CHUNK_ITEMS];
+}
+
+
+@interface BMScriptHistorySnapshot (/* Private */)
+- (id) initWithChunks:(NSArray *)someChunks log:(BMScriptHistoryLog *)aLog start:(NSUInteger)first count:(NSUInteger)n;
+@end
+
+@implementation BMScriptHistorySnapshot
+
+- (id) initWithChunks:(NSArray *)someChunks log:(BMScriptHistoryLog *)aLog start:(NSUInteger)first count:(NSUInteger)n {
+    if ((self = [super init])) {
+        chunks = [someChunks retain];
+        BMScriptHistoryPinChunks(chunks);
+        log = [aLog retain];
+        start = first;
+        count = n;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    BMScriptHistoryUnpinChunks(chunks);
+    [chunks release], chunks = nil;
+    [log release], log = nil;
+    [super dealloc];
+}
+
+- (NSUInteger) count {
+    return count;
+}
+
+- (id) objectAtIndex:(NSUInteger)index {
+    if (index >= count) @throw BMScriptHistoryRangeException([self className], index, count);
+    if (log) return [log objectAtIndex:start + index];
+    return BMScriptHistoryItem(BMScriptHistoryEntryAt(chunks, start + index));
+}
+
+- (id) sourceAtIndex:(NSUInteger)index {
+    if (index >= count) @throw BMScriptHistoryRangeException([self className], index, count);
+    if (log) {
+        NSArray * item = [log objectAtIndex:start + index];
+        return ([item count] > 0 ? [item objectAtIndex:0] : nil);
+    }
+    return BMScriptHistoryEntryAt(chunks, start + index)->source;
+}
+
+- (id) resultAtIndex:(NSUInteger)index {
+    if (index >= count) @throw BMScriptHistoryRangeException([self className], index, count);
+    if (log) {
+        NSArray * item = [log objectAtIndex:start + index];
+        return ([item count] > 1 ? [item objectAtIndex:1] : nil);
+    }
+    return BMScriptHistoryEntryAt(chunks, start + index)->result;
+}
+
+- (id) errorResultAtIndex:(NSUInteger)index {
+    if (index >= count) @throw BMScriptHistoryRangeException([self className], index, count);
+    if (log) {
+        NSArray * item = [log objectAtIndex:start + index];
+        return ([item count] > 2 ? [item objectAtIndex:2] : nil);
+    }
+    return BMScriptHistoryEntryAt(chunks, start + index)->errorResult;
+}
+
+- (NSArray *) subarrayWithRange:(NSRange)range {
+    if (range.location > count || range.length > count - range.location) {
+        @throw [NSException exceptionWithName:NSRangeException
+                                       reason:[NSString stringWithFormat:@"%@: range %@ beyond bounds (%lu)", [self className], NSStringFromRange(range), (unsigned long)count]
+                                     userInfo:nil];
+    }
+    return [[[[self class] alloc] initWithChunks:chunks log:log start:start + range.location count:range.length] autorelease];
+}
+
+- (NSUInteger) countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(id *)buffer count:(NSUInteger)len {
+    NSUInteger index = state->state;
+    NSUInteger n = 0;
+    while (index < count && n < len) {
+        buffer[n++] = [self objectAtIndex:index++];
+    }
+    state->state = index;
+    state->itemsPtr = buffer;
+    state->mutationsPtr = &state->extra[0];     // immutable, so anything that stays put
+    return n;
+}
+
+- (id) copyWithZone:(NSZone *)zone {
+    #pragma unused(zone)
+    return [self retain];
+}
+
+- (Class) classForCoder {
+    return [NSArray class];
+}
+
+@end
+
+
+@interface BMScriptHistory (/* Private */)
+- (id) intern:(id)object;
+- (void) releaseAtom:(id)object;
+- (const BMScriptHistoryEntry *) entryAtIndex:(NSUInteger)index;
+- (void) evictToLimits;
+- (void) didChange;
+@end
+
+@implementation BMScriptHistory
+
+- (id) init {
+    return [self initWithLimit:BMSCRIPT_HISTORY_LIMIT byteLimit:BMSCRIPT_HISTORY_BYTE_LIMIT];
+}
+
+/* designated initializer */
+- (id) initWithLimit:(NSUInteger)maxItems byteLimit:(unsigned long long)maxBytes {
+    if ((self = [super init])) {
+        lock = [[NSLock alloc] init];
+        chunks = [[NSMutableArray alloc] init];
+        atoms = [[NSCountedSet alloc] init];
+        limit = maxItems;
+        byteLimit = maxBytes;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [chunks release], chunks = nil;
+    [atoms release], atoms = nil;
+    [log release], log = nil;
+    [snapshot release], snapshot = nil;
+    [lock release], lock = nil;
+    [super dealloc];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%lu items, %llu bytes, %lu evicted)",
+            [super description], (unsigned long)[self count], [self byteCount], (unsigned long)[self evictionCount]];
+}
+
+- (id) copyWithZone:(NSZone *)zone {
+    BMScriptHistory * copy = [[[self class] allocWithZone:zone] initWithLimit:self.limit byteLimit:self.byteLimit];
+    BMScriptHistoryLog * sharedLog = self.log;
+    if (sharedLog) {
+        copy.log = sharedLog;
+        return copy;
+    }
+    // the copy appends to chunks of its own, the items themselves are shared
+    for (NSArray * item in [self snapshot]) {
+        [copy addItem:item];
+    }
+    return copy;
+}
+
+// MARK: Accessors
+
+- (NSUInteger) limit {
+    [lock lock];
+    NSUInteger n = limit;
+    [lock unlock];
+    return n;
+}
+
+- (void) setLimit:(NSUInteger)maxItems {
+    [lock lock];
+    limit = maxItems;
+    [self evictToLimits];
+    [lock unlock];
+}
+
+- (unsigned long long) byteLimit {
+    [lock lock];
+    unsigned long long n = byteLimit;
+    [lock unlock];
+    return n;
+}
+
+- (void) setByteLimit:(unsigned long long)maxBytes {
+    [lock lock];
+    byteLimit = maxBytes;
+    [self evictToLimits];
+    [lock unlock];
+}
+
+- (BMScriptHistoryLog *) log {
+    [lock lock];
+    BMScriptHistoryLog * l = [[log retain] autorelease];
+    [lock unlock];
+    return l;
+}
+
+- (void) setLog:(BMScriptHistoryLog *)newLog {
+    [lock lock];
+    if (newLog != log) {
+        NSUInteger i;
+        for (i = 0; i < count; i++) {
+            [newLog addItem:BMScriptHistoryItem([self entryAtIndex:i])];
+        }
+        [chunks removeAllObjects];
+        [atoms removeAllObjects];
+        head = count = 0;
+        byteCount = 0;
+        [log release];
+        log = [newLog retain];
+        [self didChange];
+    }
+    [lock unlock];
+}
+
+- (NSUInteger) count {
+    BMScriptHistoryLog * l = self.log;
+    if (l) return [l count];
+    [lock lock];
+    NSUInteger n = count;
+    [lock unlock];
+    return n;
+}
+
+- (unsigned long long) byteCount {
+    [lock lock];
+    unsigned long long n = byteCount;
+    [lock unlock];
+    return n;
+}
+
+- (NSUInteger) evictionCount {
+    [lock lock];
+    NSUInteger n = evictionCount;
+    [lock unlock];
+    return n;
+}
+
+- (unsigned long long) generation {
+    [lock lock];
+    unsigned long long n = generation;
+    [lock unlock];
+    return n;
+}
+
+// MARK: Items
+
+- (void) addItem:(NSArray *)item {
+
+    NSUInteger n = [item count];
+
+    [lock lock];
+
+    if (log) {
+        [log addItem:item];
+        [self didChange];
+        [lock unlock];
+        return;
+    }
+
+    BMScriptHistoryChunk * chunk = [chunks lastObject];
+    if (!chunk || chunk->used == BMSCRIPT_HISTORY_CHUNK_ITEMS) {
+        chunk = [[[BMScriptHistoryChunk alloc] init] autorelease];
+        [chunks addObject:chunk];
+    }
+
+    // snapshots only look at the slots that were filled when they were taken, so this one is ours
+    BMScriptHistoryEntry * entry = &chunk->entries[chunk->used];
+    entry->source = [[self intern:(n > 0 ? [item objectAtIndex:0] : nil)] retain];
+    entry->result = [[self intern:(n > 1 ? [item objectAtIndex:1] : nil)] retain];
+    entry->errorResult = [[self intern:(n > 2 ? [item objectAtIndex:2] : nil)] retain];
+    chunk->used++;
+    count++;
+    byteCount += sizeof(BMScriptHistoryEntry);
+    [self didChange];
+
+    [self evictToLimits];
+
+    [lock unlock];
+}
+
+- (void) removeAllItems {
+    [self.log removeAllItems];
+    [lock lock];
+    [chunks removeAllObjects];
+    [atoms removeAllObjects];
+    head = count = 0;
+    byteCount = 0;
+    [self didChange];
+    [lock unlock];
+}
+
+- (NSArray *) objectAtIndex:(NSUInteger)index {
+    BMScriptHistoryLog * l = self.log;
+    if (l) return [l objectAtIndex:index];
+    [lock lock];
+    if (index >= count) {
+        NSUInteger n = count;
+        [lock unlock];
+        @throw BMScriptHistoryRangeException([self className], index, n);
+    }
+    NSArray * item = BMScriptHistoryItem([self entryAtIndex:index]);
+    [lock unlock];
+    return item;
+}
+
+- (NSArray *) lastObject {
+    BMScriptHistoryLog * l = self.log;
+    if (l) return [l lastObject];
+    [lock lock];
+    NSArray * item = (count > 0 ? BMScriptHistoryItem([self entryAtIndex:count - 1]) : nil);
+    [lock unlock];
+    return item;
+}
+
+- (NSArray *) allItems {
+    return [self snapshot];
+}
+
+- (BMScriptHistorySnapshot *) snapshot {
+    [lock lock];
+    NSUInteger n = (log ? [log count] : count);
+    if (!snapshot || [snapshot count] != n) {
+        // the log can be appended to behind our back, so its count is checked too
+        [snapshot release];
+        snapshot = [[BMScriptHistorySnapshot alloc] initWithChunks:(log ? nil : [NSArray arrayWithArray:chunks])
+                                                               log:log
+                                                             start:(log ? 0 : head)
+                                                             count:n];
+    }
+    BMScriptHistorySnapshot * s = [[snapshot retain] autorelease];
+    [lock unlock];
+    return s;
+}
+
+// MARK: Private (called with the lock held)
+
+/* returns the canonical instance of an object, adding it if it is new */
+- (id) intern:(id)object {
+    if (!object || object == [NSNull null]) return nil;
+    id member = [atoms member:object];
+    if (!member) {
+        member = [[object copy] autorelease];
+        byteCount += BMScriptHistoryCost(member);
+    }
+    [atoms addObject:member];
+    return member;
+}
+
+- (void) releaseAtom:(id)object {
+    if (!object) return;
+    if ([atoms countForObject:object] == 1) {
+        byteCount -= BMScriptHistoryCost(object);
+    }
+    [atoms removeObject:object];
+}
+
+- (const BMScriptHistoryEntry *) entryAtIndex:(NSUInteger)index {
+    return BMScriptHistoryEntryAt(chunks, head + index);
+}
+
+/* drops the oldest items while a limit is exceeded, but never the newest one */
+- (void) evictToLimits {
+    while (count > 1 && ((limit > 0 && count > limit) || (byteLimit > 0 && byteCount > byteLimit))) {
+        const BMScriptHistoryEntry * oldest = [self entryAtIndex:0];
+        [self releaseAtom:oldest->source];
+        [self releaseAtom:oldest->result];
+        [self releaseAtom:oldest->errorResult];
+
+        // the slot is emptied now unless a snapshot still covers it, then by the last of them to go
+        BMScriptHistoryChunk * chunk = [chunks objectAtIndex:0];
+        pthread_mutex_lock(&BMScriptHistoryPinLock);
+        chunk->evicted = head + 1;
+        if (chunk->pins == 0) {
+            [chunk releaseEntriesBelow:chunk->evicted];
+        }
+        pthread_mutex_unlock(&BMScriptHistoryPinLock);
+        head++;
+        count--;
+        byteCount -= sizeof(BMScriptHistoryEntry);
+        evictionCount++;
+        if (head == BMSCRIPT_HISTORY_CHUNK_ITEMS) {
+            [chunks removeObjectAtIndex:0];
+            head = 0;
+        }
+        [self didChange];
+    }
+}
+
+- (void) didChange {
+    generation++;
+    [snapshot release], snapshot = nil;
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,150 @@
+//
+//  BMScriptHistoryLog.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptHistoryLog.h
+ * Class interface of BMScriptHistoryLog.
+ */
+
+#import "BMDefines.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*! Number of items per segment of a BMScriptHistoryLog. Must not change for an existing log. */
+#ifndef BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS
+    #define BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS 4096
+#endif
+
+/*! Default for BMScriptHistoryLog#flushInterval, in seconds. */
+#ifndef BMSCRIPT_HISTORY_LOG_FLUSH_INTERVAL
+    #define BMSCRIPT_HISTORY_LOG_FLUSH_INTERVAL 0.5
+#endif
+
+/*! Number of pending items that makes a BMScriptHistoryLog write them out without waiting for the flush interval. */
+#ifndef BMSCRIPT_HISTORY_LOG_BATCH_SIZE
+    #define BMSCRIPT_HISTORY_LOG_BATCH_SIZE 64
+#endif
+
+/*! Number of compressed segments a BMScriptHistoryLog keeps inflated in memory. */
+#ifndef BMSCRIPT_HISTORY_LOG_INFLATED_SEGMENTS
+    #define BMSCRIPT_HISTORY_LOG_INFLATED_SEGMENTS 2
+#endif
+
+/*! @} */
+
+/*!
+ * @class BMScriptHistoryLog
+ * A persistent, append-only log of history items, kept in a directory of its own.
+ *
+ * Set BMScript#historyLog and the history of the script is kept here instead of in memory, so it survives the
+ * process and can grow to months of executions. BMScript#historyLimit and BMScript#historyByteLimit don't apply.
+ *
+ * The log is split into segments of #BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS items. Each segment is a record file
+ * (<span class="sourcecode">00000000.log</span>) holding the items one after the other, and an index file
+ * (<span class="sourcecode">00000000.idx</span>) holding the offset of each record. Both are memory-mapped, so
+ * looking up an item is a division and two loads, however long the log. Items are handed out as NSArrays that
+ * only read a field when it is asked for; results are NSData objects pointing into the mapping, so the
+ * pages of a result are only read in once it is used.
+ *
+ * Appending is cheap: the item goes into a queue and a background thread writes the queue out in one go once
+ * #BMSCRIPT_HISTORY_LOG_BATCH_SIZE items are waiting or BMScriptHistoryLog#flushInterval has passed. Queued
+ * items can be looked up like written ones. #flush writes the queue right away; what is still queued when the
+ * process exits is written by an exit handler. Records are written before their index entries, so after a crash
+ * the log ends with the last item whose index entry made it to disk.
+ *
+ * Full segments can be compressed with zlib (see #compressSealedSegments and BMScriptHistoryLog#compressesSealedSegments).
+ * Looking up an item in a compressed segment inflates the whole segment once; the last
+ * #BMSCRIPT_HISTORY_LOG_INFLATED_SEGMENTS inflated segments are kept around.
+ *
+ * Only one log object can have a directory open at a time, across all processes (guarded by an flock(2) on a lock
+ * file in the directory). All methods are thread-safe.
+ */
+@interface BMScriptHistoryLog : NSObject {
+ @private
+    NSString * directory;
+    NSCondition * lock;
+    NSLock * writeLock;
+    int lockFile;
+    NSMutableArray * segments;
+    NSMutableArray * inflated;
+    NSMutableArray * pending;
+    NSUInteger writtenCount;
+    int logFile;
+    int indexFile;
+    unsigned long long logLength;
+    NSTimeInterval flushInterval;
+    BOOL compressesSealedSegments;
+    BOOL writerRunning;
+}
+
+/*! Gets or sets for how many seconds appended items may wait before they are written. Defaults to #BMSCRIPT_HISTORY_LOG_FLUSH_INTERVAL. */
+@property (BM_ATOMIC assign) NSTimeInterval flushInterval;
+/*! Gets or sets whether a segment is compressed as soon as it is full. Defaults to NO. */
+@property (BM_ATOMIC assign) BOOL compressesSealedSegments;
+
+/*! Returns an autoreleased log for a directory. @see #initWithDirectory: */
++ (id) logWithDirectory:(NSString *)path;
+
+/*!
+ * Opens the log in a directory, creating the directory if needed. This is the designated initializer.
+ *
+ * Records left over past the last index entry by a crash are cut off.
+ * @param path the directory of the log
+ * @returns the log, or nil if the directory can't be created, is damaged or is already open
+ */
+- (id) initWithDirectory:(NSString *)path;
+
+/*! Returns the directory of the log. */
+- (NSString *) directory;
+
+/*!
+ * Appends an item. It is written in the background.
+ * @param item an NSArray with the source, the result and optionally the stderr result. NSStrings and NSData objects are kept, anything else is stored as nil.
+ */
+- (void) addItem:(NSArray *)item;
+/*! Writes all queued items before returning. */
+- (void) flush;
+/*! Removes all items and segment files. */
+- (void) removeAllItems;
+
+/*! Returns the number of items in the log, written or queued. */
+- (NSUInteger) count;
+/*!
+ * Returns the item at an index as an NSArray of source, result and stderr result.
+ * @throws NSRangeException if index is beyond the end of the log
+ */
+- (NSArray *) objectAtIndex:(NSUInteger)index;
+/*! Returns the newest item or nil if the log is empty. */
+- (NSArray *) lastObject;
+/*! Returns all items, oldest first. The items read their fields lazily. */
+- (NSArray *) allItems;
+
+/*!
+ * Compresses all full segments that are not compressed yet.
+ * @returns the number of segments compressed
+ */
+- (NSUInteger) compressSealedSegments;
+/*! Returns the number of bytes the segment files take up on disk. */
+- (unsigned long long) size;
+
+@end
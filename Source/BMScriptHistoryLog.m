@@ -0,0 +1,892 @@
+//
+//  BMScriptHistoryLog.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptHistoryLog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define BMSCRIPT_HISTORY_LOG_RECORD_MAGIC       "BMH1"
+#define BMSCRIPT_HISTORY_LOG_RECORD_HEADER_SIZE 32      /* magic, three field kinds, padding, three field lengths */
+#define BMSCRIPT_HISTORY_LOG_COMPRESSED_MAGIC   "BMHLZ1\n"
+#define BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER  16      /* magic, inflated length */
+
+/* what a field of a record holds */
+enum {
+    BMScriptHistoryLogFieldNone = 0,
+    BMScriptHistoryLogFieldData = 1,
+    BMScriptHistoryLogFieldString = 2
+};
+
+static NSLock * BMScriptHistoryLogRegistryLock = nil;
+static NSMutableSet * BMScriptHistoryLogsWriting = nil;
+
+static void BMScriptHistoryLogPut64(unsigned char * p, uint64_t value) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(value >> (56 - i * 8));
+    }
+}
+
+static uint64_t BMScriptHistoryLogGet64(const unsigned char * p) {
+    uint64_t value = 0;
+    int i;
+    for (i = 0; i < 8; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/* Writes all of a buffer at an offset, retrying on short writes and EINTR. */
+static BOOL BMScriptHistoryLogWriteAll(int fd, const void * bytes, size_t len, off_t offset) {
+    const char * p = bytes;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return YES;
+}
+
+/* Reads all of a range into a buffer, retrying on short reads and EINTR. */
+static BOOL BMScriptHistoryLogReadAll(int fd, void * bytes, size_t len, off_t offset) {
+    char * p = bytes;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return NO;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return YES;
+}
+
+/* Checks a record header and returns the length of the whole record, or 0 if it is damaged. */
+static uint64_t BMScriptHistoryLogRecordLength(const unsigned char * header) {
+    if (memcmp(header, BMSCRIPT_HISTORY_LOG_RECORD_MAGIC, 4) != 0) return 0;
+    uint64_t total = BMSCRIPT_HISTORY_LOG_RECORD_HEADER_SIZE;
+    int i;
+    for (i = 0; i < 3; i++) {
+        uint64_t len = BMScriptHistoryLogGet64(header + 8 + i * 8);
+        if (header[4 + i] > BMScriptHistoryLogFieldString || len > UINT64_MAX - total) return 0;
+        total += len;
+    }
+    return total;
+}
+
+/* Appends the record of an item to a buffer and returns its length. */
+static uint64_t BMScriptHistoryLogAppendRecord(NSMutableData * records, NSArray * item) {
+    unsigned char header[BMSCRIPT_HISTORY_LOG_RECORD_HEADER_SIZE];
+    NSData * fields[3];
+    NSUInteger n = [item count];
+    uint64_t total = sizeof(header);
+    int i;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, BMSCRIPT_HISTORY_LOG_RECORD_MAGIC, 4);
+    for (i = 0; i < 3; i++) {
+        id field = ((NSUInteger)i < n ? [item objectAtIndex:i] : nil);
+        fields[i] = nil;
+        if ([field isKindOfClass:[NSData class]]) {
+            header[4 + i] = BMScriptHistoryLogFieldData;
+            fields[i] = field;
+        } else if ([field isKindOfClass:[NSString class]]) {
+            header[4 + i] = BMScriptHistoryLogFieldString;
+            fields[i] = [field dataUsingEncoding:NSUTF8StringEncoding];
+        }
+        BMScriptHistoryLogPut64(header + 8 + i * 8, [fields[i] length]);
+        total += [fields[i] length];
+    }
+    [records appendBytes:header length:sizeof(header)];
+    for (i = 0; i < 3; i++) {
+        if ([fields[i] length] > 0) [records appendData:fields[i]];
+    }
+    return total;
+}
+
+/* Keeps what a record can hold: NSStrings and NSData objects, up to the first entry that is neither. */
+static NSArray * BMScriptHistoryLogNormalizedItem(NSArray * item) {
+    NSMutableArray * normalized = [NSMutableArray arrayWithCapacity:3];
+    for (id field in item) {
+        if ([normalized count] == 3 || !([field isKindOfClass:[NSData class]] || [field isKindOfClass:[NSString class]])) break;
+        [normalized addObject:[[field copy] autorelease]];
+    }
+    return normalized;
+}
+
+static void BMScriptHistoryLogFlushAtExit(void) {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    [BMScriptHistoryLogRegistryLock lock];
+    NSArray * logs = [BMScriptHistoryLogsWriting allObjects];
+    [BMScriptHistoryLogRegistryLock unlock];
+    [logs makeObjectsPerformSelector:@selector(flush)];
+    [pool drain];
+}
+
+
+/* A read-only mapping of a whole file, unmapped when the last object pointing into it is gone. */
+@interface BMScriptHistoryLogMapping : NSObject {
+ @public
+    void * bytes;
+    size_t length;
+}
+- (id) initWithPath:(NSString *)path;
+@end
+
+@implementation BMScriptHistoryLogMapping
+
+- (id) initWithPath:(NSString *)path {
+    if ((self = [super init])) {
+        int fd = open([path fileSystemRepresentation], O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+            bytes = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            length = (size_t)st.st_size;
+        }
+        if (fd >= 0) close(fd);
+        if (!bytes || bytes == MAP_FAILED) {
+            bytes = NULL;
+            [self release];
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    if (bytes) munmap(bytes, length);
+    [super dealloc];
+}
+
+- (void) finalize {
+    if (bytes) munmap(bytes, length);
+    [super finalize];
+}
+
+@end
+
+
+/* Bytes inside a mapping or an inflated segment, without a copy. Keeps its owner alive. */
+@interface BMScriptHistoryLogSlice : NSData {
+ @private
+    id owner;
+    const void * sliceBytes;
+    NSUInteger sliceLength;
+}
+- (id) initWithOwner:(id)anOwner bytes:(const void *)bytes length:(NSUInteger)length;
+@end
+
+@implementation BMScriptHistoryLogSlice
+
+- (id) initWithOwner:(id)anOwner bytes:(const void *)bytes length:(NSUInteger)length {
+    if ((self = [super init])) {
+        owner = [anOwner retain];
+        sliceBytes = bytes;
+        sliceLength = length;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [owner release], owner = nil;
+    [super dealloc];
+}
+
+- (NSUInteger) length {
+    return sliceLength;
+}
+
+- (const void *) bytes {
+    return sliceBytes;
+}
+
+- (Class) classForCoder {
+    return [NSData class];
+}
+
+@end
+
+
+/* A history item read from a record. Fields are only turned into objects when asked for. */
+@interface BMScriptHistoryLogItem : NSArray {
+ @private
+    id owner;
+    const unsigned char * record;
+    NSUInteger fieldCount;
+}
+- (id) initWithOwner:(id)anOwner record:(const unsigned char *)bytes;
+@end
+
+@implementation BMScriptHistoryLogItem
+
+- (id) initWithOwner:(id)anOwner record:(const unsigned char *)bytes {
+    if ((self = [super init])) {
+        owner = [anOwner retain];
+        record = bytes;
+        // same shape as -[BMScript historyItem], which stops at the first nil
+        while (fieldCount < 3 && record[4 + fieldCount] != BMScriptHistoryLogFieldNone) {
+            fieldCount++;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [owner release], owner = nil;
+    [super dealloc];
+}
+
+- (NSUInteger) count {
+    return fieldCount;
+}
+
+- (id) objectAtIndex:(NSUInteger)index {
+    if (index >= fieldCount) {
+        @throw [NSException exceptionWithName:NSRangeException
+                                       reason:[NSString stringWithFormat:@"BMScriptHistoryLogItem: index (%lu) beyond bounds (%lu)", (unsigned long)index, (unsigned long)fieldCount]
+                                     userInfo:nil];
+    }
+    const unsigned char * field = record + BMSCRIPT_HISTORY_LOG_RECORD_HEADER_SIZE;
+    NSUInteger i;
+    for (i = 0; i < index; i++) {
+        field += BMScriptHistoryLogGet64(record + 8 + i * 8);
+    }
+    NSUInteger len = (NSUInteger) BMScriptHistoryLogGet64(record + 8 + index * 8);
+    if (record[4 + index] == BMScriptHistoryLogFieldString) {
+        return [[[NSString alloc] initWithBytes:field length:len encoding:NSUTF8StringEncoding] autorelease];
+    }
+    return [[[BMScriptHistoryLogSlice alloc] initWithOwner:owner bytes:field length:len] autorelease];
+}
+
+- (Class) classForCoder {
+    return [NSArray class];
+}
+
+@end
+
+
+/* One segment: up to BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS records and their offsets. */
+@interface BMScriptHistoryLogSegment : NSObject {
+ @public
+    NSUInteger number;
+    NSUInteger count;
+    unsigned long long recordsLength;
+    BOOL compressed;
+    BMScriptHistoryLogMapping * records;
+    BMScriptHistoryLogMapping * offsets;
+    NSData * inflatedRecords;
+}
+@end
+
+@implementation BMScriptHistoryLogSegment
+
+- (void) dealloc {
+    [records release], records = nil;
+    [offsets release], offsets = nil;
+    [inflatedRecords release], inflatedRecords = nil;
+    [super dealloc];
+}
+
+@end
+
+
+@interface BMScriptHistoryLog (/* Private */)
+- (NSString *) pathOfSegment:(NSUInteger)number extension:(NSString *)extension;
+- (BOOL) openSegments;
+- (NSArray *) itemAtIndex:(NSUInteger)index;
+- (NSData *) inflatedRecordsOfSegment:(BMScriptHistoryLogSegment *)segment;
+- (BMScriptHistoryLogSegment *) segmentForWriting;
+- (BOOL) writePendingItems;
+- (void) runWriter;
+- (BOOL) compressSegment:(BMScriptHistoryLogSegment *)segment;
+- (void) closeFiles;
+@end
+
+@implementation BMScriptHistoryLog
+
+@synthesize compressesSealedSegments;
+
++ (void) initialize {
+    if (self == [BMScriptHistoryLog class]) {
+        BMScriptHistoryLogRegistryLock = [[NSLock alloc] init];
+        BMScriptHistoryLogsWriting = [[NSMutableSet alloc] init];
+        atexit(BMScriptHistoryLogFlushAtExit);
+    }
+}
+
++ (id) logWithDirectory:(NSString *)path {
+    return [[[self alloc] initWithDirectory:path] autorelease];
+}
+
+- (id) init {
+    return [self initWithDirectory:nil];
+}
+
+/* designated initializer */
+- (id) initWithDirectory:(NSString *)path {
+    if ((self = [super init])) {
+        logFile = indexFile = lockFile = -1;
+        NSDictionary * privateDirectory = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:0700] forKey:NSFilePosixPermissions];
+        if (!path || ![[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:privateDirectory error:NULL]) {
+            [self release];
+            return nil;
+        }
+        directory = [path copy];
+        lockFile = open([[path stringByAppendingPathComponent:@"lock"] fileSystemRepresentation], O_RDWR | O_CREAT, 0600);
+        if (lockFile < 0 || flock(lockFile, LOCK_EX | LOCK_NB) != 0) {
+            [self release];
+            return nil;
+        }
+        fcntl(lockFile, F_SETFD, FD_CLOEXEC);
+        lock = [[NSCondition alloc] init];
+        writeLock = [[NSLock alloc] init];
+        segments = [[NSMutableArray alloc] init];
+        inflated = [[NSMutableArray alloc] init];
+        pending = [[NSMutableArray alloc] init];
+        flushInterval = BMSCRIPT_HISTORY_LOG_FLUSH_INTERVAL;
+        if (![self openSegments]) {
+            [self release];
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    // a running writer retains the log, so all that can be left is what an append failed to write
+    if ([pending count] > 0) [self writePendingItems];
+    [self closeFiles];
+    if (lockFile >= 0) close(lockFile);
+    [directory release], directory = nil;
+    [lock release], lock = nil;
+    [writeLock release], writeLock = nil;
+    [segments release], segments = nil;
+    [inflated release], inflated = nil;
+    [pending release], pending = nil;
+    [super dealloc];
+}
+
+- (void) finalize {
+    if ([pending count] > 0) [self writePendingItems];
+    [self closeFiles];
+    if (lockFile >= 0) close(lockFile);
+    [super finalize];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%@, %lu items)", [super description], directory, (unsigned long)[self count]];
+}
+
+// MARK: Accessors
+
+- (NSString *) directory {
+    return directory;
+}
+
+- (NSTimeInterval) flushInterval {
+    [lock lock];
+    NSTimeInterval interval = flushInterval;
+    [lock unlock];
+    return interval;
+}
+
+- (void) setFlushInterval:(NSTimeInterval)interval {
+    [lock lock];
+    flushInterval = interval;
+    [lock signal];
+    [lock unlock];
+}
+
+- (NSUInteger) count {
+    [lock lock];
+    NSUInteger n = writtenCount + [pending count];
+    [lock unlock];
+    return n;
+}
+
+- (unsigned long long) size {
+    [lock lock];
+    NSArray * all = [[segments copy] autorelease];
+    [lock unlock];
+    unsigned long long total = 0;
+    for (BMScriptHistoryLogSegment * segment in all) {
+        for (NSString * extension in [NSArray arrayWithObjects:@"log", @"logz", @"idx", nil]) {
+            struct stat st;
+            if (stat([[self pathOfSegment:segment->number extension:extension] fileSystemRepresentation], &st) == 0) {
+                total += (unsigned long long) st.st_size;
+            }
+        }
+    }
+    return total;
+}
+
+// MARK: Items
+
+- (void) addItem:(NSArray *)item {
+    NSArray * normalized = BMScriptHistoryLogNormalizedItem(item);
+    [lock lock];
+    [pending addObject:normalized];
+    if (!writerRunning) {
+        writerRunning = YES;
+        [BMScriptHistoryLogRegistryLock lock];
+        [BMScriptHistoryLogsWriting addObject:self];
+        [BMScriptHistoryLogRegistryLock unlock];
+        [NSThread detachNewThreadSelector:@selector(runWriter) toTarget:self withObject:nil];
+    } else if ([pending count] >= BMSCRIPT_HISTORY_LOG_BATCH_SIZE) {
+        [lock signal];
+    }
+    [lock unlock];
+}
+
+- (void) flush {
+    [self writePendingItems];
+}
+
+- (void) removeAllItems {
+    [writeLock lock];
+    [lock lock];
+    [self closeFiles];
+    for (BMScriptHistoryLogSegment * segment in segments) {
+        unlink([[self pathOfSegment:segment->number extension:@"log"] fileSystemRepresentation]);
+        unlink([[self pathOfSegment:segment->number extension:@"logz"] fileSystemRepresentation]);
+        unlink([[self pathOfSegment:segment->number extension:@"idx"] fileSystemRepresentation]);
+    }
+    [segments removeAllObjects];
+    [inflated removeAllObjects];
+    [pending removeAllObjects];
+    writtenCount = 0;
+    [lock unlock];
+    [writeLock unlock];
+}
+
+- (NSArray *) objectAtIndex:(NSUInteger)index {
+    [lock lock];
+    NSUInteger n = writtenCount + [pending count];
+    NSArray * item = (index < n ? [self itemAtIndex:index] : nil);
+    [lock unlock];
+    if (index >= n) {
+        @throw [NSException exceptionWithName:NSRangeException
+                                       reason:[NSString stringWithFormat:@"BMScriptHistoryLog: index (%lu) beyond bounds (%lu)", (unsigned long)index, (unsigned long)n]
+                                     userInfo:nil];
+    }
+    if (!item) {
+        @throw [NSException exceptionWithName:NSInternalInconsistencyException
+                                       reason:[NSString stringWithFormat:@"BMScriptHistoryLog: item %lu in %@ is damaged", (unsigned long)index, directory]
+                                     userInfo:nil];
+    }
+    return item;
+}
+
+- (NSArray *) lastObject {
+    [lock lock];
+    NSUInteger n = writtenCount + [pending count];
+    NSArray * item = (n > 0 ? [self itemAtIndex:n - 1] : nil);
+    [lock unlock];
+    return item;
+}
+
+- (NSArray *) allItems {
+    [lock lock];
+    NSUInteger n = writtenCount + [pending count];
+    NSMutableArray * items = [NSMutableArray arrayWithCapacity:n];
+    NSUInteger i;
+    for (i = 0; i < n; i++) {
+        NSArray * item = [self itemAtIndex:i];
+        if (item) [items addObject:item];
+    }
+    [lock unlock];
+    return items;
+}
+
+// MARK: Compression
+
+- (NSUInteger) compressSealedSegments {
+    NSUInteger compressed = 0;
+    // like writePendingItems: the writer may be compressing the same segment, and removeAllItems must not 
+    // unlink the files while a compressed copy is on its way in, or it is left behind without its index
+    [writeLock lock];
+    [lock lock];
+    NSArray * all = [[segments copy] autorelease];
+    [lock unlock];
+    for (BMScriptHistoryLogSegment * segment in all) {
+        [lock lock];
+        BOOL sealed = (segment->count == BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS && !segment->compressed);
+        [lock unlock];
+        if (sealed && [self compressSegment:segment]) {
+            compressed++;
+        }
+    }
+    [writeLock unlock];
+    return compressed;
+}
+
+// MARK: Private
+
+- (NSString *) pathOfSegment:(NSUInteger)number extension:(NSString *)extension {
+    return [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%08lx.%@", (unsigned long)number, extension]];
+}
+
+/* Finds the segments in the directory and cuts off what a crash left behind at the end of the last one. */
+- (BOOL) openSegments {
+    NSArray * names = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:NULL];
+    NSMutableIndexSet * numbers = [NSMutableIndexSet indexSet];
+    for (NSString * name in names) {
+        const char * s = [name UTF8String];
+        char * end = NULL;
+        unsigned long number = strtoul(s, &end, 16);
+        if (end == s + 8 && strcmp(end, ".idx") == 0) [numbers addIndex:number];
+    }
+
+    NSUInteger expected = 0;
+    NSUInteger number;
+    for (number = [numbers firstIndex]; number != NSNotFound; number = [numbers indexGreaterThanIndex:number]) {
+        // segments are found by dividing the index, so there must be no gaps
+        if (number != expected++) return NO;
+
+        BMScriptHistoryLogSegment * segment = [[[BMScriptHistoryLogSegment alloc] init] autorelease];
+        segment->number = number;
+
+        NSString * idxPath = [self pathOfSegment:number extension:@"idx"];
+        NSString * logPath = [self pathOfSegment:number extension:@"log"];
+        NSString * logzPath = [self pathOfSegment:number extension:@"logz"];
+        struct stat st;
+
+        if (stat([idxPath fileSystemRepresentation], &st) != 0) return NO;
+        segment->count = (NSUInteger)(st.st_size / 8);
+        if (segment->count > BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS) return NO;
+
+        int fd = open([logzPath fileSystemRepresentation], O_RDONLY);
+        if (fd >= 0) {
+            // compressed and renamed into place, so the plain file is left over from before
+            unsigned char header[BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER];
+            BOOL ok = (BMScriptHistoryLogReadAll(fd, header, sizeof(header), 0)
+                       && memcmp(header, BMSCRIPT_HISTORY_LOG_COMPRESSED_MAGIC, 8) == 0);
+            close(fd);
+            if (!ok || segment->count != BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS) return NO;
+            segment->compressed = YES;
+            segment->recordsLength = BMScriptHistoryLogGet64(header + 8);
+            unlink([logPath fileSystemRepresentation]);
+        } else {
+            fd = open([logPath fileSystemRepresentation], O_RDWR);
+            if (fd < 0) {
+                if (errno != ENOENT || segment->count > 0) return NO;
+            } else {
+                if (fstat(fd, &st) != 0) {
+                    close(fd);
+                    return NO;
+                }
+                // drop index entries whose records didn't make it, then the bytes past the last good record
+                NSData * offsets = [NSData dataWithContentsOfFile:idxPath];
+                const unsigned char * p = [offsets bytes];
+                uint64_t end = 0;
+                if ([offsets length] < segment->count * 8) segment->count = [offsets length] / 8;
+                while (segment->count > 0) {
+                    unsigned char header[BMSCRIPT_HISTORY_LOG_RECORD_HEADER_SIZE];
+                    uint64_t offset = BMScriptHistoryLogGet64(p + (segment->count - 1) * 8);
+                    uint64_t len = 0;
+                    if (BMScriptHistoryLogReadAll(fd, header, sizeof(header), (off_t)offset)) {
+                        len = BMScriptHistoryLogRecordLength(header);
+                    }
+                    if (len > 0 && offset + len >= offset && offset + len <= (uint64_t)st.st_size) {
+                        end = offset + len;
+                        break;
+                    }
+                    segment->count--;
+                }
+                if (end < (uint64_t)st.st_size) (void) ftruncate(fd, (off_t)end);
+                close(fd);
+                (void) truncate([idxPath fileSystemRepresentation], (off_t)(segment->count * 8));
+                segment->recordsLength = end;
+            }
+        }
+        // only the last segment may be partly filled
+        if ([segments count] > 0 && ((BMScriptHistoryLogSegment *)[segments lastObject])->count != BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS) {
+            return NO;
+        }
+        [segments addObject:segment];
+        writtenCount += segment->count;
+    }
+    return YES;
+}
+
+/* Returns the item at an index below the count, or nil if its record is damaged. Must be called with the lock held. */
+- (NSArray *) itemAtIndex:(NSUInteger)index {
+
+    if (index >= writtenCount) {
+        return [pending objectAtIndex:index - writtenCount];
+    }
+
+    BMScriptHistoryLogSegment * segment = [segments objectAtIndex:index / BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS];
+    NSUInteger slot = index % BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS;
+
+    // the mappings of the segment being written only cover what was there when they were made
+    if (!segment->offsets || segment->offsets->length < (slot + 1) * 8) {
+        [segment->offsets release];
+        segment->offsets = [[BMScriptHistoryLogMapping alloc] initWithPath:[self pathOfSegment:segment->number extension:@"idx"]];
+        if (!segment->offsets || segment->offsets->length < (slot + 1) * 8) return nil;
+    }
+    uint64_t offset = BMScriptHistoryLogGet64((const unsigned char *)segment->offsets->bytes + slot * 8);
+
+    id owner = nil;
+    const unsigned char * bytes = NULL;
+    uint64_t length = 0;
+    if (segment->compressed) {
+        NSData * data = [self inflatedRecordsOfSegment:segment];
+        owner = data;
+        bytes = [data bytes];
+        length = [data length];
+    } else {
+        if (!segment->records || segment->records->length < segment->recordsLength) {
+            [segment->records release];
+            segment->records = [[BMScriptHistoryLogMapping alloc] initWithPath:[self pathOfSegment:segment->number extension:@"log"]];
+        }
+        owner = segment->records;
+        if (owner) {
+            bytes = segment->records->bytes;
+            length = segment->records->length;
+        }
+    }
+    if (!owner || offset > length || length - offset < BMSCRIPT_HISTORY_LOG_RECORD_HEADER_SIZE) return nil;
+
+    uint64_t recordLength = BMScriptHistoryLogRecordLength(bytes + offset);
+    if (recordLength == 0 || recordLength > length - offset) return nil;
+
+    return [[[BMScriptHistoryLogItem alloc] initWithOwner:owner record:bytes + offset] autorelease];
+}
+
+/* Must be called with the lock held. */
+- (NSData *) inflatedRecordsOfSegment:(BMScriptHistoryLogSegment *)segment {
+    if (!segment->inflatedRecords) {
+        NSData * file = [NSData dataWithContentsOfMappedFile:[self pathOfSegment:segment->number extension:@"logz"]];
+        NSMutableData * data = nil;
+        if ([file length] >= BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER
+            && memcmp([file bytes], BMSCRIPT_HISTORY_LOG_COMPRESSED_MAGIC, 8) == 0) {
+            uLongf inflatedLength = (uLongf) BMScriptHistoryLogGet64((const unsigned char *)[file bytes] + 8);
+            data = [NSMutableData dataWithLength:inflatedLength];
+            if (!data || uncompress([data mutableBytes], &inflatedLength,
+                                    (const Bytef *)[file bytes] + BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER,
+                                    [file length] - BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER) != Z_OK
+                || inflatedLength != [data length]) {
+                data = nil;
+            }
+        }
+        if (!data) return nil;
+        segment->inflatedRecords = [data copy];
+    }
+    [segment retain];
+    [inflated removeObject:segment];
+    [inflated addObject:segment];
+    [segment release];
+    while ([inflated count] > BMSCRIPT_HISTORY_LOG_INFLATED_SEGMENTS) {
+        // items still pointing into it keep the data alive
+        BMScriptHistoryLogSegment * oldest = [inflated objectAtIndex:0];
+        [oldest->inflatedRecords release], oldest->inflatedRecords = nil;
+        [inflated removeObjectAtIndex:0];
+    }
+    return segment->inflatedRecords;
+}
+
+/* Returns the segment to append to, starting a new one if the last is full. Must be called with the write lock held. */
+- (BMScriptHistoryLogSegment *) segmentForWriting {
+    [lock lock];
+    BMScriptHistoryLogSegment * segment = [[[segments lastObject] retain] autorelease];
+    [lock unlock];
+
+    if (!segment || segment->count == BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS) {
+        [self closeFiles];
+        NSUInteger number = (segment ? segment->number + 1 : 0);
+        logFile = open([[self pathOfSegment:number extension:@"log"] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        indexFile = open([[self pathOfSegment:number extension:@"idx"] fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (logFile < 0 || indexFile < 0) {
+            [self closeFiles];
+            return nil;
+        }
+        segment = [[[BMScriptHistoryLogSegment alloc] init] autorelease];
+        segment->number = number;
+        [lock lock];
+        [segments addObject:segment];
+        [lock unlock];
+    } else if (logFile < 0 || indexFile < 0) {
+        [self closeFiles];
+        logFile = open([[self pathOfSegment:segment->number extension:@"log"] fileSystemRepresentation], O_WRONLY | O_CREAT, 0600);
+        indexFile = open([[self pathOfSegment:segment->number extension:@"idx"] fileSystemRepresentation], O_WRONLY | O_CREAT, 0600);
+        if (logFile < 0 || indexFile < 0) {
+            [self closeFiles];
+            return nil;
+        }
+    }
+    fcntl(logFile, F_SETFD, FD_CLOEXEC);
+    fcntl(indexFile, F_SETFD, FD_CLOEXEC);
+    logLength = segment->recordsLength;
+    return segment;
+}
+
+/* Writes the queued items, a segment at a time. Returns NO if a write failed; the items stay queued. */
+- (BOOL) writePendingItems {
+    BOOL ok = YES;
+
+    [writeLock lock];
+    [lock lock];
+    NSArray * batch = [[pending copy] autorelease];
+    [lock unlock];
+
+    NSUInteger done = 0;
+    while (done < [batch count]) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        BMScriptHistoryLogSegment * segment = [self segmentForWriting];
+        if (!segment) {
+            ok = NO;
+            [pool drain];
+            break;
+        }
+
+        NSUInteger n = MIN(BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS - segment->count, [batch count] - done);
+        NSMutableData * records = [NSMutableData data];
+        NSMutableData * offsets = [NSMutableData dataWithLength:n * 8];
+        unsigned long long end = logLength;
+        NSUInteger i;
+        for (i = 0; i < n; i++) {
+            BMScriptHistoryLogPut64((unsigned char *)[offsets mutableBytes] + i * 8, end);
+            end += BMScriptHistoryLogAppendRecord(records, [batch objectAtIndex:done + i]);
+        }
+
+        // records first: an index entry must never point past what is on disk. no fsync, a crash
+        // costs the items since the last write the system got around to, not the log.
+        if (!BMScriptHistoryLogWriteAll(logFile, [records bytes], [records length], (off_t)logLength)
+            || !BMScriptHistoryLogWriteAll(indexFile, [offsets bytes], [offsets length], (off_t)(segment->count * 8))) {
+            NSLog(@"BMScriptHistoryLog: writing to %@ failed: %s", directory, strerror(errno));
+            [self closeFiles];
+            ok = NO;
+            [pool drain];
+            break;
+        }
+        logLength = end;
+
+        [lock lock];
+        segment->count += n;
+        segment->recordsLength = end;
+        writtenCount += n;
+        [pending removeObjectsInRange:NSMakeRange(0, n)];
+        BOOL compress = (segment->count == BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS && compressesSealedSegments);
+        [lock unlock];
+        done += n;
+
+        if (segment->count == BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS) {
+            [self closeFiles];
+            if (compress) [self compressSegment:segment];
+        }
+        [pool drain];
+    }
+
+    [writeLock unlock];
+    return ok;
+}
+
+/* The background writer. Waits for a batch or the flush interval, writes, and quits once nothing is queued. */
+- (void) runWriter {
+    for (;;) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+
+        [lock lock];
+        NSDate * deadline = [NSDate dateWithTimeIntervalSinceNow:flushInterval];
+        while ([pending count] > 0 && [pending count] < BMSCRIPT_HISTORY_LOG_BATCH_SIZE) {
+            if (![lock waitUntilDate:deadline]) break;
+        }
+        [lock unlock];
+
+        BOOL written = [self writePendingItems];
+
+        [lock lock];
+        if ([pending count] == 0 || !written) {
+            // a failed write is tried again by the next append or flush
+            writerRunning = NO;
+            [BMScriptHistoryLogRegistryLock lock];
+            [BMScriptHistoryLogsWriting removeObject:self];
+            [BMScriptHistoryLogRegistryLock unlock];
+            [lock unlock];
+            [pool drain];
+            break;
+        }
+        [lock unlock];
+        [pool drain];
+    }
+}
+
+/* Replaces the records of a full segment with a compressed copy. */
+- (BOOL) compressSegment:(BMScriptHistoryLogSegment *)segment {
+    NSString * logPath = [self pathOfSegment:segment->number extension:@"log"];
+    NSString * logzPath = [self pathOfSegment:segment->number extension:@"logz"];
+    NSData * raw = [NSData dataWithContentsOfMappedFile:logPath];
+    if (!raw || [raw length] != segment->recordsLength) return NO;
+
+    uLongf compressedLength = compressBound((uLong)[raw length]);
+    NSMutableData * data = [NSMutableData dataWithLength:BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER + compressedLength];
+    if (!data) return NO;
+    unsigned char * header = [data mutableBytes];
+    memcpy(header, BMSCRIPT_HISTORY_LOG_COMPRESSED_MAGIC, 8);
+    BMScriptHistoryLogPut64(header + 8, [raw length]);
+    if (compress2(header + BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER, &compressedLength,
+                  [raw bytes], (uLong)[raw length], Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return NO;
+    }
+    [data setLength:BMSCRIPT_HISTORY_LOG_COMPRESSED_HEADER + compressedLength];
+
+    char * tmpPath = strdup([[logzPath stringByAppendingString:@".XXXXXX"] fileSystemRepresentation]);
+    if (!tmpPath) return NO;
+    int fd = mkstemp(tmpPath);
+    BOOL written = (fd >= 0 && BMScriptHistoryLogWriteAll(fd, [data bytes], [data length], 0));
+    if (fd >= 0 && close(fd) != 0) written = NO;
+    if (written) written = (rename(tmpPath, [logzPath fileSystemRepresentation]) == 0);
+    if (!written && fd >= 0) unlink(tmpPath);
+    free(tmpPath);
+    if (!written) return NO;
+
+    [lock lock];
+    segment->compressed = YES;
+    [segment->records release], segment->records = nil;  // items pointing into it keep the mapping
+    [lock unlock];
+    unlink([logPath fileSystemRepresentation]);
+    return YES;
+}
+
+- (void) closeFiles {
+    if (logFile >= 0) close(logFile);
+    if (indexFile >= 0) close(indexFile);
+    logFile = indexFile = -1;
+}
+
+@end
+
+/// @endcond
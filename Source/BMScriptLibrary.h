@@ -0,0 +1,107 @@
+//
+//  BMScriptLibrary.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptLibrary.h
+ * Class interface of BMScriptLibrary.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+@class BMScriptTemplate;
+
+/*!
+ * @class BMScriptLibrary
+ * An index of the scripts and templates in a directory which reads, decodes and compiles each of them only once.
+ *
+ * BMScript#initWithContentsOfFile:options: and BMScript#initWithContentsOfTemplateFile:options: read and decode the
+ * file every time. A library instead indexes a directory (including its subdirectories) once and keeps what it has
+ * loaded: a file is memory-mapped and decoded as UTF-8 the first time it is asked for, and a template is compiled
+ * into a BMScriptTemplate the first time it is asked for as one. After that, creating a script from a file is a
+ * dictionary lookup.
+ *
+ * Files are named by their path relative to the directory, e.g. <span class="sourcecode">@"ruby/convert.rb"</span>.
+ * Names starting with a dot are skipped.
+ *
+ * On Linux the library watches the directory tree with <span class="sourcecode">inotify(7)</span> on a thread of
+ * its own: a file that is written, replaced, created or removed drops out of the cache or is added to or removed from
+ * the index as it happens. Where inotify is not available (or the watch can't be set up) every lookup compares the
+ * file's inode, size and modification time with those it was loaded with instead, and names missing from the index
+ * are looked for on disk. The library falls back to the same checks if the directory itself is deleted or unmounted
+ * while it is watched.
+ *
+ * All methods are thread-safe.
+ */
+@interface BMScriptLibrary : NSObject {
+ @private
+    NSString * directory;
+    NSLock * lock;
+    NSMutableDictionary * entries;
+    id watcher;
+}
+
+/*! Returns an autoreleased library for a directory. @see #initWithDirectory: */
++ (id) libraryWithDirectory:(NSString *)path;
+
+/*!
+ * Indexes a directory. The files themselves are only read when they are asked for.
+ * @param path the directory containing scripts and templates
+ * @returns the library, or nil if the directory can't be read
+ */
+- (id) initWithDirectory:(NSString *)path;
+
+/*! Returns the directory of the library. */
+- (NSString *) directory;
+/*! Returns the names of all files in the index, sorted. */
+- (NSArray *) names;
+/*! Returns YES if the library's cache is kept up to date by a file system watch rather than by checking each lookup. */
+- (BOOL) isWatching;
+
+/*!
+ * Returns the contents of a file decoded as UTF-8, reading it only if it isn't cached.
+ * @param name the path of the file relative to the directory
+ * @returns the source, or nil if there is no such file or it isn't valid UTF-8
+ */
+- (NSString *) sourceForName:(NSString *)name;
+/*!
+ * Returns a file compiled as a template using the default magic tokens, compiling it only if it isn't cached.
+ * @param name the path of the file relative to the directory
+ */
+- (BMScriptTemplate *) templateForName:(NSString *)name;
+
+/*!
+ * Returns an autoreleased script with the contents of a file. The counterpart of BMScript#scriptWithContentsOfFile:options:.
+ * @param name the path of the file relative to the directory
+ * @param scriptOptions a dictionary containing the task options
+ */
+- (BMScript *) scriptWithName:(NSString *)name options:(NSDictionary *)scriptOptions;
+/*!
+ * Returns an autoreleased script based on the cached template of a file.
+ * The counterpart of BMScript#scriptWithContentsOfTemplateFile:options:.
+ * @param name the path of the file relative to the directory
+ * @param scriptOptions a dictionary containing the task options
+ */
+- (BMScript *) scriptWithTemplateName:(NSString *)name options:(NSDictionary *)scriptOptions;
+
+/*! Drops everything loaded so far. The index stays. */
+- (void) flushCache;
+
+@end
@@ -0,0 +1,476 @@
+//
+//  BMScriptLibrary.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptLibrary.h"
+#import "BMScriptTemplate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+    #include <sys/inotify.h>
+    #define BMSCRIPT_LIBRARY_WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+#endif
+
+#if defined(__APPLE__)
+    #define BM_STAT_MTIME_NSEC(st) ((long)(st).st_mtimespec.tv_nsec)
+#else
+    #define BM_STAT_MTIME_NSEC(st) ((long)(st).st_mtim.tv_nsec)
+#endif
+
+
+/* One file of the index. Never changed once it is in the index: loading or compiling puts a new entry in its place. */
+@interface BMScriptLibraryEntry : NSObject {
+ @public
+    NSString * path;
+    NSString * source;              /* nil until loaded */
+    BMScriptTemplate * compiled;    /* nil until compiled */
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+    long mtimeNsec;
+}
++ (id) entryWithPath:(NSString *)aPath;
+- (BOOL) isLoaded;
+- (BOOL) matchesStat:(const struct stat *)st;
+@end
+
+@implementation BMScriptLibraryEntry
+
++ (id) entryWithPath:(NSString *)aPath {
+    BMScriptLibraryEntry * entry = [[[self alloc] init] autorelease];
+    entry->path = [aPath copy];
+    return entry;
+}
+
+- (void) dealloc {
+    [path release], path = nil;
+    [source release], source = nil;
+    [compiled release], compiled = nil;
+    [super dealloc];
+}
+
+- (BOOL) isLoaded {
+    return (source != nil);
+}
+
+- (BOOL) matchesStat:(const struct stat *)st {
+    return (st->st_dev == device && st->st_ino == inode && st->st_size == size
+            && st->st_mtime == mtime && BM_STAT_MTIME_NSEC(*st) == mtimeNsec);
+}
+
+@end
+
+
+/* maps a file and decodes it as UTF-8. returns a new entry or nil. */
+static BMScriptLibraryEntry * BMScriptLibraryLoad(NSString * path) {
+
+    int fd = open([path fileSystemRepresentation], O_RDONLY);
+    if (fd < 0) return nil;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct stat st;
+    NSString * src = nil;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t len = (size_t) st.st_size;
+        if (len == 0) {
+            src = [[NSString alloc] init];
+        } else {
+            void * addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                src = [[NSString alloc] initWithBytes:addr length:len encoding:NSUTF8StringEncoding];
+                munmap(addr, len);
+            }
+        }
+    }
+    close(fd);
+
+    if (!src) return nil;
+
+    BMScriptLibraryEntry * entry = [BMScriptLibraryEntry entryWithPath:path];
+    entry->source = src;
+    entry->device = st.st_dev;
+    entry->inode = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->mtimeNsec = BM_STAT_MTIME_NSEC(st);
+    return entry;
+}
+
+
+/* Keeps the index of a library up to date on a thread of its own. The thread retains the watcher, not the library. */
+@interface BMScriptLibraryWatcher : NSObject {
+ @public
+    NSString * root;
+    NSLock * lock;
+    NSMutableDictionary * entries;
+    NSMutableDictionary * directories;  /* watch descriptor -> directory relative to root */
+    int fd;
+    int wakeupPipe[2];
+    BOOL stopped;                       /* the watch on root is gone, set with the lock held */
+}
+- (void) run;
+@end
+
+/* adds the regular files below a directory to the index and, given a watcher, watches the directories.
+   must be called with the lock held, if there is one. */
+static void BMScriptLibraryScan(NSString * root, NSString * relative, NSMutableDictionary * entries, BMScriptLibraryWatcher * watcher) {
+
+    NSString * dir = ([relative length] ? [root stringByAppendingPathComponent:relative] : root);
+
+    #if defined(__linux__)
+    if (watcher) {
+        int wd = inotify_add_watch(watcher->fd, [dir fileSystemRepresentation], BMSCRIPT_LIBRARY_WATCH_MASK);
+        if (wd >= 0) {
+            [watcher->directories setObject:relative forKey:[NSNumber numberWithInt:wd]];
+        }
+    }
+    #else
+        #pragma unused(watcher)
+    #endif
+
+    NSArray * contents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:dir error:NULL];
+    for (NSString * name in contents) {
+        if ([name hasPrefix:@"."]) continue;
+        NSString * rel = ([relative length] ? [relative stringByAppendingPathComponent:name] : name);
+        NSString * path = [root stringByAppendingPathComponent:rel];
+        struct stat st;
+        if (stat([path fileSystemRepresentation], &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            BMScriptLibraryScan(root, rel, entries, watcher);
+        } else if (S_ISREG(st.st_mode)) {
+            [entries setObject:[BMScriptLibraryEntry entryWithPath:path] forKey:rel];
+        }
+    }
+}
+
+/* removes everything below a directory from the index. must be called with the lock held. */
+static void BMScriptLibraryRemoveDirectory(NSMutableDictionary * entries, NSString * relative) {
+    NSString * prefix = [relative stringByAppendingString:@"/"];
+    for (NSString * name in [entries allKeys]) {
+        if ([name hasPrefix:prefix]) [entries removeObjectForKey:name];
+    }
+}
+
+@implementation BMScriptLibraryWatcher
+
+- (void) dealloc {
+    [root release], root = nil;
+    [lock release], lock = nil;
+    [entries release], entries = nil;
+    [directories release], directories = nil;
+    [super dealloc];
+}
+
+- (void) run {
+    #if defined(__linux__)
+
+    // big enough for a bunch of events with names of maximum length
+    char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wakeupPipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            break;
+        }
+
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        [lock lock];
+
+        BOOL rootGone = NO;
+        char * p = buffer;
+        while (p < buffer + n) {
+            const struct inotify_event * ev = (const struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // events were lost, start over
+                [entries removeAllObjects];
+                BMScriptLibraryScan(root, @"", entries, self);
+                continue;
+            }
+
+            NSNumber * wd = [NSNumber numberWithInt:ev->wd];
+            NSString * dir = [directories objectForKey:wd];
+            if (ev->mask & IN_IGNORED) {
+                // root deleted or unmounted: no more events will come, lookups have to check for themselves
+                if (dir && [dir length] == 0) {
+                    stopped = rootGone = YES;
+                }
+                [directories removeObjectForKey:wd];
+                continue;
+            }
+            if (!dir || ev->len == 0) continue;
+
+            NSString * name = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:ev->name length:strlen(ev->name)];
+            if ([name hasPrefix:@"."]) continue;
+            NSString * rel = ([dir length] ? [dir stringByAppendingPathComponent:name] : name);
+
+            if (ev->mask & IN_ISDIR) {
+                BMScriptLibraryRemoveDirectory(entries, rel);
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    BMScriptLibraryScan(root, rel, entries, self);
+                }
+            } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                [entries removeObjectForKey:rel];
+            } else {
+                // written, replaced or new: forget what was loaded
+                [entries setObject:[BMScriptLibraryEntry entryWithPath:[root stringByAppendingPathComponent:rel]] forKey:rel];
+            }
+        }
+
+        [lock unlock];
+        [pool drain];
+
+        if (rootGone) break;
+    }
+    #endif
+
+    close(fd);
+    close(wakeupPipe[0]);
+}
+
+@end
+
+
+@interface BMScriptLibrary (/* Private */)
+- (void) stopWatching;
+- (BMScriptLibraryEntry *) loadedEntryForName:(NSString *)name;
+- (void) publishEntry:(BMScriptLibraryEntry *)entry forName:(NSString *)name replacing:(BMScriptLibraryEntry *)old;
+@end
+
+@implementation BMScriptLibrary
+
++ (id) libraryWithDirectory:(NSString *)path {
+    return [[[self alloc] initWithDirectory:path] autorelease];
+}
+
+- (id) init {
+    return [self initWithDirectory:nil];
+}
+
+- (id) initWithDirectory:(NSString *)path {
+
+    BOOL isDir = NO;
+    if (!path || ![[NSFileManager defaultManager] fileExistsAtPath:path isDirectory:&isDir] || !isDir) {
+        [self release];
+        return nil;
+    }
+
+    if ((self = [super init])) {
+        directory = [[path stringByStandardizingPath] copy];
+        lock = [[NSLock alloc] init];
+        entries = [[NSMutableDictionary alloc] init];
+
+        BMScriptLibraryWatcher * w = nil;
+
+        #if defined(__linux__)
+        int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (ifd >= 0) {
+            w = [[[BMScriptLibraryWatcher alloc] init] autorelease];
+            w->fd = ifd;
+            w->root = [directory copy];
+            w->lock = [lock retain];
+            w->entries = [entries retain];
+            w->directories = [[NSMutableDictionary alloc] init];
+            w->wakeupPipe[0] = w->wakeupPipe[1] = -1;
+        }
+        #endif
+
+        [lock lock];
+        BMScriptLibraryScan(directory, @"", entries, w);
+        [lock unlock];
+
+        // without a watch on the directory itself there is nothing to rely on
+        if (w && [w->directories count] > 0 && pipe(w->wakeupPipe) == 0) {
+            fcntl(w->wakeupPipe[0], F_SETFD, FD_CLOEXEC);
+            fcntl(w->wakeupPipe[1], F_SETFD, FD_CLOEXEC);
+            watcher = [w retain];
+            [NSThread detachNewThreadSelector:@selector(run) toTarget:w withObject:nil];
+        } else if (w) {
+            close(w->fd);
+        }
+    }
+    return self;
+}
+
+- (void) stopWatching {
+    if (watcher) {
+        BMScriptLibraryWatcher * w = watcher;
+        close(w->wakeupPipe[1]);
+        [watcher release], watcher = nil;
+    }
+}
+
+- (void) dealloc {
+    [self stopWatching];
+    [directory release], directory = nil;
+    [entries release], entries = nil;
+    [lock release], lock = nil;
+    [super dealloc];
+}
+
+- (void) finalize {
+    [self stopWatching];
+    [super finalize];
+}
+
+- (NSString *) description {
+    [lock lock];
+    NSUInteger count = [entries count];
+    [lock unlock];
+    return [NSString stringWithFormat:@"%@ (%@, %lu files%@)", [super description], directory,
+            (unsigned long)count, ([self isWatching] ? @", watching" : @"")];
+}
+
+// MARK: Accessors
+
+- (NSString *) directory {
+    return directory;
+}
+
+- (NSArray *) names {
+    [lock lock];
+    NSArray * names = [[entries allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    [lock unlock];
+    return names;
+}
+
+- (BOOL) isWatching {
+    [lock lock];
+    BOOL watching = (watcher && !((BMScriptLibraryWatcher *)watcher)->stopped);
+    [lock unlock];
+    return watching;
+}
+
+// MARK: Lookup
+
+- (NSString *) sourceForName:(NSString *)name {
+    BMScriptLibraryEntry * entry = [self loadedEntryForName:name];
+    return (entry ? entry->source : nil);
+}
+
+- (BMScriptTemplate *) templateForName:(NSString *)name {
+    BMScriptLibraryEntry * entry = [self loadedEntryForName:name];
+    if (!entry) return nil;
+    if (entry->compiled) return entry->compiled;
+
+    BMScriptLibraryEntry * compiledEntry = [BMScriptLibraryEntry entryWithPath:entry->path];
+    compiledEntry->source = [entry->source retain];
+    compiledEntry->compiled = [[BMScriptTemplate alloc] initWithString:entry->source];
+    compiledEntry->device = entry->device;
+    compiledEntry->inode = entry->inode;
+    compiledEntry->size = entry->size;
+    compiledEntry->mtime = entry->mtime;
+    compiledEntry->mtimeNsec = entry->mtimeNsec;
+    [self publishEntry:compiledEntry forName:name replacing:entry];
+    return compiledEntry->compiled;
+}
+
+- (BMScript *) scriptWithName:(NSString *)name options:(NSDictionary *)scriptOptions {
+    NSString * src = [self sourceForName:name];
+    return (src ? [BMScript scriptWithSource:src options:scriptOptions] : nil);
+}
+
+- (BMScript *) scriptWithTemplateName:(NSString *)name options:(NSDictionary *)scriptOptions {
+    BMScriptTemplate * tmpl = [self templateForName:name];
+    return (tmpl ? [BMScript scriptWithTemplate:tmpl options:scriptOptions] : nil);
+}
+
+- (void) flushCache {
+    [lock lock];
+    for (NSString * name in [entries allKeys]) {
+        BMScriptLibraryEntry * entry = [entries objectForKey:name];
+        if ([entry isLoaded]) {
+            [entries setObject:[BMScriptLibraryEntry entryWithPath:entry->path] forKey:name];
+        }
+    }
+    [lock unlock];
+}
+
+// MARK: Private
+
+/* returns the entry for a name with its source loaded, loading it outside the lock if need be */
+- (BMScriptLibraryEntry *) loadedEntryForName:(NSString *)name {
+
+    // only what is below the directory
+    if (!name || [name isAbsolutePath] || [[name pathComponents] containsObject:@".."]) return nil;
+
+    [lock lock];
+    BMScriptLibraryEntry * entry = [[[entries objectForKey:name] retain] autorelease];
+    [lock unlock];
+
+    if (![self isWatching]) {
+        // nobody tells us about changes, so look for ourselves
+        struct stat st;
+        NSString * path = [directory stringByAppendingPathComponent:name];
+        if (stat([path fileSystemRepresentation], &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (entry) [self publishEntry:nil forName:name replacing:entry];
+            return nil;
+        }
+        if (!entry || ([entry isLoaded] && ![entry matchesStat:&st])) {
+            BMScriptLibraryEntry * fresh = [BMScriptLibraryEntry entryWithPath:path];
+            [self publishEntry:fresh forName:name replacing:entry];
+            entry = fresh;
+        }
+    }
+
+    if (!entry) return nil;
+    if ([entry isLoaded]) return entry;
+
+    BMScriptLibraryEntry * loaded = BMScriptLibraryLoad(entry->path);
+    if (loaded) {
+        [self publishEntry:loaded forName:name replacing:entry];
+    }
+    return loaded;
+}
+
+/* puts an entry in place of another unless the index has moved on in the meantime. nil removes the name. */
+- (void) publishEntry:(BMScriptLibraryEntry *)entry forName:(NSString *)name replacing:(BMScriptLibraryEntry *)old {
+    [lock lock];
+    if ([entries objectForKey:name] == old) {
+        if (entry) {
+            [entries setObject:entry forKey:name];
+        } else {
+            [entries removeObjectForKey:name];
+        }
+    }
+    [lock unlock];
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,80 @@
+//
+//  BMScriptLock.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptLock.h
+ * Striped object locks used by BMScript when #BMSCRIPT_THREAD_AWARE and #BMSCRIPT_FAST_LOCK are set.
+ *
+ * An object is locked by locking one of #BMSCRIPT_LOCK_STRIPES mutexes, picked by the object's address.
+ * Locking two different BMScript instances therefore only waits if they happen to share a stripe,
+ * while the same instance always maps to the same mutex. The mutexes live in a static table, so
+ * locking needs neither an allocation nor an instance variable.
+ *
+ * Each stripe counts its acquisitions, how many of them had to wait and for how long.
+ * #BMScriptGetLockStatistics adds them up.
+ */
+
+#import "BMDefines.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*! Number of mutexes object locks are spread over. Must be a power of two. */
+#ifndef BMSCRIPT_LOCK_STRIPES
+    #define BMSCRIPT_LOCK_STRIPES 64
+#endif
+
+/*! @} */
+
+/*!
+ * @addtogroup functions Functions and Global Variables
+ * @{
+ */
+
+/*! Counters of the object locks, summed over all stripes. */
+typedef struct BMScriptLockStatistics {
+    /*! Number of times a lock was taken. */
+    uint64_t acquisitions;
+    /*! Number of acquisitions that found the lock taken and had to wait. */
+    uint64_t contentions;
+    /*! Total time spent waiting in contended acquisitions, in nanoseconds. */
+    uint64_t waitNanoseconds;
+} BMScriptLockStatistics;
+
+/*!
+ * Locks the stripe of an object. Blocks while another thread holds it.
+ * The stripe locks are recursive, like <span class="sourcecode">\@synchronized</span>: a thread may lock an object again, 
+ * or another object on the same stripe, as long as it unlocks as often.
+ * Unrelated objects may share a stripe, so never call out to code you don't control, like a delegate or a
+ * notification observer, while holding a lock: two threads doing so can deadlock on each other's stripes.
+ * Exits the process if the mutex fails, as a failed lock leaves the caller's state undefined.
+ * @param object the object to lock; nil locks the first stripe
+ */
+OBJC_EXPORT void BMScriptLockObject(id object);
+/*! Unlocks the stripe of an object locked with #BMScriptLockObject. */
+OBJC_EXPORT void BMScriptUnlockObject(id object);
+/*! Returns the counters of all stripes added up. The counters are read without a lock, so they may be off by a few while locks are in use. */
+OBJC_EXPORT BMScriptLockStatistics BMScriptGetLockStatistics(void);
+/*! Sets all counters back to zero. */
+OBJC_EXPORT void BMScriptResetLockStatistics(void);
+
+/*! @} */
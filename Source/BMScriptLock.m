@@ -0,0 +1,131 @@
+//
+//  BMScriptLock.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptLock.h"
+
+#include <pthread.h>            /* for pthread_*    */
+#include <stdio.h>              /* for printf       */
+#include <stdlib.h>             /* for exit         */
+
+#if defined(__APPLE__)
+    #include <mach/mach_time.h>
+#else
+    #include <time.h>
+#endif
+
+#define BMSCRIPT_LOCK_CACHE_LINE    64
+
+#if (BMSCRIPT_LOCK_STRIPES & (BMSCRIPT_LOCK_STRIPES - 1)) != 0
+    #error BMSCRIPT_LOCK_STRIPES must be a power of two
+#endif
+
+/* One mutex and its counters, on a cache line of its own so neighbouring stripes don't slow each other down.
+   The counters are only changed while the mutex is held. */
+typedef struct BMScriptLockStripe {
+    pthread_mutex_t mutex;
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t waitNanoseconds;
+} __attribute__((aligned(BMSCRIPT_LOCK_CACHE_LINE))) BMScriptLockStripe;
+
+static BMScriptLockStripe BMScriptLockStripes[BMSCRIPT_LOCK_STRIPES];
+static pthread_once_t BMScriptLockStripesOnce = PTHREAD_ONCE_INIT;
+
+/* recursive like @synchronized, so a thread holding a stripe can lock another object on the same stripe */
+static void BMScriptLockMakeStripes(void) {
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    NSUInteger i;
+    for (i = 0; i < BMSCRIPT_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&BMScriptLockStripes[i].mutex, &attributes);
+    }
+    pthread_mutexattr_destroy(&attributes);
+}
+
+static uint64_t BMScriptLockNanoseconds(void) {
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) mach_timebase_info(&timebase);
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* objects are at least 16 byte aligned, so the low bits carry nothing. the multiplication spreads the rest. */
+NS_INLINE BMScriptLockStripe * BMScriptLockStripeForObject(id object) {
+    uintptr_t address = (uintptr_t)object >> 4;
+    return &BMScriptLockStripes[((address * 2654435761U) >> 8) & (BMSCRIPT_LOCK_STRIPES - 1)];
+}
+
+void BMScriptLockObject(id object) {
+    pthread_once(&BMScriptLockStripesOnce, BMScriptLockMakeStripes);
+    BMScriptLockStripe * stripe = BMScriptLockStripeForObject(object);
+
+    // only time the acquisitions which actually have to wait
+    if (pthread_mutex_trylock(&stripe->mutex) == 0) {
+        stripe->acquisitions++;
+        return;
+    }
+    uint64_t start = BMScriptLockNanoseconds();
+    if (pthread_mutex_lock(&stripe->mutex)) {
+        printf("*** Warning: Lock failed! Application behaviour may be undefined. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    stripe->acquisitions++;
+    stripe->contentions++;
+    stripe->waitNanoseconds += BMScriptLockNanoseconds() - start;
+}
+
+void BMScriptUnlockObject(id object) {
+    if (pthread_mutex_unlock(&BMScriptLockStripeForObject(object)->mutex) != 0) {
+        printf("*** Warning: Unlock failed! Application behaviour may be undefined. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+}
+
+BMScriptLockStatistics BMScriptGetLockStatistics(void) {
+    BMScriptLockStatistics statistics = { 0, 0, 0 };
+    NSUInteger i;
+    for (i = 0; i < BMSCRIPT_LOCK_STRIPES; i++) {
+        statistics.acquisitions += BMScriptLockStripes[i].acquisitions;
+        statistics.contentions += BMScriptLockStripes[i].contentions;
+        statistics.waitNanoseconds += BMScriptLockStripes[i].waitNanoseconds;
+    }
+    return statistics;
+}
+
+void BMScriptResetLockStatistics(void) {
+    pthread_once(&BMScriptLockStripesOnce, BMScriptLockMakeStripes);
+    NSUInteger i;
+    for (i = 0; i < BMSCRIPT_LOCK_STRIPES; i++) {
+        pthread_mutex_lock(&BMScriptLockStripes[i].mutex);
+        BMScriptLockStripes[i].acquisitions = 0;
+        BMScriptLockStripes[i].contentions = 0;
+        BMScriptLockStripes[i].waitNanoseconds = 0;
+        pthread_mutex_unlock(&BMScriptLockStripes[i].mutex);
+    }
+}
+
+/// @endcond
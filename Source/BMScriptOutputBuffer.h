@@ -0,0 +1,114 @@
+//
+//  BMScriptOutputBuffer.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptOutputBuffer.h
+ * Class interface of BMScriptOutputBuffer.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*!
+ * Default for BMScript#outputSpillThreshold and BMScriptWorkerPool#outputSpillThreshold, in bytes.
+ * Output growing beyond this is moved out of the heap into an anonymous file.
+ */
+#ifndef BMSCRIPT_OUTPUT_SPILL_THRESHOLD
+    #define BMSCRIPT_OUTPUT_SPILL_THRESHOLD (8 * 1024 * 1024)
+#endif
+
+/*! @} */
+
+/*!
+ * @class BMScriptOutputBuffer
+ * Collects the output of a script, in memory while it is small and in a file once it grows large.
+ *
+ * As long as the output stays below the spill threshold it is kept in an NSMutableData. When it crosses
+ * the threshold, everything is moved to an anonymous file: a <span class="sourcecode">memfd_create(2)</span>
+ * descriptor on Linux, an unlinked temporary file elsewhere. From then on appends are plain writes.
+ * BMScriptOutputBuffer#data maps that file read-only, so a result of several gigabytes costs page cache,
+ * which the kernel can write back or evict, instead of the same amount (several times over, counting
+ * the copies made along the way) of heap.
+ *
+ * The NSData returned for a spilled buffer behaves like any other immutable NSData and unmaps the file
+ * when it is deallocated. Not thread-safe; BMScript serializes access itself.
+ *
+ * A buffer can also enforce a #BMScriptOutputRetention policy. The head is stored as it comes in, the tail
+ * as a ring behind it which overwrites its oldest bytes once full, so the storage never grows beyond the limit.
+ * The ring is put in order when BMScriptOutputBuffer#data is asked for.
+ */
+@interface BMScriptOutputBuffer : NSObject {
+ @private
+    NSMutableData * memory;
+    NSUInteger spillThreshold;
+    int fileDescriptor;
+    BOOL failed;
+    unsigned long long headLimit;
+    unsigned long long headLength;
+    unsigned long long tailLimit;
+    unsigned long long tailLength;
+    unsigned long long tailStart;
+    unsigned long long totalLength;
+}
+
+/*! Initializes an empty buffer which keeps all output. */
+- (id) initWithSpillThreshold:(NSUInteger)threshold;
+
+/*!
+ * Initializes an empty buffer. This is the designated initializer.
+ * @param threshold the length in bytes beyond which the buffer moves to a file. 0 means never.
+ * @param policy which part of the output to keep
+ * @param limit how many bytes the policy keeps. 0 means no limit.
+ */
+- (id) initWithSpillThreshold:(NSUInteger)threshold retentionPolicy:(BMScriptOutputRetention)policy limit:(unsigned long long)limit;
+
+/*! Returns the number of bytes kept. */
+- (unsigned long long) length;
+/*! Returns the number of bytes appended so far. */
+- (unsigned long long) totalLength;
+/*! Returns the number of bytes appended but not kept. */
+- (unsigned long long) discardedLength;
+/*! Returns YES if the contents have been moved to a file. */
+- (BOOL) isSpilled;
+
+/*!
+ * Appends bytes to the buffer, moving it to a file first if it would grow beyond the threshold.
+ * Bytes the retention policy does not keep are only counted.
+ * If writing to the file fails the rest of the output is dropped and a warning is logged.
+ * @param bytes the bytes to append
+ * @param len the number of bytes
+ */
+- (void) appendBytes:(const void *)bytes length:(NSUInteger)len;
+/*! Same as #appendBytes:length: for the contents of an NSData. */
+- (void) appendData:(NSData *)data;
+
+/*!
+ * Returns the contents appended so far as an immutable NSData. For a spilled buffer this is a read-only
+ * mapping of the file which stays valid after the buffer is gone. Falls back to reading the file into
+ * memory if it can't be mapped.
+ */
+- (NSData *) data;
+
+@end
@@ -0,0 +1,334 @@
+//
+//  BMScriptOutputBuffer.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptOutputBuffer.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+    #include <sys/syscall.h>
+    #if !defined(SYS_memfd_create) && defined(__NR_memfd_create)
+        #define SYS_memfd_create __NR_memfd_create
+    #endif
+    #ifndef MFD_CLOEXEC
+        #define MFD_CLOEXEC 0x0001U
+    #endif
+#endif
+
+
+/* An immutable NSData backed by a read-only file mapping, unmapped on deallocation. */
+@interface BMScriptMappedData : NSData {
+ @private
+    void * mapping;
+    NSUInteger mappingLength;
+}
+- (id) initWithMapping:(void *)addr length:(NSUInteger)len;
+@end
+
+@implementation BMScriptMappedData
+
+- (id) initWithMapping:(void *)addr length:(NSUInteger)len {
+    if ((self = [super init])) {
+        mapping = addr;
+        mappingLength = len;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    if (mapping) munmap(mapping, mappingLength);
+    [super dealloc];
+}
+
+- (void) finalize {
+    if (mapping) munmap(mapping, mappingLength);
+    [super finalize];
+}
+
+- (const void *) bytes {
+    return mapping;
+}
+
+- (NSUInteger) length {
+    return mappingLength;
+}
+
+- (id) copyWithZone:(NSZone *)zone {
+    #pragma unused(zone)
+    return [self retain];
+}
+
+@end
+
+
+/* Creates an anonymous file. Returns -1 on failure. */
+static int BMScriptOutputBufferCreateFile(void) {
+    int fd = -1;
+    #if defined(__linux__) && defined(SYS_memfd_create)
+        fd = (int) syscall(SYS_memfd_create, "bmscript-output", MFD_CLOEXEC);
+    #endif
+    if (fd < 0) {
+        NSString * template = [NSTemporaryDirectory() stringByAppendingPathComponent:@"bmscript-output.XXXXXX"];
+        char * path = strdup([template fileSystemRepresentation]);
+        if (path) {
+            fd = mkstemp(path);
+            if (fd >= 0) {
+                unlink(path);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+            free(path);
+        }
+    }
+    return fd;
+}
+
+/* Writes all of a buffer at an offset, retrying on short writes and EINTR. */
+static BOOL BMScriptOutputBufferWriteAll(int fd, const char * bytes, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, bytes, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        bytes += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return YES;
+}
+
+
+@interface BMScriptOutputBuffer (/* Private */)
+- (BOOL) spill;
+- (BOOL) writeBytes:(const char *)bytes length:(NSUInteger)len atOffset:(unsigned long long)offset;
+- (NSData *) storedData;
+@end
+
+@implementation BMScriptOutputBuffer
+
+- (id) init {
+    return [self initWithSpillThreshold:BMSCRIPT_OUTPUT_SPILL_THRESHOLD];
+}
+
+- (id) initWithSpillThreshold:(NSUInteger)threshold {
+    return [self initWithSpillThreshold:threshold retentionPolicy:BMScriptRetainAllOutput limit:0];
+}
+
+/* designated initializer */
+- (id) initWithSpillThreshold:(NSUInteger)threshold retentionPolicy:(BMScriptOutputRetention)policy limit:(unsigned long long)limit {
+    if ((self = [super init])) {
+        memory = [[NSMutableData alloc] init];
+        spillThreshold = threshold;
+        fileDescriptor = -1;
+        headLimit = ULLONG_MAX;
+        if (limit > 0) {
+            switch (policy) {
+                case BMScriptRetainOutputHead:
+                    headLimit = limit;
+                    break;
+                case BMScriptRetainOutputTail:
+                    headLimit = 0;
+                    tailLimit = limit;
+                    break;
+                case BMScriptRetainOutputHeadAndTail:
+                    headLimit = limit / 2;
+                    tailLimit = limit - headLimit;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    if (fileDescriptor >= 0) close(fileDescriptor);
+    [memory release], memory = nil;
+    [super dealloc];
+}
+
+- (void) finalize {
+    if (fileDescriptor >= 0) close(fileDescriptor);
+    [super finalize];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%llu of %llu bytes%@)", [super description], 
+            [self length], totalLength, ([self isSpilled] ? @", spilled" : @"")];
+}
+
+- (unsigned long long) length {
+    return headLength + tailLength;
+}
+
+- (unsigned long long) totalLength {
+    return totalLength;
+}
+
+- (unsigned long long) discardedLength {
+    return totalLength - [self length];
+}
+
+- (BOOL) isSpilled {
+    return (fileDescriptor >= 0);
+}
+
+/* moves what is in memory to a new anonymous file */
+- (BOOL) spill {
+    int fd = BMScriptOutputBufferCreateFile();
+    if (fd < 0) {
+        NSLog(@"%@ Warning: Could not create a file to spill output to (%s), keeping it in memory.", [self className], strerror(errno));
+        spillThreshold = 0;
+        return NO;
+    }
+    if (!BMScriptOutputBufferWriteAll(fd, [memory bytes], [memory length], 0)) {
+        NSLog(@"%@ Warning: Could not spill output (%s), keeping it in memory.", [self className], strerror(errno));
+        close(fd);
+        spillThreshold = 0;
+        return NO;
+    }
+    fileDescriptor = fd;
+    [memory release], memory = nil;
+    return YES;
+}
+
+/* stores bytes at an offset no further than the current end of the storage */
+- (BOOL) writeBytes:(const char *)bytes length:(NSUInteger)len atOffset:(unsigned long long)offset {
+    
+    if (fileDescriptor < 0 && spillThreshold > 0 && offset + len > spillThreshold) {
+        [self spill];
+    }
+    if (fileDescriptor >= 0) {
+        if (!BMScriptOutputBufferWriteAll(fileDescriptor, bytes, len, (off_t) offset)) {
+            NSLog(@"%@ Warning: Writing spilled output failed (%s), the rest of it is lost.", [self className], strerror(errno));
+            failed = YES;
+            return NO;
+        }
+    } else if (offset == [memory length]) {
+        [memory appendBytes:bytes length:len];
+    } else {
+        [memory replaceBytesInRange:NSMakeRange((NSUInteger) offset, len) withBytes:bytes];
+    }
+    return YES;
+}
+
+- (void) appendBytes:(const void *)bytes length:(NSUInteger)len {
+
+    totalLength += len;
+    
+    if (len == 0 || failed) return;
+
+    const char * p = bytes;
+    unsigned long long rest = len;
+    
+    // the head is stored as it comes in
+    if (headLength < headLimit) {
+        NSUInteger n = (NSUInteger) MIN(rest, headLimit - headLength);
+        if (![self writeBytes:p length:n atOffset:headLength]) return;
+        headLength += n;
+        p += n;
+        rest -= n;
+    }
+    if (rest == 0 || tailLimit == 0) return;
+    
+    // the tail is a ring right behind the (full) head. of a chunk larger than the ring only its end survives.
+    if (rest > tailLimit) {
+        p += rest - tailLimit;
+        rest = tailLimit;
+    }
+    while (rest > 0) {
+        NSUInteger n;
+        if (tailLength < tailLimit) {
+            n = (NSUInteger) MIN(rest, tailLimit - tailLength);
+            if (![self writeBytes:p length:n atOffset:(headLimit + tailLength)]) return;
+            tailLength += n;
+        } else {
+            n = (NSUInteger) MIN(rest, tailLimit - tailStart);
+            if (![self writeBytes:p length:n atOffset:(headLimit + tailStart)]) return;
+            tailStart = (tailStart + n) % tailLimit;
+        }
+        p += n;
+        rest -= n;
+    }
+}
+
+- (void) appendData:(NSData *)data {
+    [self appendBytes:[data bytes] length:[data length]];
+}
+
+- (NSData *) data {
+    
+    // the ring overwrites its storage in place, so a mapping of it could change under the caller's feet
+    // and a wrapped ring is out of order anyway. hand out a copy with the tail put in order instead.
+    if (tailLimit > 0 && (fileDescriptor >= 0 || tailStart > 0)) {
+        NSData * stored = [self storedData];
+        const char * bytes = [stored bytes];
+        BMScriptOutputBuffer * linear = [[[BMScriptOutputBuffer alloc] initWithSpillThreshold:spillThreshold] autorelease];
+        [linear appendBytes:bytes length:(NSUInteger) headLength];
+        [linear appendBytes:(bytes + headLimit + tailStart) length:(NSUInteger)(tailLength - tailStart)];
+        [linear appendBytes:(bytes + headLimit) length:(NSUInteger) tailStart];
+        return [linear data];
+    }
+    return [self storedData];
+}
+
+/* returns the storage as it is */
+- (NSData *) storedData {
+
+    if (fileDescriptor < 0) {
+        return [[memory copy] autorelease];
+    }
+    
+    NSUInteger len = (NSUInteger) [self length];
+    if (len == 0) {
+        return [NSData data];
+    }
+
+    void * addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    if (addr != MAP_FAILED) {
+        return [[[BMScriptMappedData alloc] initWithMapping:addr length:len] autorelease];
+    }
+
+    // no address space left for the mapping (think 32-bit). read it back, if that fails there is nothing we can do
+    NSMutableData * copy = [NSMutableData dataWithLength:len];
+    if (!copy) return nil;
+    char * bytes = [copy mutableBytes];
+    NSUInteger offset = 0;
+    while (offset < len) {
+        ssize_t n = pread(fileDescriptor, bytes + offset, len - offset, (off_t) offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        offset += (NSUInteger) n;
+    }
+    [copy setLength:offset];
+    return copy;
+}
+
+@end
+
+/// @endcond
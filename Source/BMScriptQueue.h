@@ -0,0 +1,182 @@
+//
+//  BMScriptQueue.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptQueue.h
+ * Class interface of BMScriptQueue.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+@class BMScriptQueue;
+
+/*!
+ * @addtogroup constants Constants
+ * @{
+ */
+
+/*!
+ * Notification sent by a BMScriptQueue each time one of its scripts has finished.
+ * The userInfo dictionary contains #BMScriptQueueNotificationScript, #BMScriptNotificationExecutionStatus,
+ * #BMScriptNotificationTaskReturnValue, #BMScriptNotificationTaskErrorResults and, if the script produced a result, 
+ * #BMScriptNotificationTaskResults.
+ */
+OBJC_EXPORT NSString * const BMScriptQueueScriptDidFinishNotification;
+/*!
+ * Notification sent by a BMScriptQueue when it has run out of scripts, i.e. all scripts added since the last
+ * time it was sent have finished. The userInfo dictionary contains #BMScriptQueueNotificationFinishedCount
+ * and #BMScriptQueueNotificationFailedCount.
+ */
+OBJC_EXPORT NSString * const BMScriptQueueDidFinishNotification;
+/*! Key incorporated by the notification's userInfo dictionary. Contains the BMScript instance that finished. */
+OBJC_EXPORT NSString * const BMScriptQueueNotificationScript;
+/*! Key incorporated by the notification's userInfo dictionary. Contains the number of scripts that finished as an NSNumber. */
+OBJC_EXPORT NSString * const BMScriptQueueNotificationFinishedCount;
+/*!
+ * Key incorporated by the notification's userInfo dictionary. Contains the number of scripts, as an NSNumber,
+ * whose execution status was not #BMScriptFinishedSuccessfully.
+ */
+OBJC_EXPORT NSString * const BMScriptQueueNotificationFailedCount;
+
+/*! @} */
+
+/*!
+ * @addtogroup protocols Protocols
+ * @{
+ */
+
+/*!
+ * @protocol BMScriptQueueDelegateProtocol
+ * Objects conforming to this protocol may pose as delegates for BMScriptQueue.
+ * The methods are called on BMScriptQueue#completionThread, or on the queue's worker thread if it is nil.
+ */
+@protocol BMScriptQueueDelegateProtocol <NSObject>
+@optional
+/*!
+ * If implemented, called each time a script has finished. Result and return value are available from the script.
+ * @param queue the queue that executed the script
+ * @param script the script that finished
+ * @param status the script's execution status
+ */
+- (void) scriptQueue:(BMScriptQueue *)queue didFinishScript:(BMScript *)script withStatus:(ExecutionStatus)status;
+/*!
+ * If implemented, called when the queue has run out of scripts.
+ * @param queue the queue
+ * @param finishedCount the number of scripts that finished since the last call
+ * @param failedCount how many of those did not finish with #BMScriptFinishedSuccessfully
+ */
+- (void) scriptQueueDidFinish:(BMScriptQueue *)queue finishedCount:(NSUInteger)finishedCount failedCount:(NSUInteger)failedCount;
+@end
+
+/*! @} */
+
+/*!
+ * @class BMScriptQueue
+ * Executes many BMScript instances with a bounded number of tasks running at the same time.
+ *
+ * Scripts are run in the order they were added by up to BMScriptQueue#maxConcurrentScripts worker threads,
+ * each using the blocking execution model (so BMScript#timeLimit and BMScript#usesWorkerPool apply).
+ * The worker threads are started on demand and exit when there is nothing left to do, so an idle queue
+ * costs nothing and there is no need for a run loop on any thread.
+ *
+ * Completion is reported per script and once for the whole batch, both to the delegate and through
+ * notifications.
+ *
+ * A script instance must not be added again while it is still pending or running, as BMScript instances
+ * are not meant to execute more than once at the same time. All methods are thread-safe.
+ *
+ * For parameter sweeps, BMScriptQueue#executeTemplateScript:withValues: saturates a copy of a template script
+ * for each row of values, runs them all on the queue and returns what each of them produced, in input order.
+ */
+@interface BMScriptQueue : NSObject {
+ @private
+    NSCondition * lock;
+    NSMutableArray * pendingScripts;
+    NSMutableArray * runningScripts;
+    NSUInteger maxConcurrentScripts;
+    NSUInteger threadCount;
+    NSUInteger finishedCount;
+    NSUInteger failedCount;
+    NSThread * completionThread;
+    id<BMScriptQueueDelegateProtocol> delegate;
+    NSMapTable * sweepEntries;
+}
+
+/*! Gets or sets the maximum number of scripts executing at the same time. Defaults to the number of active processor cores. */
+@property (BM_ATOMIC assign) NSUInteger maxConcurrentScripts;
+/*! Gets or sets the delegate. */
+@property (BM_ATOMIC assign) id<BMScriptQueueDelegateProtocol> delegate;
+/*!
+ * Gets or sets the thread completions are reported on. The thread must run its run loop.
+ * Defaults to nil, which reports them right on the worker thread that executed the script.
+ */
+@property (BM_ATOMIC retain) NSThread * completionThread;
+
+/*! Returns an autoreleased queue. */
++ (id) queue;
+
+/*!
+ * Adds a script to the end of the queue and starts executing it as soon as the concurrency limit permits.
+ * @param script the script to execute. It is retained until it has finished.
+ */
+- (void) addScript:(BMScript *)script;
+/*!
+ * Adds several scripts to the end of the queue in the order they appear in the array.
+ * @param scripts an array of BMScript instances
+ */
+- (void) addScripts:(NSArray *)scripts;
+/*! Returns the number of scripts that are either pending or executing. */
+- (NSUInteger) scriptCount;
+/*!
+ * Removes all pending scripts and cancels the executing ones (see BMScript#cancel).
+ * Removed scripts are not reported, cancelled ones finish with #BMScriptCancelled.
+ */
+- (void) cancelAllScripts;
+/*!
+ * Blocks until all scripts have finished.
+ * @note If BMScriptQueue#completionThread is the calling thread, completions pile up until it returns to its run loop.
+ */
+- (void) waitUntilAllScriptsAreFinished;
+
+/*!
+ * Runs a parameter sweep: saturates a copy of the template script for each row of values, executes the copies 
+ * on the queue (so at most BMScriptQueue#maxConcurrentScripts at a time, alongside any other scripts of the queue) 
+ * and blocks until all of them have finished.
+ *
+ * The template is compiled once and shared by all copies, which also inherit the options and settings of the
+ * template script, such as its BMScript#timeLimit. Each copy is reported to the delegate and through notifications
+ * like any other script of the queue.
+ *
+ * @param templateScript a script created from a template, e.g. with BMScript#scriptWithContentsOfTemplateFile:options:.
+ *        It is not modified.
+ * @param rows an array with one entry per script: an NSDictionary is passed to BMScript#saturateTemplateWithDictionary:,
+ *        an NSArray to BMScript#saturateTemplateWithArgumentsInArray:
+ * @returns an array with one dictionary per row, in the order of the rows. Each holds #BMScriptQueueNotificationScript,
+ *          #BMScriptNotificationExecutionStatus, #BMScriptNotificationTaskReturnValue, #BMScriptNotificationTaskErrorResults
+ *          and, if there is one, #BMScriptNotificationTaskResults, just like the userInfo of #BMScriptQueueScriptDidFinishNotification.
+ *          A row whose values don't saturate the template is not executed and reports #BMScriptFailedWithException,
+ *          rows removed by #cancelAllScripts report #BMScriptCancelled.
+ * @throws NSInvalidArgumentException if a row is neither a dictionary nor an array
+ * @note If BMScriptQueue#completionThread is the calling thread, completions pile up until it returns to its run loop.
+ */
+- (NSArray *) executeTemplateScript:(BMScript *)templateScript withValues:(NSArray *)rows;
+
+@end
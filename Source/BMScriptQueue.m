@@ -0,0 +1,348 @@
+//
+//  BMScriptQueue.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptQueue.h"
+#import "BMScriptTemplate.h"
+
+NSString * const BMScriptQueueScriptDidFinishNotification   = @"BMScriptQueueScriptDidFinishNotification";
+NSString * const BMScriptQueueDidFinishNotification         = @"BMScriptQueueDidFinishNotification";
+NSString * const BMScriptQueueNotificationScript            = @"BMScriptQueueNotificationScript";
+NSString * const BMScriptQueueNotificationFinishedCount     = @"BMScriptQueueNotificationFinishedCount";
+NSString * const BMScriptQueueNotificationFailedCount       = @"BMScriptQueueNotificationFailedCount";
+
+/* Collects the outcome of the rows of one sweep. Guarded by the queue's lock. */
+@interface BMScriptQueueSweep : NSObject {
+ @public
+    NSMutableArray * results;
+    NSUInteger remaining;
+}
+@end
+
+@implementation BMScriptQueueSweep
+
+- (void) dealloc {
+    [results release], results = nil;
+    [super dealloc];
+}
+
+@end
+
+/* what a script of a sweep reports in place of running, e.g. because it was never executed */
+static NSDictionary * BMScriptQueueRowInfo(BMScript * script, ExecutionStatus status) {
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+                                                 script, BMScriptQueueNotificationScript,
+                   [NSNumber numberWithInteger:status], BMScriptNotificationExecutionStatus,
+      [NSNumber numberWithInteger:BMScriptNotExecuted], BMScriptNotificationTaskReturnValue,
+                                         [NSData data], BMScriptNotificationTaskErrorResults, nil];
+}
+
+@interface BMScriptQueue (/* Private */)
+- (void) startThreadsIfNeeded;
+- (void) runScripts;
+- (void) deliver:(SEL)selector info:(NSDictionary *)info;
+- (void) deliverScriptDidFinish:(NSDictionary *)info;
+- (void) deliverQueueDidFinish:(NSDictionary *)info;
+- (void) recordSweepRowOfScript:(BMScript *)script info:(NSDictionary *)info;
+@end
+
+@implementation BMScriptQueue
+
+@synthesize delegate;
+@synthesize completionThread;
+
++ (id) queue {
+    return [[[self alloc] init] autorelease];
+}
+
+- (id) init {
+    if ((self = [super init])) {
+        lock = [[NSCondition alloc] init];
+        pendingScripts = [[NSMutableArray alloc] init];
+        runningScripts = [[NSMutableArray alloc] init];
+        maxConcurrentScripts = [[NSProcessInfo processInfo] activeProcessorCount];
+        if (maxConcurrentScripts < 1) maxConcurrentScripts = 1;
+    }
+    return self;
+}
+
+// worker threads retain the queue, so by the time we get here all of them have exited
+- (void) dealloc {
+    [pendingScripts release], pendingScripts = nil;
+    [runningScripts release], runningScripts = nil;
+    [completionThread release], completionThread = nil;
+    [sweepEntries release], sweepEntries = nil;
+    [lock release], lock = nil;
+    [super dealloc];
+}
+
+- (NSString *) description {
+    [lock lock];
+    NSString * desc = [NSString stringWithFormat:@"%@ (%lu pending, %lu running, max. %lu)", [super description],
+                       (unsigned long)[pendingScripts count], (unsigned long)[runningScripts count], (unsigned long)maxConcurrentScripts];
+    [lock unlock];
+    return desc;
+}
+
+// MARK: Accessors
+
+- (NSUInteger) maxConcurrentScripts {
+    [lock lock];
+    NSUInteger value = maxConcurrentScripts;
+    [lock unlock];
+    return value;
+}
+
+- (void) setMaxConcurrentScripts:(NSUInteger)value {
+    [lock lock];
+    maxConcurrentScripts = (value > 0 ? value : 1);
+    [self startThreadsIfNeeded];
+    [lock unlock];
+}
+
+- (NSUInteger) scriptCount {
+    [lock lock];
+    NSUInteger count = [pendingScripts count] + [runningScripts count];
+    [lock unlock];
+    return count;
+}
+
+// MARK: Adding and Cancelling
+
+- (void) addScript:(BMScript *)script {
+    if (!script) return;
+    [self addScripts:[NSArray arrayWithObject:script]];
+}
+
+- (void) addScripts:(NSArray *)scripts {
+    if ([scripts count] == 0) return;
+    [lock lock];
+    [pendingScripts addObjectsFromArray:scripts];
+    [self startThreadsIfNeeded];
+    [lock unlock];
+}
+
+- (void) cancelAllScripts {
+    [lock lock];
+    for (BMScript * script in pendingScripts) {
+        [self recordSweepRowOfScript:script info:BMScriptQueueRowInfo(script, BMScriptCancelled)];
+    }
+    [pendingScripts removeAllObjects];
+    NSArray * running = [[runningScripts copy] autorelease];
+    [lock unlock];
+    [running makeObjectsPerformSelector:@selector(cancel)];
+}
+
+- (void) waitUntilAllScriptsAreFinished {
+    [lock lock];
+    while (threadCount > 0) {
+        [lock wait];
+    }
+    [lock unlock];
+}
+
+// MARK: Sweeps
+
+- (NSArray *) executeTemplateScript:(BMScript *)templateScript withValues:(NSArray *)rows {
+    
+    for (id row in rows) {
+        if (![row isKindOfClass:[NSDictionary class]] && ![row isKindOfClass:[NSArray class]]) {
+            @throw [NSException exceptionWithName:NSInvalidArgumentException 
+                                           reason:[NSString stringWithFormat:@"%@ Error: sweep rows must be dictionaries or arrays, not %@", 
+                                                   NSStringFromClass([self class]), NSStringFromClass([row class])]
+                                         userInfo:nil];
+        }
+    }
+    
+    NSUInteger count = [rows count];
+    BMScriptQueueSweep * sweep = [[[BMScriptQueueSweep alloc] init] autorelease];
+    sweep->results = [[NSMutableArray alloc] initWithCapacity:count];
+    
+    // compile the template once up front, the copies share it
+    [templateScript scriptTemplate];
+    
+    NSMutableArray * scripts = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray * indexes = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger i = 0;
+    
+    for (id row in rows) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        BMScript * script = [[templateScript copy] autorelease];
+        BOOL saturated = NO;
+        @try {
+            if ([row isKindOfClass:[NSDictionary class]]) {
+                saturated = [script saturateTemplateWithDictionary:row];
+            } else {
+                saturated = [script saturateTemplateWithArgumentsInArray:row];
+            }
+        }
+        @catch (NSException * e) {
+            if (![[e name] isEqualToString:BMScriptTemplateArgumentMissingException]) {
+                // the exception may live in our pool, so it goes on to the caller's
+                [e retain];
+                [pool drain];
+                @throw [e autorelease];
+            }
+        }
+        if (saturated) {
+            [sweep->results addObject:[NSNull null]];
+            [scripts addObject:script];
+            [indexes addObject:[NSNumber numberWithUnsignedInteger:i]];
+        } else {
+            [sweep->results addObject:BMScriptQueueRowInfo(script, BMScriptFailedWithException)];
+        }
+        i++;
+        [pool drain];
+    }
+    
+    [lock lock];
+    if (!sweepEntries) {
+        sweepEntries = [[NSMapTable alloc] initWithKeyOptions:(NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality)
+                                                 valueOptions:NSPointerFunctionsStrongMemory
+                                                     capacity:[scripts count]];
+    }
+    for (i = 0; i < [scripts count]; i++) {
+        [sweepEntries setObject:[NSArray arrayWithObjects:sweep, [indexes objectAtIndex:i], nil] forKey:[scripts objectAtIndex:i]];
+    }
+    sweep->remaining = [scripts count];
+    [pendingScripts addObjectsFromArray:scripts];
+    [self startThreadsIfNeeded];
+    while (sweep->remaining > 0) {
+        [lock wait];
+    }
+    [lock unlock];
+    
+    return [[sweep->results copy] autorelease];
+}
+
+/* must be called with the lock held */
+- (void) recordSweepRowOfScript:(BMScript *)script info:(NSDictionary *)info {
+    NSArray * entry = [sweepEntries objectForKey:script];
+    if (!entry) return;
+    BMScriptQueueSweep * sweep = [entry objectAtIndex:0];
+    [sweep->results replaceObjectAtIndex:[[entry objectAtIndex:1] unsignedIntegerValue] withObject:info];
+    sweep->remaining--;
+    [sweepEntries removeObjectForKey:script];
+    [lock broadcast];
+}
+
+// MARK: Worker Threads
+
+/* must be called with the lock held */
+- (void) startThreadsIfNeeded {
+    while (threadCount < maxConcurrentScripts && threadCount < [pendingScripts count] + [runningScripts count]) {
+        threadCount++;
+        [NSThread detachNewThreadSelector:@selector(runScripts) toTarget:self withObject:nil];
+    }
+}
+
+- (void) runScripts {
+    for (;;) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+
+        [lock lock];
+        if ([pendingScripts count] == 0 || threadCount > maxConcurrentScripts) {
+            if (threadCount == 1 && [pendingScripts count] == 0 && finishedCount > 0) {
+                // last one out reports the batch. new scripts may come in meanwhile, so look again afterwards.
+                NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:
+                                       [NSNumber numberWithUnsignedInteger:finishedCount], BMScriptQueueNotificationFinishedCount,
+                                         [NSNumber numberWithUnsignedInteger:failedCount], BMScriptQueueNotificationFailedCount, nil];
+                finishedCount = failedCount = 0;
+                [lock unlock];
+                [self deliver:@selector(deliverQueueDidFinish:) info:info];
+                [pool drain];
+                continue;
+            }
+            threadCount--;
+            [lock broadcast];
+            [lock unlock];
+            [pool drain];
+            break;
+        }
+        BMScript * script = [[[pendingScripts objectAtIndex:0] retain] autorelease];
+        [pendingScripts removeObjectAtIndex:0];
+        [runningScripts addObject:script];
+        [lock unlock];
+
+        NSData * results = nil;
+        ExecutionStatus status = BMScriptNotExecuted;
+        @try {
+            status = [script executeAndReturnResult:&results error:nil];
+        }
+        @catch (NSException * e) {
+            NSLog(@"%@ Warning: Executing script %@ raised %@: %@", NSStringFromClass([self class]), script, [e name], [e reason]);
+            status = BMScriptFailedWithException;
+        }
+
+        NSData * errorResults = [script lastErrorResult];
+        NSDictionary * info = [NSDictionary dictionaryWithObjectsAndKeys:
+                                                                 script, BMScriptQueueNotificationScript,
+                                   [NSNumber numberWithInteger:status], BMScriptNotificationExecutionStatus,
+               [NSNumber numberWithInteger:[script lastReturnValue]], BMScriptNotificationTaskReturnValue,
+                             (errorResults ? errorResults : [NSData data]), BMScriptNotificationTaskErrorResults,
+                                                                results, BMScriptNotificationTaskResults, nil];
+
+        [lock lock];
+        [runningScripts removeObjectIdenticalTo:script];
+        finishedCount++;
+        if (status != BMScriptFinishedSuccessfully) failedCount++;
+        [self recordSweepRowOfScript:script info:info];
+        [lock unlock];
+
+        [self deliver:@selector(deliverScriptDidFinish:) info:info];
+
+        [pool drain];
+    }
+}
+
+// MARK: Delivery
+
+- (void) deliver:(SEL)selector info:(NSDictionary *)info {
+    NSThread * thread = self.completionThread;
+    if (thread && thread != [NSThread currentThread]) {
+        [self performSelector:selector onThread:thread withObject:info waitUntilDone:NO];
+    } else {
+        [self performSelector:selector withObject:info];
+    }
+}
+
+- (void) deliverScriptDidFinish:(NSDictionary *)info {
+    id<BMScriptQueueDelegateProtocol> aDelegate = self.delegate;
+    if ([aDelegate respondsToSelector:@selector(scriptQueue:didFinishScript:withStatus:)]) {
+        [aDelegate scriptQueue:self
+               didFinishScript:[info objectForKey:BMScriptQueueNotificationScript]
+                    withStatus:[[info objectForKey:BMScriptNotificationExecutionStatus] integerValue]];
+    }
+    [[NSNotificationCenter defaultCenter] postNotificationName:BMScriptQueueScriptDidFinishNotification object:self userInfo:info];
+}
+
+- (void) deliverQueueDidFinish:(NSDictionary *)info {
+    id<BMScriptQueueDelegateProtocol> aDelegate = self.delegate;
+    if ([aDelegate respondsToSelector:@selector(scriptQueueDidFinish:finishedCount:failedCount:)]) {
+        [aDelegate scriptQueueDidFinish:self
+                          finishedCount:[[info objectForKey:BMScriptQueueNotificationFinishedCount] unsignedIntegerValue]
+                            failedCount:[[info objectForKey:BMScriptQueueNotificationFailedCount] unsignedIntegerValue]];
+    }
+    [[NSNotificationCenter defaultCenter] postNotificationName:BMScriptQueueDidFinishNotification object:self userInfo:info];
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,161 @@
+//
+//  BMScriptResultCache.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptResultCache.h
+ * Class interface of BMScriptResultCache.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*! Default for BMScriptResultCache#byteBudget of the shared cache, in bytes. */
+#ifndef BMSCRIPT_RESULT_CACHE_BYTE_BUDGET
+    #define BMSCRIPT_RESULT_CACHE_BYTE_BUDGET (64ULL * 1024 * 1024)
+#endif
+
+/*! @} */
+
+/*!
+ * @addtogroup functions Functions and Global Variables
+ * @{
+ */
+
+/*!
+ * Returns the SHA-256 digest of everything that goes into an execution as a string of 64 lowercase hex digits.
+ *
+ * The options dictionary is hashed in a canonical form: dictionaries by sorted keys, every value prefixed with its
+ * kind and length, so two option sets only share a fingerprint if they are equal. Strings are hashed as UTF-8.
+ * Input files are hashed by path and contents; a missing file counts as such. The digest of a file's contents is
+ * remembered along with its inode, size and modification time, so an unchanged file is only read once per process.
+ * @param scriptSource the script source
+ * @param scriptOptions a dictionary containing the task options
+ * @param inputPaths the paths of the files the script reads, or nil. See BMScript#inputPaths.
+ */
+OBJC_EXPORT NSString * BMScriptFingerprint(NSString * scriptSource, NSDictionary * scriptOptions, NSArray * inputPaths);
+
+/*!
+ * @}
+ */
+
+/*!
+ * @class BMScriptResultCache
+ * An in-memory cache for the results of scripts whose output only depends on their source and options.
+ *
+ * Set BMScript#resultCache to opt a script in. Its blocking executions then look up the fingerprint of the script
+ * (see BMScript#fingerprint) before doing anything else. On a hit the cached result, error result and return value
+ * are handed out as if the script had just run: the delegate is asked about the result and the history item,
+ * the BMScript#outputHandler gets the output in one chunk, and no process is started. On a miss the script runs
+ * as usual and its result is cached if it finished (with whatever exit status) and kept all of its output.
+ * Timed out and cancelled executions, scripts that don't retain their output (BMScript#retainsOutput) and results
+ * cut down by the BMScript#outputRetentionPolicy are never cached.
+ *
+ * The least recently used results are evicted once the results together take up more than BMScriptResultCache#byteBudget
+ * bytes. A result is fresh for BMScriptResultCache#timeToLive seconds after it was stored. For another
+ * BMScriptResultCache#staleWhileRevalidate seconds it is still handed out, but the first lookup of the stale result
+ * also starts a copy of the script on a background thread whose result replaces it. After that it is gone.
+ *
+ * Hits, misses, stale hits and evictions are counted for tuning. All methods are thread-safe.
+ */
+@interface BMScriptResultCache : NSObject {
+ @private
+    NSLock * lock;
+    NSMutableDictionary * entries;
+    id newest;
+    id oldest;
+    unsigned long long byteBudget;
+    unsigned long long totalBytes;
+    NSTimeInterval timeToLive;
+    NSTimeInterval staleWhileRevalidate;
+    NSUInteger hits;
+    NSUInteger misses;
+    NSUInteger staleHits;
+    NSUInteger evictions;
+}
+
+/*! Gets or sets how many bytes of results the cache may hold. Defaults to #BMSCRIPT_RESULT_CACHE_BYTE_BUDGET for the shared cache. */
+@property (BM_ATOMIC assign) unsigned long long byteBudget;
+/*! Gets or sets for how many seconds a result is fresh. 0 means forever. Defaults to 0. */
+@property (BM_ATOMIC assign) NSTimeInterval timeToLive;
+/*! Gets or sets for how many seconds past its time to live a result is still handed out while it is being refreshed. Defaults to 0. */
+@property (BM_ATOMIC assign) NSTimeInterval staleWhileRevalidate;
+
+/*! Returns the cache shared by all scripts, created on first use. */
++ (BMScriptResultCache *) sharedCache;
+
+/*!
+ * Initializes an empty cache. This is the designated initializer.
+ * @param budget the number of bytes of results the cache may hold
+ */
+- (id) initWithByteBudget:(unsigned long long)budget;
+
+/*!
+ * Looks up a result. Counts a hit, a stale hit or a miss.
+ * @param fingerprint the key, usually BMScript#fingerprint
+ * @param revalidate on return YES if the result is stale and the caller is the first to find out, and so should run
+ *        the script again and store its result. The caller must call #endRevalidatingFingerprint: if it can't.
+ *        May be NULL.
+ * @returns a dictionary with the #BMScriptNotificationTaskResults, #BMScriptNotificationTaskErrorResults,
+ *          #BMScriptNotificationTaskReturnValue and #BMScriptNotificationExecutionStatus of the cached execution,
+ *          or nil if there is no (usable) result
+ */
+- (NSDictionary *) resultForFingerprint:(NSString *)fingerprint needsRevalidation:(BOOL *)revalidate;
+/*!
+ * Stores a result, replacing an older one for the same fingerprint, and evicts the least recently used results
+ * until the cache fits its byte budget again. A result larger than the whole budget is not stored.
+ * @param data the output
+ * @param errors what the script wrote to stderr, or nil
+ * @param retval the exit status of the script
+ * @param status the execution status
+ * @param fingerprint the key, usually BMScript#fingerprint
+ */
+- (void) setResult:(NSData *)data
+       errorResult:(NSData *)errors
+       returnValue:(NSInteger)retval
+   executionStatus:(ExecutionStatus)status
+    forFingerprint:(NSString *)fingerprint;
+/*! Gives up a revalidation that didn't store a new result, so the next lookup of the stale result may try again. */
+- (void) endRevalidatingFingerprint:(NSString *)fingerprint;
+/*! Removes the result for a fingerprint. */
+- (void) removeResultForFingerprint:(NSString *)fingerprint;
+/*! Removes all results. The counters are kept. */
+- (void) removeAllResults;
+
+/*! Returns the number of cached results. */
+- (NSUInteger) count;
+/*! Returns the number of bytes the cached results take up. */
+- (unsigned long long) totalBytes;
+/*! Returns the number of lookups that found a result, including stale ones. */
+- (NSUInteger) hits;
+/*! Returns the number of lookups that found a stale result. */
+- (NSUInteger) staleHits;
+/*! Returns the number of lookups that found no usable result. */
+- (NSUInteger) misses;
+/*! Returns the number of results evicted to stay within the byte budget. */
+- (NSUInteger) evictions;
+/*! Sets all counters back to 0. */
+- (void) resetStatistics;
+
+@end
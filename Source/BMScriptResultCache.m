@@ -0,0 +1,625 @@
+//
+//  BMScriptResultCache.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptResultCache.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__APPLE__)
+    #define BM_STAT_MTIME_NSEC(st) ((long)(st).st_mtimespec.tv_nsec)
+#else
+    #define BM_STAT_MTIME_NSEC(st) ((long)(st).st_mtim.tv_nsec)
+#endif
+
+#define BMSCRIPT_RESULT_CACHE_ENTRY_OVERHEAD    128     /* bytes charged per entry on top of its data and key */
+#define BMSCRIPT_FINGERPRINT_CHUNK_LENGTH       4096    /* bytes of UTF-8 converted at a time while hashing a string */
+
+// MARK: SHA-256
+
+typedef struct BMScriptSHA256Context {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} BMScriptSHA256Context;
+
+static const uint32_t BMScriptSHA256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define BMSCRIPT_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void BMScriptSHA256Transform(BMScriptSHA256Context * ctx, const unsigned char * block) {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = BMSCRIPT_ROTR(w[i - 15], 7) ^ BMSCRIPT_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = BMSCRIPT_ROTR(w[i - 2], 17) ^ BMSCRIPT_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    for (i = 0; i < 64; i++) {
+        uint32_t t1 = h + (BMSCRIPT_ROTR(e, 6) ^ BMSCRIPT_ROTR(e, 11) ^ BMSCRIPT_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + BMScriptSHA256K[i] + w[i];
+        uint32_t t2 = (BMSCRIPT_ROTR(a, 2) ^ BMSCRIPT_ROTR(a, 13) ^ BMSCRIPT_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+static void BMScriptSHA256Init(BMScriptSHA256Context * ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void BMScriptSHA256Update(BMScriptSHA256Context * ctx, const void * bytes, size_t len) {
+    const unsigned char * p = bytes;
+    ctx->length += len;
+    if (ctx->used > 0) {
+        size_t take = MIN(len, 64 - ctx->used);
+        memcpy(ctx->block + ctx->used, p, take);
+        ctx->used += take;
+        p += take;
+        len -= take;
+        if (ctx->used < 64) return;
+        BMScriptSHA256Transform(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    while (len >= 64) {
+        BMScriptSHA256Transform(ctx, p);
+        p += 64;
+        len -= 64;
+    }
+    if (len > 0) {
+        memcpy(ctx->block, p, len);
+        ctx->used = len;
+    }
+}
+
+static void BMScriptSHA256Final(BMScriptSHA256Context * ctx, unsigned char digest[32]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad[72];
+    size_t padLength = (ctx->used < 56 ? 56 - ctx->used : 120 - ctx->used);
+    int i;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[padLength + i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    BMScriptSHA256Update(ctx, pad, padLength + 8);
+    for (i = 0; i < 8; i++) {
+        digest[i * 4]     = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)(ctx->state[i]);
+    }
+}
+
+// MARK: Fingerprints
+
+/* a kind tag and a length in front of every value, so no two different values hash alike */
+static void BMScriptFingerprintUpdateHeader(BMScriptSHA256Context * ctx, char kind, unsigned long long length) {
+    unsigned char header[9];
+    int i;
+    header[0] = (unsigned char)kind;
+    for (i = 0; i < 8; i++) {
+        header[i + 1] = (unsigned char)(length >> (56 - i * 8));
+    }
+    BMScriptSHA256Update(ctx, header, sizeof(header));
+}
+
+/* hashes the UTF-8 of a string in chunks instead of converting the whole (possibly huge) source at once */
+static void BMScriptFingerprintUpdateString(BMScriptSHA256Context * ctx, NSString * string) {
+    NSUInteger length = [string length];
+    BMScriptFingerprintUpdateHeader(ctx, 's', length);
+    unsigned char buffer[BMSCRIPT_FINGERPRINT_CHUNK_LENGTH];
+    NSRange remaining = NSMakeRange(0, length);
+    while (remaining.length > 0) {
+        NSUInteger used = 0;
+        NSRange rest;
+        if (![string getBytes:buffer maxLength:sizeof(buffer) usedLength:&used encoding:NSUTF8StringEncoding
+                      options:0 range:remaining remainingRange:&rest] || rest.location == remaining.location) {
+            // not representable (lone surrogates): hash the UTF-16 instead
+            unichar c = [string characterAtIndex:remaining.location];
+            BMScriptSHA256Update(ctx, &c, sizeof(c));
+            rest = NSMakeRange(remaining.location + 1, remaining.length - 1);
+        } else {
+            BMScriptSHA256Update(ctx, buffer, used);
+        }
+        remaining = rest;
+    }
+}
+
+static void BMScriptFingerprintUpdateObject(BMScriptSHA256Context * ctx, id object) {
+    if ([object isKindOfClass:[NSString class]]) {
+        BMScriptFingerprintUpdateString(ctx, object);
+    } else if ([object isKindOfClass:[NSData class]]) {
+        BMScriptFingerprintUpdateHeader(ctx, 'b', [object length]);
+        BMScriptSHA256Update(ctx, [object bytes], [object length]);
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        BMScriptFingerprintUpdateHeader(ctx, 'a', [object count]);
+        for (id element in object) {
+            BMScriptFingerprintUpdateObject(ctx, element);
+        }
+    } else if ([object isKindOfClass:[NSDictionary class]]) {
+        NSArray * keys = [[object allKeys] sortedArrayUsingSelector:@selector(compare:)];
+        BMScriptFingerprintUpdateHeader(ctx, 'd', [keys count]);
+        for (id key in keys) {
+            BMScriptFingerprintUpdateObject(ctx, key);
+            BMScriptFingerprintUpdateObject(ctx, [object objectForKey:key]);
+        }
+    } else if ([object isKindOfClass:[NSNumber class]]) {
+        BMScriptFingerprintUpdateHeader(ctx, 'n', 0);
+        BMScriptFingerprintUpdateString(ctx, [object stringValue]);
+    } else if (object) {
+        BMScriptFingerprintUpdateHeader(ctx, 'o', 0);
+        BMScriptFingerprintUpdateString(ctx, [object description]);
+    } else {
+        BMScriptFingerprintUpdateHeader(ctx, '0', 0);
+    }
+}
+
+/* The digest of an input file's contents, valid as long as the file has the same identity, size and modification time. */
+@interface BMScriptInputDigest : NSObject {
+ @public
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    time_t mtime;
+    long mtimeNsec;
+    unsigned char digest[32];
+}
+@end
+
+@implementation BMScriptInputDigest
+@end
+
+static NSLock * inputDigestsLock = nil;
+static NSMutableDictionary * inputDigests = nil;     /* path -> BMScriptInputDigest */
+
+/* hashes the contents of a file into digest. returns NO if it can't be read. */
+static BOOL BMScriptDigestOfInputFile(NSString * path, unsigned char digest[32]) {
+
+    int fd = open([path fileSystemRepresentation], O_RDONLY);
+    if (fd < 0) return NO;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NO;
+    }
+
+    @synchronized([BMScriptInputDigest class]) {
+        if (!inputDigestsLock) {
+            inputDigestsLock = [[NSLock alloc] init];
+            inputDigests = [[NSMutableDictionary alloc] init];
+        }
+    }
+
+    [inputDigestsLock lock];
+    BMScriptInputDigest * known = [[inputDigests objectForKey:path] retain];
+    [inputDigestsLock unlock];
+
+    if (known && known->device == st.st_dev && known->inode == st.st_ino && known->size == st.st_size
+        && known->mtime == st.st_mtime && known->mtimeNsec == BM_STAT_MTIME_NSEC(st)) {
+        memcpy(digest, known->digest, 32);
+        [known release];
+        close(fd);
+        return YES;
+    }
+    [known release];
+
+    BMScriptSHA256Context ctx;
+    BMScriptSHA256Init(&ctx);
+    BOOL ok = YES;
+    if (st.st_size > 0) {
+        void * addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            BMScriptSHA256Update(&ctx, addr, (size_t)st.st_size);
+            munmap(addr, (size_t)st.st_size);
+        } else {
+            ok = NO;
+        }
+    }
+    close(fd);
+    if (!ok) return NO;
+    BMScriptSHA256Final(&ctx, digest);
+
+    BMScriptInputDigest * entry = [[BMScriptInputDigest alloc] init];
+    entry->device = st.st_dev;
+    entry->inode = st.st_ino;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->mtimeNsec = BM_STAT_MTIME_NSEC(st);
+    memcpy(entry->digest, digest, 32);
+    [inputDigestsLock lock];
+    [inputDigests setObject:entry forKey:path];
+    [inputDigestsLock unlock];
+    [entry release];
+
+    return YES;
+}
+
+NSString * BMScriptFingerprint(NSString * scriptSource, NSDictionary * scriptOptions, NSArray * inputPaths) {
+    BMScriptSHA256Context ctx;
+    unsigned char digest[32];
+    char hex[65];
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    BMScriptSHA256Init(&ctx);
+    BMScriptFingerprintUpdateObject(&ctx, scriptOptions);
+    BMScriptFingerprintUpdateObject(&ctx, scriptSource);
+
+    if ([inputPaths count] > 0) {
+        BMScriptFingerprintUpdateHeader(&ctx, 'i', [inputPaths count]);
+        for (NSString * path in inputPaths) {
+            BMScriptFingerprintUpdateString(&ctx, path);
+            if (BMScriptDigestOfInputFile(path, digest)) {
+                BMScriptFingerprintUpdateHeader(&ctx, 'f', sizeof(digest));
+                BMScriptSHA256Update(&ctx, digest, sizeof(digest));
+            } else {
+                BMScriptFingerprintUpdateHeader(&ctx, '0', 0);
+            }
+        }
+    }
+    BMScriptSHA256Final(&ctx, digest);
+
+    for (i = 0; i < 32; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[64] = '\0';
+    return [NSString stringWithUTF8String:hex];
+}
+
+// MARK: Entries
+
+/* a cached execution, linked into the LRU list of its cache (newest first) */
+@interface BMScriptResultCacheEntry : NSObject {
+ @public
+    NSString * fingerprint;
+    NSData * result;
+    NSData * errorResult;
+    NSInteger returnValue;
+    ExecutionStatus status;
+    NSTimeInterval storedAt;
+    unsigned long long cost;
+    BOOL revalidating;
+    BMScriptResultCacheEntry * newer;   /* not retained, the cache's dictionary owns the entries */
+    BMScriptResultCacheEntry * older;
+}
+@end
+
+@implementation BMScriptResultCacheEntry
+
+- (void) dealloc {
+    [fingerprint release], fingerprint = nil;
+    [result release], result = nil;
+    [errorResult release], errorResult = nil;
+    [super dealloc];
+}
+
+@end
+
+
+@interface BMScriptResultCache (/* Private */)
+- (void) unlinkEntry:(BMScriptResultCacheEntry *)entry;
+- (void) linkEntryAsNewest:(BMScriptResultCacheEntry *)entry;
+- (void) removeEntry:(BMScriptResultCacheEntry *)entry;
+- (void) evictToBudget:(unsigned long long)budget;
+@end
+
+@implementation BMScriptResultCache
+
+static BMScriptResultCache * sharedCache = nil;
+
++ (BMScriptResultCache *) sharedCache {
+    @synchronized(self) {
+        if (!sharedCache) {
+            sharedCache = [[self alloc] initWithByteBudget:BMSCRIPT_RESULT_CACHE_BYTE_BUDGET];
+        }
+    }
+    return sharedCache;
+}
+
+- (id) init {
+    return [self initWithByteBudget:BMSCRIPT_RESULT_CACHE_BYTE_BUDGET];
+}
+
+/* designated initializer */
+- (id) initWithByteBudget:(unsigned long long)budget {
+    if ((self = [super init])) {
+        lock = [[NSLock alloc] init];
+        entries = [[NSMutableDictionary alloc] init];
+        byteBudget = budget;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [entries release], entries = nil;
+    [lock release], lock = nil;
+    [super dealloc];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%lu results, %llu of %llu bytes, %lu hits, %lu stale, %lu misses, %lu evictions)",
+            [super description], (unsigned long)[self count], [self totalBytes], self.byteBudget,
+            (unsigned long)[self hits], (unsigned long)[self staleHits], (unsigned long)[self misses], (unsigned long)[self evictions]];
+}
+
+// MARK: Accessors
+
+- (unsigned long long) byteBudget {
+    [lock lock];
+    unsigned long long budget = byteBudget;
+    [lock unlock];
+    return budget;
+}
+
+- (void) setByteBudget:(unsigned long long)budget {
+    [lock lock];
+    byteBudget = budget;
+    [self evictToBudget:budget];
+    [lock unlock];
+}
+
+- (NSTimeInterval) timeToLive {
+    [lock lock];
+    NSTimeInterval ttl = timeToLive;
+    [lock unlock];
+    return ttl;
+}
+
+- (void) setTimeToLive:(NSTimeInterval)ttl {
+    [lock lock];
+    timeToLive = MAX(ttl, 0);
+    [lock unlock];
+}
+
+- (NSTimeInterval) staleWhileRevalidate {
+    [lock lock];
+    NSTimeInterval window = staleWhileRevalidate;
+    [lock unlock];
+    return window;
+}
+
+- (void) setStaleWhileRevalidate:(NSTimeInterval)window {
+    [lock lock];
+    staleWhileRevalidate = MAX(window, 0);
+    [lock unlock];
+}
+
+- (NSUInteger) count {
+    [lock lock];
+    NSUInteger count = [entries count];
+    [lock unlock];
+    return count;
+}
+
+- (unsigned long long) totalBytes {
+    [lock lock];
+    unsigned long long bytes = totalBytes;
+    [lock unlock];
+    return bytes;
+}
+
+- (NSUInteger) hits {
+    [lock lock];
+    NSUInteger n = hits;
+    [lock unlock];
+    return n;
+}
+
+- (NSUInteger) staleHits {
+    [lock lock];
+    NSUInteger n = staleHits;
+    [lock unlock];
+    return n;
+}
+
+- (NSUInteger) misses {
+    [lock lock];
+    NSUInteger n = misses;
+    [lock unlock];
+    return n;
+}
+
+- (NSUInteger) evictions {
+    [lock lock];
+    NSUInteger n = evictions;
+    [lock unlock];
+    return n;
+}
+
+- (void) resetStatistics {
+    [lock lock];
+    hits = staleHits = misses = evictions = 0;
+    [lock unlock];
+}
+
+// MARK: Lookup
+
+- (NSDictionary *) resultForFingerprint:(NSString *)fingerprint needsRevalidation:(BOOL *)revalidate {
+
+    if (revalidate) *revalidate = NO;
+    if (!fingerprint) return nil;
+
+    NSDictionary * info = nil;
+
+    [lock lock];
+
+    BMScriptResultCacheEntry * entry = [entries objectForKey:fingerprint];
+    if (entry && timeToLive > 0) {
+        NSTimeInterval age = [NSDate timeIntervalSinceReferenceDate] - entry->storedAt;
+        if (age >= timeToLive + staleWhileRevalidate) {
+            [self removeEntry:entry];
+            entry = nil;
+        } else if (age >= timeToLive) {
+            staleHits++;
+            if (revalidate && !entry->revalidating) {
+                entry->revalidating = YES;
+                *revalidate = YES;
+            }
+        }
+    }
+
+    if (entry) {
+        hits++;
+        [self unlinkEntry:entry];
+        [self linkEntryAsNewest:entry];
+        info = [NSDictionary dictionaryWithObjectsAndKeys:
+                entry->result, BMScriptNotificationTaskResults,
+                entry->errorResult, BMScriptNotificationTaskErrorResults,
+                [NSNumber numberWithInteger:entry->returnValue], BMScriptNotificationTaskReturnValue,
+                [NSNumber numberWithInteger:entry->status], BMScriptNotificationExecutionStatus, nil];
+    } else {
+        misses++;
+    }
+
+    [lock unlock];
+
+    return info;
+}
+
+// MARK: Storing
+
+- (void) setResult:(NSData *)data
+       errorResult:(NSData *)errors
+       returnValue:(NSInteger)retval
+   executionStatus:(ExecutionStatus)status
+    forFingerprint:(NSString *)fingerprint {
+
+    if (!fingerprint) return;
+
+    BMScriptResultCacheEntry * entry = [[BMScriptResultCacheEntry alloc] init];
+    entry->fingerprint = [fingerprint copy];
+    entry->result = (data ? [data copy] : [[NSData alloc] init]);
+    entry->errorResult = (errors ? [errors copy] : [[NSData alloc] init]);
+    entry->returnValue = retval;
+    entry->status = status;
+    entry->storedAt = [NSDate timeIntervalSinceReferenceDate];
+    entry->cost = [entry->result length] + [entry->errorResult length] + [fingerprint length] + BMSCRIPT_RESULT_CACHE_ENTRY_OVERHEAD;
+
+    [lock lock];
+
+    BMScriptResultCacheEntry * previous = [entries objectForKey:fingerprint];
+    if (previous) {
+        [self removeEntry:previous];
+    }
+    if (entry->cost <= byteBudget) {
+        [self evictToBudget:(byteBudget - entry->cost)];
+        [entries setObject:entry forKey:fingerprint];
+        [self linkEntryAsNewest:entry];
+        totalBytes += entry->cost;
+    }
+
+    [lock unlock];
+
+    [entry release];
+}
+
+- (void) endRevalidatingFingerprint:(NSString *)fingerprint {
+    if (!fingerprint) return;
+    [lock lock];
+    BMScriptResultCacheEntry * entry = [entries objectForKey:fingerprint];
+    if (entry) entry->revalidating = NO;
+    [lock unlock];
+}
+
+- (void) removeResultForFingerprint:(NSString *)fingerprint {
+    if (!fingerprint) return;
+    [lock lock];
+    BMScriptResultCacheEntry * entry = [entries objectForKey:fingerprint];
+    if (entry) [self removeEntry:entry];
+    [lock unlock];
+}
+
+- (void) removeAllResults {
+    [lock lock];
+    [entries removeAllObjects];
+    newest = oldest = nil;
+    totalBytes = 0;
+    [lock unlock];
+}
+
+// MARK: Private (called with the lock held)
+
+- (void) unlinkEntry:(BMScriptResultCacheEntry *)entry {
+    if (entry->newer) entry->newer->older = entry->older;
+    else newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else oldest = entry->newer;
+    entry->newer = entry->older = nil;
+}
+
+- (void) linkEntryAsNewest:(BMScriptResultCacheEntry *)entry {
+    BMScriptResultCacheEntry * head = newest;
+    entry->newer = nil;
+    entry->older = head;
+    if (head) head->newer = entry;
+    else oldest = entry;
+    newest = entry;
+}
+
+- (void) removeEntry:(BMScriptResultCacheEntry *)entry {
+    [self unlinkEntry:entry];
+    totalBytes -= entry->cost;
+    // the key belongs to the entry, keep it alive until the dictionary is done with it
+    [entry retain];
+    [entries removeObjectForKey:entry->fingerprint];
+    [entry release];
+}
+
+- (void) evictToBudget:(unsigned long long)budget {
+    while (oldest && totalBytes > budget) {
+        [self removeEntry:oldest];
+        evictions++;
+    }
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,137 @@
+//
+//  BMScriptResultStore.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptResultStore.h
+ * Class interface of BMScriptResultStore.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*! Default for BMScriptResultStore#sizeLimit, in bytes. */
+#ifndef BMSCRIPT_RESULT_STORE_SIZE_LIMIT
+    #define BMSCRIPT_RESULT_STORE_SIZE_LIMIT (256ULL * 1024 * 1024)
+#endif
+
+/*! Number of results a store writes before it adds up the size of its directory again to account for other processes. */
+#ifndef BMSCRIPT_RESULT_STORE_RESCAN_INTERVAL
+    #define BMSCRIPT_RESULT_STORE_RESCAN_INTERVAL 100
+#endif
+
+/*! @} */
+
+/*!
+ * @class BMScriptResultStore
+ * A persistent, content-addressed store for the results of scripts, shared by all processes using the same directory.
+ *
+ * The counterpart of BMScriptResultCache on disk: set BMScript#resultStore and blocking executions look up the script's
+ * BMScript#fingerprint, which covers the source, the options and the contents of the BMScript#inputPaths, in the
+ * store before starting a process. A hit is handed out just like a hit in the BMScript#resultCache (and added to it,
+ * if the script has one). The results of executions that ran to their end are written to the store.
+ *
+ * Each result is one file named after its fingerprint (<span class="sourcecode">objects/ab/abcdef…</span>), holding
+ * a small header with the return value and the execution status followed by the output and the stderr output.
+ * Files are written under a temporary name and renamed into place, so a reader only ever sees complete results and
+ * needs no lock; a writer racing another for the same fingerprint simply replaces an identical result.
+ *
+ * A hit updates the access time of the file. Once the files add up to more than BMScriptResultStore#sizeLimit
+ * bytes, the least recently accessed ones are removed until the store is back at 90% of the limit. Only one process
+ * evicts at a time (guarded by an flock(2) on a lock file in the directory); results removed while being read stay
+ * readable to whoever has them open. Temporary files left behind by crashed writers are cleaned up along the way.
+ *
+ * All methods are thread-safe.
+ */
+@interface BMScriptResultStore : NSObject {
+ @private
+    NSString * directory;
+    NSLock * lock;
+    unsigned long long sizeLimit;
+    unsigned long long approximateSize;
+    BOOL sizeKnown;
+    NSUInteger writesSinceScan;
+    NSUInteger hits;
+    NSUInteger misses;
+    NSUInteger evictions;
+}
+
+/*! Gets or sets how many bytes the results in the store may take up. Defaults to #BMSCRIPT_RESULT_STORE_SIZE_LIMIT. */
+@property (BM_ATOMIC assign) unsigned long long sizeLimit;
+
+/*!
+ * Returns the store in the default directory, created on first use: <span class="sourcecode">BMScript/Results</span>
+ * in the user's caches directory, or in the temporary directory if there is none.
+ */
++ (BMScriptResultStore *) sharedStore;
+/*! Returns an autoreleased store for a directory. @see #initWithDirectory: */
++ (id) storeWithDirectory:(NSString *)path;
+
+/*!
+ * Opens the store in a directory, creating the directory if needed. This is the designated initializer.
+ * @param path the directory of the store
+ * @returns the store, or nil if the directory can't be created
+ */
+- (id) initWithDirectory:(NSString *)path;
+
+/*! Returns the directory of the store. */
+- (NSString *) directory;
+
+/*!
+ * Looks up a result. Counts a hit or a miss.
+ * @param fingerprint the key, usually BMScript#fingerprint
+ * @returns a dictionary with the #BMScriptNotificationTaskResults, #BMScriptNotificationTaskErrorResults,
+ *          #BMScriptNotificationTaskReturnValue and #BMScriptNotificationExecutionStatus of the stored execution,
+ *          or nil if there is no (complete) result
+ */
+- (NSDictionary *) resultForFingerprint:(NSString *)fingerprint;
+/*!
+ * Writes a result, replacing an older one for the same fingerprint, and evicts results if the store is over its size limit.
+ * @param data the output
+ * @param errors what the script wrote to stderr, or nil
+ * @param retval the exit status of the script
+ * @param status the execution status
+ * @param fingerprint the key, usually BMScript#fingerprint
+ * @returns YES if the result was written
+ */
+- (BOOL) setResult:(NSData *)data
+       errorResult:(NSData *)errors
+       returnValue:(NSInteger)retval
+   executionStatus:(ExecutionStatus)status
+    forFingerprint:(NSString *)fingerprint;
+/*! Removes the result for a fingerprint. */
+- (void) removeResultForFingerprint:(NSString *)fingerprint;
+/*! Removes all results. */
+- (void) removeAllResults;
+
+/*! Returns the number of bytes taken up by the results in the store, adding up the sizes of the files. */
+- (unsigned long long) size;
+/*! Returns the number of lookups by this process that found a result. */
+- (NSUInteger) hits;
+/*! Returns the number of lookups by this process that found no result. */
+- (NSUInteger) misses;
+/*! Returns the number of results this process evicted to stay within the size limit. */
+- (NSUInteger) evictions;
+
+@end
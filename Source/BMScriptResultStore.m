@@ -0,0 +1,470 @@
+//
+//  BMScriptResultStore.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptResultStore.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#if defined(__APPLE__)
+    #define BM_STAT_ATIME_NSEC(st) ((long)(st).st_atimespec.tv_nsec)
+#else
+    #define BM_STAT_ATIME_NSEC(st) ((long)(st).st_atim.tv_nsec)
+#endif
+
+#define BMSCRIPT_RESULT_STORE_MAGIC         "BMSRES1\n"
+#define BMSCRIPT_RESULT_STORE_HEADER_SIZE   40      /* magic, return value, status, output length, stderr length */
+#define BMSCRIPT_RESULT_STORE_TOUCH_AGE     60      /* seconds before a hit moves the access time of a result again */
+#define BMSCRIPT_RESULT_STORE_TMP_AGE       3600    /* seconds after which an abandoned temporary file is removed */
+
+/* one result file found while scanning the store */
+typedef struct BMScriptResultStoreFile {
+    char * path;
+    time_t atime;
+    long atimeNsec;
+    unsigned long long size;
+} BMScriptResultStoreFile;
+
+static void BMScriptResultStorePut64(unsigned char * p, uint64_t value) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(value >> (56 - i * 8));
+    }
+}
+
+static uint64_t BMScriptResultStoreGet64(const unsigned char * p) {
+    uint64_t value = 0;
+    int i;
+    for (i = 0; i < 8; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/* Writes all of a buffer, retrying on short writes and EINTR. */
+static BOOL BMScriptResultStoreWriteAll(int fd, const void * bytes, size_t len) {
+    const char * p = bytes;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return YES;
+}
+
+/* Reads all of a range into a buffer, retrying on short reads and EINTR. */
+static BOOL BMScriptResultStoreReadAll(int fd, void * bytes, size_t len, off_t offset) {
+    char * p = bytes;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return NO;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return YES;
+}
+
+static int BMScriptResultStoreCompareAccess(const void * a, const void * b) {
+    const BMScriptResultStoreFile * fa = a;
+    const BMScriptResultStoreFile * fb = b;
+    if (fa->atime != fb->atime) return (fa->atime < fb->atime ? -1 : 1);
+    return (fa->atimeNsec < fb->atimeNsec ? -1 : (fa->atimeNsec > fb->atimeNsec ? 1 : 0));
+}
+
+
+@interface BMScriptResultStore (/* Private */)
+- (NSString *) pathForFingerprint:(NSString *)fingerprint;
+- (unsigned long long) scanEvictingDownTo:(unsigned long long)target;
+@end
+
+@implementation BMScriptResultStore
+
+static BMScriptResultStore * sharedStore = nil;
+
++ (BMScriptResultStore *) sharedStore {
+    @synchronized(self) {
+        if (!sharedStore) {
+            NSArray * caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+            NSString * base = ([caches count] > 0 ? [caches objectAtIndex:0] : NSTemporaryDirectory());
+            sharedStore = [[self alloc] initWithDirectory:[base stringByAppendingPathComponent:@"BMScript/Results"]];
+        }
+    }
+    return sharedStore;
+}
+
++ (id) storeWithDirectory:(NSString *)path {
+    return [[[self alloc] initWithDirectory:path] autorelease];
+}
+
+- (id) init {
+    return [self initWithDirectory:nil];
+}
+
+/* designated initializer */
+- (id) initWithDirectory:(NSString *)path {
+    if ((self = [super init])) {
+        NSFileManager * fm = [NSFileManager defaultManager];
+        NSDictionary * privateDirectory = [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedLong:0700] forKey:NSFilePosixPermissions];
+        if (!path
+            || ![fm createDirectoryAtPath:[path stringByAppendingPathComponent:@"objects"] withIntermediateDirectories:YES attributes:privateDirectory error:NULL]
+            || ![fm createDirectoryAtPath:[path stringByAppendingPathComponent:@"tmp"] withIntermediateDirectories:YES attributes:privateDirectory error:NULL]) {
+            [self release];
+            return nil;
+        }
+        directory = [path copy];
+        lock = [[NSLock alloc] init];
+        sizeLimit = BMSCRIPT_RESULT_STORE_SIZE_LIMIT;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [directory release], directory = nil;
+    [lock release], lock = nil;
+    [super dealloc];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%@, limit %llu bytes, %lu hits, %lu misses, %lu evictions)",
+            [super description], directory, self.sizeLimit,
+            (unsigned long)[self hits], (unsigned long)[self misses], (unsigned long)[self evictions]];
+}
+
+// MARK: Accessors
+
+- (NSString *) directory {
+    return directory;
+}
+
+- (unsigned long long) sizeLimit {
+    [lock lock];
+    unsigned long long limit = sizeLimit;
+    [lock unlock];
+    return limit;
+}
+
+- (void) setSizeLimit:(unsigned long long)limit {
+    [lock lock];
+    sizeLimit = limit;
+    sizeKnown = NO;     // have the next write check
+    [lock unlock];
+}
+
+- (NSUInteger) hits {
+    [lock lock];
+    NSUInteger n = hits;
+    [lock unlock];
+    return n;
+}
+
+- (NSUInteger) misses {
+    [lock lock];
+    NSUInteger n = misses;
+    [lock unlock];
+    return n;
+}
+
+- (NSUInteger) evictions {
+    [lock lock];
+    NSUInteger n = evictions;
+    [lock unlock];
+    return n;
+}
+
+- (unsigned long long) size {
+    return [self scanEvictingDownTo:ULLONG_MAX];
+}
+
+// MARK: Lookup
+
+- (NSDictionary *) resultForFingerprint:(NSString *)fingerprint {
+
+    NSString * path = [self pathForFingerprint:fingerprint];
+    NSDictionary * info = nil;
+    int fd = (path ? open([path fileSystemRepresentation], O_RDONLY) : -1);
+
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        struct stat st;
+        unsigned char header[BMSCRIPT_RESULT_STORE_HEADER_SIZE];
+
+        if (fstat(fd, &st) == 0
+            && st.st_size >= BMSCRIPT_RESULT_STORE_HEADER_SIZE
+            && BMScriptResultStoreReadAll(fd, header, sizeof(header), 0)
+            && memcmp(header, BMSCRIPT_RESULT_STORE_MAGIC, 8) == 0) {
+
+            int64_t retval = (int64_t) BMScriptResultStoreGet64(header + 8);
+            int64_t status = (int64_t) BMScriptResultStoreGet64(header + 16);
+            uint64_t resultLength = BMScriptResultStoreGet64(header + 24);
+            uint64_t errorLength = BMScriptResultStoreGet64(header + 32);
+
+            // a file of the wrong size is damaged, leave it to eviction
+            if (resultLength <= (uint64_t)st.st_size && errorLength <= (uint64_t)st.st_size
+                && BMSCRIPT_RESULT_STORE_HEADER_SIZE + resultLength + errorLength == (uint64_t)st.st_size) {
+
+                NSMutableData * data = [NSMutableData dataWithLength:(NSUInteger)resultLength];
+                NSMutableData * errors = [NSMutableData dataWithLength:(NSUInteger)errorLength];
+                if (data && errors
+                    && BMScriptResultStoreReadAll(fd, [data mutableBytes], (size_t)resultLength, BMSCRIPT_RESULT_STORE_HEADER_SIZE)
+                    && BMScriptResultStoreReadAll(fd, [errors mutableBytes], (size_t)errorLength, (off_t)(BMSCRIPT_RESULT_STORE_HEADER_SIZE + resultLength))) {
+                    info = [NSDictionary dictionaryWithObjectsAndKeys:
+                            data, BMScriptNotificationTaskResults,
+                            errors, BMScriptNotificationTaskErrorResults,
+                            [NSNumber numberWithInteger:(NSInteger)retval], BMScriptNotificationTaskReturnValue,
+                            [NSNumber numberWithInteger:(NSInteger)status], BMScriptNotificationExecutionStatus, nil];
+
+                    // the access time orders eviction. moving it on every hit would mean a metadata write per lookup
+                    if (time(NULL) - st.st_atime > BMSCRIPT_RESULT_STORE_TOUCH_AGE) {
+                        struct timespec times[2];
+                        times[0].tv_sec = 0;
+                        times[0].tv_nsec = UTIME_NOW;
+                        times[1].tv_sec = 0;
+                        times[1].tv_nsec = UTIME_OMIT;
+                        (void) futimens(fd, times);
+                    }
+                }
+            }
+        }
+        close(fd);
+    }
+
+    [lock lock];
+    if (info) hits++;
+    else misses++;
+    [lock unlock];
+
+    return info;
+}
+
+// MARK: Storing
+
+- (BOOL) setResult:(NSData *)data
+       errorResult:(NSData *)errors
+       returnValue:(NSInteger)retval
+   executionStatus:(ExecutionStatus)status
+    forFingerprint:(NSString *)fingerprint {
+
+    NSString * path = [self pathForFingerprint:fingerprint];
+    if (!path) return NO;
+
+    char * tmpPath = strdup([[directory stringByAppendingPathComponent:@"tmp/result.XXXXXX"] fileSystemRepresentation]);
+    if (!tmpPath) return NO;
+    int fd = mkstemp(tmpPath);
+    if (fd < 0) {
+        free(tmpPath);
+        return NO;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    unsigned char header[BMSCRIPT_RESULT_STORE_HEADER_SIZE];
+    memcpy(header, BMSCRIPT_RESULT_STORE_MAGIC, 8);
+    BMScriptResultStorePut64(header + 8, (uint64_t)(int64_t)retval);
+    BMScriptResultStorePut64(header + 16, (uint64_t)(int64_t)status);
+    BMScriptResultStorePut64(header + 24, [data length]);
+    BMScriptResultStorePut64(header + 32, [errors length]);
+
+    // no fsync: after a crash a result may come back short, which readers reject by its size
+    BOOL written = (BMScriptResultStoreWriteAll(fd, header, sizeof(header))
+                    && BMScriptResultStoreWriteAll(fd, [data bytes], [data length])
+                    && BMScriptResultStoreWriteAll(fd, [errors bytes], [errors length]));
+    if (close(fd) != 0) written = NO;
+
+    const char * target = [path fileSystemRepresentation];
+    if (written && rename(tmpPath, target) != 0) {
+        written = NO;
+        if (errno == ENOENT && (mkdir([[path stringByDeletingLastPathComponent] fileSystemRepresentation], 0700) == 0 || errno == EEXIST)) {
+            written = (rename(tmpPath, target) == 0);
+        }
+    }
+    if (!written) unlink(tmpPath);
+    free(tmpPath);
+
+    if (!written) return NO;
+
+    [lock lock];
+    approximateSize += BMSCRIPT_RESULT_STORE_HEADER_SIZE + [data length] + [errors length];
+    writesSinceScan++;
+    if (!sizeKnown || approximateSize > sizeLimit || writesSinceScan >= BMSCRIPT_RESULT_STORE_RESCAN_INTERVAL) {
+        unsigned long long target = sizeLimit - sizeLimit / 10;
+        [lock unlock];
+        unsigned long long size = [self scanEvictingDownTo:target];
+        [lock lock];
+        approximateSize = size;
+        sizeKnown = YES;
+        writesSinceScan = 0;
+    }
+    [lock unlock];
+
+    return YES;
+}
+
+- (void) removeResultForFingerprint:(NSString *)fingerprint {
+    NSString * path = [self pathForFingerprint:fingerprint];
+    if (path) unlink([path fileSystemRepresentation]);
+}
+
+- (void) removeAllResults {
+    // move the objects out of the way in one step, so nobody sees half of them gone, then delete them at leisure
+    NSString * objects = [directory stringByAppendingPathComponent:@"objects"];
+    char * trash = strdup([[directory stringByAppendingPathComponent:@"tmp/objects.XXXXXX"] fileSystemRepresentation]);
+    if (trash && mkdtemp(trash)) {
+        NSString * trashPath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:trash length:strlen(trash)];
+        NSString * moved = [trashPath stringByAppendingPathComponent:@"objects"];
+        if (rename([objects fileSystemRepresentation], [moved fileSystemRepresentation]) == 0) {
+            mkdir([objects fileSystemRepresentation], 0700);
+        }
+        [[NSFileManager defaultManager] removeItemAtPath:trashPath error:NULL];
+    }
+    free(trash);
+
+    [lock lock];
+    approximateSize = 0;
+    sizeKnown = NO;
+    [lock unlock];
+}
+
+// MARK: Private
+
+/* objects/ab/abcdef..., or nil for anything that doesn't look like a fingerprint */
+- (NSString *) pathForFingerprint:(NSString *)fingerprint {
+    NSUInteger len = [fingerprint length];
+    if (len < 3) return nil;
+    NSUInteger i;
+    for (i = 0; i < len; i++) {
+        unichar c = [fingerprint characterAtIndex:i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return nil;
+    }
+    return [NSString stringWithFormat:@"%@/objects/%@/%@", directory, [fingerprint substringToIndex:2], fingerprint];
+}
+
+/* Adds up the sizes of all results and removes the least recently accessed ones until they fit target bytes.
+   Returns the size that is left. Eviction is skipped while another process holds the lock file. */
+- (unsigned long long) scanEvictingDownTo:(unsigned long long)target {
+
+    NSString * objects = [directory stringByAppendingPathComponent:@"objects"];
+    BMScriptResultStoreFile * files = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long long total = 0;
+
+    DIR * top = opendir([objects fileSystemRepresentation]);
+    if (!top) return 0;
+
+    struct dirent * shard;
+    while ((shard = readdir(top))) {
+        if (shard->d_name[0] == '.') continue;
+        NSString * shardPath = [objects stringByAppendingPathComponent:[NSString stringWithUTF8String:shard->d_name]];
+        DIR * dir = opendir([shardPath fileSystemRepresentation]);
+        if (!dir) continue;
+        struct dirent * ent;
+        while ((ent = readdir(dir))) {
+            if (ent->d_name[0] == '.') continue;
+            struct stat st;
+            if (fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (count == capacity) {
+                size_t newCapacity = (capacity ? capacity * 2 : 256);
+                void * grown = realloc(files, newCapacity * sizeof(BMScriptResultStoreFile));
+                if (!grown) break;
+                files = grown;
+                capacity = newCapacity;
+            }
+            files[count].path = strdup([[shardPath stringByAppendingPathComponent:[NSString stringWithUTF8String:ent->d_name]] fileSystemRepresentation]);
+            files[count].atime = st.st_atime;
+            files[count].atimeNsec = BM_STAT_ATIME_NSEC(st);
+            files[count].size = (unsigned long long) st.st_size;
+            if (files[count].path) {
+                total += files[count].size;
+                count++;
+            }
+        }
+        closedir(dir);
+    }
+    closedir(top);
+
+    if (total > target) {
+        int lockFile = open([[directory stringByAppendingPathComponent:@"lock"] fileSystemRepresentation], O_RDWR | O_CREAT, 0600);
+        if (lockFile >= 0) {
+            fcntl(lockFile, F_SETFD, FD_CLOEXEC);
+            if (flock(lockFile, LOCK_EX | LOCK_NB) == 0) {
+                NSUInteger evicted = 0;
+                size_t i;
+                qsort(files, count, sizeof(BMScriptResultStoreFile), BMScriptResultStoreCompareAccess);
+                for (i = 0; i < count && total > target; i++) {
+                    if (unlink(files[i].path) == 0) {
+                        total -= files[i].size;
+                        evicted++;
+                    }
+                }
+
+                // temporary files of writers which didn't live to rename them
+                NSString * tmp = [directory stringByAppendingPathComponent:@"tmp"];
+                DIR * dir = opendir([tmp fileSystemRepresentation]);
+                if (dir) {
+                    time_t now = time(NULL);
+                    struct dirent * ent;
+                    while ((ent = readdir(dir))) {
+                        struct stat st;
+                        if (strncmp(ent->d_name, "result.", 7) == 0
+                            && fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0
+                            && now - st.st_mtime > BMSCRIPT_RESULT_STORE_TMP_AGE) {
+                            unlinkat(dirfd(dir), ent->d_name, 0);
+                        }
+                    }
+                    closedir(dir);
+                }
+
+                flock(lockFile, LOCK_UN);
+
+                [lock lock];
+                evictions += evicted;
+                [lock unlock];
+            }
+            close(lockFile);
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < count; i++) {
+        free(files[i].path);
+    }
+    free(files);
+
+    return total;
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,163 @@
+//
+//  BMScriptTask.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptTask.h
+ * Class interface of BMScriptTask.
+ */
+
+#import "BMDefines.h"
+#import <Foundation/Foundation.h>
+
+#include <sys/types.h>
+#include <pthread.h>
+
+/*!
+ * @class BMScriptTask
+ * A lightweight, one-shot process launcher used by BMScript in place of NSTask.
+ *
+ * The interface mirrors the subset of NSTask that BMScript relies on so it can be used as a drop-in
+ * replacement. The difference lies in how the child is created: NSTask (depending on the Foundation
+ * implementation) may <span class="sourcecode">fork(2)</span> the complete parent process, which gets
+ * slower the more memory the host application has mapped. BMScriptTask uses
+ * <span class="sourcecode">vfork(2)</span> + <span class="sourcecode">execve(2)</span> on Linux and
+ * <span class="sourcecode">posix_spawn(3)</span> everywhere else, so the cost of a launch is independent
+ * of the parent's resident set size.
+ *
+ * All file descriptors except standard input, output and error (and BMScriptTask#inputDescriptor) are closed in the child before
+ * the new image is executed (via <span class="sourcecode">close_range(2)</span> where available,
+ * <span class="sourcecode">POSIX_SPAWN_CLOEXEC_DEFAULT</span> on Mac OS X), so descriptors leaked by
+ * other parts of the host application never end up in the script's process.
+ *
+ * Optionally the child is made the leader of a new process group (BMScriptTask#createsProcessGroup)
+ * so that BMScriptTask#signalProcessGroup: reaches everything the script spawned, and on Linux it can
+ * be asked to die together with its parent (BMScriptTask#terminatesWithParent).
+ *
+ * Like NSTask, a BMScriptTask can only be launched once.
+ */
+@interface BMScriptTask : NSObject {
+ @private
+    NSString * launchPath;
+    NSArray * arguments;
+    NSDictionary * environment;
+    id standardInput;
+    id standardOutput;
+    id standardError;
+    pid_t processIdentifier;
+    int terminationStatus;
+    int exitDescriptor;
+    BOOL launched;
+    BOOL exited;
+    BOOL createsProcessGroup;
+    BOOL terminatesWithParent;
+    NSData * inputData;
+    int inputDescriptor;
+    pthread_mutex_t stateLock;
+}
+
+/*! Gets or sets the absolute path to the executable. Must be set before launching. */
+@property (BM_ATOMIC copy) NSString * launchPath;
+/*! Gets or sets the arguments passed to the executable (argv[1] and on). */
+@property (BM_ATOMIC copy) NSArray * arguments;
+/*! Gets or sets the environment of the child. If nil, the environment of the parent process is inherited. */
+@property (BM_ATOMIC copy) NSDictionary * environment;
+/*! Gets or sets the standard input. Accepts an NSPipe or an NSFileHandle. If nil, the parent's standard input is inherited. */
+@property (BM_ATOMIC retain) id standardInput;
+/*! Gets or sets the standard output. Accepts an NSPipe or an NSFileHandle. If nil, the parent's standard output is inherited. */
+@property (BM_ATOMIC retain) id standardOutput;
+/*! Gets or sets the standard error. Accepts an NSPipe or an NSFileHandle. If nil, the parent's standard error is inherited. */
+@property (BM_ATOMIC retain) id standardError;
+/*!
+ * If YES, the child calls <span class="sourcecode">setpgid(0, 0)</span> before executing the new image, which makes it
+ * the leader of a new process group whose id equals BMScriptTask#processIdentifier. Defaults to NO.
+ * @note A process in a background process group is stopped when it tries to read from the controlling terminal,
+ * so set BMScriptTask#standardInput to something other than the terminal when using this.
+ */
+@property (BM_ATOMIC assign) BOOL createsProcessGroup;
+/*!
+ * If YES, the child is sent SIGKILL when the parent goes away (<span class="sourcecode">PR_SET_PDEATHSIG</span>).
+ * Only supported on Linux, ignored elsewhere. Defaults to NO.
+ * @note Linux delivers the signal when the <i>thread</i> that launched the task exits, not the process. Only enable
+ * this for tasks launched from threads that outlive them.
+ */
+@property (BM_ATOMIC assign) BOOL terminatesWithParent;
+/*!
+ * Gets or sets data streamed to the child through a pipe of its own once it is launched. Defaults to nil.
+ * The pipe is installed as BMScriptTask#inputDescriptor in the child and closed once all data is written, 
+ * so the child sees EOF afterwards. What fits into the pipe is written right away, the rest by a short-lived thread.
+ * A child that exits without reading everything does not raise SIGPIPE in the parent.
+ */
+@property (BM_ATOMIC copy) NSData * inputData;
+/*!
+ * Gets or sets the descriptor under which the child reads BMScriptTask#inputData: 0 replaces BMScriptTask#standardInput,
+ * 3 makes it readable as <span class="sourcecode">/dev/fd/3</span> next to the standard descriptors. 
+ * Launching fails with EINVAL for anything else if there is input data. Defaults to -1.
+ */
+@property (BM_ATOMIC assign) int inputDescriptor;
+
+/*!
+ * Launches the task.
+ * Raises an NSInvalidArgumentException if the task was already launched, the launch path is not set
+ * or the executable could not be started.
+ */
+- (void) launch;
+/*!
+ * Launches the task. Same as BMScriptTask#launch but reports failures by returning NO instead of raising.
+ * @param error on return contains an NSError in the NSPOSIXErrorDomain describing the failure. May be NULL.
+ */
+- (BOOL) launchAndReturnError:(NSError **)error;
+/*! Returns YES if the task was launched and has not been reaped yet. */
+- (BOOL) isRunning;
+/*! Blocks until the child has exited and collects its termination status. */
+- (void) waitUntilExit;
+/*!
+ * Returns a file descriptor that becomes readable once the child has exited, or -1 if the platform has no such
+ * facility or the task was not launched. On Linux this is a pidfd, on Mac OS X and the BSDs a kqueue with an
+ * <span class="sourcecode">EVFILT_PROC</span> filter registered. The descriptor can be passed to
+ * <span class="sourcecode">poll(2)</span> together with the output pipes to wait for output and exit at the same time.
+ * It is owned by the task and closed when the task is deallocated.
+ */
+- (int) exitFileDescriptor;
+/*! Returns the process identifier of the child or 0 if the task was not launched. */
+- (pid_t) processIdentifier;
+/*!
+ * Returns the exit code of the child or the number of the signal that terminated it.
+ * Raises an NSInvalidArgumentException if the task is still running.
+ */
+- (int) terminationStatus;
+/*! Sends SIGINT to the child. Does nothing if the task is not running. */
+- (void) interrupt;
+/*! Sends SIGTERM to the child. Does nothing if the task is not running. */
+- (void) terminate;
+/*!
+ * Sends a signal to the task's process group if BMScriptTask#createsProcessGroup is YES, 
+ * otherwise to the child only. Does nothing once the child has been reaped, since from then on 
+ * its process group id may be recycled.
+ * @param sig the signal to send
+ */
+- (void) signalProcessGroup:(int)sig;
+/*!
+ * Performs the next step of the termination sequence used for timed out and cancelled scripts:
+ * SIGINT, SIGTERM and finally SIGKILL, each sent with BMScriptTask#signalProcessGroup:.
+ * @param step the step to perform, 0 for the first one. Advanced by one on return.
+ * @returns NO once there is no step left (SIGKILL has been sent), YES if the caller should try again after a grace period.
+ */
+- (BOOL) escalateTermination:(NSUInteger *)step;
+
+@end
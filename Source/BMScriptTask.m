@@ -0,0 +1,605 @@
+//
+//  BMScriptTask.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptTask.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(__linux__)
+    #include <sys/syscall.h>
+    #include <sys/prctl.h>
+#else
+    #include <spawn.h>
+    #include <sys/event.h>
+#endif
+
+#if defined(__APPLE__)
+    #include <crt_externs.h>    /* for _NSGetEnviron */
+    #define BM_ENVIRON (*_NSGetEnviron())
+#else
+    extern char ** environ;
+    #define BM_ENVIRON environ
+#endif
+
+#if defined(__linux__) && !defined(SYS_close_range) && defined(__NR_close_range)
+    #define SYS_close_range __NR_close_range
+#endif
+#if defined(__linux__) && !defined(SYS_pidfd_open) && defined(__NR_pidfd_open)
+    #define SYS_pidfd_open __NR_pidfd_open
+#endif
+
+/* Signals sent to the process group, one after another, by -escalateTermination: */
+static const int BMScriptTaskTerminationSignals[] = { SIGINT, SIGTERM, SIGKILL };
+#define BMSCRIPT_TASK_TERMINATION_STEPS (sizeof(BMScriptTaskTerminationSignals) / sizeof(BMScriptTaskTerminationSignals[0]))
+
+/* Everything the child needs, prepared by the parent before spawning so the child does not have to allocate. */
+typedef struct BMScriptTaskSpawnAttributes {
+    const char * path;
+    char * const * argv;
+    char * const * envp;
+    int stdio[4];           /* descriptor to install as fd 0, 1, 2 or -1 to inherit the parent's, and as fd 3 or -1 for none */
+    BOOL setProcessGroup;   /* make the child the leader of a new process group */
+    BOOL dieWithParent;     /* Linux only: PR_SET_PDEATHSIG */
+    pid_t parent;
+} BMScriptTaskSpawnAttributes;
+
+#if defined(__linux__)
+
+/* Runs in the vfork'd child: shares the parent's memory, so only async-signal-safe calls and no allocation. */
+static void BMScriptTaskExecChild(const BMScriptTaskSpawnAttributes * attrs, const sigset_t * oldMask, int maxfd, volatile int * childErrno) {
+
+    int fds[4] = { attrs->stdio[0], attrs->stdio[1], attrs->stdio[2], attrs->stdio[3] };
+    int keep = (fds[3] >= 0 ? 4 : 3);
+    int i;
+
+    // signal handlers of the parent make no sense in the new image
+    for (i = 1; i < NSIG; i++) {
+        struct sigaction sa;
+        if (sigaction(i, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = SIG_DFL;
+            sigaction(i, &sa, NULL);
+        }
+    }
+
+    // move descriptors that live in the range we install first out of the way so dup2 can't clobber them
+    for (i = 0; i < keep; i++) {
+        if (fds[i] >= 0 && fds[i] < keep && fds[i] != i) {
+            fds[i] = fcntl(fds[i], F_DUPFD, keep);
+        }
+    }
+    for (i = 0; i < keep; i++) {
+        if (fds[i] < 0) continue;
+        if (fds[i] == i) {
+            fcntl(i, F_SETFD, 0);
+        } else if (dup2(fds[i], i) < 0) {
+            goto fail;
+        }
+    }
+
+    if (attrs->setProcessGroup && setpgid(0, 0) < 0) goto fail;
+    
+    if (attrs->dieWithParent) {
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0) goto fail;
+        // the parent may have died before prctl took effect
+        if (getppid() != attrs->parent) _exit(127);
+    }
+
+    #ifdef SYS_close_range
+    if (syscall(SYS_close_range, (unsigned int) keep, ~0U, 0U) != 0)
+    #endif
+    {
+        for (i = keep; i < maxfd; i++) close(i);
+    }
+
+    sigprocmask(SIG_SETMASK, oldMask, NULL);
+    execve(attrs->path, attrs->argv, attrs->envp);
+
+fail:
+    *childErrno = errno;
+    _exit(127);
+}
+
+static int BMScriptTaskSpawn(const BMScriptTaskSpawnAttributes * attrs, pid_t * pid) {
+
+    volatile int childErrno = 0;
+    long maxfd = sysconf(_SC_OPEN_MAX);
+    sigset_t allSignals, oldMask;
+
+    if (maxfd < 0 || maxfd > 65536) maxfd = 65536;
+
+    // block everything so no handler of the parent runs in the child between vfork and execve
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldMask);
+
+    pid_t child = vfork();
+    if (child == 0) {
+        BMScriptTaskExecChild(attrs, &oldMask, (int)maxfd, &childErrno);
+    }
+    int err = (child < 0 ? errno : 0);
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+
+    if (child < 0) return err;
+
+    // the parent is suspended until the child has exec'd or exited, so childErrno is final here
+    if (childErrno != 0) {
+        while (waitpid(child, NULL, 0) < 0 && errno == EINTR);
+        return childErrno;
+    }
+    *pid = child;
+    return 0;
+}
+
+#else
+
+static int BMScriptTaskSpawn(const BMScriptTaskSpawnAttributes * attrs, pid_t * pid) {
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t spawnAttrs;
+    sigset_t noSignals, defaultSignals;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    int i, err;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&spawnAttrs);
+
+    for (i = 0; i < 4; i++) {
+        if (attrs->stdio[i] >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, attrs->stdio[i], i);
+        }
+        #ifdef POSIX_SPAWN_CLOEXEC_DEFAULT
+        else if (i < 3) {
+            posix_spawn_file_actions_addinherit_np(&actions, i);
+        }
+        #endif
+    }
+
+    #ifdef POSIX_SPAWN_CLOEXEC_DEFAULT
+        flags |= POSIX_SPAWN_CLOEXEC_DEFAULT;
+    #endif
+    if (attrs->setProcessGroup) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&spawnAttrs, 0);
+    }
+
+    sigemptyset(&noSignals);
+    sigfillset(&defaultSignals);
+    sigdelset(&defaultSignals, SIGKILL);
+    sigdelset(&defaultSignals, SIGSTOP);
+    posix_spawnattr_setsigmask(&spawnAttrs, &noSignals);
+    posix_spawnattr_setsigdefault(&spawnAttrs, &defaultSignals);
+    posix_spawnattr_setflags(&spawnAttrs, flags);
+
+    err = posix_spawn(pid, attrs->path, &actions, &spawnAttrs, attrs->argv, attrs->envp);
+
+    posix_spawnattr_destroy(&spawnAttrs);
+    posix_spawn_file_actions_destroy(&actions);
+
+    return err;
+}
+
+#endif
+
+static int BMScriptTaskStatusFromWaitStatus(int waitStatus) {
+    if (WIFEXITED(waitStatus)) return WEXITSTATUS(waitStatus);
+    if (WIFSIGNALED(waitStatus)) return WTERMSIG(waitStatus);
+    return waitStatus;
+}
+
+/* write(2) that reports a reader which went away as EPIPE instead of killing the process with SIGPIPE.
+   the signal is blocked for the calling thread during the write and consumed if the write raised it. */
+static ssize_t BMScriptTaskWriteIgnoringSIGPIPE(int fd, const char * bytes, size_t len) {
+    sigset_t pipeSignal, pending, oldMask;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+    sigpending(&pending);
+    BOOL wasPending = sigismember(&pending, SIGPIPE);
+    ssize_t n = write(fd, bytes, len);
+    int err = errno;
+    if (n < 0 && err == EPIPE && !wasPending) {
+        sigpending(&pending);
+        if (sigismember(&pending, SIGPIPE)) {
+            int sig;
+            sigwait(&pipeSignal, &sig);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    errno = err;
+    return n;
+}
+
+/* Streams what did not fit into the pipe right away on a thread of its own, then closes the pipe. */
+@interface BMScriptTaskInputWriter : NSObject {
+ @public
+    NSData * data;
+    NSUInteger offset;
+    int fd;
+}
+- (void) run;
+@end
+
+@implementation BMScriptTaskInputWriter
+
+- (void) dealloc {
+    [data release], data = nil;
+    [super dealloc];
+}
+
+- (void) run {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    const char * bytes = [data bytes];
+    NSUInteger length = [data length];
+    while (offset < length) {
+        ssize_t n = BMScriptTaskWriteIgnoringSIGPIPE(fd, bytes + offset, length - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;      // the child stopped reading, it will see what it got
+        offset += (NSUInteger) n;
+    }
+    close(fd);
+    [pool drain];
+}
+
+@end
+
+/* writes as much as the pipe takes without blocking and hands the rest to a BMScriptTaskInputWriter.
+   most scripts fit into the pipe buffer, so usually no thread is needed. takes ownership of fd. */
+static void BMScriptTaskDeliverInput(int fd, NSData * data) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    const char * bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger offset = 0;
+    while (offset < length) {
+        ssize_t n = BMScriptTaskWriteIgnoringSIGPIPE(fd, bytes + offset, length - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            BMScriptTaskInputWriter * writer = [[[BMScriptTaskInputWriter alloc] init] autorelease];
+            writer->data = [data retain];
+            writer->offset = offset;
+            writer->fd = fd;
+            [NSThread detachNewThreadSelector:@selector(run) toTarget:writer withObject:nil];
+            return;
+        }
+        if (n <= 0) break;
+        offset += (NSUInteger) n;
+    }
+    close(fd);
+}
+
+/* childReads is YES for standard input, NO for standard output and error */
+static int BMScriptTaskDescriptorForStdio(id stdio, BOOL childReads) {
+    if ([stdio isKindOfClass:[NSPipe class]]) {
+        return [(childReads ? [stdio fileHandleForReading] : [stdio fileHandleForWriting]) fileDescriptor];
+    } else if ([stdio isKindOfClass:[NSFileHandle class]]) {
+        return [stdio fileDescriptor];
+    }
+    return -1;
+}
+
+
+@interface BMScriptTask (/* Private */)
+- (BOOL) reapChild;
+@end
+
+@implementation BMScriptTask
+
+@synthesize launchPath;
+@synthesize arguments;
+@synthesize environment;
+@synthesize standardInput;
+@synthesize standardOutput;
+@synthesize standardError;
+@synthesize createsProcessGroup;
+@synthesize terminatesWithParent;
+@synthesize inputData;
+@synthesize inputDescriptor;
+
+- (id) init {
+    if ((self = [super init])) {
+        pthread_mutex_init(&stateLock, NULL);
+        exitDescriptor = -1;
+        inputDescriptor = -1;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [launchPath release], launchPath = nil;
+    [arguments release], arguments = nil;
+    [environment release], environment = nil;
+    [standardInput release], standardInput = nil;
+    [standardOutput release], standardOutput = nil;
+    [standardError release], standardError = nil;
+    [inputData release], inputData = nil;
+    if (exitDescriptor >= 0) close(exitDescriptor);
+    pthread_mutex_destroy(&stateLock);
+    [super dealloc];
+}
+
+- (void) finalize {
+    if (exitDescriptor >= 0) close(exitDescriptor);
+    pthread_mutex_destroy(&stateLock);
+    [super finalize];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ pid = %d, launchPath = '%@', arguments = %@",
+                                      [super description], processIdentifier, self.launchPath, self.arguments];
+}
+
+// MARK: Launching
+
+- (BOOL) launchAndReturnError:(NSError **)error {
+
+    int err = 0;
+
+    pthread_mutex_lock(&stateLock);
+
+    if (launched) {
+        err = EALREADY;
+        goto endnow;
+    }
+    if (!self.launchPath || (self.inputData && self.inputDescriptor != 0 && self.inputDescriptor != 3)) {
+        err = EINVAL;
+        goto endnow;
+    }
+
+    // the pipe the input data goes through. the child gets the read end, we keep the write end.
+    int inputPipe[2] = { -1, -1 };
+    if (self.inputData) {
+        if (pipe(inputPipe) != 0) {
+            err = errno;
+            goto endnow;
+        }
+        fcntl(inputPipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(inputPipe[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    NSArray * args = self.arguments;
+    NSDictionary * env = self.environment;
+    NSUInteger argc = [args count];
+    NSUInteger envc = [env count];
+
+    char ** argv = calloc(argc + 2, sizeof(char *));
+    char ** envp = (env ? calloc(envc + 1, sizeof(char *)) : NULL);
+
+    if (!argv || (env && !envp)) {
+        free(argv), free(envp);
+        if (inputPipe[0] >= 0) close(inputPipe[0]), close(inputPipe[1]);
+        err = ENOMEM;
+        goto endnow;
+    }
+
+    // the C strings are owned by the autorelease pool and outlive the spawn call
+    NSUInteger i = 0;
+    argv[0] = (char *) [self.launchPath fileSystemRepresentation];
+    for (NSString * arg in args) {
+        argv[++i] = (char *) [[arg description] UTF8String];
+    }
+    i = 0;
+    for (NSString * key in env) {
+        envp[i++] = (char *) [[NSString stringWithFormat:@"%@=%@", key, [env objectForKey:key]] UTF8String];
+    }
+
+    BMScriptTaskSpawnAttributes attrs;
+    attrs.path = argv[0];
+    attrs.argv = argv;
+    attrs.envp = (envp ? envp : BM_ENVIRON);
+    attrs.stdio[0] = BMScriptTaskDescriptorForStdio(self.standardInput, YES);
+    attrs.stdio[1] = BMScriptTaskDescriptorForStdio(self.standardOutput, NO);
+    attrs.stdio[2] = BMScriptTaskDescriptorForStdio(self.standardError, NO);
+    attrs.stdio[3] = -1;
+    if (inputPipe[0] >= 0) {
+        attrs.stdio[self.inputDescriptor] = inputPipe[0];
+    }
+    attrs.setProcessGroup = self.createsProcessGroup;
+    attrs.dieWithParent = self.terminatesWithParent;
+    attrs.parent = getpid();
+
+    err = BMScriptTaskSpawn(&attrs, &processIdentifier);
+
+    free(argv), free(envp);
+
+    if (inputPipe[0] >= 0) {
+        close(inputPipe[0]);
+        if (err == 0) {
+            BMScriptTaskDeliverInput(inputPipe[1], self.inputData);
+        } else {
+            close(inputPipe[1]);
+        }
+    }
+
+    if (err == 0) {
+        launched = YES;
+
+        // close the child's ends of any pipes in the parent, otherwise we would never see EOF
+        if ([self.standardInput isKindOfClass:[NSPipe class]]) {
+            [[self.standardInput fileHandleForReading] closeFile];
+        }
+        if ([self.standardOutput isKindOfClass:[NSPipe class]]) {
+            [[self.standardOutput fileHandleForWriting] closeFile];
+        }
+        if ([self.standardError isKindOfClass:[NSPipe class]] && self.standardError != self.standardOutput) {
+            [[self.standardError fileHandleForWriting] closeFile];
+        }
+    }
+
+endnow:
+    pthread_mutex_unlock(&stateLock);
+
+    if (err != 0 && error) {
+        NSString * reason = [NSString stringWithFormat:@"%@ Error: Launching '%@' failed: %s",
+                             [self className], self.launchPath, strerror(err)];
+        NSDictionary * errorDict = [NSDictionary dictionaryWithObject:reason forKey:NSLocalizedFailureReasonErrorKey];
+        *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:err userInfo:errorDict];
+    }
+    return (err == 0);
+}
+
+- (void) launch {
+    NSError * err = nil;
+    if (![self launchAndReturnError:&err]) {
+        @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                       reason:[err localizedFailureReason]
+                                     userInfo:nil];
+    }
+}
+
+// MARK: Process State
+
+/* must be called with stateLock held. returns YES if the child has been collected */
+- (BOOL) reapChild {
+    if (!launched) return NO;
+    if (exited) return YES;
+
+    int waitStatus = 0;
+    pid_t r;
+    do {
+        r = waitpid(processIdentifier, &waitStatus, WNOHANG);
+    } while (r < 0 && errno == EINTR);
+
+    if (r == 0) return NO;
+
+    // r < 0 means somebody else reaped our child (e.g. SIGCHLD set to SIG_IGN), the status is lost then
+    if (r > 0) terminationStatus = BMScriptTaskStatusFromWaitStatus(waitStatus);
+    exited = YES;
+    return YES;
+}
+
+- (BOOL) isRunning {
+    pthread_mutex_lock(&stateLock);
+    BOOL running = (launched && ![self reapChild]);
+    pthread_mutex_unlock(&stateLock);
+    return running;
+}
+
+- (void) waitUntilExit {
+
+    pthread_mutex_lock(&stateLock);
+    BOOL done = (!launched || [self reapChild]);
+    pid_t pid = processIdentifier;
+    pthread_mutex_unlock(&stateLock);
+
+    while (!done) {
+        // block until the child exits but leave it a zombie, so the pid can't be recycled
+        // while -interrupt or -terminate may still be signalling it from another thread
+        siginfo_t info;
+        int r = waitid(P_PID, (id_t) pid, &info, WEXITED | WNOWAIT);
+        if (r < 0 && errno == EINTR) continue;
+
+        pthread_mutex_lock(&stateLock);
+        done = [self reapChild];
+        pthread_mutex_unlock(&stateLock);
+
+        if (r < 0) break;
+    }
+}
+
+- (int) exitFileDescriptor {
+    
+    pthread_mutex_lock(&stateLock);
+    
+    // the child stays a zombie until reapChild ran under this lock, so the pid can't have been recycled yet
+    if (exitDescriptor < 0 && launched && !exited) {
+        #if defined(__linux__)
+            #ifdef SYS_pidfd_open
+            exitDescriptor = (int) syscall(SYS_pidfd_open, processIdentifier, 0);
+            #endif
+        #else
+            int kq = kqueue();
+            if (kq >= 0) {
+                struct kevent change;
+                EV_SET(&change, processIdentifier, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+                if (kevent(kq, &change, 1, NULL, 0, NULL) < 0) {
+                    close(kq), kq = -1;
+                }
+            }
+            exitDescriptor = kq;
+        #endif
+        if (exitDescriptor >= 0) {
+            fcntl(exitDescriptor, F_SETFD, FD_CLOEXEC);
+        } else {
+            exitDescriptor = -1;
+        }
+    }
+    int fd = exitDescriptor;
+    
+    pthread_mutex_unlock(&stateLock);
+    
+    return fd;
+}
+
+- (pid_t) processIdentifier {
+    return processIdentifier;
+}
+
+- (int) terminationStatus {
+    if ([self isRunning] || !launched) {
+        @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                       reason:[NSString stringWithFormat:@"%@ Error: Task not launched or still running", [self className]]
+                                     userInfo:nil];
+    }
+    return terminationStatus;
+}
+
+- (void) interrupt {
+    pthread_mutex_lock(&stateLock);
+    if (launched && !exited) kill(processIdentifier, SIGINT);
+    pthread_mutex_unlock(&stateLock);
+}
+
+- (void) terminate {
+    pthread_mutex_lock(&stateLock);
+    if (launched && !exited) kill(processIdentifier, SIGTERM);
+    pthread_mutex_unlock(&stateLock);
+}
+
+- (void) signalProcessGroup:(int)sig {
+    pthread_mutex_lock(&stateLock);
+    if (launched && !exited) {
+        if (createsProcessGroup) {
+            killpg(processIdentifier, sig);
+        } else {
+            kill(processIdentifier, sig);
+        }
+    }
+    pthread_mutex_unlock(&stateLock);
+}
+
+- (BOOL) escalateTermination:(NSUInteger *)step {
+    if (*step < BMSCRIPT_TASK_TERMINATION_STEPS) {
+        [self signalProcessGroup:BMScriptTaskTerminationSignals[(*step)++]];
+    }
+    return (*step < BMSCRIPT_TASK_TERMINATION_STEPS);
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,107 @@
+//
+//  BMScriptTemplate.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptTemplate.h
+ * Class interface of BMScriptTemplate.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @class BMScriptTemplate
+ * A script template compiled once into a list of segments and rendered as often as needed.
+ *
+ * The template string is scanned a single time for magic tokens (#BMSCRIPT_TEMPLATE_TOKEN_START and
+ * #BMSCRIPT_TEMPLATE_TOKEN_END, or any other pair of delimiters) and broken up into literal text and tokens.
+ * Rendering then only resolves each distinct key once, adds up the lengths and copies the segments and
+ * values into a buffer of the final size, so it takes time linear in the length of the result no matter
+ * how many tokens or keys there are. The template itself is never modified.
+ *
+ * Empty tokens (<span class="sourcecode">&lt;\#\#&gt;</span>) are positional, tokens wrapping a name
+ * (<span class="sourcecode">&lt;\#KEY\#&gt;</span>) are looked up by key. A token which gets no value is
+ * left in the result as it is, just like the saturation methods of BMScript do.
+ *
+ * BMScript compiles its template source into a BMScriptTemplate the first time it is saturated and keeps it,
+ * so a template script can be saturated again and again (see BMScript#scriptTemplate).
+ *
+ * Instances are immutable and may be rendered from several threads at once.
+ */
+@interface BMScriptTemplate : NSObject <NSCopying> {
+ @private
+    NSString * string;
+    NSString * tokenStart;
+    NSString * tokenEnd;
+    unichar * characters;
+    void * segments;
+    NSUInteger segmentCount;
+    NSArray * keys;
+    NSUInteger positionalTokenCount;
+}
+
+/*! Returns an autoreleased template using the default magic tokens. */
++ (id) templateWithString:(NSString *)aString;
+/*! Returns an autoreleased template using custom delimiters. @see #initWithString:tokenStart:tokenEnd: */
++ (id) templateWithString:(NSString *)aString tokenStart:(NSString *)start tokenEnd:(NSString *)end;
+
+/*! Initializes a template using the default magic tokens. */
+- (id) initWithString:(NSString *)aString;
+/*!
+ * Compiles a template. This is the designated initializer.
+ * @param aString the template source
+ * @param start the start delimiter of a magic token, e.g. #BMSCRIPT_TEMPLATE_TOKEN_START
+ * @param end the end delimiter of a magic token, e.g. #BMSCRIPT_TEMPLATE_TOKEN_END
+ * @throws NSInvalidArgumentException if one of the parameters is nil or a delimiter is empty
+ */
+- (id) initWithString:(NSString *)aString tokenStart:(NSString *)start tokenEnd:(NSString *)end;
+
+/*! Returns the template source. */
+- (NSString *) string;
+/*! Returns the start delimiter of the magic tokens. */
+- (NSString *) tokenStart;
+/*! Returns the end delimiter of the magic tokens. */
+- (NSString *) tokenEnd;
+/*! Returns the distinct names wrapped by the tokens of the template, in order of first occurrence. */
+- (NSArray *) keys;
+/*! Returns the number of empty (positional) tokens. */
+- (NSUInteger) positionalTokenCount;
+
+/*!
+ * Returns the template with every empty token replaced by the same value.
+ * Equivalent to BMScript#saturateTemplateWithArgument:.
+ */
+- (NSString *) stringByRenderingWithArgument:(NSString *)arg;
+/*!
+ * Returns the template with its empty tokens replaced by the arguments in order of occurrence.
+ * Equivalent to BMScript#saturateTemplateWithArguments:.
+ * @throws BMScriptTemplateArgumentMissingException if there are fewer arguments than empty tokens
+ */
+- (NSString *) stringByRenderingWithArguments:(NSArray *)args;
+/*!
+ * Returns the template with each token wrapping a key of the dictionary replaced by its value
+ * (its description if it isn't a string). Tokens wrapping unknown keys are kept.
+ * @param dictionary the replacement values by key
+ * @param unescape YES to collapse each <span class="sourcecode">%%</span> of the result into a single
+ *        percent sign, as BMScript#saturateTemplateWithDictionary: always has
+ */
+- (NSString *) stringByRenderingWithDictionary:(NSDictionary *)dictionary unescapingPercentSigns:(BOOL)unescape;
+
+@end
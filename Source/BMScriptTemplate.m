@@ -0,0 +1,347 @@
+//
+//  BMScriptTemplate.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptTemplate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BMSCRIPT_TEMPLATE_SEGMENT_LITERAL       (-1)
+#define BMSCRIPT_TEMPLATE_SEGMENT_POSITIONAL    (-2)
+
+/* A run of the template's characters. For a token the run covers the whole token including its delimiters,
+   so a token which gets no value can be copied through as it is. */
+typedef struct BMScriptTemplateSegment {
+    NSUInteger location;
+    NSUInteger length;
+    NSInteger key;          /* index into keys, or one of the BMSCRIPT_TEMPLATE_SEGMENT_* constants */
+} BMScriptTemplateSegment;
+
+/* Returns the first occurrence of pattern at or after from, or NSNotFound. */
+static NSUInteger BMScriptTemplateFind(const unichar * chars, NSUInteger len, NSUInteger from, const unichar * pattern, NSUInteger plen) {
+    if (from >= len) return NSNotFound;
+    NSUInteger found = BMNSStringFindCharacters(chars + from, len - from, pattern, plen);
+    return (found == NSNotFound ? NSNotFound : from + found);
+}
+
+static NSString * BMScriptTemplateStringValue(id value) {
+    if (!value || [value isKindOfClass:[NSString class]]) return value;
+    return [value description];
+}
+
+
+@interface BMScriptTemplate (/* Private */)
+- (void) addSegmentAt:(NSUInteger)location length:(NSUInteger)length key:(NSInteger)key capacity:(NSUInteger *)capacity;
+- (NSString *) stringByRenderingKeyValues:(NSString **)keyValues
+                         positionalValues:(NSString **)positional
+                                repeating:(NSString *)repeated
+                   unescapingPercentSigns:(BOOL)unescape;
+@end
+
+@implementation BMScriptTemplate
+
++ (id) templateWithString:(NSString *)aString {
+    return [[[self alloc] initWithString:aString] autorelease];
+}
+
++ (id) templateWithString:(NSString *)aString tokenStart:(NSString *)start tokenEnd:(NSString *)end {
+    return [[[self alloc] initWithString:aString tokenStart:start tokenEnd:end] autorelease];
+}
+
+- (id) init {
+    return [self initWithString:@""];
+}
+
+- (id) initWithString:(NSString *)aString {
+    return [self initWithString:aString tokenStart:BMSCRIPT_TEMPLATE_TOKEN_START tokenEnd:BMSCRIPT_TEMPLATE_TOKEN_END];
+}
+
+/* designated initializer */
+- (id) initWithString:(NSString *)aString tokenStart:(NSString *)start tokenEnd:(NSString *)end {
+
+    if (!aString || [start length] == 0 || [end length] == 0) {
+        [self release];
+        @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                       reason:@"BMScriptTemplate: template string and non-empty token delimiters required"
+                                     userInfo:nil];
+    }
+
+    if ((self = [super init])) {
+
+        string = [aString copy];
+        tokenStart = [start copy];
+        tokenEnd = [end copy];
+
+        NSUInteger len = [string length];
+        NSUInteger slen = [start length];
+        NSUInteger elen = [end length];
+
+        characters = malloc((len + slen + elen) * sizeof(unichar));
+        if (!characters) {
+            [self release];
+            return nil;
+        }
+        unichar * startChars = characters + len;
+        unichar * endChars = startChars + slen;
+        [string getCharacters:characters];
+        [start getCharacters:startChars];
+        [end getCharacters:endChars];
+
+        NSMutableArray * names = [NSMutableArray array];
+        NSMutableDictionary * indexes = [NSMutableDictionary dictionary];
+        NSUInteger capacity = 0;
+        NSUInteger literalStart = 0;
+        NSUInteger i = 0;
+
+        while ((i = BMScriptTemplateFind(characters, len, i, startChars, slen)) != NSNotFound) {
+
+            // look for the end delimiter. a start delimiter on the way means the earlier one was just text.
+            NSUInteger tokenLocation = i;
+            NSUInteger j = i + slen;
+            NSUInteger end = BMScriptTemplateFind(characters, len, j, endChars, elen);
+            if (end == NSNotFound) break;
+            NSUInteger restart;
+            while ((restart = BMScriptTemplateFind(characters, MIN(len, end + slen - 1), j, startChars, slen)) != NSNotFound) {
+                tokenLocation = restart;
+                j = restart + slen;
+                if (end < j) {
+                    end = BMScriptTemplateFind(characters, len, j, endChars, elen);
+                    if (end == NSNotFound) break;
+                }
+            }
+            if (end == NSNotFound) break;
+            j = end;
+
+            NSInteger key = BMSCRIPT_TEMPLATE_SEGMENT_POSITIONAL;
+            NSUInteger nameLength = j - (tokenLocation + slen);
+            if (nameLength > 0) {
+                NSString * name = [NSString stringWithCharacters:(characters + tokenLocation + slen) length:nameLength];
+                NSNumber * index = [indexes objectForKey:name];
+                if (!index) {
+                    index = [NSNumber numberWithUnsignedInteger:[names count]];
+                    [indexes setObject:index forKey:name];
+                    [names addObject:name];
+                }
+                key = [index integerValue];
+            } else {
+                positionalTokenCount++;
+            }
+
+            if (tokenLocation > literalStart) {
+                [self addSegmentAt:literalStart length:(tokenLocation - literalStart) key:BMSCRIPT_TEMPLATE_SEGMENT_LITERAL capacity:&capacity];
+            }
+            [self addSegmentAt:tokenLocation length:(j + elen - tokenLocation) key:key capacity:&capacity];
+
+            i = literalStart = j + elen;
+        }
+        if (len > literalStart) {
+            [self addSegmentAt:literalStart length:(len - literalStart) key:BMSCRIPT_TEMPLATE_SEGMENT_LITERAL capacity:&capacity];
+        }
+
+        keys = [names copy];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    free(characters), characters = NULL;
+    free(segments), segments = NULL;
+    [string release], string = nil;
+    [tokenStart release], tokenStart = nil;
+    [tokenEnd release], tokenEnd = nil;
+    [keys release], keys = nil;
+    [super dealloc];
+}
+
+- (void) finalize {
+    free(characters);
+    free(segments);
+    [super finalize];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"%@ (%lu segments, %lu positional tokens, keys: %@)", [super description],
+            (unsigned long)segmentCount, (unsigned long)positionalTokenCount, [keys componentsJoinedByString:@", "]];
+}
+
+- (id) copyWithZone:(NSZone *)zone {
+    #pragma unused(zone)
+    return [self retain];
+}
+
+// MARK: Accessors
+
+- (NSString *) string {
+    return string;
+}
+
+- (NSString *) tokenStart {
+    return tokenStart;
+}
+
+- (NSString *) tokenEnd {
+    return tokenEnd;
+}
+
+- (NSArray *) keys {
+    return keys;
+}
+
+- (NSUInteger) positionalTokenCount {
+    return positionalTokenCount;
+}
+
+// MARK: Rendering
+
+- (NSString *) stringByRenderingWithArgument:(NSString *)arg {
+    return [self stringByRenderingKeyValues:NULL positionalValues:NULL repeating:BMScriptTemplateStringValue(arg) unescapingPercentSigns:NO];
+}
+
+- (NSString *) stringByRenderingWithArguments:(NSArray *)args {
+    if ([args count] < positionalTokenCount) {
+        @throw [NSException exceptionWithName:BMScriptTemplateArgumentMissingException
+                                       reason:[NSString stringWithFormat:@"BMScriptTemplate: %lu arguments for %lu tokens",
+                                               (unsigned long)[args count], (unsigned long)positionalTokenCount]
+                                     userInfo:nil];
+    }
+    if (positionalTokenCount == 0) {
+        return [self stringByRenderingKeyValues:NULL positionalValues:NULL repeating:nil unescapingPercentSigns:NO];
+    }
+    NSString ** values = malloc(positionalTokenCount * sizeof(NSString *));
+    if (!values) return nil;
+    NSUInteger i;
+    for (i = 0; i < positionalTokenCount; i++) {
+        values[i] = BMScriptTemplateStringValue([args objectAtIndex:i]);
+    }
+    NSString * rendered = [self stringByRenderingKeyValues:NULL positionalValues:values repeating:nil unescapingPercentSigns:NO];
+    free(values);
+    return rendered;
+}
+
+- (NSString *) stringByRenderingWithDictionary:(NSDictionary *)dictionary unescapingPercentSigns:(BOOL)unescape {
+
+    NSUInteger keyCount = [keys count];
+    NSString ** keyValues = NULL;
+
+    if (keyCount > 0) {
+        keyValues = malloc(keyCount * sizeof(NSString *));
+        if (!keyValues) return nil;
+        NSUInteger i = 0;
+        for (NSString * key in keys) {
+            keyValues[i++] = BMScriptTemplateStringValue([dictionary objectForKey:key]);
+        }
+    }
+
+    // the empty key fills the positional tokens, as replacing "<##>" would
+    NSString * repeated = BMScriptTemplateStringValue([dictionary objectForKey:@""]);
+    NSString * rendered = [self stringByRenderingKeyValues:keyValues positionalValues:NULL repeating:repeated unescapingPercentSigns:unescape];
+
+    free(keyValues);
+    return rendered;
+}
+
+// MARK: Private
+
+- (void) addSegmentAt:(NSUInteger)location length:(NSUInteger)length key:(NSInteger)key capacity:(NSUInteger *)capacity {
+    if (segmentCount == *capacity) {
+        NSUInteger newCapacity = (*capacity ? *capacity * 2 : 16);
+        void * grown = realloc(segments, newCapacity * sizeof(BMScriptTemplateSegment));
+        if (!grown) {
+            @throw [NSException exceptionWithName:NSMallocException reason:@"BMScriptTemplate: out of memory" userInfo:nil];
+        }
+        segments = grown;
+        *capacity = newCapacity;
+    }
+    BMScriptTemplateSegment * segment = (BMScriptTemplateSegment *)segments + segmentCount++;
+    segment->location = location;
+    segment->length = length;
+    segment->key = key;
+}
+
+/* one pass to add up the lengths, one to copy. a nil value keeps the token as it is. */
+- (NSString *) stringByRenderingKeyValues:(NSString **)keyValues
+                         positionalValues:(NSString **)positional
+                                repeating:(NSString *)repeated
+                   unescapingPercentSigns:(BOOL)unescape {
+
+    const BMScriptTemplateSegment * segs = segments;
+    NSUInteger positionalIndex = 0;
+    NSUInteger total = 0;
+    NSUInteger s;
+
+    for (s = 0; s < segmentCount; s++) {
+        NSString * value = nil;
+        if (segs[s].key >= 0) {
+            value = (keyValues ? keyValues[segs[s].key] : nil);
+        } else if (segs[s].key == BMSCRIPT_TEMPLATE_SEGMENT_POSITIONAL) {
+            value = (positional ? positional[positionalIndex++] : repeated);
+        }
+        total += (value ? [value length] : segs[s].length);
+    }
+
+    if (total == 0) {
+        return @"";
+    }
+
+    unichar * buffer = malloc(total * sizeof(unichar));
+    if (!buffer) return nil;
+
+    unichar * p = buffer;
+    positionalIndex = 0;
+    for (s = 0; s < segmentCount; s++) {
+        NSString * value = nil;
+        if (segs[s].key >= 0) {
+            value = (keyValues ? keyValues[segs[s].key] : nil);
+        } else if (segs[s].key == BMSCRIPT_TEMPLATE_SEGMENT_POSITIONAL) {
+            value = (positional ? positional[positionalIndex++] : repeated);
+        }
+        if (value) {
+            NSUInteger vlen = [value length];
+            [value getCharacters:p range:NSMakeRange(0, vlen)];
+            p += vlen;
+        } else {
+            memcpy(p, characters + segs[s].location, segs[s].length * sizeof(unichar));
+            p += segs[s].length;
+        }
+    }
+
+    // same as replacing "%%" with "%" left to right over the whole result
+    if (unescape) {
+        unichar * out = buffer;
+        BOOL pairOpen = NO;
+        for (p = buffer; p < buffer + total; p++) {
+            if (*p == '%') {
+                pairOpen = !pairOpen;
+                if (!pairOpen) continue;
+            } else {
+                pairOpen = NO;
+            }
+            *out++ = *p;
+        }
+        total = (NSUInteger)(out - buffer);
+    }
+
+    return [[[NSString alloc] initWithCharactersNoCopy:buffer length:total freeWhenDone:YES] autorelease];
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,170 @@
+//
+//  BMScriptWorkerPool.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*!
+ * @file BMScriptWorkerPool.h
+ * Class interface of BMScriptWorkerPool.
+ */
+
+#import "BMDefines.h"
+#import "BMScript.h"
+#import "BMScriptOutputBuffer.h"
+#import <Foundation/Foundation.h>
+
+/*!
+ * @addtogroup defines Defines
+ * @{
+ */
+
+/*! Default for BMScriptWorkerPool#maxJobsPerWorker. */
+#ifndef BMSCRIPT_WORKER_MAX_JOBS
+    #define BMSCRIPT_WORKER_MAX_JOBS 500
+#endif
+
+/*! Default for BMScriptWorkerPool#maxResidentSize, in bytes. */
+#ifndef BMSCRIPT_WORKER_MAX_RESIDENT_SIZE
+    #define BMSCRIPT_WORKER_MAX_RESIDENT_SIZE (256ULL * 1024 * 1024)
+#endif
+
+/*! @} */
+
+/*!
+ * @addtogroup constants Constants
+ * @{
+ */
+
+/*! Name of the shim for Python 2.6+ and 3.x. Use as value for #BMScriptOptionsWorkerShimKey. */
+OBJC_EXPORT NSString * const BMScriptWorkerShimPython;
+/*! Name of the shim for Ruby 1.8+. Use as value for #BMScriptOptionsWorkerShimKey. */
+OBJC_EXPORT NSString * const BMScriptWorkerShimRuby;
+/*! Name of the shim for Perl 5.8+. Use as value for #BMScriptOptionsWorkerShimKey. */
+OBJC_EXPORT NSString * const BMScriptWorkerShimPerl;
+/*! Name of the shim for POSIX shells. Use as value for #BMScriptOptionsWorkerShimKey. */
+OBJC_EXPORT NSString * const BMScriptWorkerShimShell;
+
+/*! @} */
+
+/*!
+ * @class BMScriptWorkerPool
+ * A pool of long-lived interpreter processes that execute script sources one after another.
+ *
+ * Starting an interpreter usually costs a lot more than running a short script in it. A worker pool
+ * keeps interpreters around between executions: each worker runs a small shim (passed to the
+ * interpreter the same way a script source is, i.e. appended to the arguments of the options
+ * dictionary) which reads jobs from its standard input, runs them and writes the output back.
+ *
+ * The shim and the pool talk over a UNIX domain socket installed as the worker's standard input
+ * and output, using a line-based header followed by a payload of the announced length:
+ *
+ * <pre>
+ * request:   BMSCRIPT &lt;source length&gt;\\n&lt;UTF-8 source&gt;
+ * response:  BMSCRIPT &lt;exit status&gt; &lt;output length&gt;\\n&lt;output&gt;
+ * </pre>
+ *
+ * While a job runs the shim points file descriptors 1 and 2 to a private temporary file, so the
+ * output of child processes is captured as well and can't corrupt the protocol. The exit status
+ * is what the script passed to exit() (or the interpreter's status for an uncaught exception).
+ * Each job gets a fresh top level scope; state kept in modules or globals of the interpreter
+ * itself, however, carries over to the next job running on the same worker.
+ *
+ * Workers are recycled after BMScriptWorkerPool#maxJobsPerWorker jobs or once their resident
+ * set size exceeds BMScriptWorkerPool#maxResidentSize. A worker whose job was cancelled or timed
+ * out is killed and replaced.
+ *
+ * Normally there is no need to talk to a pool directly: set BMScript#usesWorkerPool and
+ * BMScript routes its blocking executions through the shared pool for its options.
+ * All methods are thread-safe.
+ */
+@interface BMScriptWorkerPool : NSObject {
+ @private
+    NSString * launchPath;
+    NSArray * arguments;
+    NSCondition * lock;
+    NSMutableArray * idleWorkers;
+    NSUInteger workerCount;
+    NSUInteger generation;
+    NSUInteger maxWorkers;
+    NSUInteger maxJobsPerWorker;
+    unsigned long long maxResidentSize;
+    NSUInteger outputSpillThreshold;
+}
+
+/*! Gets the path of the interpreter. */
+@property (BM_ATOMIC copy, readonly) NSString * launchPath;
+/*! Gets the arguments a worker is started with, including the shim source. */
+@property (BM_ATOMIC copy, readonly) NSArray * arguments;
+/*! Gets or sets the maximum number of workers running at the same time. Defaults to the number of active processor cores. */
+@property (BM_ATOMIC assign) NSUInteger maxWorkers;
+/*! Gets or sets the number of jobs after which a worker is replaced. 0 means never. Defaults to #BMSCRIPT_WORKER_MAX_JOBS. */
+@property (BM_ATOMIC assign) NSUInteger maxJobsPerWorker;
+/*! Gets or sets the resident set size in bytes above which a worker is replaced after its current job. 0 means no limit. Defaults to #BMSCRIPT_WORKER_MAX_RESIDENT_SIZE. */
+@property (BM_ATOMIC assign) unsigned long long maxResidentSize;
+/*! Gets or sets the output size in bytes beyond which the output of a job is moved to an anonymous file. 0 means never. Defaults to #BMSCRIPT_OUTPUT_SPILL_THRESHOLD. @sa BMScriptOutputBuffer */
+@property (BM_ATOMIC assign) NSUInteger outputSpillThreshold;
+
+/*!
+ * Returns the shared pool for a set of BMScript options or nil if the options name no known shim
+ * in #BMScriptOptionsWorkerShimKey. Options that only differ in keys other than the launch path,
+ * the arguments and the shim share a pool.
+ * @param scriptOptions an options dictionary as used by BMScript
+ */
++ (BMScriptWorkerPool *) poolForOptions:(NSDictionary *)scriptOptions;
+/*!
+ * Returns the source of a registered shim or nil.
+ * @param name one of the BMScriptWorkerShim... constants or a name registered with #registerShimSource:forName:
+ */
++ (NSString *) shimSourceForName:(NSString *)name;
+/*!
+ * Registers the source of a shim for custom language profiles. The shim must implement the protocol
+ * described above. Registering a source for an existing name replaces it for pools created afterwards.
+ * @param shimSource the program passed to the interpreter
+ * @param name the name used as value for #BMScriptOptionsWorkerShimKey
+ */
++ (void) registerShimSource:(NSString *)shimSource forName:(NSString *)name;
+
+/*!
+ * Initializes a pool for an interpreter. This is the designated initializer.
+ * @param path absolute path of the interpreter
+ * @param args the arguments to start a worker with. The last argument usually is the shim source.
+ */
+- (id) initWithLaunchPath:(NSString *)path arguments:(NSArray *)args;
+
+/*!
+ * Runs a script source on one of the workers and blocks until it has finished. If all workers
+ * are busy and #maxWorkers is reached, waits for one to become available.
+ * @param scriptSource the source to execute
+ * @param limit time limit in seconds, 0 means no limit
+ * @param fd a descriptor that becomes readable to cancel the job, or -1
+ * @param results on return contains the output of the job. May be NULL.
+ * @param retval on return contains the exit status of the job. May be NULL.
+ * @param error on return contains an NSError in the NSPOSIXErrorDomain if no worker could be started. May be NULL.
+ * @returns #BMScriptFinishedSuccessfully or the exit status of the job, #BMScriptTimedOut, #BMScriptCancelled,
+ * or #BMScriptFailedWithException if no worker could be started.
+ */
+- (ExecutionStatus) executeSource:(NSString *)scriptSource
+                        timeLimit:(NSTimeInterval)limit
+                 cancelDescriptor:(int)fd
+                          results:(NSData **)results
+                      returnValue:(NSInteger *)retval
+                            error:(NSError **)error;
+
+/*! Terminates all idle workers. Busy workers are terminated when they finish their current job. */
+- (void) drain;
+
+@end
@@ -0,0 +1,661 @@
+//
+//  BMScriptWorkerPool.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptWorkerPool.h"
+#import "BMScriptTask.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#if defined(__APPLE__)
+    #include <libproc.h>        /* for proc_pidinfo */
+#endif
+
+#ifdef MSG_NOSIGNAL
+    #define BM_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define BM_SEND_FLAGS 0
+#endif
+
+#define BMSCRIPT_WORKER_READ_BUFFER_SIZE    65536   /* size of the stack buffer used when reading responses */
+#define BMSCRIPT_WORKER_MAX_HEADER_LENGTH   64      /* a response header longer than this is a protocol error */
+
+NSString * const BMScriptWorkerShimPython   = @"python";
+NSString * const BMScriptWorkerShimRuby     = @"ruby";
+NSString * const BMScriptWorkerShimPerl     = @"perl";
+NSString * const BMScriptWorkerShimShell    = @"sh";
+
+// The shims dup the protocol socket away from fd 0 and 1 and point 0, 1 and 2 at /dev/null.
+// While a job runs, 1 and 2 go to a temporary file which is sent back in one piece afterwards.
+
+static NSString * const BMScriptPythonWorkerShimSource =
+    @"import os, sys, tempfile, traceback\n"
+    @"rfd, wfd = os.dup(0), os.dup(1)\n"
+    @"null = os.open(os.devnull, os.O_RDWR)\n"
+    @"for fd in (0, 1, 2): os.dup2(null, fd)\n"
+    @"inp = os.fdopen(rfd, 'rb')\n"
+    @"tmp = tempfile.TemporaryFile()\n"
+    @"while True:\n"
+    @"    line = inp.readline()\n"
+    @"    if not line: break\n"
+    @"    src = inp.read(int(line.split()[1])).decode('utf-8')\n"
+    @"    tmp.seek(0); tmp.truncate()\n"
+    @"    os.dup2(tmp.fileno(), 1); os.dup2(tmp.fileno(), 2)\n"
+    @"    status = 0\n"
+    @"    try:\n"
+    @"        exec(compile(src, '-c', 'exec'), {'__name__': '__main__', '__builtins__': __builtins__})\n"
+    @"    except SystemExit:\n"
+    @"        code = sys.exc_info()[1].code\n"
+    @"        if code is None: status = 0\n"
+    @"        elif isinstance(code, int): status = code\n"
+    @"        else: sys.stderr.write('%s\\n' % code); status = 1\n"
+    @"    except BaseException:\n"
+    @"        info = sys.exc_info()\n"
+    @"        traceback.print_exception(info[0], info[1], info[2].tb_next); status = 1\n"
+    @"    sys.stdout.flush(); sys.stderr.flush()\n"
+    @"    os.dup2(null, 1); os.dup2(null, 2)\n"
+    @"    tmp.seek(0); data = tmp.read()\n"
+    @"    buf = ('BMSCRIPT %d %d\\n' % (status & 0xff, len(data))).encode('ascii') + data\n"
+    @"    while buf: buf = buf[os.write(wfd, buf):]\n";
+
+static NSString * const BMScriptRubyWorkerShimSource =
+    @"require 'tempfile'\n"
+    @"proto_in, proto_out = $stdin.dup, $stdout.dup\n"
+    @"proto_in.binmode; proto_out.binmode; proto_out.sync = true\n"
+    @"null = File.open('/dev/null', 'r+')\n"
+    @"$stdin.reopen(null); $stdout.reopen(null); $stderr.reopen(null)\n"
+    @"tmp = Tempfile.new('bmscript'); tmp.binmode\n"
+    @"def bmscript_binding; binding; end\n"
+    @"while (line = proto_in.gets)\n"
+    @"  src = proto_in.read(line.split[1].to_i) || ''\n"
+    @"  tmp.truncate(0); tmp.rewind\n"
+    @"  $stdout.reopen(tmp); $stderr.reopen(tmp)\n"
+    @"  status = 0\n"
+    @"  begin\n"
+    @"    eval(src, bmscript_binding, '-e')\n"
+    @"  rescue SystemExit => e\n"
+    @"    status = e.status\n"
+    @"  rescue Exception => e\n"
+    @"    $stderr.puts \"-e: #{e.message} (#{e.class})\", e.backtrace\n"
+    @"    status = 1\n"
+    @"  end\n"
+    @"  $stdout.flush; $stderr.flush\n"
+    @"  $stdout.reopen(null); $stderr.reopen(null)\n"
+    @"  tmp.rewind; data = tmp.read\n"
+    @"  proto_out.write(\"BMSCRIPT #{status & 0xff} #{data.respond_to?(:bytesize) ? data.bytesize : data.length}\\n\", data)\n"
+    @"end\n";
+
+// exit() inside a string eval would end the worker, so it is turned into an exception
+static NSString * const BMScriptPerlWorkerShimSource =
+    @"use File::Temp qw(tempfile);\n"
+    @"BEGIN { *CORE::GLOBAL::exit = sub { die bless({ code => (defined $_[0] ? $_[0] : 0) }, 'BMScript::Exit') } }\n"
+    @"open(my $in, '<&', \\*STDIN) or die; open(my $out, '>&', \\*STDOUT) or die;\n"
+    @"binmode $in; binmode $out; select((select($out), $| = 1)[0]);\n"
+    @"open(STDIN, '<', '/dev/null'); open(STDOUT, '>', '/dev/null'); open(STDERR, '>', '/dev/null');\n"
+    @"my (undef, $tmp) = tempfile(UNLINK => 1);\n"
+    @"sub bmscript_run { package main; eval $_[0]; die $@ if $@ }\n"
+    @"while (defined(my $line = <$in>)) {\n"
+    @"    my (undef, $len) = split(' ', $line);\n"
+    @"    my $src = ''; read($in, $src, $len) if $len;\n"
+    @"    open(STDOUT, '>', $tmp); open(STDERR, '>&', \\*STDOUT);\n"
+    @"    select((select(STDERR), $| = 1)[0]);\n"
+    @"    my $status = 0;\n"
+    @"    unless (eval { bmscript_run($src); 1 }) {\n"
+    @"        if (ref($@) eq 'BMScript::Exit') { $status = $@->{code} } else { print STDERR $@; $status = 255 }\n"
+    @"    }\n"
+    @"    close(STDOUT); close(STDERR);\n"
+    @"    open(STDOUT, '>', '/dev/null'); open(STDERR, '>', '/dev/null');\n"
+    @"    open(my $fh, '<', $tmp); binmode $fh; local $/; my $data = <$fh>; $data = '' unless defined $data; close($fh);\n"
+    @"    print $out 'BMSCRIPT ' . ($status & 0xff) . ' ' . length($data) . \"\\n\" . $data;\n"
+    @"}\n";
+
+// the shell can't evaluate in-process without leaking state, so every job still gets a subshell (a fork, no exec)
+static NSString * const BMScriptShellWorkerShimSource =
+    @"exec 3<&0 4>&1 0</dev/null 1>/dev/null 2>/dev/null\n"
+    @"bmscript_tmp=$(mktemp \"${TMPDIR:-/tmp}/bmscript.XXXXXX\") || exit 1\n"
+    @"trap 'rm -f \"$bmscript_tmp\"' EXIT\n"
+    @"while read -r bmscript_tag bmscript_len <&3; do\n"
+    @"    bmscript_src=$(head -c \"$bmscript_len\" <&3)\n"
+    @"    (eval \"$bmscript_src\") 3<&- 4>&- >\"$bmscript_tmp\" 2>&1\n"
+    @"    bmscript_status=$?\n"
+    @"    printf 'BMSCRIPT %d %d\\n' \"$bmscript_status\" \"$(($(wc -c <\"$bmscript_tmp\")))\" >&4\n"
+    @"    cat \"$bmscript_tmp\" >&4\n"
+    @"done\n";
+
+static NSMutableDictionary * BMScriptWorkerShims = nil;
+static NSMutableDictionary * BMScriptWorkerPools = nil;
+
+/* Writes the complete buffer. Returns NO if the worker went away. */
+static BOOL BMScriptWorkerSendAll(int fd, const char * bytes, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, bytes, length, BM_SEND_FLAGS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return NO;
+        }
+        bytes += n;
+        length -= (size_t)n;
+    }
+    return YES;
+}
+
+/* Returns the resident set size of a process in bytes or 0 if it can't be determined. */
+static unsigned long long BMScriptWorkerResidentSize(pid_t pid) {
+    unsigned long long rss = 0;
+#if defined(__linux__)
+    char path[64];
+    char buffer[128];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+        if (n > 0) {
+            unsigned long long pages = 0;
+            buffer[n] = '\0';
+            if (sscanf(buffer, "%*u %llu", &pages) == 1) {
+                rss = pages * (unsigned long long)sysconf(_SC_PAGESIZE);
+            }
+        }
+        close(fd);
+    }
+#elif defined(__APPLE__)
+    struct proc_taskinfo info;
+    if (proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &info, sizeof(info)) == (int)sizeof(info)) {
+        rss = info.pti_resident_size;
+    }
+#else
+    #pragma unused(pid)
+#endif
+    return rss;
+}
+
+
+/* One interpreter process and the parent's end of its socket. */
+@interface BMScriptWorker : NSObject {
+ @public
+    BMScriptTask * task;
+    int channel;
+    NSUInteger jobs;
+    NSUInteger generation;
+}
+- (void) terminate;
+@end
+
+@implementation BMScriptWorker
+
+- (id) init {
+    if ((self = [super init])) {
+        channel = -1;
+    }
+    return self;
+}
+
+/* Kills the worker and reaps it. The worker is its own process group, so anything a job left behind goes too. */
+- (void) terminate {
+    if (channel >= 0) {
+        close(channel);
+        channel = -1;
+    }
+    if (task) {
+        [task signalProcessGroup:SIGKILL];
+        [task waitUntilExit];
+        [task release], task = nil;
+    }
+}
+
+- (void) dealloc {
+    [self terminate];
+    [super dealloc];
+}
+
+- (void) finalize {
+    [self terminate];
+    [super finalize];
+}
+
+@end
+
+
+@interface BMScriptWorkerPool (/* Private */)
+- (BMScriptWorker *) spawnWorkerAndReturnError:(NSError **)error;
+- (BMScriptWorker *) checkoutWorkerAndReturnError:(NSError **)error;
+- (void) checkinWorker:(BMScriptWorker *)worker reusable:(BOOL)reusable;
+@end
+
+@implementation BMScriptWorkerPool
+
+@synthesize launchPath;
+@synthesize arguments;
+
++ (void) initialize {
+    if (self == [BMScriptWorkerPool class]) {
+        BMScriptWorkerPools = [[NSMutableDictionary alloc] init];
+        BMScriptWorkerShims = [[NSMutableDictionary alloc] initWithObjectsAndKeys:
+                               BMScriptPythonWorkerShimSource, BMScriptWorkerShimPython,
+                                 BMScriptRubyWorkerShimSource, BMScriptWorkerShimRuby,
+                                 BMScriptPerlWorkerShimSource, BMScriptWorkerShimPerl,
+                                BMScriptShellWorkerShimSource, BMScriptWorkerShimShell, nil];
+    }
+}
+
++ (NSString *) shimSourceForName:(NSString *)name {
+    if (!name) return nil;
+    @synchronized(BMScriptWorkerShims) {
+        return [[[BMScriptWorkerShims objectForKey:name] retain] autorelease];
+    }
+    return nil;
+}
+
++ (void) registerShimSource:(NSString *)shimSource forName:(NSString *)name {
+    if (!shimSource || !name) return;
+    @synchronized(BMScriptWorkerShims) {
+        [BMScriptWorkerShims setObject:shimSource forKey:name];
+    }
+}
+
++ (BMScriptWorkerPool *) poolForOptions:(NSDictionary *)scriptOptions {
+
+    NSString * path = [scriptOptions objectForKey:BMScriptOptionsTaskLaunchPathKey];
+    NSArray * args = [scriptOptions objectForKey:BMScriptOptionsTaskArgumentsKey];
+    NSString * shim = [self shimSourceForName:[scriptOptions objectForKey:BMScriptOptionsWorkerShimKey]];
+
+    if (!path || !shim) return nil;
+
+    // see -[BMScript setupTask] for the "nil" arguments case
+    if (!args || [args isEmptyStringArray] || [args isZeroArray]) {
+        args = [NSArray arrayWithObject:shim];
+    } else {
+        args = [args arrayByAddingObject:shim];
+    }
+
+    NSArray * key = [NSArray arrayWithObjects:path, args, nil];
+    BMScriptWorkerPool * aPool = nil;
+
+    @synchronized(BMScriptWorkerPools) {
+        aPool = [BMScriptWorkerPools objectForKey:key];
+        if (!aPool) {
+            aPool = [[[BMScriptWorkerPool alloc] initWithLaunchPath:path arguments:args] autorelease];
+            [BMScriptWorkerPools setObject:aPool forKey:key];
+        }
+        [[aPool retain] autorelease];
+    }
+    return aPool;
+}
+
+- (id) init {
+    return [self initWithLaunchPath:nil arguments:nil];
+}
+
+/* designated initializer */
+- (id) initWithLaunchPath:(NSString *)path arguments:(NSArray *)args {
+    if (!path) {
+        [self release];
+        return nil;
+    }
+    if ((self = [super init])) {
+        launchPath = [path copy];
+        arguments = [(args ? args : [NSArray array]) copy];
+        lock = [[NSCondition alloc] init];
+        idleWorkers = [[NSMutableArray alloc] init];
+        maxWorkers = [[NSProcessInfo processInfo] activeProcessorCount];
+        if (maxWorkers < 1) maxWorkers = 1;
+        maxJobsPerWorker = BMSCRIPT_WORKER_MAX_JOBS;
+        maxResidentSize = BMSCRIPT_WORKER_MAX_RESIDENT_SIZE;
+        outputSpillThreshold = BMSCRIPT_OUTPUT_SPILL_THRESHOLD;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [idleWorkers release], idleWorkers = nil;
+    [lock release], lock = nil;
+    [launchPath release], launchPath = nil;
+    [arguments release], arguments = nil;
+    [super dealloc];
+}
+
+// MARK: Accessors
+
+- (NSUInteger) maxWorkers {
+    [lock lock];
+    NSUInteger value = maxWorkers;
+    [lock unlock];
+    return value;
+}
+
+- (void) setMaxWorkers:(NSUInteger)value {
+    [lock lock];
+    maxWorkers = (value > 0 ? value : 1);
+    [lock broadcast];
+    [lock unlock];
+}
+
+- (NSUInteger) maxJobsPerWorker {
+    [lock lock];
+    NSUInteger value = maxJobsPerWorker;
+    [lock unlock];
+    return value;
+}
+
+- (void) setMaxJobsPerWorker:(NSUInteger)value {
+    [lock lock];
+    maxJobsPerWorker = value;
+    [lock unlock];
+}
+
+- (unsigned long long) maxResidentSize {
+    [lock lock];
+    unsigned long long value = maxResidentSize;
+    [lock unlock];
+    return value;
+}
+
+- (void) setMaxResidentSize:(unsigned long long)value {
+    [lock lock];
+    maxResidentSize = value;
+    [lock unlock];
+}
+
+- (NSUInteger) outputSpillThreshold {
+    [lock lock];
+    NSUInteger value = outputSpillThreshold;
+    [lock unlock];
+    return value;
+}
+
+- (void) setOutputSpillThreshold:(NSUInteger)value {
+    [lock lock];
+    outputSpillThreshold = value;
+    [lock unlock];
+}
+
+// MARK: Workers
+
+- (BMScriptWorker *) spawnWorkerAndReturnError:(NSError **)error {
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        return nil;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+    #ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(sv[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    #endif
+
+    NSFileHandle * childEnd = [[[NSFileHandle alloc] initWithFileDescriptor:sv[1] closeOnDealloc:NO] autorelease];
+    BMScriptTask * aTask = [[[BMScriptTask alloc] init] autorelease];
+
+    [aTask setLaunchPath:launchPath];
+    [aTask setArguments:arguments];
+    [aTask setStandardInput:childEnd];
+    [aTask setStandardOutput:childEnd];
+    [aTask setStandardError:[NSFileHandle fileHandleForWritingAtPath:@"/dev/null"]];
+    // workers outlive the thread that happened to start them, so no PR_SET_PDEATHSIG here.
+    // they exit on their own when the socket reports EOF, which is also the case when we die.
+    [aTask setCreatesProcessGroup:YES];
+    [aTask setTerminatesWithParent:NO];
+
+    BOOL launched = [aTask launchAndReturnError:error];
+
+    [aTask setStandardInput:nil];
+    [aTask setStandardOutput:nil];
+    close(sv[1]);
+
+    if (!launched) {
+        close(sv[0]);
+        return nil;
+    }
+
+    BMScriptWorker * worker = [[[BMScriptWorker alloc] init] autorelease];
+    worker->task = [aTask retain];
+    worker->channel = sv[0];
+    return worker;
+}
+
+- (BMScriptWorker *) checkoutWorkerAndReturnError:(NSError **)error {
+
+    BMScriptWorker * worker = nil;
+
+    [lock lock];
+    for (;;) {
+        while ([idleWorkers count] > 0) {
+            worker = [[[idleWorkers lastObject] retain] autorelease];
+            [idleWorkers removeLastObject];
+            if ([worker->task isRunning]) {
+                [lock unlock];
+                return worker;
+            }
+            workerCount--;
+            worker = nil;
+        }
+        if (workerCount < maxWorkers) {
+            workerCount++;
+            NSUInteger currentGeneration = generation;
+            [lock unlock];
+            worker = [self spawnWorkerAndReturnError:error];
+            if (worker) {
+                worker->generation = currentGeneration;
+            } else {
+                [lock lock];
+                workerCount--;
+                [lock signal];
+                [lock unlock];
+            }
+            return worker;
+        }
+        [lock wait];
+    }
+    return nil;
+}
+
+- (void) checkinWorker:(BMScriptWorker *)worker reusable:(BOOL)reusable {
+    [lock lock];
+    if (reusable && worker->generation == generation) {
+        [idleWorkers addObject:worker];
+    } else {
+        workerCount--;
+        [worker terminate];
+    }
+    [lock signal];
+    [lock unlock];
+}
+
+- (void) drain {
+    [lock lock];
+    generation++;
+    workerCount -= [idleWorkers count];
+    NSArray * retired = [[idleWorkers copy] autorelease];
+    [idleWorkers removeAllObjects];
+    [lock broadcast];
+    [lock unlock];
+    [retired makeObjectsPerformSelector:@selector(terminate)];
+}
+
+// MARK: Execution
+
+- (ExecutionStatus) executeSource:(NSString *)scriptSource
+                        timeLimit:(NSTimeInterval)limit
+                 cancelDescriptor:(int)fd
+                          results:(NSData **)results
+                      returnValue:(NSInteger *)retval
+                            error:(NSError **)error {
+
+    NSData * sourceData = [(scriptSource ? scriptSource : @"") dataUsingEncoding:NSUTF8StringEncoding];
+    NSData * header = [[NSString stringWithFormat:@"BMSCRIPT %lu\n", (unsigned long)[sourceData length]]
+                       dataUsingEncoding:NSASCIIStringEncoding];
+
+    BMScriptWorker * worker = nil;
+
+    // an idle worker may have died since its last job (killed from outside, say).
+    // if the request can't be delivered, retry once with a fresh one.
+    for (NSUInteger attempt = 0; attempt < 2 && !worker; attempt++) {
+        worker = [self checkoutWorkerAndReturnError:error];
+        if (!worker) {
+            if (retval) *retval = BMScriptFailedWithException;
+            return BMScriptFailedWithException;
+        }
+        if (!BMScriptWorkerSendAll(worker->channel, [header bytes], [header length]) ||
+            !BMScriptWorkerSendAll(worker->channel, [sourceData bytes], [sourceData length])) {
+            [self checkinWorker:worker reusable:NO];
+            worker = nil;
+        }
+    }
+    if (!worker) {
+        if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EPIPE userInfo:nil];
+        if (retval) *retval = BMScriptFailedWithException;
+        return BMScriptFailedWithException;
+    }
+
+    // the header is collected in memory, the payload goes to a buffer which spills large outputs to a file
+    NSMutableData * response = [NSMutableData data];
+    BMScriptOutputBuffer * payload = nil;
+    NSUInteger headerLength = 0;
+    unsigned long long expected = 0;
+    long jobStatus = 0;
+    BOOL complete = NO;
+    BOOL broken = NO;
+    ExecutionStatus terminationReason = BMScriptNotExecuted;
+
+    int sock = worker->channel;
+    int exitfd = [worker->task exitFileDescriptor];
+    char buffer[BMSCRIPT_WORKER_READ_BUFFER_SIZE];
+    NSTimeInterval deadline = (limit > 0 ? [NSDate timeIntervalSinceReferenceDate] + limit : 0);
+
+    while (!complete && !broken && terminationReason == BMScriptNotExecuted) {
+        struct pollfd fds[3] = { { sock, POLLIN, 0 }, { fd, POLLIN, 0 }, { exitfd, POLLIN, 0 } };
+        int timeout = -1;
+        if (deadline > 0) {
+            // checked on every round: a worker that keeps writing would otherwise never let poll time out
+            NSTimeInterval remaining = deadline - [NSDate timeIntervalSinceReferenceDate];
+            if (remaining <= 0) {
+                terminationReason = BMScriptTimedOut;
+                break;
+            }
+            timeout = (int) ceil(remaining * 1000.0);
+        }
+        int n = poll(fds, 3, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            broken = YES;
+            break;
+        }
+        if (n == 0) {
+            terminationReason = BMScriptTimedOut;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            terminationReason = BMScriptCancelled;
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytesRead = read(sock, buffer, sizeof(buffer));
+            if (bytesRead > 0) {
+                if (payload) {
+                    unsigned long long missing = expected - [payload length];
+                    [payload appendBytes:buffer length:(NSUInteger)MIN((unsigned long long)bytesRead, missing)];
+                } else {
+                    [response appendBytes:buffer length:(NSUInteger)bytesRead];
+                }
+            } else if (bytesRead == 0 || errno != EINTR) {
+                broken = YES;
+            }
+        } else if (fds[2].revents) {
+            // gone without closing the socket (a grandchild still holds it)
+            broken = YES;
+        }
+        if (!headerLength) {
+            const char * bytes = [response bytes];
+            const char * newline = memchr(bytes, '\n', [response length]);
+            if (newline) {
+                char line[BMSCRIPT_WORKER_MAX_HEADER_LENGTH + 1];
+                size_t lineLength = (size_t)(newline - bytes);
+                if (lineLength > BMSCRIPT_WORKER_MAX_HEADER_LENGTH) lineLength = BMSCRIPT_WORKER_MAX_HEADER_LENGTH;
+                memcpy(line, bytes, lineLength);
+                line[lineLength] = '\0';
+                if (sscanf(line, "BMSCRIPT %ld %llu", &jobStatus, &expected) == 2) {
+                    headerLength = (NSUInteger)(newline - bytes) + 1;
+                    payload = [[[BMScriptOutputBuffer alloc] initWithSpillThreshold:self.outputSpillThreshold] autorelease];
+                    [payload appendBytes:(bytes + headerLength) length:(NSUInteger)MIN((unsigned long long)([response length] - headerLength), expected)];
+                    response = nil;
+                } else {
+                    broken = YES;
+                }
+            } else if ([response length] > BMSCRIPT_WORKER_MAX_HEADER_LENGTH) {
+                broken = YES;
+            }
+        }
+        if (payload && [payload length] >= expected) {
+            complete = YES;
+        }
+    }
+
+    ExecutionStatus status = BMScriptNotExecuted;
+    NSData * output = nil;
+
+    if (complete) {
+        output = [payload data];
+        if (retval) *retval = jobStatus;
+        status = jobStatus;
+
+        [lock lock];
+        NSUInteger jobLimit = maxJobsPerWorker;
+        unsigned long long sizeLimit = maxResidentSize;
+        [lock unlock];
+
+        BOOL reusable = YES;
+        if (jobLimit > 0 && ++worker->jobs >= jobLimit) {
+            reusable = NO;
+        } else if (sizeLimit > 0 && BMScriptWorkerResidentSize([worker->task processIdentifier]) > sizeLimit) {
+            reusable = NO;
+        }
+        [self checkinWorker:worker reusable:reusable];
+    } else {
+        // the worker is in an unknown state: timed out, cancelled, crashed (os._exit, exit!, a signal) or
+        // talking nonsense. kill what is left of it and report how it went. the job's output is lost with it.
+        BMScriptTask * aTask = [[worker->task retain] autorelease];
+        [self checkinWorker:worker reusable:NO];
+        output = [NSData data];
+        if (terminationReason != BMScriptNotExecuted) {
+            status = terminationReason;
+            if (retval) *retval = [aTask terminationStatus];
+        } else {
+            status = [aTask terminationStatus];
+            if (retval) *retval = status;
+        }
+    }
+
+    if (results) *results = output;
+    return status;
+}
+
+@end
+
+/// @endcond
@@ -0,0 +1,47 @@
+//
+//  BMScriptBenchmarks.h
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import <Foundation/Foundation.h>
+#import "BMDefines.h"
+
+/* Runs all benchmarks below with their default parameters. Results are reported through NSLog. */
+BM_EXTERN void BMScriptRunBenchmarks(void);
+
+/* Launches /usr/bin/true iterations times through NSTask and BMScriptTask and compares the spawn latency.
+   ballastMiB megabytes are allocated and touched beforehand to show how launch cost scales with the parent's RSS. */
+BM_EXTERN void BMScriptBenchmarkSpawnLatency(NSUInteger iterations, NSUInteger ballastMiB);
+
+/* Measures the wall clock time of -[BMScript execute] for a trivial shell script. */
+BM_EXTERN void BMScriptBenchmarkBlockingExecution(NSUInteger iterations);
+
+/* Pushes count trivial shell scripts through a BMScriptQueue with the default concurrency and reports the throughput. */
+BM_EXTERN void BMScriptBenchmarkQueueThroughput(NSUInteger count);
+
+/* Escapes a mostly ASCII and a mostly non-ASCII string of megabytes MiB each with -stringByEscapingUnicodeCharacters
+   and with the former appendFormat: per character loop, and reports the throughput of both. */
+BM_EXTERN void BMScriptBenchmarkUnicodeEscaping(NSUInteger megabytes);
+
+/* Lets threads threads lock and unlock iterations times each, through a single function-static pthread mutex and
+   @synchronized on a static string (what BM_LOCK used to expand to with and without BMSCRIPT_FAST_LOCK), and through
+   BMScriptLockObject and @synchronized on an object of each thread's own. Reports the time per lock and the lock statistics. */
+BM_EXTERN void BMScriptBenchmarkLocking(NSUInteger threads, NSUInteger iterations);
+
+/// @endcond
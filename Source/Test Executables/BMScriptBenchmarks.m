@@ -0,0 +1,349 @@
+//
+//  BMScriptBenchmarks.m
+//  BMScriptTest
+//
+//  Created by Andre Berg on 17.10.26.
+//  Copyright 2026 Berg Media. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//  
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/// @cond HIDDEN
+
+#import "BMScriptBenchmarks.h"
+#import "BMScript.h"
+#import "BMScriptTask.h"
+#import "BMScriptQueue.h"
+#import "BMScriptLock.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__APPLE__)
+    #include <mach/mach_time.h>
+#else
+    #include <time.h>
+#endif
+
+#define BMBENCHMARK_TRUE_PATH   @"/usr/bin/true"
+
+// MARK: Helpers
+
+static uint64_t BMBenchmarkNanoseconds(void) {
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) mach_timebase_info(&timebase);
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static int BMBenchmarkCompareSamples(const void * a, const void * b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* sorts samples in place and logs mean, median and 99th percentile in microseconds */
+static void BMBenchmarkReport(NSString * label, uint64_t * samples, NSUInteger count) {
+    if (count == 0) return;
+    uint64_t total = 0;
+    for (NSUInteger i = 0; i < count; i++) total += samples[i];
+    qsort(samples, count, sizeof(uint64_t), BMBenchmarkCompareSamples);
+    NSLog(@"%@: n = %lu  mean = %9.1f us  p50 = %9.1f us  p99 = %9.1f us", label, (unsigned long)count,
+          (double)total / count / 1000.0,
+          samples[count / 2] / 1000.0,
+          samples[(count * 99) / 100] / 1000.0);
+}
+
+// MARK: Spawn Latency
+
+void BMScriptBenchmarkSpawnLatency(NSUInteger iterations, NSUInteger ballastMiB) {
+    
+    uint64_t * samples = calloc(iterations, sizeof(uint64_t));
+    size_t ballastSize = ballastMiB * 1024 * 1024;
+    char * ballast = (ballastSize ? malloc(ballastSize) : NULL);
+    
+    if (!samples || (ballastSize && !ballast)) {
+        NSLog(@"BMScriptBenchmarks Error: Unable to allocate memory for spawn latency benchmark");
+        goto endnow;
+    }
+    if (ballast) memset(ballast, 0xAB, ballastSize);   // touch every page so it counts towards the RSS
+    
+    NSLog(@"Spawn latency with %lu MiB ballast:", (unsigned long)ballastMiB);
+    
+    for (NSUInteger i = 0; i < iterations; i++) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        NSTask * task = [[NSTask alloc] init];
+        [task setLaunchPath:BMBENCHMARK_TRUE_PATH];
+        uint64_t start = BMBenchmarkNanoseconds();
+        [task launch];
+        [task waitUntilExit];
+        samples[i] = BMBenchmarkNanoseconds() - start;
+        [task release];
+        [pool drain];
+    }
+    BMBenchmarkReport(@"NSTask", samples, iterations);
+    
+    for (NSUInteger i = 0; i < iterations; i++) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        BMScriptTask * task = [[BMScriptTask alloc] init];
+        [task setLaunchPath:BMBENCHMARK_TRUE_PATH];
+        uint64_t start = BMBenchmarkNanoseconds();
+        [task launch];
+        [task waitUntilExit];
+        samples[i] = BMBenchmarkNanoseconds() - start;
+        [task release];
+        [pool drain];
+    }
+    BMBenchmarkReport(@"BMScriptTask", samples, iterations);
+    
+endnow:
+    free(ballast);
+    free(samples);
+}
+
+// MARK: Blocking Execution
+
+void BMScriptBenchmarkBlockingExecution(NSUInteger iterations) {
+    
+    uint64_t * samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) return;
+    
+    BMScript * script = [[BMScript alloc] initWithScriptSource:@"echo" options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    
+    for (NSUInteger i = 0; i < iterations; i++) {
+        NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+        uint64_t start = BMBenchmarkNanoseconds();
+        [script execute];
+        samples[i] = BMBenchmarkNanoseconds() - start;
+        [pool drain];
+    }
+    BMBenchmarkReport(@"BMScript -execute (sh -c echo)", samples, iterations);
+    
+    [script release];
+    free(samples);
+}
+
+// MARK: Queue Throughput
+
+void BMScriptBenchmarkQueueThroughput(NSUInteger count) {
+    
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray * scripts = [NSMutableArray arrayWithCapacity:count];
+    
+    for (NSUInteger i = 0; i < count; i++) {
+        [scripts addObject:[BMScript scriptWithSource:@"echo" options:BMSynthesizeOptions(@"/bin/sh", @"-c")]];
+    }
+    
+    BMScriptQueue * queue = [BMScriptQueue queue];
+    uint64_t start = BMBenchmarkNanoseconds();
+    [queue addScripts:scripts];
+    [queue waitUntilAllScriptsAreFinished];
+    double seconds = (BMBenchmarkNanoseconds() - start) / 1e9;
+    
+    NSLog(@"BMScriptQueue: %lu scripts, %lu concurrent, %.2f s = %.0f scripts/min", (unsigned long)count, 
+          (unsigned long)queue.maxConcurrentScripts, seconds, count / seconds * 60.0);
+    
+    [pool drain];
+}
+
+// MARK: Unicode Escaping
+
+/* the implementation -stringByEscapingUnicodeCharacters had before its vectorized run scan */
+static NSString * BMBenchmarkEscapeUnicodeCharactersPerCharacter(NSString * string) {
+    NSMutableString * uniString = [[NSMutableString alloc] init];
+    NSUInteger length = [string length];
+    UniChar * uniBuffer = (UniChar *)malloc(sizeof(UniChar) * (length ? length : 1));
+    [string getCharacters:uniBuffer range:NSMakeRange(0, length)];
+    for (NSUInteger i = 0; i < length; i++) {
+        if (uniBuffer[i] > 0x7e) {
+            [uniString appendFormat:@"\\u%04x", uniBuffer[i]];
+        } else {
+            [uniString appendFormat:@"%c", uniBuffer[i]];
+        }
+    }
+    free(uniBuffer);
+    NSString * retString = [NSString stringWithString:uniString];
+    [uniString release];
+    return retString;
+}
+
+static void BMBenchmarkUnicodeEscapingOfString(NSString * label, NSString * string) {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    double mebibytes = [string length] * sizeof(UniChar) / (1024.0 * 1024.0);
+    
+    uint64_t start = BMBenchmarkNanoseconds();
+    NSString * escaped = [string stringByEscapingUnicodeCharacters];
+    double seconds = (BMBenchmarkNanoseconds() - start) / 1e9;
+    
+    start = BMBenchmarkNanoseconds();
+    NSString * reference = BMBenchmarkEscapeUnicodeCharactersPerCharacter(string);
+    double referenceSeconds = (BMBenchmarkNanoseconds() - start) / 1e9;
+    
+    NSLog(@"%@: -stringByEscapingUnicodeCharacters %8.1f MiB/s  per character %8.1f MiB/s  (%.1fx)%@", label,
+          mebibytes / seconds, mebibytes / referenceSeconds, referenceSeconds / seconds,
+          ([escaped isEqualToString:reference] ? @"" : @"  *** OUTPUT DIFFERS ***"));
+    [pool drain];
+}
+
+void BMScriptBenchmarkUnicodeEscaping(NSUInteger megabytes) {
+    
+    NSUInteger length = megabytes * 1024 * 1024 / sizeof(UniChar);
+    UniChar * mostlyASCII = malloc(sizeof(UniChar) * (length ? length : 1));
+    UniChar * mostlyUnicode = malloc(sizeof(UniChar) * (length ? length : 1));
+    
+    if (!mostlyASCII || !mostlyUnicode) {
+        NSLog(@"BMScriptBenchmarks Error: Unable to allocate memory for unicode escaping benchmark");
+        goto endnow;
+    }
+    
+    // a script source with an accented character now and then, and a source in a non-Latin script
+    for (NSUInteger i = 0; i < length; i++) {
+        mostlyASCII[i] = (i % 97 == 96 ? 0x00e9 : (i % 61 == 60 ? '\n' : (UniChar)(' ' + i % 95)));
+        mostlyUnicode[i] = (i % 7 == 6 ? ' ' : (UniChar)(0x0430 + i % 32));
+    }
+    
+    NSString * string = [[NSString alloc] initWithCharactersNoCopy:mostlyASCII length:length freeWhenDone:NO];
+    BMBenchmarkUnicodeEscapingOfString(@"Unicode escaping (mostly ASCII)", string);
+    [string release];
+    
+    string = [[NSString alloc] initWithCharactersNoCopy:mostlyUnicode length:length freeWhenDone:NO];
+    BMBenchmarkUnicodeEscapingOfString(@"Unicode escaping (mostly Cyrillic)", string);
+    [string release];
+    
+endnow:
+    free(mostlyUnicode);
+    free(mostlyASCII);
+}
+
+// MARK: Locking
+
+typedef enum {
+    BMBenchmarkLockStaticMutex = 0,
+    BMBenchmarkLockStaticSynchronized,
+    BMBenchmarkLockStriped,
+    BMBenchmarkLockSynchronizedObject
+} BMBenchmarkLockScheme;
+
+typedef struct BMBenchmarkLockWorker {
+    BMBenchmarkLockScheme scheme;
+    NSUInteger iterations;
+    id object;
+    NSUInteger counter;
+} BMBenchmarkLockWorker;
+
+static pthread_mutex_t BMBenchmarkStaticMutex = PTHREAD_MUTEX_INITIALIZER;
+static id const BMBenchmarkStaticToken = @"task";
+
+static void * BMBenchmarkLockWorkerMain(void * argument) {
+    BMBenchmarkLockWorker * worker = (BMBenchmarkLockWorker *)argument;
+    NSUInteger i;
+    switch (worker->scheme) {
+        case BMBenchmarkLockStaticMutex:
+            for (i = 0; i < worker->iterations; i++) {
+                pthread_mutex_lock(&BMBenchmarkStaticMutex);
+                worker->counter++;
+                pthread_mutex_unlock(&BMBenchmarkStaticMutex);
+            }
+            break;
+        case BMBenchmarkLockStaticSynchronized:
+            for (i = 0; i < worker->iterations; i++) {
+                @synchronized(BMBenchmarkStaticToken) {
+                    worker->counter++;
+                }
+            }
+            break;
+        case BMBenchmarkLockStriped:
+            for (i = 0; i < worker->iterations; i++) {
+                BMScriptLockObject(worker->object);
+                worker->counter++;
+                BMScriptUnlockObject(worker->object);
+            }
+            break;
+        case BMBenchmarkLockSynchronizedObject:
+            for (i = 0; i < worker->iterations; i++) {
+                @synchronized(worker->object) {
+                    worker->counter++;
+                }
+            }
+            break;
+    }
+    return NULL;
+}
+
+void BMScriptBenchmarkLocking(NSUInteger threads, NSUInteger iterations) {
+    
+    NSString * labels[] = { @"static pthread mutex", @"static @synchronized", @"BMScriptLockObject", @"@synchronized(object)" };
+    BMBenchmarkLockWorker * workers = calloc(threads, sizeof(BMBenchmarkLockWorker));
+    pthread_t * threadIDs = calloc(threads, sizeof(pthread_t));
+    
+    if (!workers || !threadIDs) {
+        NSLog(@"BMScriptBenchmarks Error: Unable to allocate memory for locking benchmark");
+        goto endnow;
+    }
+    
+    NSUInteger i, started;
+    BMBenchmarkLockScheme scheme;
+    for (scheme = BMBenchmarkLockStaticMutex; scheme <= BMBenchmarkLockSynchronizedObject; scheme++) {
+        
+        BMScriptResetLockStatistics();
+        for (i = 0; i < threads; i++) {
+            workers[i].scheme = scheme;
+            workers[i].iterations = iterations;
+            workers[i].object = [[NSObject alloc] init];
+            workers[i].counter = 0;
+        }
+        
+        uint64_t start = BMBenchmarkNanoseconds();
+        for (started = 0; started < threads; started++) {
+            if (pthread_create(&threadIDs[started], NULL, BMBenchmarkLockWorkerMain, &workers[started]) != 0) break;
+        }
+        for (i = 0; i < started; i++) {
+            pthread_join(threadIDs[i], NULL);
+        }
+        double nanoseconds = (double)(BMBenchmarkNanoseconds() - start);
+        
+        for (i = 0; i < threads; i++) {
+            [workers[i].object release];
+        }
+        
+        NSString * statistics = @"";
+        if (scheme == BMBenchmarkLockStriped) {
+            BMScriptLockStatistics stats = BMScriptGetLockStatistics();
+            statistics = [NSString stringWithFormat:@"  (%llu acquisitions, %llu contended, %.1f ms waiting)",
+                          (unsigned long long)stats.acquisitions, (unsigned long long)stats.contentions, stats.waitNanoseconds / 1e6];
+        }
+        NSLog(@"Locking with %@: %lu threads x %lu = %8.1f ns per lock%@", labels[scheme], (unsigned long)started, 
+              (unsigned long)iterations, nanoseconds / (started * iterations ? started * iterations : 1), statistics);
+    }
+    
+endnow:
+    free(threadIDs);
+    free(workers);
+}
+
+// MARK: All
+
+void BMScriptRunBenchmarks(void) {
+    BMScriptBenchmarkSpawnLatency(200, 0);
+    BMScriptBenchmarkSpawnLatency(200, 512);
+    BMScriptBenchmarkBlockingExecution(200);
+    BMScriptBenchmarkQueueThroughput(2000);
+    BMScriptBenchmarkUnicodeEscaping(4);
+    BMScriptBenchmarkLocking(8, 1000000);
+}
+
+/// @endcond
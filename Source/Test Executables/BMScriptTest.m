@@ -25,6 +25,7 @@
 #import "BMScript.h"
 #import "BMRubyScript.h"
 #import "ScriptRunner.h"
+#import "BMScriptBenchmarks.h"
 
 #include <unistd.h>
 #include <sys/param.h>
@@ -556,6 +557,14 @@ int main (int argc, const char * argv[]) {
     NSLog(@"Shell low complexity script result = %@", [shLCScriptResult contentsAsString]);
     NSLog(@"Shell low complexity script retval = %d", shLCScriptRetVal);
     
+    NSLog(@"----------------------------------------------------------------------------------------");
+    // ---------------------------------------------------------------------------------------- 
+    
+    if (getenv("BMSCRIPT_RUN_BENCHMARKS")) {
+        NSLog(@"Run benchmarks");
+        BMScriptRunBenchmarks();
+    }
+    
         
     [sr1 release], sr1 = nil;
     [sr2 release], sr2 = nil;
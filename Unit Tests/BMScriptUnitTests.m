@@ -15,6 +15,18 @@
 
 #import <SenTestingKit/SenTestingKit.h>
 #import "BMScript.h"
+#import "BMScriptTask.h"
+#import "BMScriptEngine.h"
+#import "BMScriptOutputBuffer.h"
+#import "BMScriptWorkerPool.h"
+#import "BMScriptQueue.h"
+#import "BMScriptTemplate.h"
+#import "BMScriptLibrary.h"
+#import "BMScriptResultCache.h"
+#import "BMScriptResultStore.h"
+#import "BMScriptHistory.h"
+#import "BMScriptHistoryLog.h"
+#import "BMScriptLock.h"
 #import "BMRubyScript.h"    /* needed for testing isDescendantOfClass */
 
 #ifdef PATHFOR
@@ -25,7 +37,7 @@
 
 #define HELLIPSIS "\u2026"
 
-@interface BMScriptUnitTests : SenTestCase {
+@interface BMScriptUnitTests : SenTestCase <BMScriptQueueDelegateProtocol, BMScriptOutputHandler> {
     NSDictionary * rubyDefaultOptions;
     NSDictionary * alternativeOptions;    
     
@@ -40,7 +52,36 @@
     NSString * testString2;
     
     NSString * bgResults;
+    NSUInteger bgErrorResultsLength;
     ExecutionStatus bgStatus;
+    
+    NSUInteger queueItemCount;
+    NSUInteger queueFinishedCount;
+    NSUInteger queueFailedCount;
+    
+    NSMutableData * streamedOutput;
+    NSUInteger streamedLengthAtCompletion;
+    NSUInteger streamedChunkCount;
+}
+
+@end
+
+/* a history result that counts its deallocations */
+static NSUInteger BMScriptHistoryTracerDeallocs = 0;
+
+@interface BMScriptHistoryTracer : NSObject <NSCopying>
+@end
+
+@implementation BMScriptHistoryTracer
+
+- (id) copyWithZone:(NSZone *)zone {
+    #pragma unused(zone)
+    return [self retain];
+}
+
+- (void) dealloc {
+    BMScriptHistoryTracerDeallocs++;
+    [super dealloc];
 }
 
 @end
@@ -357,8 +398,8 @@
     
     STAssertEqualObjects([script1 history], [script2 history], @"");
     
-    STAssertTrue([[script1 history] isKindOfClass:[NSMutableArray class]], @"but is '%@'", NSStringFromClass([[script1 history] class]));
-    STAssertTrue([[script2 history] isKindOfClass:[NSMutableArray class]], @"but is '%@'", NSStringFromClass([[script2 history] class]));
+    STAssertTrue([[script1 history] isKindOfClass:[NSArray class]], @"but is '%@'", NSStringFromClass([[script1 history] class]));
+    STAssertTrue([[script2 history] isKindOfClass:[NSArray class]], @"but is '%@'", NSStringFromClass([[script2 history] class]));
     
 }
 
@@ -494,6 +535,1129 @@
     
 }
 
+- (void) testScriptTask {
+    
+    BMScriptTask * task = [[BMScriptTask alloc] init];
+    NSPipe * pipe = [NSPipe pipe];
+    
+    [task setLaunchPath:@"/bin/sh"];
+    [task setArguments:[NSArray arrayWithObjects:@"-c", @"printf 'out'; printf 'err' >&2; exit 3", nil]];
+    [task setStandardOutput:pipe];
+    [task setStandardError:pipe];
+    [task launch];
+    
+    NSString * output = [[[pipe fileHandleForReading] readDataToEndOfFile] contentsAsString];
+    [task waitUntilExit];
+    
+    STAssertFalse([task isRunning], @"task should not be running after waitUntilExit");
+    STAssertTrue([task terminationStatus] == 3, @"but is %d", [task terminationStatus]);
+    STAssertTrue([output isEqualToString:@"outerr"], @"but is '%@'", output);
+    STAssertThrowsSpecificNamed([task launch], NSException, NSInvalidArgumentException, @"relaunching a task should throw");
+    
+    [task release], task = nil;
+    
+    NSError * error = nil;
+    BMScriptTask * badTask = [[BMScriptTask alloc] init];
+    [badTask setLaunchPath:@"/this/path/does/not/exist"];
+    
+    STAssertFalse([badTask launchAndReturnError:&error], @"launching a non-existing executable should fail");
+    STAssertTrue([error code] == ENOENT, @"but error is %@", error);
+    STAssertFalse([badTask isRunning], @"");
+    
+    [badTask release], badTask = nil;
+    
+    BMScript * script = [BMScript shellScriptWithSource:@"exit 7"];
+    [script execute];
+    
+    STAssertTrue([script lastReturnValue] == 7, @"but is %d", [script lastReturnValue]);
+}
+
+- (void) cancelScriptAfterDelay:(BMScript *)script {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    [NSThread sleepForTimeInterval:0.5];
+    [script cancel];
+    [pool drain];
+}
+
+- (void) testTimeLimitAndCancel {
+    
+    NSError * error = nil;
+    NSDate * start = [NSDate date];
+    
+    // the background sleep keeps the pipe open and must be killed along with the shell
+    BMScript * script1 = [BMScript shellScriptWithSource:@"echo started; sleep 30 & sleep 30"];
+    ExecutionStatus status = [script1 executeAndReturnResult:nil error:&error timeLimit:0.5];
+    NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+    
+    STAssertTrue(status == BMScriptTimedOut, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertNotNil(error, @"a timed out execution should return an error");
+    STAssertTrue(elapsed < 5.0, @"but took %f seconds", elapsed);
+    STAssertTrue([[[script1 lastResult] contentsAsString] isEqualToString:@"started\n"], @"but is '%@'", [[script1 lastResult] contentsAsString]);
+    
+    BMScript * script2 = [BMScript shellScriptWithSource:@"sleep 30"];
+    script2.timeLimit = 0;
+    [NSThread detachNewThreadSelector:@selector(cancelScriptAfterDelay:) toTarget:self withObject:script2];
+    
+    start = [NSDate date];
+    status = [script2 execute];
+    elapsed = -[start timeIntervalSinceNow];
+    
+    STAssertTrue(status == BMScriptCancelled, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(elapsed < 5.0, @"but took %f seconds", elapsed);
+    STAssertTrue([[script2 history] count] == 0, @"cancelled executions should not be added to the history");
+}
+
+- (void) testTimeLimitAndCancelWhileWriting {
+    
+    // output arrives before every poll timeout, the time limit must hold all the same
+    BMScript * script1 = [BMScript shellScriptWithSource:@"while :; do echo tick; echo tock >&2; done"];
+    script1.capturesStandardErrorSeparately = YES;
+    script1.retainsOutput = NO;
+    NSDate * start = [NSDate date];
+    ExecutionStatus status = [script1 executeAndReturnResult:nil error:nil timeLimit:0.5];
+    NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+    
+    STAssertTrue(status == BMScriptTimedOut, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(elapsed < 5.0, @"but took %f seconds", elapsed);
+    
+    // ignores SIGINT and keeps writing, so the cancel has to escalate
+    BMScript * script2 = [BMScript shellScriptWithSource:@"trap '' INT; while :; do echo tick; done"];
+    script2.retainsOutput = NO;
+    script2.timeLimit = 0;
+    [NSThread detachNewThreadSelector:@selector(cancelScriptAfterDelay:) toTarget:self withObject:script2];
+    
+    start = [NSDate date];
+    status = [script2 execute];
+    elapsed = -[start timeIntervalSinceNow];
+    
+    STAssertTrue(status == BMScriptCancelled, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(elapsed < 5.0 + 2 * BMSCRIPT_TERMINATION_GRACE_PERIOD, @"but took %f seconds", elapsed);
+}
+
+- (void) testWorkerPool {
+    
+    // $$ is the pid of the worker's shell, not of the subshell running the job
+    BMScript * script1 = [BMScript shellScriptWithSource:@"echo $$"];
+    script1.usesWorkerPool = YES;
+    
+    ExecutionStatus status = [script1 execute];
+    NSString * firstWorker = [[script1 lastResult] contentsAsString];
+    [script1 execute];
+    NSString * secondWorker = [[script1 lastResult] contentsAsString];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([firstWorker isEqualToString:secondWorker], @"both jobs should have run on the same worker, but got '%@' and '%@'", firstWorker, secondWorker);
+    STAssertTrue([[script1 history] count] == 2, @"but is %d", [[script1 history] count]);
+    
+    BMScriptWorkerPool * shellPool = [BMScriptWorkerPool poolForOptions:script1.options];
+    STAssertNotNil(shellPool, @"");
+    STAssertTrue(shellPool == [BMScriptWorkerPool poolForOptions:[[BMScript shellScriptWithSource:@""] options]], @"scripts with the same options should share a pool");
+    
+    shellPool.maxJobsPerWorker = 1;
+    [script1 execute];
+    firstWorker = [[script1 lastResult] contentsAsString];
+    [script1 execute];
+    secondWorker = [[script1 lastResult] contentsAsString];
+    shellPool.maxJobsPerWorker = BMSCRIPT_WORKER_MAX_JOBS;
+    
+    STAssertFalse([firstWorker isEqualToString:secondWorker], @"workers should be recycled after maxJobsPerWorker jobs");
+    
+    BMScript * script2 = [BMScript shellScriptWithSource:@"echo failing; exit 3"];
+    script2.usesWorkerPool = YES;
+    status = [script2 execute];
+    
+    STAssertTrue(status == 3, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([script2 lastReturnValue] == 3, @"but is %d", [script2 lastReturnValue]);
+    STAssertTrue([[[script2 lastResult] contentsAsString] isEqualToString:@"failing\n"], @"but is '%@'", [[script2 lastResult] contentsAsString]);
+    
+    BMScript * script3 = [BMScript shellScriptWithSource:@"sleep 30"];
+    script3.usesWorkerPool = YES;
+    NSDate * start = [NSDate date];
+    status = [script3 executeAndReturnResult:nil error:nil timeLimit:0.5];
+    
+    STAssertTrue(status == BMScriptTimedOut, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(-[start timeIntervalSinceNow] < 5.0, @"but took %f seconds", -[start timeIntervalSinceNow]);
+    
+    BMScript * script4 = [BMScript pythonScriptWithSource:@"import sys\nprint('pooled')\nsys.exit(2)"];
+    script4.usesWorkerPool = YES;
+    status = [script4 execute];
+    
+    STAssertTrue([script4 lastReturnValue] == 2, @"but is %d", [script4 lastReturnValue]);
+    STAssertTrue([[[script4 lastResult] contentsAsString] isEqualToString:@"pooled\n"], @"but is '%@'", [[script4 lastResult] contentsAsString]);
+    
+    // a worker can't keep stderr apart, so this one runs in a process of its own
+    BMScript * script5 = [BMScript shellScriptWithSource:@"printf out; printf err >&2"];
+    script5.usesWorkerPool = YES;
+    script5.capturesStandardErrorSeparately = YES;
+    status = [script5 execute];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([[[script5 lastResult] contentsAsString] isEqualToString:@"out"], @"but is '%@'", [[script5 lastResult] contentsAsString]);
+    STAssertTrue([[[script5 lastErrorResult] contentsAsString] isEqualToString:@"err"], @"but is '%@'", [[script5 lastErrorResult] contentsAsString]);
+}
+
+- (void) scriptQueue:(BMScriptQueue *)queue didFinishScript:(BMScript *)script withStatus:(ExecutionStatus)status {
+    @synchronized(self) {
+        queueItemCount++;
+    }
+}
+
+- (void) scriptQueueDidFinish:(BMScriptQueue *)queue finishedCount:(NSUInteger)finishedCount failedCount:(NSUInteger)failedCount {
+    @synchronized(self) {
+        queueFinishedCount += finishedCount;
+        queueFailedCount += failedCount;
+    }
+}
+
+- (void) testScriptQueue {
+    
+    NSMutableArray * scripts = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 16; i++) {
+        [scripts addObject:[BMScript shellScriptWithSource:[NSString stringWithFormat:@"echo %lu; exit %d", (unsigned long)i, (i % 4 == 0)]]];
+    }
+    
+    BMScriptQueue * queue = [BMScriptQueue queue];
+    STAssertTrue(queue.maxConcurrentScripts == [[NSProcessInfo processInfo] activeProcessorCount], @"but is %lu", (unsigned long)queue.maxConcurrentScripts);
+    
+    queueItemCount = queueFinishedCount = queueFailedCount = 0;
+    queue.maxConcurrentScripts = 3;
+    queue.delegate = self;
+    [queue addScripts:scripts];
+    [queue waitUntilAllScriptsAreFinished];
+    
+    STAssertTrue([queue scriptCount] == 0, @"but is %lu", (unsigned long)[queue scriptCount]);
+    STAssertTrue(queueItemCount == 16, @"but is %lu", (unsigned long)queueItemCount);
+    STAssertTrue(queueFinishedCount == 16, @"but is %lu", (unsigned long)queueFinishedCount);
+    STAssertTrue(queueFailedCount == 4, @"but is %lu", (unsigned long)queueFailedCount);
+    
+    for (NSUInteger i = 0; i < 16; i++) {
+        BMScript * script = [scripts objectAtIndex:i];
+        NSString * expected = [NSString stringWithFormat:@"%lu\n", (unsigned long)i];
+        STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:expected], @"but is '%@'", [[script lastResult] contentsAsString]);
+        STAssertTrue([script lastReturnValue] == (i % 4 == 0), @"but is %d", [script lastReturnValue]);
+    }
+    
+    // the queue is reusable and reports each batch separately. cancelling right away catches the scripts 
+    // still pending, or taken by a worker but not yet launched, which must not run either.
+    queueFinishedCount = 0;
+    BMScript * sleeper1 = [BMScript shellScriptWithSource:@"sleep 30"];
+    BMScript * sleeper2 = [BMScript shellScriptWithSource:@"sleep 30"];
+    [queue addScript:sleeper1];
+    [queue addScript:sleeper2];
+    
+    NSDate * start = [NSDate date];
+    [queue cancelAllScripts];
+    [queue waitUntilAllScriptsAreFinished];
+    
+    STAssertTrue(-[start timeIntervalSinceNow] < 5.0, @"but took %f seconds", -[start timeIntervalSinceNow]);
+    STAssertTrue(queueFinishedCount <= 2, @"but is %lu", (unsigned long)queueFinishedCount);
+    STAssertTrue([[sleeper1 history] count] == 0 && [[sleeper2 history] count] == 0, @"cancelled scripts should not have finished");
+}
+
+- (void) backgroundTaskDidEnd:(NSNotification *)aNotification {
+    @synchronized(self) {
+        [bgResults release];
+        bgResults = [[[[aNotification userInfo] objectForKey:BMScriptNotificationTaskResults] contentsAsString] copy];
+        bgStatus = [[[aNotification userInfo] objectForKey:BMScriptNotificationExecutionStatus] integerValue];
+        bgErrorResultsLength = [[[aNotification userInfo] objectForKey:BMScriptNotificationTaskErrorResults] length];
+        streamedLengthAtCompletion = [streamedOutput length];
+    }
+}
+
+/* sleeps instead of spinning a run loop: the engine makes progress on its own */
+- (ExecutionStatus) waitForBackgroundStatus {
+    NSDate * timeout = [NSDate dateWithTimeIntervalSinceNow:10.0];
+    ExecutionStatus status = BMScriptNotExecuted;
+    while (status == BMScriptNotExecuted && [timeout timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+        @synchronized(self) {
+            status = bgStatus;
+        }
+    }
+    @synchronized(self) {
+        bgStatus = BMScriptNotExecuted;
+    }
+    return status;
+}
+
+- (void) testBackgroundEngine {
+    
+    BMScript * script = [BMScript shellScriptWithSource:@"echo engine"];
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(backgroundTaskDidEnd:) name:BMScriptTaskDidEndNotification object:nil];
+    bgStatus = BMScriptNotExecuted;
+    
+    // delivered on the engine's I/O thread
+    [script executeInBackgroundAndNotifyOnThread:nil timeLimit:0];
+    ExecutionStatus status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([bgResults isEqualToString:@"engine\n"], @"but is '%@'", bgResults);
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"engine\n"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    STAssertTrue([[script history] count] == 1, @"but is %lu", (unsigned long)[[script history] count]);
+    
+    // delivered on an operation queue
+    NSOperationQueue * queue = [[[NSOperationQueue alloc] init] autorelease];
+    script.source = @"echo queue; exit 3";
+    [script executeInBackgroundAndNotifyOnQueue:queue timeLimit:0];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == 3, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([script lastReturnValue] == 3, @"but is %d", [script lastReturnValue]);
+    STAssertTrue([bgResults isEqualToString:@"queue\n"], @"but is '%@'", bgResults);
+    
+    // a grandchild holding on to the output pipe doesn't keep the script from finishing
+    NSDate * start = [NSDate date];
+    script.source = @"sleep 30 & echo detached";
+    [script executeInBackgroundAndNotifyOnThread:nil timeLimit:0];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(-[start timeIntervalSinceNow] < 5.0, @"but took %f seconds", -[start timeIntervalSinceNow]);
+    
+    // time limits and cancel are enforced by the engine, no run loop needed
+    start = [NSDate date];
+    script.source = @"sleep 30";
+    [script executeInBackgroundAndNotifyOnThread:nil timeLimit:0.5];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptTimedOut, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(-[start timeIntervalSinceNow] < 5.0, @"but took %f seconds", -[start timeIntervalSinceNow]);
+    
+    start = [NSDate date];
+    [script executeInBackgroundAndNotifyOnQueue:queue timeLimit:0];
+    [NSThread sleepForTimeInterval:0.2];
+    [script cancel];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptCancelled, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue(-[start timeIntervalSinceNow] < 5.0, @"but took %f seconds", -[start timeIntervalSinceNow]);
+    STAssertTrue([[BMScriptEngine sharedEngine] taskCount] == 0, @"but is %lu", (unsigned long)[[BMScriptEngine sharedEngine] taskCount]);
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:BMScriptTaskDidEndNotification object:nil];
+}
+
+- (void) script:(BMScript *)script didReceiveOutput:(NSData *)chunk {
+    @synchronized(self) {
+        [streamedOutput appendData:chunk];
+        streamedChunkCount++;
+    }
+    // a slow consumer
+    if ([script outputHighWaterMark] < BMSCRIPT_OUTPUT_HIGH_WATER_MARK) {
+        [NSThread sleepForTimeInterval:0.001];
+    }
+}
+
+- (void) testOutputHandler {
+    
+    streamedOutput = [[NSMutableData alloc] init];
+    
+    // blocking: chunks arrive on the calling thread, nothing is retained
+    BMScript * script = [BMScript shellScriptWithSource:@"printf abc; sleep 0.1; printf def"];
+    script.outputHandler = self;
+    script.retainsOutput = NO;
+    ExecutionStatus status = [script execute];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([[streamedOutput contentsAsString] isEqualToString:@"abcdef"], @"but is '%@'", [streamedOutput contentsAsString]);
+    STAssertTrue([[script lastResult] length] == 0, @"but is %lu", (unsigned long)[[script lastResult] length]);
+    
+    // a worker only hands the output back at the end, so a script with a handler streams from a process of its own
+    [streamedOutput setLength:0];
+    streamedChunkCount = 0;
+    script.usesWorkerPool = YES;
+    status = [script execute];
+    script.usesWorkerPool = NO;
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([[streamedOutput contentsAsString] isEqualToString:@"abcdef"], @"but is '%@'", [streamedOutput contentsAsString]);
+    STAssertTrue(streamedChunkCount >= 2, @"but is %lu", (unsigned long)streamedChunkCount);
+    
+    // background: 4 MiB through a consumer much slower than the script, with a 64 KiB high water mark
+    [streamedOutput setLength:0];
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(backgroundTaskDidEnd:) name:BMScriptTaskDidEndNotification object:script];
+    bgStatus = BMScriptNotExecuted;
+    
+    NSOperationQueue * queue = [[[NSOperationQueue alloc] init] autorelease];
+    script.source = @"head -c 4194304 /dev/zero";
+    script.outputHighWaterMark = 65536;
+    [script executeInBackgroundAndNotifyOnQueue:queue timeLimit:60];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([streamedOutput length] == 4194304, @"but is %lu", (unsigned long)[streamedOutput length]);
+    // all chunks are delivered before the completion
+    STAssertTrue(streamedLengthAtCompletion == 4194304, @"but is %lu", (unsigned long)streamedLengthAtCompletion);
+    STAssertTrue([[script lastResult] length] == 0, @"but is %lu", (unsigned long)[[script lastResult] length]);
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:BMScriptTaskDidEndNotification object:script];
+    [streamedOutput release], streamedOutput = nil;
+}
+
+- (void) testOutputAfterPausedExit {
+    
+    // every 64 KiB read fills the 4 KiB high water mark, so the script writes its last chunk 
+    // into the pipe and exits while reading is paused. that chunk must still arrive.
+    streamedOutput = [[NSMutableData alloc] init];
+    BMScript * script = [BMScript shellScriptWithSource:@"head -c 524288 /dev/zero; exit 0"];
+    script.outputHandler = self;
+    script.retainsOutput = NO;
+    script.outputHighWaterMark = 4096;
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(backgroundTaskDidEnd:) name:BMScriptTaskDidEndNotification object:script];
+    bgStatus = BMScriptNotExecuted;
+    [script executeInBackgroundAndNotifyOnQueue:[[[NSOperationQueue alloc] init] autorelease] timeLimit:60];
+    ExecutionStatus status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([streamedOutput length] == 524288, @"but is %lu", (unsigned long)[streamedOutput length]);
+    STAssertTrue(streamedLengthAtCompletion == 524288, @"but is %lu", (unsigned long)streamedLengthAtCompletion);
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:BMScriptTaskDidEndNotification object:script];
+    [streamedOutput release], streamedOutput = nil;
+}
+
+- (void) testOutputSpilling {
+    
+    // the buffer itself: stays in memory up to the threshold, then moves to a file
+    BMScriptOutputBuffer * buffer = [[[BMScriptOutputBuffer alloc] initWithSpillThreshold:8] autorelease];
+    [buffer appendBytes:"abcd" length:4];
+    STAssertFalse([buffer isSpilled], @"");
+    [buffer appendData:[@"efghij" dataUsingEncoding:NSUTF8StringEncoding]];
+    STAssertTrue([buffer isSpilled], @"");
+    STAssertTrue([buffer length] == 10, @"but is %llu", [buffer length]);
+    NSData * mapped = [buffer data];
+    [buffer appendBytes:"k" length:1];
+    STAssertTrue([[mapped contentsAsString] isEqualToString:@"abcdefghij"], @"but is '%@'", [mapped contentsAsString]);
+    STAssertTrue([[[buffer data] contentsAsString] isEqualToString:@"abcdefghijk"], @"but is '%@'", [[buffer data] contentsAsString]);
+    
+    // blocking and background executions with a small threshold
+    BMScript * script = [BMScript shellScriptWithSource:@"head -c 1048576 /dev/zero; printf end"];
+    script.outputSpillThreshold = 4096;
+    ExecutionStatus status = [script execute];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    NSData * result = [script lastResult];
+    STAssertTrue([result length] == 1048579, @"but is %lu", (unsigned long)[result length]);
+    STAssertTrue(memcmp((const char *)[result bytes] + 1048576, "end", 3) == 0, @"");
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(backgroundTaskDidEnd:) name:BMScriptTaskDidEndNotification object:script];
+    bgStatus = BMScriptNotExecuted;
+    [script executeInBackgroundAndNotifyOnQueue:[[[NSOperationQueue alloc] init] autorelease] timeLimit:60];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([[script lastResult] isEqualToData:result], @"but is %lu bytes", (unsigned long)[[script lastResult] length]);
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:BMScriptTaskDidEndNotification object:script];
+}
+
+- (void) testOutputRetention {
+    
+    // a ring that wraps several times, in chunks of varying size, spilled to a file half way
+    BMScriptOutputBuffer * buffer = [[[BMScriptOutputBuffer alloc] initWithSpillThreshold:12 
+                                                                          retentionPolicy:BMScriptRetainOutputHeadAndTail 
+                                                                                    limit:16] autorelease];
+    const char * alphabet = "abcdefghijklmnopqrstuvwxyz";
+    [buffer appendBytes:alphabet length:3];
+    [buffer appendBytes:(alphabet + 3) length:11];
+    [buffer appendBytes:(alphabet + 14) length:5];
+    [buffer appendBytes:(alphabet + 19) length:7];
+    STAssertTrue([buffer isSpilled], @"");
+    STAssertTrue([buffer length] == 16, @"but is %llu", [buffer length]);
+    STAssertTrue([buffer discardedLength] == 10, @"but is %llu", [buffer discardedLength]);
+    STAssertTrue([[[buffer data] contentsAsString] isEqualToString:@"abcdefghstuvwxyz"], @"but is '%@'", [[buffer data] contentsAsString]);
+    
+    BMScript * script = [BMScript shellScriptWithSource:@"printf 0123456789; printf abcdefghij"];
+    script.outputRetentionLimit = 8;
+    
+    script.outputRetentionPolicy = BMScriptRetainOutputHead;
+    [script execute];
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"01234567"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    STAssertTrue([script discardedOutputLength] == 12, @"but is %llu", [script discardedOutputLength]);
+    
+    script.outputRetentionPolicy = BMScriptRetainOutputTail;
+    [script execute];
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"cdefghij"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    
+    script.outputRetentionPolicy = BMScriptRetainOutputHeadAndTail;
+    [script execute];
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"0123ghij"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    
+    // the background path enforces it in -appendPartialData: and still drains everything
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(backgroundTaskDidEnd:) name:BMScriptTaskDidEndNotification object:script];
+    bgStatus = BMScriptNotExecuted;
+    script.source = @"head -c 4194304 /dev/zero; printf end";
+    script.outputRetentionPolicy = BMScriptRetainOutputTail;
+    script.outputRetentionLimit = 3;
+    [script executeInBackgroundAndNotifyOnQueue:[[[NSOperationQueue alloc] init] autorelease] timeLimit:60];
+    ExecutionStatus status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"end"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    STAssertTrue([script discardedOutputLength] == 4194304, @"but is %llu", [script discardedOutputLength]);
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:BMScriptTaskDidEndNotification object:script];
+}
+
+- (void) testSeparateErrorOutput {
+    
+    // more stderr than a pipe holds while stdout stays open: reading only one of them would deadlock
+    BMScript * script = [BMScript shellScriptWithSource:@"printf out; head -c 1048576 /dev/zero >&2; printf err >&2; printf put"];
+    script.capturesStandardErrorSeparately = YES;
+    ExecutionStatus status = [script execute];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"output"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    STAssertTrue([[script lastErrorResult] length] == 1048579, @"but is %lu", (unsigned long)[[script lastErrorResult] length]);
+    STAssertTrue([[script lastErrorResultFromHistory] isEqualToData:[script lastErrorResult]], @"");
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(backgroundTaskDidEnd:) name:BMScriptTaskDidEndNotification object:script];
+    bgStatus = BMScriptNotExecuted;
+    [script executeInBackgroundAndNotifyOnQueue:[[[NSOperationQueue alloc] init] autorelease] timeLimit:60];
+    status = [self waitForBackgroundStatus];
+    
+    STAssertTrue(status == BMScriptFinishedSuccessfully, @"but is %@", BMNSStringFromExecutionStatus(status));
+    STAssertTrue([bgResults isEqualToString:@"output"], @"but is '%@'", bgResults);
+    STAssertTrue(bgErrorResultsLength == 1048579, @"but is %lu", (unsigned long)bgErrorResultsLength);
+    STAssertTrue(memcmp((const char *)[[script lastErrorResult] bytes] + 1048576, "err", 3) == 0, @"");
+    
+    [[NSNotificationCenter defaultCenter] removeObserver:self name:BMScriptTaskDidEndNotification object:script];
+    
+    // merged as before unless asked for
+    script.capturesStandardErrorSeparately = NO;
+    script.source = @"printf out; printf err >&2";
+    [script execute];
+    STAssertTrue([[script lastErrorResult] length] == 0, @"but is %lu", (unsigned long)[[script lastErrorResult] length]);
+}
+
+- (void) testSourceDelivery {
+    
+    // larger than a pipe holds and than Linux accepts as a single argument
+    NSMutableString * src = [NSMutableString stringWithString:@"printf start\n"];
+    while ([src length] < 256 * 1024) {
+        [src appendString:@"# padding padding padding padding padding padding padding padding padding\n"];
+    }
+    [src appendString:@"printf done\n"];
+    
+    // argument delivery falls back to stdin for a source this large
+    BMScript * script = [BMScript shellScriptWithSource:src];
+    NSArray * modes = [NSArray arrayWithObjects:BMScriptSourceDeliveryArgument, BMScriptSourceDeliveryStandardInput, BMScriptSourceDeliveryFileDescriptor, nil];
+    for (NSString * mode in modes) {
+        script.options = [script.options dictionaryByAddingObject:mode forKey:BMScriptOptionsSourceDeliveryKey];
+        ExecutionStatus status = [script execute];
+        STAssertTrue(status == BMScriptFinishedSuccessfully, @"%@: but is %@", mode, BMNSStringFromExecutionStatus(status));
+        STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"startdone"], @"%@: but is '%@'", mode, [[script lastResult] contentsAsString]);
+    }
+    
+    // with the source on descriptor 3 stdin is left to the script
+    script.source = @"cat; printf done";
+    [script execute];
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"done"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    
+    // the script exits before reading all of its source: no SIGPIPE for us
+    [src insertString:@"exit 0\n" atIndex:0];
+    script.source = src;
+    STAssertTrue([script execute] == BMScriptFinishedSuccessfully, @"");
+}
+
+- (void) testCompiledTemplates {
+    
+    BMScriptTemplate * tmpl = [BMScriptTemplate templateWithString:@"<#a#> and <##>, <#b#> <#a#> 100%% <##> <#open"];
+    
+    STAssertTrue([[tmpl keys] isEqualToArray:[NSArray arrayWithObjects:@"a", @"b", nil]], @"but is %@", [tmpl keys]);
+    STAssertTrue([tmpl positionalTokenCount] == 2, @"but is %lu", (unsigned long)[tmpl positionalTokenCount]);
+    
+    NSString * rendered = [tmpl stringByRenderingWithArguments:[NSArray arrayWithObjects:@"x", @"y", nil]];
+    STAssertTrue([rendered isEqualToString:@"<#a#> and x, <#b#> <#a#> 100%% y <#open"], @"but is '%@'", rendered);
+    rendered = [tmpl stringByRenderingWithArgument:@"z"];
+    STAssertTrue([rendered isEqualToString:@"<#a#> and z, <#b#> <#a#> 100%% z <#open"], @"but is '%@'", rendered);
+    
+    NSDictionary * values = [NSDictionary dictionaryWithObjectsAndKeys:@"A", @"a", [NSNumber numberWithInt:2], @"b", nil];
+    rendered = [tmpl stringByRenderingWithDictionary:values unescapingPercentSigns:YES];
+    STAssertTrue([rendered isEqualToString:@"A and <##>, 2 A 100% <##> <#open"], @"but is '%@'", rendered);
+    
+    STAssertThrowsSpecificNamed([tmpl stringByRenderingWithArguments:[NSArray arrayWithObject:@"x"]], NSException, BMScriptTemplateArgumentMissingException, @"", nil);
+    
+    // custom delimiters, and a start delimiter inside a token
+    tmpl = [BMScriptTemplate templateWithString:@"{{ {{name}}!" tokenStart:@"{{" tokenEnd:@"}}"];
+    rendered = [tmpl stringByRenderingWithDictionary:[NSDictionary dictionaryWithObject:@"you" forKey:@"name"] unescapingPercentSigns:NO];
+    STAssertTrue([rendered isEqualToString:@"{{ you!"], @"but is '%@'", rendered);
+    
+    // saturating a script leaves its template intact, so it can be saturated again
+    BMScript * script = [BMScript scriptWithTemplate:[BMScriptTemplate templateWithString:@"<##>-<##>"] options:BMSynthesizeOptions(@"/bin/echo", @"-n")];
+    STAssertThrowsSpecificNamed([script execute], NSException, BMScriptTemplateArgumentMissingException, @"", nil);
+    NSUInteger i;
+    for (i = 0; i < 3; i++) {
+        NSString * n = [NSString stringWithFormat:@"%lu", (unsigned long)i];
+        STAssertTrue([script saturateTemplateWithArguments:n, @"x"], @"");
+        [script execute];
+        STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:[n stringByAppendingString:@"-x"]], @"but is '%@'", [[script lastResult] contentsAsString]);
+    }
+    STAssertTrue([[[script scriptTemplate] string] isEqualToString:@"<##>-<##>"], @"but is '%@'", [[script scriptTemplate] string]);
+    
+    // a plain script has no template to saturate
+    script = [BMScript scriptWithSource:@"<##>" options:BMSynthesizeOptions(@"/bin/echo", @"-n")];
+    STAssertFalse([script saturateTemplateWithArgument:@"x"], @"not a template");
+}
+
+- (void) testParameterSweep {
+    
+    BMScript * templateScript = [[[BMScript alloc] initWithTemplateSource:@"echo <#n#>; exit <#code#>" options:BMSynthesizeOptions(@"/bin/sh", @"-c")] autorelease];
+    
+    NSMutableArray * rows = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 40; i++) {
+        [rows addObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:i], @"n", 
+                                                                   [NSNumber numberWithInt:(i % 10 == 0)], @"code", nil]];
+    }
+    
+    BMScriptQueue * queue = [BMScriptQueue queue];
+    queue.maxConcurrentScripts = 4;
+    NSArray * results = [queue executeTemplateScript:templateScript withValues:rows];
+    
+    STAssertTrue([results count] == 40, @"but is %lu", (unsigned long)[results count]);
+    for (NSUInteger i = 0; i < 40; i++) {
+        NSDictionary * row = [results objectAtIndex:i];
+        NSString * expected = [NSString stringWithFormat:@"%lu\n", (unsigned long)i];
+        NSString * output = [[row objectForKey:BMScriptNotificationTaskResults] contentsAsString];
+        ExecutionStatus status = [[row objectForKey:BMScriptNotificationExecutionStatus] integerValue];
+        STAssertTrue([output isEqualToString:expected], @"row %lu: but is '%@'", (unsigned long)i, output);
+        STAssertTrue([[row objectForKey:BMScriptNotificationTaskReturnValue] integerValue] == (i % 10 == 0), @"row %lu", (unsigned long)i);
+        STAssertTrue((status == BMScriptFinishedSuccessfully) == (i % 10 != 0), @"row %lu: but is %@", (unsigned long)i, BMNSStringFromExecutionStatus(status));
+    }
+    
+    // the template script itself is left alone
+    STAssertThrowsSpecificNamed([templateScript execute], NSException, BMScriptTemplateArgumentMissingException, @"", nil);
+    
+    // positional rows, one of them short of values
+    templateScript = [[[BMScript alloc] initWithTemplateSource:@"printf '%s-%s' <##> <##>" options:BMSynthesizeOptions(@"/bin/sh", @"-c")] autorelease];
+    rows = [NSArray arrayWithObjects:[NSArray arrayWithObjects:@"a", @"b", nil], [NSArray arrayWithObject:@"c"], nil];
+    results = [queue executeTemplateScript:templateScript withValues:rows];
+    
+    STAssertTrue([[[[results objectAtIndex:0] objectForKey:BMScriptNotificationTaskResults] contentsAsString] isEqualToString:@"a-b"], @"");
+    STAssertTrue([[[results objectAtIndex:1] objectForKey:BMScriptNotificationExecutionStatus] integerValue] == BMScriptFailedWithException, @"");
+    
+    STAssertThrowsSpecificNamed([queue executeTemplateScript:templateScript withValues:[NSArray arrayWithObject:@"x"]], 
+                                NSException, NSInvalidArgumentException, @"", nil);
+}
+
+- (void) testScriptLibrary {
+    
+    NSFileManager * fm = [NSFileManager defaultManager];
+    NSString * dir = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"BMScriptLibraryTest-%d", getpid()]];
+    [fm removeItemAtPath:dir error:NULL];
+    STAssertTrue([fm createDirectoryAtPath:[dir stringByAppendingPathComponent:@"sub"] withIntermediateDirectories:YES attributes:nil error:NULL], @"");
+    [@"printf hello" writeToFile:[dir stringByAppendingPathComponent:@"hello.sh"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    [@"printf '%s' <##>" writeToFile:[dir stringByAppendingPathComponent:@"sub/echo.sh"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    [@"hidden" writeToFile:[dir stringByAppendingPathComponent:@".hidden"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    
+    BMScriptLibrary * library = [BMScriptLibrary libraryWithDirectory:dir];
+    STAssertNotNil(library, @"");
+    STAssertTrue([[library names] isEqualToArray:[NSArray arrayWithObjects:@"hello.sh", @"sub/echo.sh", nil]], @"but is %@", [library names]);
+    
+    BMScript * script = [library scriptWithName:@"hello.sh" options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    [script execute];
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"hello"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    
+    // the template is compiled once and shared
+    BMScriptTemplate * tmpl = [library templateForName:@"sub/echo.sh"];
+    STAssertTrue([library templateForName:@"sub/echo.sh"] == tmpl, @"");
+    script = [library scriptWithTemplateName:@"sub/echo.sh" options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    [script saturateTemplateWithArgument:@"templated"];
+    [script execute];
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"templated"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    
+    STAssertNil([library sourceForName:@"../hello.sh"], @"");
+    STAssertNil([library sourceForName:@"missing.sh"], @"");
+    
+    // changes show up, be it through the watch or the check on lookup
+    [NSThread sleepForTimeInterval:0.05];   // a different modification time without a watch
+    [@"printf changed" writeToFile:[dir stringByAppendingPathComponent:@"hello.sh"] atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    [@"printf new" writeToFile:[dir stringByAppendingPathComponent:@"new.sh"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    [fm removeItemAtPath:[dir stringByAppendingPathComponent:@"sub"] error:NULL];
+    
+    NSDate * deadline = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (![[library sourceForName:@"hello.sh"] isEqualToString:@"printf changed"] && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    STAssertTrue([[library sourceForName:@"hello.sh"] isEqualToString:@"printf changed"], @"but is '%@'", [library sourceForName:@"hello.sh"]);
+    while (![library sourceForName:@"new.sh"] && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    STAssertTrue([[library sourceForName:@"new.sh"] isEqualToString:@"printf new"], @"but is '%@'", [library sourceForName:@"new.sh"]);
+    while ([library templateForName:@"sub/echo.sh"] && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    STAssertNil([library templateForName:@"sub/echo.sh"], @"");
+    
+    // without the directory there is nothing left to watch, lookups check the disk again
+    [fm removeItemAtPath:dir error:NULL];
+    while ([library isWatching] && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    STAssertFalse([library isWatching], @"%@", library);
+    STAssertNil([library sourceForName:@"hello.sh"], @"");
+}
+
+- (void) testResultCache {
+    
+    // every run leaves a mark in a file, so hits can be told from executions
+    NSString * marks = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"BMScriptResultCacheTest-%d", getpid()]];
+    [[NSFileManager defaultManager] removeItemAtPath:marks error:NULL];
+    NSString * src = [NSString stringWithFormat:@"printf x >> '%@'; printf cached", marks];
+    
+    BMScriptResultCache * cache = [[[BMScriptResultCache alloc] initWithByteBudget:4096] autorelease];
+    BMScript * script = [BMScript scriptWithSource:src options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    script.resultCache = cache;
+    
+    STAssertTrue([script execute] == BMScriptFinishedSuccessfully, @"");
+    STAssertTrue([script execute] == BMScriptFinishedSuccessfully, @"");
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"cached"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    STAssertTrue([script lastReturnValue] == 0, @"");
+    STAssertTrue([[script history] count] == 2, @"but is %lu", (unsigned long)[[script history] count]);
+    STAssertTrue([[NSData dataWithContentsOfFile:marks] length] == 1, @"");
+    STAssertTrue([cache hits] == 1 && [cache misses] == 1 && [cache count] == 1, @"%@", cache);
+    
+    // a different source or option set is a different fingerprint
+    BMScript * other = [BMScript scriptWithSource:src options:BMSynthesizeOptions(@"/bin/sh", @"-e", @"-c")];
+    STAssertFalse([[other fingerprint] isEqualToString:[script fingerprint]], @"");
+    STAssertTrue([[[[script copy] autorelease] fingerprint] isEqualToString:[script fingerprint]], @"");
+    STAssertTrue([BMScriptFingerprint(@"", nil, nil) length] == 64, @"");
+    
+    // stale results are handed out once more while a copy of the script refreshes them
+    cache.timeToLive = 0.05;
+    cache.staleWhileRevalidate = 60;
+    [NSThread sleepForTimeInterval:0.1];
+    STAssertTrue([script execute] == BMScriptFinishedSuccessfully, @"");
+    STAssertTrue([cache staleHits] == 1, @"%@", cache);
+    NSDate * deadline = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while ([[NSData dataWithContentsOfFile:marks] length] < 2 && [deadline timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    STAssertTrue([[NSData dataWithContentsOfFile:marks] length] == 2, @"");
+    
+    // least recently used results go first once the budget is exceeded
+    cache = [[[BMScriptResultCache alloc] initWithByteBudget:4096] autorelease];
+    NSData * kilobyte = [NSMutableData dataWithLength:1024];
+    NSUInteger i;
+    for (i = 0; i < 5; i++) {
+        [cache setResult:kilobyte errorResult:nil returnValue:0 executionStatus:BMScriptFinishedSuccessfully forFingerprint:[NSString stringWithFormat:@"%lu", (unsigned long)i]];
+        [cache resultForFingerprint:@"0" needsRevalidation:NULL];
+    }
+    STAssertTrue([cache totalBytes] <= 4096 && [cache evictions] == 2, @"%@", cache);
+    STAssertNotNil([cache resultForFingerprint:@"0" needsRevalidation:NULL], @"");
+    STAssertNil([cache resultForFingerprint:@"1" needsRevalidation:NULL], @"");
+    
+    [[NSFileManager defaultManager] removeItemAtPath:marks error:NULL];
+}
+
+- (void) testResultStore {
+    
+    NSFileManager * fm = [NSFileManager defaultManager];
+    NSString * dir = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"BMScriptResultStoreTest-%d", getpid()]];
+    NSString * marks = [dir stringByAppendingPathComponent:@"marks"];
+    NSString * input = [dir stringByAppendingPathComponent:@"input"];
+    [fm removeItemAtPath:dir error:NULL];
+    
+    BMScriptResultStore * store = [BMScriptResultStore storeWithDirectory:[dir stringByAppendingPathComponent:@"store"]];
+    STAssertNotNil(store, @"");
+    [@"one" writeToFile:input atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+    
+    NSString * src = [NSString stringWithFormat:@"printf x >> '%@'; cat '%@'", marks, input];
+    BMScript * script = [BMScript scriptWithSource:src options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    script.resultStore = store;
+    script.inputPaths = [NSArray arrayWithObject:input];
+    
+    STAssertTrue([script execute] == BMScriptFinishedSuccessfully, @"");
+    STAssertTrue([[[script lastResult] contentsAsString] isEqualToString:@"one"], @"but is '%@'", [[script lastResult] contentsAsString]);
+    STAssertTrue([store misses] == 1, @"%@", store);
+    
+    // another store on the same directory, as after a restart
+    BMScriptResultStore * reopened = [BMScriptResultStore storeWithDirectory:[dir stringByAppendingPathComponent:@"store"]];
+    BMScript * again = [BMScript scriptWithSource:src options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    again.resultStore = reopened;
+    again.inputPaths = [NSArray arrayWithObject:input];
+    STAssertTrue([again execute] == BMScriptFinishedSuccessfully, @"");
+    STAssertTrue([[[again lastResult] contentsAsString] isEqualToString:@"one"], @"but is '%@'", [[again lastResult] contentsAsString]);
+    STAssertTrue([[again history] count] == 1, @"");
+    STAssertTrue([reopened hits] == 1, @"%@", reopened);
+    STAssertTrue([[NSData dataWithContentsOfFile:marks] length] == 1, @"");
+    
+    // a changed input is a different fingerprint
+    NSString * before = [again fingerprint];
+    [@"two" writeToFile:input atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    STAssertFalse([[again fingerprint] isEqualToString:before], @"");
+    STAssertTrue([again execute] == BMScriptFinishedSuccessfully, @"");
+    STAssertTrue([[[again lastResult] contentsAsString] isEqualToString:@"two"], @"but is '%@'", [[again lastResult] contentsAsString]);
+    STAssertTrue([[NSData dataWithContentsOfFile:marks] length] == 2, @"");
+    
+    // exceeding the size limit evicts results down to 90% of it
+    NSData * kilobyte = [NSMutableData dataWithLength:1024];
+    store.sizeLimit = 4096;
+    NSUInteger i;
+    for (i = 0; i < 8; i++) {
+        STAssertTrue([store setResult:kilobyte errorResult:nil returnValue:0 executionStatus:BMScriptFinishedSuccessfully 
+                       forFingerprint:[NSString stringWithFormat:@"%064lx", (unsigned long)i]], @"");
+    }
+    STAssertTrue([store size] <= 4096, @"but is %llu", [store size]);
+    STAssertTrue([store evictions] > 0, @"%@", store);
+    STAssertNotNil([store resultForFingerprint:[NSString stringWithFormat:@"%064lx", (unsigned long)7]], @"");
+    STAssertNil([store resultForFingerprint:@"../../marks"], @"");
+    
+    [store removeAllResults];
+    STAssertTrue([store size] == 0, @"");
+    
+    [fm removeItemAtPath:dir error:NULL];
+}
+
+- (void) testHistoryLimits {
+    
+    BMScript * script = [BMScript scriptWithSource:@"printf same" options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    script.historyLimit = 3;
+    NSUInteger i;
+    for (i = 0; i < 5; i++) {
+        [script execute];
+    }
+    STAssertTrue([[script history] count] == 3, @"but is %lu", (unsigned long)[[script history] count]);
+    STAssertTrue([[[script lastResultFromHistory] contentsAsString] isEqualToString:@"same"], @"");
+    
+    // equal sources and results are stored once
+    BMScriptHistory * history = [[[BMScriptHistory alloc] initWithLimit:0 byteLimit:0] autorelease];
+    NSData * big = [NSMutableData dataWithLength:100000];
+    [history addItem:[NSArray arrayWithObjects:@"src", big, [NSData data], nil]];
+    unsigned long long once = [history byteCount];
+    for (i = 0; i < 99; i++) {
+        [history addItem:[NSArray arrayWithObjects:@"src", [NSMutableData dataWithLength:100000], [NSData data], nil]];
+    }
+    STAssertTrue([history count] == 100, @"");
+    STAssertTrue([history byteCount] < once + 100 * 64, @"but is %llu", [history byteCount]);
+    STAssertTrue([[history objectAtIndex:99] objectAtIndex:1] == [[history objectAtIndex:0] objectAtIndex:1], @"");
+    
+    // the byte limit drops the oldest items but keeps the newest
+    history.byteLimit = 50000;
+    STAssertTrue([history count] == 1 && [history evictionCount] == 99, @"%@", history);
+    [history addItem:[NSArray arrayWithObjects:@"other", [NSData data], nil]];
+    STAssertTrue([history count] == 1, @"");
+    STAssertTrue([[[history lastObject] objectAtIndex:0] isEqualToString:@"other"], @"");
+    STAssertTrue([history byteCount] < 1000, @"but is %llu", [history byteCount]);
+    STAssertThrowsSpecificNamed([history objectAtIndex:1], NSException, NSRangeException, @"");
+}
+
+- (void) testHistorySnapshots {
+    
+    BMScript * script = [BMScript scriptWithSource:@"printf snap" options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    [script execute];
+    
+    // an unchanged history hands out the same snapshot
+    NSArray * first = [script history];
+    STAssertTrue([script history] == first, @"");
+    STAssertTrue([first count] == 1, @"");
+    
+    // a snapshot doesn't see later changes
+    [script execute];
+    NSArray * second = [script history];
+    STAssertTrue(second != first, @"");
+    STAssertTrue([first count] == 1 && [second count] == 2, @"");
+    
+    // items and their fields are shared, not copied
+    BMScriptHistory * history = [[[BMScriptHistory alloc] initWithLimit:BMSCRIPT_HISTORY_CHUNK_ITEMS * 2 byteLimit:0] autorelease];
+    NSUInteger i;
+    for (i = 0; i < BMSCRIPT_HISTORY_CHUNK_ITEMS * 3; i++) {
+        [history addItem:[NSArray arrayWithObjects:[NSString stringWithFormat:@"%lu", (unsigned long)i], [NSData data], nil]];
+    }
+    BMScriptHistorySnapshot * snapshot = [history snapshot];
+    unsigned long long generation = [history generation];
+    STAssertTrue([snapshot count] == BMSCRIPT_HISTORY_CHUNK_ITEMS * 2, @"but is %lu", (unsigned long)[snapshot count]);
+    STAssertTrue([snapshot sourceAtIndex:0] == [[history objectAtIndex:0] objectAtIndex:0], @"");
+    STAssertTrue([[snapshot sourceAtIndex:0] isEqualToString:[NSString stringWithFormat:@"%lu", (unsigned long)BMSCRIPT_HISTORY_CHUNK_ITEMS]], @"");
+    STAssertNil([snapshot errorResultAtIndex:0], @"");
+    
+    // ranges and fast enumeration
+    NSArray * range = [snapshot subarrayWithRange:NSMakeRange(10, 5)];
+    STAssertTrue([range count] == 5, @"");
+    STAssertTrue([[[range objectAtIndex:0] objectAtIndex:0] isEqualToString:[[snapshot objectAtIndex:10] objectAtIndex:0]], @"");
+    NSUInteger n = 0;
+    for (NSArray * item in snapshot) {
+        STAssertTrue([[item objectAtIndex:0] isEqualToString:[snapshot sourceAtIndex:n]], @"");
+        n++;
+    }
+    STAssertTrue(n == [snapshot count], @"");
+    STAssertThrowsSpecificNamed([snapshot subarrayWithRange:NSMakeRange(n, 1)], NSException, NSRangeException, @"");
+    
+    // dropping items leaves the snapshot intact
+    [history removeAllItems];
+    STAssertTrue([history generation] != generation, @"");
+    STAssertTrue([snapshot count] == BMSCRIPT_HISTORY_CHUNK_ITEMS * 2, @"");
+    STAssertTrue([[snapshot sourceAtIndex:0] isEqualToString:[NSString stringWithFormat:@"%lu", (unsigned long)BMSCRIPT_HISTORY_CHUNK_ITEMS]], @"");
+    STAssertTrue([[history snapshot] count] == 0, @"");
+}
+
+- (void) testHistoryEvictionReleases {
+    
+    BMScriptHistory * history = [[[BMScriptHistory alloc] initWithLimit:1 byteLimit:0] autorelease];
+    BMScriptHistorySnapshot * snapshot = nil;
+    BMScriptHistoryTracerDeallocs = 0;
+    
+    // without a snapshot an evicted result goes right away, long before its chunk does
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    [history addItem:[NSArray arrayWithObjects:@"first", [[[BMScriptHistoryTracer alloc] init] autorelease], nil]];
+    [pool drain];
+    STAssertTrue(BMScriptHistoryTracerDeallocs == 0, @"but is %lu", (unsigned long)BMScriptHistoryTracerDeallocs);
+    pool = [[NSAutoreleasePool alloc] init];
+    [history addItem:[NSArray arrayWithObjects:@"second", [NSData data], nil]];
+    [pool drain];
+    STAssertTrue(BMScriptHistoryTracerDeallocs == 1, @"but is %lu", (unsigned long)BMScriptHistoryTracerDeallocs);
+    
+    // a snapshot that shows it keeps it until the snapshot is gone
+    pool = [[NSAutoreleasePool alloc] init];
+    [history addItem:[NSArray arrayWithObjects:@"third", [[[BMScriptHistoryTracer alloc] init] autorelease], nil]];
+    snapshot = [[history snapshot] retain];
+    [pool drain];
+    pool = [[NSAutoreleasePool alloc] init];
+    [history addItem:[NSArray arrayWithObjects:@"fourth", [NSData data], nil]];
+    [pool drain];
+    STAssertTrue(BMScriptHistoryTracerDeallocs == 1, @"but is %lu", (unsigned long)BMScriptHistoryTracerDeallocs);
+    STAssertTrue([[snapshot resultAtIndex:0] isKindOfClass:[BMScriptHistoryTracer class]], @"");
+    [snapshot release];
+    STAssertTrue(BMScriptHistoryTracerDeallocs == 2, @"but is %lu", (unsigned long)BMScriptHistoryTracerDeallocs);
+    STAssertTrue([history count] == 1 && [history evictionCount] == 3, @"%@", history);
+}
+
+- (void) testEscapeTables {
+    
+    // the tables must give what one replacement pass per mapping entry gives
+    NSArray * samples = [NSArray arrayWithObjects:@"", @"plain", @"a\\b\n\"c\"\t\r", @"\\\\n\\n\a\v\b\f", 
+                         @"tab\there\\\\", @"\u00e9 \u2026\n", @"\\\\\\\"", nil];
+    NSArray * mapping = BMNSStringC99EscapeCharacterMapping;
+    STAssertTrue(BMNSStringC99EscapeCharacterMapping == mapping, @"the built-in mappings are made once");
+    
+    for (NSString * sample in samples) {
+        NSInteger order;
+        for (order = BMNSStringEscapeTraversingOrderFirst; order <= BMNSStringEscapeTraversingOrderLast; order++) {
+            NSString * escaped = sample;
+            NSString * unescaped = sample;
+            NSUInteger i, n = [mapping count];
+            for (i = 0; i < n; i++) {
+                NSArray * pair = [mapping objectAtIndex:(order == BMNSStringEscapeTraversingOrderLast ? n - 1 - i : i)];
+                escaped = [escaped stringByReplacingOccurrencesOfString:[pair objectAtIndex:0] withString:[pair objectAtIndex:1]];
+                unescaped = [unescaped stringByReplacingOccurrencesOfString:[pair objectAtIndex:1] withString:[pair objectAtIndex:0]];
+            }
+            STAssertEqualObjects([sample stringByEscapingStringUsingOrder:order], escaped, @"");
+            STAssertEqualObjects([sample unescapedStringUsingOrder:order], unescaped, @"");
+        }
+    }
+    
+    STAssertEqualObjects([@"say \"hi\"\n" quotedString], @"say \\\"hi\\\"\\n", @"");
+    STAssertEqualObjects([[@"say \"hi\"\n" quotedString] unquotedString], @"say \"hi\"\n", @"");
+    
+    // custom mappings, including ones with longer targets
+    NSArray * custom = [NSArray arrayWithObjects:[NSArray arrayWithObjects:@"ab", @"b", nil], [NSArray arrayWithObjects:@"b", @"ab", nil], nil];
+    STAssertEqualObjects([@"aab" stringByEscapingStringUsingMapping:custom order:BMNSStringEscapeTraversingOrderFirst], @"aab", @"");
+    STAssertEqualObjects([@"aab" stringByEscapingStringUsingMapping:custom order:BMNSStringEscapeTraversingOrderLast], @"aab", @"");
+    STAssertEqualObjects([@"xyz" stringByEscapingStringUsingMapping:[NSArray arrayWithObject:[NSArray arrayWithObjects:@"y", @"\u00e9\u00e9", nil]] 
+                                                               order:BMNSStringEscapeTraversingOrderFirst], @"x\u00e9\u00e9z", @"");
+    STAssertThrowsSpecificNamed([@"x" stringByEscapingStringUsingMapping:[NSArray array] order:BMNSStringEscapeTraversingOrderFirst], 
+                                NSException, NSInvalidArgumentException, @"");
+}
+
+- (void) testEscapeUnicodeCharacters {
+    
+    // runs of every length around the vector widths, with escapes at every position, against one escape per unit
+    UniChar units[70];
+    UniChar specials[] = { 0x7e, 0x7f, 0x00e9, 0x2026, 0xd83d, 0xffff };
+    NSUInteger length, position, k;
+    for (length = 0; length <= 70; length += (length < 40 ? 1 : 15)) {
+        for (position = 0; position <= length; position++) {
+            for (k = 0; k < sizeof(specials) / sizeof(UniChar); k++) {
+                NSMutableString * expected = [NSMutableString string];
+                NSUInteger i;
+                for (i = 0; i < length; i++) {
+                    units[i] = (i == position || i + 3 == position ? specials[k] : (UniChar)('!' + i % 90));
+                    if (units[i] > 0x7e) {
+                        [expected appendFormat:@"\\u%04x", units[i]];
+                    } else {
+                        [expected appendFormat:@"%c", units[i]];
+                    }
+                }
+                NSString * string = [NSString stringWithCharacters:units length:length];
+                STAssertEqualObjects([string stringByEscapingUnicodeCharacters], expected, @"length %lu, position %lu", (unsigned long)length, (unsigned long)position);
+            }
+        }
+    }
+    
+    STAssertEqualObjects([@"" stringByEscapingUnicodeCharacters], @"", @"");
+    STAssertEqualObjects([[NSMutableString stringWithString:@"x \\u y"] stringByEscapingUnicodeCharacters], @"x \\u y", @"");
+    STAssertEqualObjects([@"caf\u00e9 \u201cquoted\u201d" stringByEscapingUnicodeCharacters], @"caf\\u00e9 \\u201cquoted\\u201d", @"");
+}
+
+- (void) testCountOccurrences {
+    
+    STAssertEquals([@"abababa" countOccurrencesOfString:@"aba"], (NSInteger)2, @"occurrences don't overlap");
+    STAssertEquals([@"<##> <##><#KEY#>" countOccurrencesOfString:BMSCRIPT_TEMPLATE_TOKEN_START], (NSInteger)3, @"");
+    STAssertEquals([@"abc" countOccurrencesOfString:@"x"], (NSInteger)NSNotFound, @"");
+    STAssertEquals([@"abc" countOccurrencesOfString:@""], (NSInteger)NSNotFound, @"");
+    STAssertEquals([@"ab" countOccurrencesOfString:@"abc"], (NSInteger)NSNotFound, @"");
+    STAssertEquals([@"\u00e4 a\u00e4\u00e4" countOccurrencesOfString:@"\u00e4"], (NSInteger)3, @"");
+    
+    // long receivers are searched in windows when their characters can't be had directly; matches may straddle them
+    NSMutableString * haystack = [NSMutableString string];
+    NSUInteger i, expected = 0;
+    for (i = 0; i < 5000; i++) {
+        [haystack appendString:(i % 7 == 0 ? @"<#x#>" : @"y")];
+        if (i % 7 == 0) expected++;
+    }
+    STAssertEquals([haystack countOccurrencesOfString:@"<#x#>"], (NSInteger)expected, @"");
+    NSString * utf8Haystack = [[[NSString alloc] initWithData:[haystack dataUsingEncoding:NSUTF8StringEncoding] encoding:NSUTF8StringEncoding] autorelease];
+    STAssertEquals([utf8Haystack countOccurrencesOfString:@"#>y"], (NSInteger)expected, @"");
+    
+    unichar characters[] = { 'a', 'b', 'a', 'b', 'c' };
+    unichar pattern[] = { 'a', 'b', 'c' };
+    STAssertEquals(BMNSStringFindCharacters(characters, 5, pattern, 3), (NSUInteger)2, @"");
+    STAssertEquals(BMNSStringFindCharacters(characters, 4, pattern, 3), (NSUInteger)NSNotFound, @"");
+    STAssertEquals(BMNSStringFindCharacters(characters, 5, pattern, 0), (NSUInteger)NSNotFound, @"");
+    
+    // the template scan is built on the same search
+    BMScriptTemplate * tmpl = [BMScriptTemplate templateWithString:@"<# <#a#> <##> #> <#b"];
+    STAssertEqualObjects([tmpl keys], [NSArray arrayWithObject:@"a"], @"");
+    STAssertEquals([tmpl positionalTokenCount], (NSUInteger)1, @"");
+}
+
+- (void) testByteDumps {
+    
+    NSString * string = @"A\u00e4\n";
+    STAssertEqualObjects([string bytesForEncoding:NSUTF8StringEncoding], [NSData dataWithBytes:"A\xc3\xa4\n" length:4], @"");
+    STAssertEqualObjects([string byteDumpForEncoding:NSUTF8StringEncoding asHex:YES], @"0x41 0xc3 0xa4 0x0a", @"");
+    STAssertEqualObjects([string byteDumpForEncoding:NSUTF8StringEncoding asHex:NO], @"65 195 164 10", @"");
+    STAssertEqualObjects([string bytesForEncoding:NSUTF8StringEncoding asHex:NO], 
+                         ([NSArray arrayWithObjects:@"65", @"195", @"164", @"10", nil]), @"");
+    STAssertEquals([[string bytesForEncoding:NSUnicodeStringEncoding] length], (NSUInteger)8, @"the BOM is included");
+    STAssertNil([@"\u2026" bytesForEncoding:NSASCIIStringEncoding], @"");
+    STAssertEqualObjects([@"" byteDumpForEncoding:NSUTF8StringEncoding asHex:YES], @"", @"");
+    STAssertThrows([string bytesForEncoding:0], @"");
+    
+    // long enough for the vectorized formatter, with every byte value
+    unsigned char bytes[600];
+    NSMutableArray * expected = [NSMutableArray array];
+    NSUInteger i;
+    for (i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (unsigned char)(i * 7);
+        [expected addObject:[NSString stringWithFormat:@"0x%02x", bytes[i]]];
+    }
+    NSData * data = [NSData dataWithBytes:bytes length:sizeof(bytes)];
+    STAssertEqualObjects([data byteDumpAsHex:YES], [expected componentsJoinedByString:@" "], @"");
+    STAssertEquals(BMNSDataWriteByteDump(bytes, sizeof(bytes), YES, NULL), (NSUInteger)(sizeof(bytes) * 5 - 1), @"");
+}
+
+- (void) testLockStatistics {
+    
+    NSObject * object = [[NSObject alloc] init];
+    BMScriptResetLockStatistics();
+    
+    BMScriptLockObject(object);
+    BMScriptLockObject(object);     // recursive
+    BMScriptUnlockObject(object);
+    BMScriptUnlockObject(object);
+    BMScriptLockObject(nil);
+    BMScriptUnlockObject(nil);
+    
+    BMScriptLockStatistics statistics = BMScriptGetLockStatistics();
+    STAssertTrue(statistics.acquisitions >= 3, @"but is %llu", (unsigned long long)statistics.acquisitions);
+    STAssertTrue(statistics.contentions <= statistics.acquisitions, @"");
+    
+    BMScriptResetLockStatistics();
+    STAssertTrue(BMScriptGetLockStatistics().acquisitions < 3, @"");
+    
+    // another thread holds the lock for a while, so taking it here has to wait and is counted
+    NSConditionLock * held = [[[NSConditionLock alloc] initWithCondition:0] autorelease];
+    [NSThread detachNewThreadSelector:@selector(holdLockOfObject:) toTarget:self withObject:[NSArray arrayWithObjects:object, held, nil]];
+    [held lockWhenCondition:1];
+    [held unlock];
+    statistics = BMScriptGetLockStatistics();
+    BMScriptLockObject(object);
+    BMScriptUnlockObject(object);
+    BMScriptLockStatistics contended = BMScriptGetLockStatistics();
+    STAssertTrue(contended.contentions > statistics.contentions, @"but is %llu", (unsigned long long)contended.contentions);
+    STAssertTrue(contended.waitNanoseconds - statistics.waitNanoseconds >= 50000000ULL, 
+                 @"but waited %llu ns", (unsigned long long)(contended.waitNanoseconds - statistics.waitNanoseconds));
+    [object release];
+}
+
+- (void) holdLockOfObject:(NSArray *)objectAndCondition {
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    id object = [objectAndCondition objectAtIndex:0];
+    NSConditionLock * held = [objectAndCondition objectAtIndex:1];
+    BMScriptLockObject(object);
+    [held lock];
+    [held unlockWithCondition:1];
+    [NSThread sleepForTimeInterval:0.2];
+    BMScriptUnlockObject(object);
+    [pool drain];
+}
+
+- (void) testHistoryLog {
+    
+    NSString * dir = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"BMScriptHistoryLogTest.%d", getpid()]];
+    [[NSFileManager defaultManager] removeItemAtPath:dir error:NULL];
+    NSUInteger total, i;
+    NSString * lastSource = [NSString stringWithFormat:@"item %lu", (unsigned long)(BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS + 9)];
+    
+    NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+    BMScriptHistoryLog * log = [BMScriptHistoryLog logWithDirectory:dir];
+    STAssertNotNil(log, @"");
+    STAssertNil([BMScriptHistoryLog logWithDirectory:dir], @"a directory can only be open once");
+    
+    // setting the log moves the items kept in memory into it
+    BMScript * script = [BMScript scriptWithSource:@"printf logged" options:BMSynthesizeOptions(@"/bin/sh", @"-c")];
+    [script execute];
+    script.historyLog = log;
+    [script execute];
+    STAssertTrue([log count] == 2, @"but is %lu", (unsigned long)[log count]);
+    STAssertTrue([[[script resultFromHistoryAtIndex:1] contentsAsString] isEqualToString:@"logged"], @"");
+    
+    // queued items are found before and after they are written, across segments
+    for (i = 0; i < BMSCRIPT_HISTORY_LOG_SEGMENT_ITEMS + 10; i++) {
+        NSString * itemSource = [NSString stringWithFormat:@"item %lu", (unsigned long)i];
+        [log addItem:[NSArray arrayWithObjects:itemSource, [itemSource dataUsingEncoding:NSUTF8StringEncoding], nil]];
+    }
+    STAssertTrue([[[log objectAtIndex:7] objectAtIndex:0] isEqualToString:@"item 5"], @"");
+    [log flush];
+    STAssertTrue([[[log objectAtIndex:7] objectAtIndex:0] isEqualToString:@"item 5"], @"");
+    STAssertTrue([[[log objectAtIndex:7] objectAtIndex:1] isEqualToData:[@"item 5" dataUsingEncoding:NSUTF8StringEncoding]], @"");
+    STAssertTrue([[log objectAtIndex:7] count] == 2, @"");
+    STAssertThrowsSpecificNamed([log objectAtIndex:[log count]], NSException, NSRangeException, @"");
+    
+    STAssertTrue([log compressSealedSegments] == 1, @"");
+    STAssertTrue([[[script scriptSourceFromHistoryAtIndex:7] description] isEqualToString:@"item 5"], @"");
+    STAssertTrue([[[script lastScriptSourceFromHistory] description] isEqualToString:lastSource], @"");
+    total = [log count];
+    script.historyLog = nil;
+    [pool drain];
+    
+    // the writer thread lets go of the log once it is idle
+    BMScriptHistoryLog * reopened = nil;
+    NSDate * giveUp = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (!(reopened = [[BMScriptHistoryLog alloc] initWithDirectory:dir]) && [giveUp timeIntervalSinceNow] > 0) {
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    STAssertNotNil(reopened, @"");
+    STAssertTrue([reopened count] == total, @"but is %lu", (unsigned long)[reopened count]);
+    STAssertTrue([[[reopened objectAtIndex:1] objectAtIndex:0] isEqualToString:@"printf logged"], @"");
+    STAssertTrue([[[reopened lastObject] objectAtIndex:0] isEqualToString:lastSource], @"");
+    [reopened release];
+    
+    // an index entry without its record, as a crash would leave it, is cut off
+    NSFileHandle * idx = [NSFileHandle fileHandleForWritingAtPath:[dir stringByAppendingPathComponent:@"00000001.idx"]];
+    [idx seekToEndOfFile];
+    [idx writeData:[NSData dataWithBytes:"\xff\xff\xff\xff\xff\xff\xff\xff" length:8]];
+    [idx closeFile];
+    reopened = [[BMScriptHistoryLog alloc] initWithDirectory:dir];
+    STAssertTrue([reopened count] == total, @"but is %lu", (unsigned long)[reopened count]);
+    [reopened removeAllItems];
+    STAssertTrue([reopened count] == 0 && [reopened size] == 0, @"");
+    [reopened release];
+    
+    [[NSFileManager defaultManager] removeItemAtPath:dir error:NULL];
+}
+
 - (void) testPythonLowComplexityScript {
     
     NSString * pyLCScriptPath = PATHFOR(@"Python Low Complexity Script", @"py");